@@ -0,0 +1,280 @@
+/*
+ * Ashmem pin/unpin contention benchmark
+ *
+ * Starts 1, 2, 4, ... up to max_procs processes that each own an ashmem
+ * area, the way separate apps own their graphics buffers, and unpin and pin
+ * pages of it back as fast as they can. Every other chunk of the area is
+ * left unpinned, so each area keeps many ranges on the LRU. For every
+ * process count it prints the pin/unpin pairs per second, in total and per
+ * process, and the slowest single pair seen.
+ *
+ * With -P one more process calls ASHMEM_PURGE_ALL_CACHES in a loop, which
+ * runs the shrinker over every unpinned range while the others pin and
+ * unpin, and the number of purges is printed as well. This needs root.
+ *
+ * Usage: ashmem-pin-bench [-d device] [-p max_procs] [-n pairs]
+ *                         [-s pages] [-c chunk_pages] [-P]
+ *
+ * -n is the number of pin/unpin pairs per process, -s the size of each
+ * area and -c the size of each range, both in pages.
+ *
+ * Build with gcc -O2.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ */
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+/* from include/linux/ashmem.h, which is not exported */
+struct ashmem_pin {
+	uint32_t offset;
+	uint32_t len;
+};
+
+#define __ASHMEMIOC		0x77
+#define ASHMEM_SET_SIZE		_IOW(__ASHMEMIOC, 3, size_t)
+#define ASHMEM_PIN		_IOW(__ASHMEMIOC, 7, struct ashmem_pin)
+#define ASHMEM_UNPIN		_IOW(__ASHMEMIOC, 8, struct ashmem_pin)
+#define ASHMEM_PURGE_ALL_CACHES	_IO(__ASHMEMIOC, 10)
+
+#define MAX_PROCS	256
+
+struct result {
+	unsigned long pairs;
+	unsigned long failed;
+	double worst;
+};
+
+static const char *device = "/dev/ashmem";
+static unsigned int max_procs = 8;
+static unsigned long pairs = 100000;
+static unsigned long pages = 256;
+static unsigned long chunk = 1;
+static int purge;
+static long page_size;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void pabort(const char *s)
+{
+	perror(s);
+	exit(1);
+}
+
+/* blocks until the parent closes the write end of the start pipe */
+static void wait_start(int start_fd)
+{
+	char c;
+
+	if (read(start_fd, &c, 1) < 0)
+		pabort("read start pipe");
+	close(start_fd);
+}
+
+static void worker(int start_fd, struct result *r)
+{
+	size_t size = pages * page_size;
+	struct ashmem_pin pin;
+	unsigned long nchunks = pages / chunk;
+	unsigned long i, n;
+	char *map;
+	int fd;
+
+	fd = open(device, O_RDWR);
+	if (fd < 0)
+		pabort("can't open device");
+	if (ioctl(fd, ASHMEM_SET_SIZE, size) < 0)
+		pabort("ASHMEM_SET_SIZE");
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		pabort("mmap");
+	memset(map, 0, size);
+
+	/* leave the odd chunks unpinned, so the ranges do not merge */
+	pin.len = chunk * page_size;
+	for (i = 1; i < nchunks; i += 2) {
+		pin.offset = i * chunk * page_size;
+		if (ioctl(fd, ASHMEM_UNPIN, &pin) < 0)
+			pabort("ASHMEM_UNPIN");
+	}
+
+	wait_start(start_fd);
+
+	/* and pin and unpin the even ones, in turn */
+	nchunks &= ~1UL;
+	for (n = 0, i = 0; n < pairs; n++, i = (i + 2) % nchunks) {
+		double t = now();
+
+		pin.offset = i * chunk * page_size;
+		if (ioctl(fd, ASHMEM_UNPIN, &pin) < 0 ||
+		    ioctl(fd, ASHMEM_PIN, &pin) < 0)
+			r->failed++;
+		else
+			r->pairs++;
+		t = now() - t;
+		if (t > r->worst)
+			r->worst = t;
+	}
+	exit(0);
+}
+
+static void purger(int start_fd, struct result *r)
+{
+	int fd;
+
+	fd = open(device, O_RDWR);
+	if (fd < 0)
+		pabort("can't open device");
+	wait_start(start_fd);
+	for (;;) {
+		if (ioctl(fd, ASHMEM_PURGE_ALL_CACHES) < 0)
+			r->failed++;
+		else
+			r->pairs++;
+	}
+}
+
+static void run(unsigned int nprocs, struct result *results)
+{
+	struct result *purged = &results[MAX_PROCS];
+	unsigned long total = 0, failed = 0;
+	double start, elapsed, worst = 0;
+	pid_t pids[MAX_PROCS], purge_pid = 0;
+	int start_pipe[2];
+	unsigned int i;
+	int status;
+
+	memset(results, 0, sizeof(*results) * (MAX_PROCS + 1));
+	if (pipe(start_pipe))
+		pabort("pipe");
+	for (i = 0; i < nprocs; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0)
+			pabort("fork");
+		if (!pids[i]) {
+			close(start_pipe[1]);
+			worker(start_pipe[0], &results[i]);
+		}
+	}
+	if (purge) {
+		purge_pid = fork();
+		if (purge_pid < 0)
+			pabort("fork");
+		if (!purge_pid) {
+			close(start_pipe[1]);
+			purger(start_pipe[0], purged);
+		}
+	}
+	close(start_pipe[0]);
+
+	/* let the workers set up their areas before starting the clock */
+	sleep(1);
+	start = now();
+	close(start_pipe[1]);
+
+	for (i = 0; i < nprocs; i++) {
+		if (waitpid(pids[i], &status, 0) < 0 ||
+		    !WIFEXITED(status) || WEXITSTATUS(status))
+			failed += pairs;
+		total += results[i].pairs;
+		failed += results[i].failed;
+		if (results[i].worst > worst)
+			worst = results[i].worst;
+	}
+	elapsed = now() - start;
+	if (purge_pid) {
+		kill(purge_pid, SIGKILL);
+		waitpid(purge_pid, NULL, 0);
+	}
+
+	printf("%3u procs: %9.0f pairs/s, %8.0f pairs/s per process, "
+	       "worst pair %.3f ms", nprocs, total / elapsed,
+	       total / elapsed / nprocs, worst * 1e3);
+	if (purge)
+		printf(", %lu purges", purged->pairs);
+	if (failed)
+		printf(", %lu failed", failed);
+	if (purged->failed)
+		printf(", %lu purges failed", purged->failed);
+	printf("\n");
+	fflush(stdout);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-d device] [-p max_procs] [-n pairs] "
+		"[-s pages] [-c chunk_pages] [-P]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct result *results;
+	unsigned int nprocs;
+	int c;
+
+	while ((c = getopt(argc, argv, "d:p:n:s:c:P")) != -1) {
+		switch (c) {
+		case 'd':
+			device = optarg;
+			break;
+		case 'p':
+			max_procs = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			pairs = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			pages = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			chunk = strtoul(optarg, NULL, 0);
+			break;
+		case 'P':
+			purge = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!max_procs || max_procs > MAX_PROCS || !chunk ||
+	    pages < 2 * chunk)
+		usage(argv[0]);
+	page_size = sysconf(_SC_PAGESIZE);
+
+	/* one result per worker and one for the purger, shared with them */
+	results = mmap(NULL, sizeof(*results) * (MAX_PROCS + 1),
+		       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+		       -1, 0);
+	if (results == MAP_FAILED)
+		pabort("mmap");
+
+	printf("%s: %lu pairs per process, %lu pages in ranges of %lu, "
+	       "%ld cpus%s\n", device, pairs, pages, chunk,
+	       sysconf(_SC_NPROCESSORS_ONLN), purge ? ", purging" : "");
+	fflush(stdout);
+	for (nprocs = 1; nprocs < max_procs; nprocs *= 2)
+		run(nprocs, results);
+	run(max_procs, results);
+	return 0;
+}
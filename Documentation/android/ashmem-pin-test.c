@@ -0,0 +1,399 @@
+/*
+ * Ashmem pin/unpin regression test
+ *
+ * Checks the unpinned ranges ashmem keeps for an area against a model of
+ * them kept here: first a list of split and merge edge cases (a range
+ * unpinned twice or inside another one, adjacent ranges, pins that cut
+ * the start, the end or a hole out of a range or span several of them,
+ * len 0 meaning the rest of the area, bad offsets), then random pins and
+ * unpins. After every step the pin status of each page, and of the whole
+ * area, must match the model, and so must what ASHMEM_PIN returns.
+ *
+ * With -P the random steps also purge every unpinned range through
+ * ASHMEM_PURGE_ALL_CACHES, which needs root, so that ASHMEM_PIN has to
+ * report ASHMEM_WAS_PURGED exactly for the ranges the model has purged,
+ * and pinned pages must keep their contents. Pages the shrinker purges on
+ * its own would show up as mismatches, so run it with memory to spare.
+ *
+ * Usage: ashmem-pin-test [-d device] [-s pages] [-n steps] [-r seed] [-P]
+ *
+ * Build with gcc -O2.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+/* from include/linux/ashmem.h, which is not exported */
+struct ashmem_pin {
+	uint32_t offset;
+	uint32_t len;
+};
+
+#define ASHMEM_NOT_PURGED	0
+#define ASHMEM_WAS_PURGED	1
+#define ASHMEM_IS_UNPINNED	0
+#define ASHMEM_IS_PINNED	1
+
+#define __ASHMEMIOC		0x77
+#define ASHMEM_SET_SIZE		_IOW(__ASHMEMIOC, 3, size_t)
+#define ASHMEM_PIN		_IOW(__ASHMEMIOC, 7, struct ashmem_pin)
+#define ASHMEM_UNPIN		_IOW(__ASHMEMIOC, 8, struct ashmem_pin)
+#define ASHMEM_GET_PIN_STATUS	_IO(__ASHMEMIOC, 9)
+#define ASHMEM_PURGE_ALL_CACHES	_IO(__ASHMEMIOC, 10)
+
+#define MAX_PAGES	4096
+
+/* the model: the unpinned ranges, in no particular order */
+struct range {
+	unsigned long start, end;	/* pages, inclusive */
+	int purged;
+};
+
+static struct range ranges[MAX_PAGES];
+static int nranges;
+static unsigned char lost[MAX_PAGES];	/* purged since the last reset */
+
+static const char *device = "/dev/ashmem";
+static unsigned long pages = 64;
+static unsigned long steps = 100000;
+static unsigned int seed = 1;
+static int purge;
+
+static long page_size;
+static unsigned char *map;
+static int fd;
+static int errors;
+static const char *step_name;
+
+static void pabort(const char *s)
+{
+	perror(s);
+	exit(1);
+}
+
+static void fail(const char *fmt, long a, long b)
+{
+	fprintf(stderr, "%s: ", step_name);
+	fprintf(stderr, fmt, a, b);
+	fprintf(stderr, "\n");
+	if (++errors >= 10)
+		exit(1);
+}
+
+static int overlaps(struct range *r, unsigned long start, unsigned long end)
+{
+	return r->end >= start && r->start <= end;
+}
+
+static void range_del(int i)
+{
+	ranges[i] = ranges[--nranges];
+}
+
+static void range_add(unsigned long start, unsigned long end, int purged)
+{
+	ranges[nranges].start = start;
+	ranges[nranges].end = end;
+	ranges[nranges].purged = purged;
+	nranges++;
+}
+
+static void model_unpin(unsigned long start, unsigned long end)
+{
+	int purged = ASHMEM_NOT_PURGED;
+	int i;
+
+	for (i = 0; i < nranges; i++) {
+		struct range *r = &ranges[i];
+
+		if (!overlaps(r, start, end))
+			continue;
+		/* already unpinned as a whole: nothing changes */
+		if (r->start <= start && r->end >= end)
+			return;
+		/* otherwise the old range is merged into the new one */
+		if (r->start < start)
+			start = r->start;
+		if (r->end > end)
+			end = r->end;
+		purged |= r->purged;
+		range_del(i--);
+	}
+	range_add(start, end, purged);
+}
+
+static int model_pin(unsigned long start, unsigned long end)
+{
+	int ret = ASHMEM_NOT_PURGED;
+	int i;
+
+	for (i = 0; i < nranges; i++) {
+		struct range *r = &ranges[i];
+
+		if (!overlaps(r, start, end))
+			continue;
+		ret |= r->purged;
+		if (start <= r->start && end >= r->end) {
+			range_del(i--);
+		} else if (r->start >= start) {
+			r->start = end + 1;
+		} else if (r->end <= end) {
+			r->end = start - 1;
+		} else {
+			range_add(end + 1, r->end, r->purged);
+			r->end = start - 1;
+		}
+	}
+	return ret;
+}
+
+static int model_status(unsigned long start, unsigned long end)
+{
+	int i;
+
+	for (i = 0; i < nranges; i++)
+		if (overlaps(&ranges[i], start, end))
+			return ASHMEM_IS_UNPINNED;
+	return ASHMEM_IS_PINNED;
+}
+
+static int pin_ioctl(int cmd, unsigned long offset, unsigned long len)
+{
+	struct ashmem_pin pin = { offset, len };
+	int ret;
+
+	ret = ioctl(fd, cmd, &pin);
+	return ret < 0 ? -errno : ret;
+}
+
+/* len is in pages; 0 means up to the end of the area */
+static void unpin(unsigned long start, unsigned long len)
+{
+	int ret;
+
+	ret = pin_ioctl(ASHMEM_UNPIN, start * page_size, len * page_size);
+	if (ret)
+		fail("unpin at page %ld returned %ld", start, ret);
+	model_unpin(start, len ? start + len - 1 : pages - 1);
+}
+
+static void pin(unsigned long start, unsigned long len)
+{
+	int ret, expect;
+
+	ret = pin_ioctl(ASHMEM_PIN, start * page_size, len * page_size);
+	expect = model_pin(start, len ? start + len - 1 : pages - 1);
+	if (ret != expect)
+		fail("pin at page %ld returned %ld", start, ret);
+}
+
+static void purge_all(void)
+{
+	unsigned long page;
+	int i;
+
+	if (ioctl(fd, ASHMEM_PURGE_ALL_CACHES) < 0)
+		pabort("ASHMEM_PURGE_ALL_CACHES");
+	for (i = 0; i < nranges; i++) {
+		ranges[i].purged = ASHMEM_WAS_PURGED;
+		for (page = ranges[i].start; page <= ranges[i].end; page++)
+			lost[page] = 1;
+	}
+}
+
+/* compares the status of every page, and of the whole area, to the model */
+static void check(void)
+{
+	unsigned long i;
+	int ret;
+
+	for (i = 0; i < pages; i++) {
+		ret = pin_ioctl(ASHMEM_GET_PIN_STATUS, i * page_size,
+				page_size);
+		if (ret != model_status(i, i))
+			fail("page %ld has status %ld", i, ret);
+		/* pinned pages keep their contents across purges */
+		if (ret == ASHMEM_IS_PINNED && !lost[i] &&
+		    map[i * page_size] != (unsigned char)i)
+			fail("page %ld lost its contents (%ld)", i,
+			     map[i * page_size]);
+	}
+	ret = pin_ioctl(ASHMEM_GET_PIN_STATUS, 0, 0);
+	if (ret != model_status(0, pages - 1))
+		fail("the area has status %ld (%ld)", ret, nranges);
+}
+
+/* pins everything and rewrites the pages the model has lost */
+static void reset(void)
+{
+	unsigned long i;
+
+	pin(0, 0);
+	for (i = 0; i < pages; i++) {
+		map[i * page_size] = i;
+		lost[i] = 0;
+	}
+	check();
+}
+
+static void expect_einval(unsigned long offset, unsigned long len)
+{
+	int ret;
+
+	ret = pin_ioctl(ASHMEM_UNPIN, offset, len);
+	if (ret != -EINVAL)
+		fail("unpin of %ld bytes at %ld was not refused", len, offset);
+	ret = pin_ioctl(ASHMEM_PIN, offset, len);
+	if (ret != -EINVAL)
+		fail("pin of %ld bytes at %ld was not refused", len, offset);
+}
+
+#define STEP(name, ops) do {		\
+	step_name = name;		\
+	ops;				\
+	check();			\
+} while (0)
+
+static void edge_cases(void)
+{
+	unsigned long q = pages / 4;
+
+	STEP("unpin one range", unpin(q, q));
+	STEP("unpin the same range again", unpin(q, q));
+	STEP("unpin inside a range", unpin(q + 1, q - 2));
+	STEP("unpin an adjacent range", unpin(2 * q, q));
+	STEP("pin across adjacent ranges", pin(2 * q - 1, 2));
+	STEP("pin the start of a range", pin(2 * q, 1));
+	STEP("pin the end of a range", pin(2 * q - 2, 1));
+	STEP("pin a range as a whole", pin(q, q - 2));
+	STEP("pin pinned pages", pin(0, q));
+	reset();
+
+	STEP("unpin around a range", unpin(q + 1, 1); unpin(q, 3));
+	STEP("unpin over several ranges",
+	     unpin(0, 1); unpin(2, 1); unpin(4, 1); unpin(1, 4));
+	STEP("unpin overlapping the start", unpin(2 * q, q); unpin(2 * q - 1, 2));
+	STEP("unpin overlapping the end", unpin(3 * q, 2));
+	STEP("pin a hole", pin(2 * q + 1, 1));
+	STEP("pin holes in one range", pin(2 * q + 3, 1); pin(2 * q + 5, 1));
+	STEP("pin over several ranges", pin(0, 3 * q));
+	reset();
+
+	STEP("unpin with len 0", unpin(q, 0));
+	STEP("pin a hole in the tail", pin(2 * q, 1));
+	STEP("pin with len 0", pin(q, 0));
+	STEP("unpin everything", unpin(0, 0));
+	STEP("pin the first page", pin(0, 1));
+	STEP("pin the last page", pin(pages - 1, 1));
+	STEP("unpin the first page back", unpin(0, 1));
+	reset();
+
+	step_name = "bad arguments";
+	expect_einval(1, page_size);
+	expect_einval(0, page_size + 1);
+	expect_einval(page_size, pages * page_size);
+	expect_einval(pages * page_size + page_size, 0);
+	expect_einval(page_size, (uint32_t)-page_size);
+	check();
+}
+
+static void random_steps(void)
+{
+	unsigned long i, start, len;
+
+	srand(seed);
+	for (i = 0; i < steps; i++) {
+		int op = rand() % 16;
+
+		start = rand() % pages;
+		len = 1 + rand() % (pages - start);
+		if (op == 0)
+			len = 0;
+
+		if (purge && op == 1) {
+			step_name = "random purge";
+			purge_all();
+		} else if (op & 2) {
+			step_name = "random unpin";
+			unpin(start, len);
+		} else {
+			step_name = "random pin";
+			pin(start, len);
+		}
+		/* the full check is slow, so only do it every few steps */
+		if (!(i % 8) || pages <= 64)
+			check();
+		if (op == 15 && !(rand() % 64))
+			reset();
+	}
+	step_name = "random steps";
+	check();
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-d device] [-s pages] [-n steps] "
+		"[-r seed] [-P]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "d:s:n:r:P")) != -1) {
+		switch (c) {
+		case 'd':
+			device = optarg;
+			break;
+		case 's':
+			pages = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			steps = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'P':
+			purge = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (pages < 16 || pages > MAX_PAGES)
+		usage(argv[0]);
+	page_size = sysconf(_SC_PAGESIZE);
+
+	fd = open(device, O_RDWR);
+	if (fd < 0)
+		pabort("can't open device");
+	if (ioctl(fd, ASHMEM_SET_SIZE, pages * page_size) < 0)
+		pabort("ASHMEM_SET_SIZE");
+	map = mmap(NULL, pages * page_size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		pabort("mmap");
+	step_name = "start";
+	reset();
+
+	edge_cases();
+	printf("edge cases: %s\n", errors ? "FAILED" : "ok");
+	random_steps();
+	printf("%lu random steps on %lu pages, seed %u%s: %s\n", steps, pages,
+	       seed, purge ? ", purging" : "", errors ? "FAILED" : "ok");
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,518 @@
+/*
+ * Binder stress test
+ *
+ * Runs many client/server process pairs doing binder transactions at the
+ * same time and reports the transactions per second, in total and per
+ * online core.
+ *
+ * The test registers itself as the context manager, so stop the system
+ * service manager first ("stop servicemanager" on Android). Each server
+ * hands its binder to the context manager; its client gets a handle to it
+ * from there and then calls it in a loop. With -o every call also carries
+ * a handle to the context manager's node, a node owned by a third process,
+ * which the driver has to translate for the server and release again.
+ *
+ * Usage: binder-stress-test [-p pairs] [-n calls] [-s size] [-o]
+ *
+ * Build with gcc -O2 -I drivers/staging/android, for the target's
+ * word size.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "binder.h"
+
+#define MAP_SIZE	(128 * 1024)
+#define MAX_PAIRS	256
+#define MAX_SIZE	4096
+
+enum {
+	REG_ADD = 1,	/* u32 id, then a binder: register server 'id' */
+	REG_GET,	/* u32 id: reply with a handle to server 'id' */
+	PING,
+};
+
+struct binder_state {
+	int fd;
+	void *mapped;
+};
+
+/* a write buffer: commands, each followed by its argument */
+struct wbuf {
+	char data[512];
+	size_t len;
+};
+
+struct result {
+	unsigned long calls;
+	double seconds;
+	int failed;
+};
+
+static unsigned int pairs = 4;
+static unsigned long calls = 10000;
+static size_t size = 64;
+static int with_object;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void pabort(const char *s)
+{
+	perror(s);
+	exit(1);
+}
+
+static void put(struct wbuf *w, const void *p, size_t len)
+{
+	if (w->len + len > sizeof(w->data)) {
+		fprintf(stderr, "write buffer overflow\n");
+		exit(1);
+	}
+	memcpy(w->data + w->len, p, len);
+	w->len += len;
+}
+
+static void put_cmd(struct wbuf *w, uint32_t cmd)
+{
+	put(w, &cmd, sizeof(cmd));
+}
+
+static void put_free(struct wbuf *w, const void *buffer)
+{
+	put_cmd(w, BC_FREE_BUFFER);
+	put(w, &buffer, sizeof(buffer));
+}
+
+static void put_ref(struct wbuf *w, uint32_t cmd, uint32_t handle)
+{
+	put_cmd(w, cmd);
+	put(w, &handle, sizeof(handle));
+}
+
+static void put_txn(struct wbuf *w, uint32_t cmd, uint32_t handle,
+		    uint32_t code, const void *data, size_t data_size,
+		    const size_t *offsets, size_t offsets_size)
+{
+	struct binder_transaction_data tr;
+
+	memset(&tr, 0, sizeof(tr));
+	tr.target.handle = handle;
+	tr.code = code;
+	tr.data_size = data_size;
+	tr.offsets_size = offsets_size;
+	tr.data.ptr.buffer = data;
+	tr.data.ptr.offsets = offsets;
+	put_cmd(w, cmd);
+	put(w, &tr, sizeof(tr));
+}
+
+static void binder_open_dev(struct binder_state *bs)
+{
+	bs->fd = open("/dev/binder", O_RDWR);
+	if (bs->fd < 0)
+		pabort("can't open /dev/binder");
+	bs->mapped = mmap(NULL, MAP_SIZE, PROT_READ, MAP_PRIVATE, bs->fd, 0);
+	if (bs->mapped == MAP_FAILED)
+		pabort("can't map /dev/binder");
+}
+
+/*
+ * Writes 'w', if not NULL, then reads until a transaction, a reply or an
+ * error arrives. Reference count requests are acknowledged on the way.
+ * Returns the BR_ command that ended the read.
+ */
+static uint32_t binder_io(struct binder_state *bs, struct wbuf *w,
+			  struct binder_transaction_data *txn)
+{
+	struct binder_write_read bwr;
+	char rbuf[256];
+	uint32_t got = 0;
+
+	memset(&bwr, 0, sizeof(bwr));
+	if (w && w->len) {
+		bwr.write_size = w->len;
+		bwr.write_buffer = (unsigned long)w->data;
+	}
+	while (!got) {
+		struct wbuf ack = { .len = 0 };
+		char *ptr = rbuf, *end;
+
+		bwr.read_size = sizeof(rbuf);
+		bwr.read_consumed = 0;
+		bwr.read_buffer = (unsigned long)rbuf;
+		if (ioctl(bs->fd, BINDER_WRITE_READ, &bwr) < 0) {
+			if (errno == EINTR)
+				continue;
+			pabort("BINDER_WRITE_READ");
+		}
+		bwr.write_size = 0;
+		end = rbuf + bwr.read_consumed;
+
+		while (ptr < end) {
+			uint32_t cmd;
+			struct binder_ptr_cookie pc;
+
+			memcpy(&cmd, ptr, sizeof(cmd));
+			ptr += sizeof(cmd);
+			switch (cmd) {
+			case BR_NOOP:
+			case BR_TRANSACTION_COMPLETE:
+			case BR_SPAWN_LOOPER:
+				break;
+			case BR_INCREFS:
+			case BR_ACQUIRE:
+				memcpy(&pc, ptr, sizeof(pc));
+				ptr += sizeof(pc);
+				put_cmd(&ack, cmd == BR_INCREFS ?
+					BC_INCREFS_DONE : BC_ACQUIRE_DONE);
+				put(&ack, &pc, sizeof(pc));
+				break;
+			case BR_RELEASE:
+			case BR_DECREFS:
+				ptr += sizeof(pc);
+				break;
+			case BR_DEAD_BINDER:
+			case BR_CLEAR_DEATH_NOTIFICATION_DONE:
+				ptr += sizeof(void *);
+				break;
+			case BR_TRANSACTION:
+			case BR_REPLY:
+				memcpy(txn, ptr, sizeof(*txn));
+				ptr += sizeof(*txn);
+				got = cmd;
+				break;
+			case BR_ERROR:
+				ptr += sizeof(int);
+				got = cmd;
+				break;
+			case BR_DEAD_REPLY:
+			case BR_FAILED_REPLY:
+				got = cmd;
+				break;
+			default:
+				fprintf(stderr, "unexpected reply %x\n", cmd);
+				exit(1);
+			}
+		}
+		if (ack.len) {
+			struct binder_write_read abwr;
+
+			memset(&abwr, 0, sizeof(abwr));
+			abwr.write_size = ack.len;
+			abwr.write_buffer = (unsigned long)ack.data;
+			if (ioctl(bs->fd, BINDER_WRITE_READ, &abwr) < 0)
+				pabort("BINDER_WRITE_READ");
+		}
+	}
+	return got;
+}
+
+/* the context manager: keeps a handle to every server */
+static void registry(struct binder_state *bs, int ready_fd)
+{
+	uint32_t handles[MAX_PAIRS];
+	struct binder_transaction_data txn;
+	struct wbuf w = { .len = 0 };
+	struct flat_binder_object obj;
+	size_t obj_offset = 0;
+	int32_t status;
+
+	memset(handles, 0, sizeof(handles));
+	if (ioctl(bs->fd, BINDER_SET_CONTEXT_MGR, 0) < 0) {
+		perror("BINDER_SET_CONTEXT_MGR (is servicemanager running?)");
+		if (write(ready_fd, "e", 1) != 1)
+			pabort("write");
+		exit(1);
+	}
+	put_cmd(&w, BC_ENTER_LOOPER);
+	if (write(ready_fd, "r", 1) != 1)
+		pabort("write");
+	close(ready_fd);
+
+	for (;;) {
+		uint32_t got = binder_io(bs, &w, &txn);
+		const char *data;
+		uint32_t id;
+
+		w.len = 0;
+		if (got != BR_TRANSACTION)
+			continue;
+		data = txn.data.ptr.buffer;
+		memcpy(&id, data, sizeof(id));
+		status = -1;
+		if (id >= MAX_PAIRS) {
+			/* bad request */
+		} else if (txn.code == REG_ADD && txn.offsets_size) {
+			memcpy(&obj, data + sizeof(void *), sizeof(obj));
+			handles[id] = obj.handle;
+			/* keep the ref once the buffer is freed */
+			put_ref(&w, BC_ACQUIRE, obj.handle);
+			status = 0;
+		} else if (txn.code == REG_GET && handles[id]) {
+			memset(&obj, 0, sizeof(obj));
+			obj.type = BINDER_TYPE_HANDLE;
+			obj.handle = handles[id];
+			put_free(&w, txn.data.ptr.buffer);
+			put_txn(&w, BC_REPLY, 0, 0, &obj, sizeof(obj),
+				&obj_offset, sizeof(obj_offset));
+			continue;
+		}
+		put_free(&w, txn.data.ptr.buffer);
+		put_txn(&w, BC_REPLY, 0, 0, &status, sizeof(status), NULL, 0);
+	}
+}
+
+static void server(struct binder_state *bs, uint32_t id)
+{
+	struct binder_transaction_data txn;
+	struct wbuf w = { .len = 0 };
+	struct {
+		uint32_t id;
+		struct flat_binder_object obj;	/* at sizeof(void *) */
+	} add;
+	size_t add_offset = sizeof(void *);
+	int32_t status = 0;
+
+	memset(&add, 0, sizeof(add));
+	add.id = id;
+	add.obj.type = BINDER_TYPE_BINDER;
+	add.obj.binder = (void *)(unsigned long)(id + 1);
+	put_txn(&w, BC_TRANSACTION, 0, REG_ADD, &add, sizeof(add),
+		&add_offset, sizeof(add_offset));
+	if (binder_io(bs, &w, &txn) != BR_REPLY) {
+		fprintf(stderr, "server %u: registration failed\n", id);
+		exit(1);
+	}
+	w.len = 0;
+	put_free(&w, txn.data.ptr.buffer);
+	put_cmd(&w, BC_ENTER_LOOPER);
+
+	for (;;) {
+		uint32_t got = binder_io(bs, &w, &txn);
+
+		w.len = 0;
+		if (got != BR_TRANSACTION)
+			continue;
+		/* freeing the buffer also drops the handle it carried */
+		put_free(&w, txn.data.ptr.buffer);
+		put_txn(&w, BC_REPLY, 0, 0, &status, sizeof(status), NULL, 0);
+	}
+}
+
+static void client(struct binder_state *bs, uint32_t id, int ready_fd,
+		   int go_fd, struct result *res)
+{
+	struct binder_transaction_data txn;
+	struct wbuf w = { .len = 0 };
+	struct flat_binder_object obj;
+	size_t obj_offset = 0;
+	static char payload[MAX_SIZE];
+	uint32_t handle = 0;
+	unsigned long i;
+	double start;
+	char c;
+
+	/* the server may not have registered yet */
+	while (!handle) {
+		put_txn(&w, BC_TRANSACTION, 0, REG_GET, &id, sizeof(id),
+			NULL, 0);
+		if (binder_io(bs, &w, &txn) != BR_REPLY)
+			pabort("REG_GET");
+		w.len = 0;
+		if (txn.offsets_size) {
+			memcpy(&obj, txn.data.ptr.buffer, sizeof(obj));
+			handle = obj.handle;
+			put_ref(&w, BC_ACQUIRE, handle);
+		}
+		put_free(&w, txn.data.ptr.buffer);
+		if (!handle)
+			usleep(1000);
+	}
+	if (with_object) {
+		/* a ref to the context manager's node, to pass along */
+		put_ref(&w, BC_ACQUIRE, 0);
+		memset(&obj, 0, sizeof(obj));
+		obj.type = BINDER_TYPE_HANDLE;
+		obj.handle = 0;
+		memcpy(payload, &obj, sizeof(obj));
+	}
+
+	if (write(ready_fd, "r", 1) != 1)
+		pabort("write");
+	close(ready_fd);
+	if (read(go_fd, &c, 1) < 0)
+		pabort("read");
+
+	start = now();
+	for (i = 0; i < calls; i++) {
+		put_txn(&w, BC_TRANSACTION, handle, PING, payload, size,
+			with_object ? &obj_offset : NULL,
+			with_object ? sizeof(obj_offset) : 0);
+		if (binder_io(bs, &w, &txn) != BR_REPLY) {
+			res->failed = 1;
+			break;
+		}
+		w.len = 0;
+		put_free(&w, txn.data.ptr.buffer);
+	}
+	res->seconds = now() - start;
+	res->calls = i;
+	/* flush the last BC_FREE_BUFFER */
+	{
+		struct binder_write_read bwr;
+
+		memset(&bwr, 0, sizeof(bwr));
+		bwr.write_size = w.len;
+		bwr.write_buffer = (unsigned long)w.data;
+		ioctl(bs->fd, BINDER_WRITE_READ, &bwr);
+	}
+	exit(0);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-p pairs] [-n calls] [-s size] [-o]\n",
+		prog);
+	exit(1);
+}
+
+static void wait_ready(int fd, unsigned int count)
+{
+	char c;
+
+	while (count--) {
+		if (read(fd, &c, 1) != 1 || c != 'r') {
+			fprintf(stderr, "a child failed to start\n");
+			exit(1);
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	pid_t pids[2 * MAX_PAIRS + 1];
+	unsigned int npids = 0;
+	struct binder_state bs;
+	struct result *res;
+	int ready[2], go[2];
+	double start, elapsed, min = 0, max = 0;
+	unsigned long total = 0;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned int i;
+	int c, failed = 0;
+
+	while ((c = getopt(argc, argv, "p:n:s:o")) != -1) {
+		switch (c) {
+		case 'p':
+			pairs = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			calls = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			with_object = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!pairs || pairs > MAX_PAIRS || size > MAX_SIZE ||
+	    size < sizeof(struct flat_binder_object) ||
+	    size % sizeof(void *))
+		usage(argv[0]);
+
+	res = mmap(NULL, pairs * sizeof(*res), PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (res == MAP_FAILED)
+		pabort("mmap");
+	memset(res, 0, pairs * sizeof(*res));
+	if (pipe(ready) < 0 || pipe(go) < 0)
+		pabort("pipe");
+
+	/* each child opens /dev/binder itself: a binder_proc per open */
+	pids[npids] = fork();
+	if (pids[npids] == 0) {
+		close(go[1]);
+		binder_open_dev(&bs);
+		registry(&bs, ready[1]);
+	}
+	npids++;
+	wait_ready(ready[0], 1);
+
+	for (i = 0; i < pairs; i++) {
+		pids[npids] = fork();
+		if (pids[npids] == 0) {
+			close(go[1]);
+			close(ready[1]);
+			binder_open_dev(&bs);
+			server(&bs, i);
+		}
+		npids++;
+		pids[npids] = fork();
+		if (pids[npids] == 0) {
+			close(go[1]);
+			binder_open_dev(&bs);
+			client(&bs, i, ready[1], go[0], &res[i]);
+		}
+		npids++;
+	}
+	close(ready[1]);
+	close(go[0]);
+	wait_ready(ready[0], pairs);
+
+	start = now();
+	close(go[1]);
+	for (i = 0; i < pairs; i++)
+		waitpid(pids[2 + 2 * i], NULL, 0);
+	elapsed = now() - start;
+
+	for (i = 0; i < npids; i++)
+		kill(pids[i], SIGKILL);
+	while (wait(NULL) > 0)
+		;
+
+	for (i = 0; i < pairs; i++) {
+		double tps = res[i].seconds ? res[i].calls / res[i].seconds : 0;
+
+		total += res[i].calls;
+		failed |= res[i].failed;
+		if (i == 0 || tps < min)
+			min = tps;
+		if (i == 0 || tps > max)
+			max = tps;
+	}
+	printf("%u pairs, %lu calls each, %zu bytes%s, %ld cpus\n",
+	       pairs, calls, size, with_object ? " with a handle" : "", cpus);
+	printf("total:    %.0f transactions/s\n", total / elapsed);
+	printf("per core: %.0f transactions/s\n", total / elapsed / cpus);
+	printf("per pair: %.0f min, %.0f max transactions/s\n", min, max);
+	if (failed)
+		printf("some calls failed\n");
+	return failed;
+}
@@ -0,0 +1,190 @@
+/*
+ * Logger writer scaling benchmark
+ *
+ * Starts 1, 2, 4, ... up to max_threads threads that each write entries
+ * to a log device as fast as they can, the way liblog does: one writev()
+ * of priority, tag and message per entry. For every thread count it
+ * prints the entries and bytes written per second, in total and per
+ * thread, and the slowest single write seen.
+ *
+ * Usage: logger-write-bench [-d device] [-t max_threads] [-n entries]
+ *                           [-s size]
+ *
+ * -n is the number of entries per thread, -s the message size in bytes.
+ * Use a log nobody reads ("logcat -b radio" off, for example) or the
+ * readers' wakeups are measured too.
+ *
+ * Build with gcc -O2 -pthread.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ */
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#define MAX_THREADS	256
+#define MAX_SIZE	4000	/* below LOGGER_ENTRY_MAX_PAYLOAD */
+
+static const char *device = "/dev/log/radio";
+static unsigned int max_threads = 8;
+static unsigned long entries = 100000;
+static size_t size = 64;
+
+struct worker {
+	pthread_t thread;
+	int fd;
+	unsigned long written;
+	unsigned long failed;
+	double worst;
+};
+
+static pthread_mutex_t start_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t start_cond = PTHREAD_COND_INITIALIZER;
+static int started;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void pabort(const char *s)
+{
+	perror(s);
+	exit(1);
+}
+
+static void *writer(void *arg)
+{
+	struct worker *w = arg;
+	unsigned char prio = 4;		/* ANDROID_LOG_INFO */
+	char tag[] = "logbench";
+	char msg[MAX_SIZE + 1];
+	struct iovec vec[3];
+	unsigned long i;
+
+	memset(msg, 'x', size);
+	msg[size] = '\0';
+	vec[0].iov_base = &prio;
+	vec[0].iov_len = 1;
+	vec[1].iov_base = tag;
+	vec[1].iov_len = sizeof(tag);
+	vec[2].iov_base = msg;
+	vec[2].iov_len = size + 1;
+
+	pthread_mutex_lock(&start_lock);
+	while (!started)
+		pthread_cond_wait(&start_cond, &start_lock);
+	pthread_mutex_unlock(&start_lock);
+
+	for (i = 0; i < entries; i++) {
+		double t = now();
+
+		if (writev(w->fd, vec, 3) < 0)
+			w->failed++;
+		else
+			w->written++;
+		t = now() - t;
+		if (t > w->worst)
+			w->worst = t;
+	}
+	return NULL;
+}
+
+static void run(unsigned int nthreads)
+{
+	struct worker workers[MAX_THREADS];
+	unsigned long total = 0, failed = 0;
+	double start, elapsed, worst = 0;
+	size_t entry = 1 + sizeof("logbench") + size + 1;
+	unsigned int i;
+
+	memset(workers, 0, sizeof(workers));
+	started = 0;
+	for (i = 0; i < nthreads; i++) {
+		/* one open file per thread, like separate processes */
+		workers[i].fd = open(device, O_WRONLY);
+		if (workers[i].fd < 0)
+			pabort("can't open device");
+		if (pthread_create(&workers[i].thread, NULL, writer,
+				   &workers[i]))
+			pabort("pthread_create");
+	}
+
+	pthread_mutex_lock(&start_lock);
+	started = 1;
+	start = now();
+	pthread_cond_broadcast(&start_cond);
+	pthread_mutex_unlock(&start_lock);
+
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		close(workers[i].fd);
+		total += workers[i].written;
+		failed += workers[i].failed;
+		if (workers[i].worst > worst)
+			worst = workers[i].worst;
+	}
+	elapsed = now() - start;
+
+	printf("%3u threads: %9.0f entries/s %7.2f MB/s, "
+	       "%8.0f entries/s per thread, worst write %.3f ms",
+	       nthreads, total / elapsed, total * entry / elapsed / 1e6,
+	       total / elapsed / nthreads, worst * 1e3);
+	if (failed)
+		printf(", %lu failed", failed);
+	printf("\n");
+	fflush(stdout);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-d device] [-t max_threads] [-n entries] "
+		"[-s size]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int nthreads;
+	int c;
+
+	while ((c = getopt(argc, argv, "d:t:n:s:")) != -1) {
+		switch (c) {
+		case 'd':
+			device = optarg;
+			break;
+		case 't':
+			max_threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			entries = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!max_threads || max_threads > MAX_THREADS || size > MAX_SIZE)
+		usage(argv[0]);
+
+	printf("%s: %lu entries of %zu bytes per thread, %ld cpus\n",
+	       device, entries, size, sysconf(_SC_NPROCESSORS_ONLN));
+	for (nthreads = 1; nthreads < max_threads; nthreads *= 2)
+		run(nthreads);
+	run(max_threads);
+	return 0;
+}
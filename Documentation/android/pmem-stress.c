@@ -0,0 +1,316 @@
+/*
+ * pmem allocator alloc/free stress test
+ *
+ * Starts processes that each keep up to max_live pmem allocations of
+ * random sizes, from 1 to max_pages pages, and at random either allocate
+ * one more with PMEM_ALLOCATE or free one by closing its file, the way
+ * gralloc and the camera and video drivers churn through buffers. Every
+ * allocation is checked: it must be at least as long as asked for, a
+ * power of two pages long, and must not overlap any other allocation the
+ * process holds. It prints the allocations per second, the percentiles of
+ * the allocation latency, the number of failed allocations and the number
+ * of bad ones, which must be none.
+ *
+ * The allocator statistics from the device's debugfs file are printed
+ * before and after. Once every allocation is freed, the free regions must
+ * have merged back to what they were before the test; that only holds if
+ * nothing else allocates from the device while it runs.
+ *
+ * Usage: pmem-stress [-d device] [-p procs] [-n ops] [-m max_pages]
+ *                    [-l max_live] [-D debugfs_file]
+ *
+ * -n is the number of allocations and frees per process. The debugfs file
+ * defaults to /sys/kernel/debug/ followed by the name of the device.
+ *
+ * Build with gcc -O2.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ */
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+/* from include/linux/android_pmem.h, which is not exported */
+struct pmem_region {
+	unsigned long offset;
+	unsigned long len;
+};
+
+#define PMEM_IOCTL_MAGIC	'p'
+#define PMEM_GET_SIZE		_IOW(PMEM_IOCTL_MAGIC, 3, unsigned int)
+#define PMEM_ALLOCATE		_IOW(PMEM_IOCTL_MAGIC, 5, unsigned int)
+
+#define MAX_PROCS	64
+#define MAX_LIVE	1024
+
+struct result {
+	unsigned long allocs;
+	unsigned long frees;
+	unsigned long failed;
+	unsigned long bad;
+};
+
+struct allocation {
+	int fd;
+	unsigned long offset;
+	unsigned long len;
+};
+
+static const char *device = "/dev/pmem";
+static const char *debug_file;
+static unsigned int nprocs = 4;
+static unsigned long ops = 100000;
+static unsigned long max_pages = 128;
+static unsigned int max_live = 64;
+static long page_size;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void pabort(const char *s)
+{
+	perror(s);
+	exit(1);
+}
+
+static int cmp_float(const void *a, const void *b)
+{
+	float x = *(const float *)a, y = *(const float *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* prints the allocator statistics, up to the list of mapped regions */
+static void print_stats(const char *when, char *order_line, size_t size)
+{
+	char line[512];
+	FILE *f;
+
+	f = fopen(debug_file, "r");
+	if (!f) {
+		printf("%s: can't open %s\n", when, debug_file);
+		return;
+	}
+	printf("%s:\n", when);
+	while (fgets(line, sizeof(line), f) && strncmp(line, "pid #", 5)) {
+		printf("  %s", line);
+		if (!strncmp(line, "free regions", 12))
+			snprintf(order_line, size, "%s", line);
+	}
+	fclose(f);
+}
+
+/* checks a new allocation against the rules and the others held */
+static int check(struct allocation *a, unsigned long want,
+		 struct allocation *live, unsigned int nlive)
+{
+	unsigned int i;
+
+	if (a->len < want || a->len % page_size ||
+	    (a->len / page_size) & (a->len / page_size - 1)) {
+		fprintf(stderr, "bad allocation: %lu bytes at %#lx for %lu\n",
+			a->len, a->offset, want);
+		return 1;
+	}
+	for (i = 0; i < nlive; i++) {
+		if (a->offset < live[i].offset + live[i].len &&
+		    live[i].offset < a->offset + a->len) {
+			fprintf(stderr, "overlap: %lu bytes at %#lx and %lu "
+				"bytes at %#lx\n", a->len, a->offset,
+				live[i].len, live[i].offset);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void worker(unsigned int id, int start_fd, struct result *r,
+		   float *lat)
+{
+	struct allocation live[MAX_LIVE];
+	struct pmem_region region;
+	unsigned int seed = id + 1;
+	unsigned int nlive = 0, i;
+	unsigned long n, want;
+	char c;
+
+	if (read(start_fd, &c, 1) < 0)
+		pabort("read start pipe");
+
+	for (n = 0; n < ops; n++) {
+		double t;
+		int fd;
+
+		if (nlive == max_live || (nlive && rand_r(&seed) % 2)) {
+			i = rand_r(&seed) % nlive;
+			close(live[i].fd);
+			live[i] = live[--nlive];
+			r->frees++;
+			continue;
+		}
+
+		fd = open(device, O_RDWR);
+		if (fd < 0)
+			pabort("can't open device");
+		want = (1 + rand_r(&seed) % max_pages) * page_size;
+		t = now();
+		if (ioctl(fd, PMEM_ALLOCATE, want) < 0)
+			pabort("PMEM_ALLOCATE");
+		lat[r->allocs + r->failed] = now() - t;
+		if (ioctl(fd, PMEM_GET_SIZE, &region) < 0)
+			pabort("PMEM_GET_SIZE");
+		if (!region.len) {
+			/* out of space, not an error */
+			close(fd);
+			r->failed++;
+			continue;
+		}
+		r->allocs++;
+		live[nlive].fd = fd;
+		live[nlive].offset = region.offset;
+		live[nlive].len = region.len;
+		if (check(&live[nlive], want, live, nlive)) {
+			r->bad++;
+			close(fd);
+			continue;
+		}
+		nlive++;
+	}
+	exit(0);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-d device] [-p procs] [-n ops] "
+		"[-m max_pages] [-l max_live] [-D debugfs_file]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct result *results, total;
+	char before[512] = "", after[512] = "";
+	char path[256];
+	pid_t pids[MAX_PROCS];
+	int start_pipe[2];
+	unsigned long nlat = 0;
+	double start, elapsed;
+	float *lat;
+	unsigned int i;
+	int status;
+	int c;
+
+	while ((c = getopt(argc, argv, "d:p:n:m:l:D:")) != -1) {
+		switch (c) {
+		case 'd':
+			device = optarg;
+			break;
+		case 'p':
+			nprocs = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			ops = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			max_pages = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			max_live = strtoul(optarg, NULL, 0);
+			break;
+		case 'D':
+			debug_file = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!nprocs || nprocs > MAX_PROCS || !ops || !max_pages ||
+	    !max_live || max_live > MAX_LIVE)
+		usage(argv[0]);
+	page_size = sysconf(_SC_PAGESIZE);
+	if (!debug_file) {
+		snprintf(path, sizeof(path), "/sys/kernel/debug/%s",
+			 basename(strdup(device)));
+		debug_file = path;
+	}
+
+	/* results and allocation latencies, shared with the workers */
+	results = mmap(NULL, sizeof(*results) * MAX_PROCS,
+		       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+		       -1, 0);
+	lat = mmap(NULL, sizeof(*lat) * nprocs * ops,
+		   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (results == MAP_FAILED || lat == MAP_FAILED)
+		pabort("mmap");
+	memset(results, 0, sizeof(*results) * MAX_PROCS);
+
+	printf("%s: %u procs, %lu ops each, up to %u allocations of up to "
+	       "%lu pages\n", device, nprocs, ops, max_live, max_pages);
+	print_stats("before", before, sizeof(before));
+	fflush(stdout);
+
+	if (pipe(start_pipe))
+		pabort("pipe");
+	for (i = 0; i < nprocs; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0)
+			pabort("fork");
+		if (!pids[i]) {
+			close(start_pipe[1]);
+			worker(i, start_pipe[0], &results[i], lat + i * ops);
+		}
+	}
+	close(start_pipe[0]);
+	start = now();
+	close(start_pipe[1]);
+
+	memset(&total, 0, sizeof(total));
+	for (i = 0; i < nprocs; i++) {
+		if (waitpid(pids[i], &status, 0) < 0 ||
+		    !WIFEXITED(status) || WEXITSTATUS(status))
+			total.bad++;
+		total.allocs += results[i].allocs;
+		total.frees += results[i].frees;
+		total.failed += results[i].failed;
+		total.bad += results[i].bad;
+		/* pack the latencies of all the workers together */
+		memmove(lat + nlat, lat + i * ops, sizeof(*lat) *
+			(results[i].allocs + results[i].failed));
+		nlat += results[i].allocs + results[i].failed;
+	}
+	elapsed = now() - start;
+
+	qsort(lat, nlat, sizeof(*lat), cmp_float);
+	printf("%.0f allocs/s, %lu allocs, %lu frees, %lu failed, %lu bad\n",
+	       total.allocs / elapsed, total.allocs, total.frees,
+	       total.failed, total.bad);
+	if (nlat)
+		printf("alloc latency p50 %.1f us, p99 %.1f us, p99.9 %.1f us, "
+		       "max %.1f us\n", lat[nlat / 2] * 1e6,
+		       lat[nlat * 99 / 100] * 1e6,
+		       lat[nlat * 999 / 1000] * 1e6, lat[nlat - 1] * 1e6);
+	print_stats("after", after, sizeof(after));
+	if (strcmp(before, after)) {
+		printf("free regions did not merge back\n");
+		total.bad++;
+	}
+	printf("%s\n", total.bad ? "FAILED" : "ok");
+	return total.bad ? 1 : 0;
+}
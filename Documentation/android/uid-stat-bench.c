@@ -0,0 +1,275 @@
+/*
+ * uid_stat TCP loopback benchmark
+ *
+ * Starts 1, 2, 4, ... up to max_pairs processes that each stream data
+ * over their own TCP connection on 127.0.0.1, one thread sending and one
+ * receiving, so every send and receive goes through the uid_stat hooks in
+ * the TCP code. For every pair count it prints the throughput, in total
+ * and per pair, and how much of the data /proc/uid_stat counted for the
+ * uids involved in tcp_snd and tcp_rcv.
+ *
+ * With -u each pair runs as its own uid, first_uid + n, so the lookups
+ * hit as many uid_stat entries as there are pairs; this needs root. Other
+ * traffic of the same uids is counted by /proc/uid_stat as well.
+ *
+ * Usage: uid-stat-bench [-p max_pairs] [-m mbytes] [-s write_size]
+ *                       [-u first_uid]
+ *
+ * -m is the amount of data per pair, in MB. Small writes, with Nagle off,
+ * make for more packets per byte and so more uid_stat updates.
+ *
+ * Build with gcc -O2 -pthread.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ */
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define MAX_PAIRS	256
+#define MAX_SIZE	65536
+
+struct result {
+	unsigned long long sent;
+	unsigned long long received;
+};
+
+/* what the receiving thread of a pair gets */
+struct receiver_arg {
+	int fd;
+	struct result *r;
+};
+
+static unsigned int max_pairs = 8;
+static unsigned long long bytes = 64ULL << 20;
+static size_t size = 1024;
+static long first_uid = -1;
+static int uid_stat;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void pabort(const char *s)
+{
+	perror(s);
+	exit(1);
+}
+
+/* returns the counter, or 0 if the uid has no entry yet */
+static unsigned int uid_stat_read(uid_t uid, const char *name)
+{
+	char path[64];
+	unsigned int val = 0;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/proc/uid_stat/%u/%s", uid, name);
+	f = fopen(path, "r");
+	if (!f)
+		return 0;
+	if (fscanf(f, "%u", &val) != 1)
+		val = 0;
+	fclose(f);
+	return val;
+}
+
+static void *receiver(void *arg)
+{
+	struct receiver_arg *ra = arg;
+	char buf[MAX_SIZE];
+	ssize_t n;
+
+	while ((n = read(ra->fd, buf, sizeof(buf))) > 0)
+		ra->r->received += n;
+	return NULL;
+}
+
+static void pair(int start_fd, struct result *r)
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	struct receiver_arg ra;
+	char buf[MAX_SIZE];
+	pthread_t thread;
+	int lfd, sfd, rfd;
+	int one = 1;
+	ssize_t n;
+	char c;
+
+	lfd = socket(AF_INET, SOCK_STREAM, 0);
+	sfd = socket(AF_INET, SOCK_STREAM, 0);
+	if (lfd < 0 || sfd < 0)
+		pabort("socket");
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(lfd, 1) ||
+	    getsockname(lfd, (struct sockaddr *)&addr, &len))
+		pabort("listen");
+	if (connect(sfd, (struct sockaddr *)&addr, sizeof(addr)))
+		pabort("connect");
+	rfd = accept(lfd, NULL, NULL);
+	if (rfd < 0)
+		pabort("accept");
+	close(lfd);
+	setsockopt(sfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	memset(buf, 'x', size);
+	ra.fd = rfd;
+	ra.r = r;
+	if (pthread_create(&thread, NULL, receiver, &ra))
+		pabort("pthread_create");
+
+	/* blocks until the parent closes the write end of the start pipe */
+	if (read(start_fd, &c, 1) < 0)
+		pabort("read start pipe");
+
+	while (r->sent < bytes) {
+		n = write(sfd, buf, size);
+		if (n < 0)
+			pabort("write");
+		r->sent += n;
+	}
+	shutdown(sfd, SHUT_WR);
+	pthread_join(thread, NULL);
+	exit(0);
+}
+
+static void run(unsigned int npairs, struct result *results)
+{
+	unsigned long long sent = 0, received = 0;
+	unsigned int snd = 0, rcv = 0;
+	pid_t pids[MAX_PAIRS];
+	int start_pipe[2];
+	double start, elapsed;
+	unsigned int i;
+	uid_t uid;
+
+	memset(results, 0, sizeof(*results) * MAX_PAIRS);
+	for (i = 0; i < npairs; i++) {
+		uid = first_uid < 0 ? getuid() : first_uid + i;
+		if (first_uid < 0 && i)
+			break;
+		snd -= uid_stat_read(uid, "tcp_snd");
+		rcv -= uid_stat_read(uid, "tcp_rcv");
+	}
+
+	if (pipe(start_pipe))
+		pabort("pipe");
+	for (i = 0; i < npairs; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0)
+			pabort("fork");
+		if (!pids[i]) {
+			close(start_pipe[1]);
+			if (first_uid >= 0 && setuid(first_uid + i))
+				pabort("setuid");
+			pair(start_pipe[0], &results[i]);
+		}
+	}
+	close(start_pipe[0]);
+
+	/* let every pair connect before starting the clock */
+	sleep(1);
+	start = now();
+	close(start_pipe[1]);
+
+	for (i = 0; i < npairs; i++) {
+		waitpid(pids[i], NULL, 0);
+		sent += results[i].sent;
+		received += results[i].received;
+	}
+	elapsed = now() - start;
+
+	for (i = 0; i < npairs; i++) {
+		uid = first_uid < 0 ? getuid() : first_uid + i;
+		if (first_uid < 0 && i)
+			break;
+		snd += uid_stat_read(uid, "tcp_snd");
+		rcv += uid_stat_read(uid, "tcp_rcv");
+	}
+
+	printf("%3u pairs: %8.1f MB/s, %7.1f MB/s per pair", npairs,
+	       received / elapsed / 1e6, received / elapsed / 1e6 / npairs);
+	if (uid_stat)
+		printf(", uid_stat snd %.1f%% rcv %.1f%%",
+		       100.0 * snd / received, 100.0 * rcv / received);
+	if (received != sent)
+		printf(", %llu bytes lost", sent - received);
+	printf("\n");
+	fflush(stdout);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-p max_pairs] [-m mbytes] [-s write_size] "
+		"[-u first_uid]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct result *results;
+	unsigned int npairs;
+	int c;
+
+	while ((c = getopt(argc, argv, "p:m:s:u:")) != -1) {
+		switch (c) {
+		case 'p':
+			max_pairs = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			bytes = strtoull(optarg, NULL, 0) << 20;
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 'u':
+			first_uid = strtol(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!max_pairs || max_pairs > MAX_PAIRS || !size || size > MAX_SIZE)
+		usage(argv[0]);
+
+	results = mmap(NULL, sizeof(*results) * MAX_PAIRS,
+		       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+		       -1, 0);
+	if (results == MAP_FAILED)
+		pabort("mmap");
+
+	printf("%llu MB per pair in writes of %zu bytes, %ld cpus, ",
+	       bytes >> 20, size, sysconf(_SC_NPROCESSORS_ONLN));
+	if (first_uid < 0)
+		printf("uid %u", getuid());
+	else
+		printf("uids from %ld", first_uid);
+	uid_stat = !access("/proc/uid_stat", F_OK);
+	printf("%s\n", uid_stat ? "" : ", no /proc/uid_stat");
+	fflush(stdout);
+	for (npairs = 1; npairs < max_pairs; npairs *= 2)
+		run(npairs, results);
+	run(max_pairs, results);
+	return 0;
+}
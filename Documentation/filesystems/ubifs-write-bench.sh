@@ -0,0 +1,152 @@
+#! /bin/sh
+# measure UBIFS sequential write throughput on nandsim with 1 to N CPUs
+#
+# Loads nandsim as a 2KiB page, 128KiB block NAND of the given size,
+# attaches UBI to it and creates one volume taking all of it. For every
+# CPU count, takes all other CPUs offline, creates a fresh UBIFS on the
+# volume, writes one file of compressible data to it with dd and syncs.
+# The time includes the sync, so it covers write-back, which is where
+# UBIFS compresses data nodes. Each run is done with compr=lzo and, for
+# reference, with compr=none, and the best of the runs printed in MB/s.
+# As nandsim keeps the flash in RAM, with lzo the CPUs doing compression
+# are the limit, and throughput should go up with the number of CPUs.
+#
+# Usage: ubifs-write-bench.sh [-s size_mb] [-f file_mb] [-r runs]
+#                             [-i input_file] [cpus ...]
+#
+# The flash is 128, 256, 512 or 1024 MB (512 by default) and the file
+# 256 MB, which must fit on it uncompressed. cpus defaults to 1, 2, 4 and
+# so on up to the number of CPUs present. The input defaults to lines of
+# text, which compress well; it is copied to a tmpfs first so reading it
+# costs nothing. Needs root, a kernel with nandsim, UBI and UBIFS, CPU
+# hotplug to run with fewer CPUs, mtd-utils (ubiformat, ubiattach,
+# ubidetach, ubimkvol, ubirmvol) and GNU date.
+
+set -e
+me=`basename $0`
+size=512
+file=256
+runs=3
+input=
+
+usage() {
+	echo "Usage: $me [-s size_mb] [-f file_mb] [-r runs] [-i input_file]" \
+	     "[cpus ...]" 1>&2
+	exit 1
+}
+
+while getopts s:f:r:i: opt; do
+	case $opt in
+	s) size=$OPTARG ;;
+	f) file=$OPTARG ;;
+	r) runs=$OPTARG ;;
+	i) input=$OPTARG ;;
+	*) usage ;;
+	esac
+done
+shift $((OPTIND - 1))
+
+case $size in
+128) id=0xf1 ;;
+256) id=0xda ;;
+512) id=0xdc ;;
+1024) id=0xd3 ;;
+*) echo "$me: no nandsim chip of $size MB" 1>&2; exit 1 ;;
+esac
+
+present=`ls -d /sys/devices/system/cpu/cpu[0-9]* | wc -l`
+if [ $# -eq 0 ]; then
+	n=1
+	while [ $n -lt $present ]; do
+		set "$@" $n
+		n=$((n * 2))
+	done
+	set "$@" $present
+fi
+
+# puts cpu0 up to cpu$1 - 1 online and the others offline
+cpus_online() {
+	for cpu in /sys/devices/system/cpu/cpu[0-9]*; do
+		test -f $cpu/online || continue
+		if [ ${cpu##*/cpu} -lt $1 ]; then
+			echo 1 > $cpu/online
+		else
+			echo 0 > $cpu/online
+		fi
+	done
+}
+
+tmp=`mktemp -d`
+mkdir $tmp/mnt $tmp/in
+trap 'umount $tmp/mnt 2>/dev/null; ubidetach -m $mtd 2>/dev/null;
+      modprobe -r nandsim; cpus_online $present; umount $tmp/in 2>/dev/null;
+      rm -rf $tmp' EXIT
+modprobe ubi 2>/dev/null || true
+modprobe ubifs 2>/dev/null || true
+
+mount -t tmpfs -o size=$((file + 16))m none $tmp/in
+if [ -n "$input" ]; then
+	dd if=$input of=$tmp/in/data bs=1M count=$file 2>/dev/null
+else
+	seq 100000000 | sed "s/\$/ written to flash/" |
+		head -c $((file * 1024 * 1024)) > $tmp/in/data
+fi
+test `stat -c %s $tmp/in/data` -eq $((file * 1024 * 1024)) ||
+	{ echo "$me: input is shorter than $file MB" 1>&2; exit 1; }
+
+# milliseconds since some fixed point
+ms() {
+	echo $((`date +%s%N` / 1000000))
+}
+
+modprobe -r nandsim 2>/dev/null || true
+modprobe nandsim first_id_byte=0xec second_id_byte=$id \
+	third_id_byte=0x00 fourth_id_byte=0x15
+mtd=`grep "NAND simulator" /proc/mtd | tail -1 | cut -d: -f1`
+mtd=${mtd#mtd}
+ubiformat -y -q /dev/mtd$mtd
+ubiattach -m $mtd >/dev/null
+for ubi in /sys/class/ubi/ubi[0-9]*; do
+	test -f $ubi/mtd_num && test `cat $ubi/mtd_num` -eq $mtd && break
+done
+ubi=${ubi##*/}
+
+# writes the file once on a new UBIFS mounted with the given compressor
+# and prints how long that and the sync took, in ms
+time_write() {
+	ubirmvol /dev/$ubi -N data 2>/dev/null || true
+	ubimkvol /dev/$ubi -m -N data >/dev/null
+	mount -t ubifs -o compr=$1 $ubi:data $tmp/mnt
+	sync
+	start=`ms`
+	dd if=$tmp/in/data of=$tmp/mnt/data bs=1M 2>/dev/null
+	sync
+	end=`ms`
+	umount $tmp/mnt
+	echo $((end - start))
+}
+
+# best throughput of $runs writes with the given compressor, in MB/s
+best_write() {
+	best=
+	for run in `seq $runs`; do
+		t=`time_write $1`
+		if [ -z "$best" ] || [ $t -lt $best ]; then
+			best=$t
+		fi
+	done
+	test $best -gt 0 || best=1
+	echo $((file * 1000 / best))
+}
+
+echo "$size MB nandsim, $file MB file, best of $runs"
+for cpus in "$@"; do
+	if [ $cpus -gt $present ]; then
+		echo "$me: only $present CPUs" 1>&2
+		exit 1
+	fi
+	cpus_online $cpus
+	lzo=`best_write lzo`
+	none=`best_write none`
+	printf "%3d CPUs: lzo %5d MB/s, none %5d MB/s\n" $cpus $lzo $none
+done
@@ -0,0 +1,221 @@
+/*
+ * YAFFS2 garbage collection write latency benchmark
+ *
+ * Fills a directory on a YAFFS2 partition with files, then overwrites
+ * random parts of them, which leaves dirty blocks behind for garbage
+ * collection to reclaim. Every write is timed, and the percentiles of the
+ * write latency are printed along with the number of garbage collections,
+ * passive ones and chunks copied, summed over the devices in /proc/yaffs.
+ *
+ * Inline GC runs inside the writes, so it shows in the tail. Run it once
+ * with the background GC thread off and once with it on (yaffs_bg_gc in
+ * /sys/module/yaffs/parameters, read when the partition is mounted), and
+ * give the thread idle time to work in with -i.
+ *
+ * Usage: yaffs2-gc-latency [-f files] [-s file_kb] [-w write_kb]
+ *                          [-n writes] [-i idle_ms] [-S] dir
+ *
+ * The files take files * file_kb of the partition; make that most of it
+ * so GC has to run. -S calls fdatasync() after every write and counts it
+ * in the latency.
+ *
+ * Build with gcc -O2.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ */
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_FILES	1024
+
+struct gc_stats {
+	unsigned long collections;
+	unsigned long passive;
+	unsigned long copies;
+};
+
+static unsigned int nfiles = 16;
+static unsigned long file_kb = 1024;
+static unsigned long write_kb = 4;
+static unsigned long writes = 10000;
+static unsigned int idle_ms;
+static int sync_writes;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void pabort(const char *s)
+{
+	perror(s);
+	exit(1);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* sums the GC counters of every device, or returns -1 without /proc/yaffs */
+static int gc_stats_read(struct gc_stats *s)
+{
+	char line[256];
+	unsigned long val;
+	FILE *f;
+
+	memset(s, 0, sizeof(*s));
+	f = fopen("/proc/yaffs", "r");
+	if (!f)
+		return -1;
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "garbageCollections. %lu", &val) == 1)
+			s->collections += val;
+		else if (sscanf(line, "passiveGCs......... %lu", &val) == 1)
+			s->passive += val;
+		else if (sscanf(line, "nGCCopies.......... %lu", &val) == 1)
+			s->copies += val;
+	}
+	fclose(f);
+	return 0;
+}
+
+static double percentile(const double *lat, unsigned long n, double pct)
+{
+	unsigned long i = n * pct / 100;
+
+	return lat[i < n ? i : n - 1] * 1e3;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-f files] [-s file_kb] [-w write_kb] "
+		"[-n writes] [-i idle_ms] [-S] dir\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct gc_stats before, after;
+	struct timespec idle;
+	int fds[MAX_FILES];
+	char path[4096];
+	unsigned long i, chunks;
+	double *lat, start, elapsed, total = 0;
+	unsigned int seed = 1;
+	char *buf;
+	int have_stats;
+	int c;
+
+	while ((c = getopt(argc, argv, "f:s:w:n:i:S")) != -1) {
+		switch (c) {
+		case 'f':
+			nfiles = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			file_kb = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			write_kb = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			writes = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			idle_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'S':
+			sync_writes = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || !nfiles || nfiles > MAX_FILES ||
+	    !write_kb || file_kb < write_kb || !writes)
+		usage(argv[0]);
+
+	buf = malloc(write_kb * 1024);
+	lat = malloc(sizeof(*lat) * writes);
+	if (!buf || !lat)
+		pabort("malloc");
+	memset(buf, 0x5a, write_kb * 1024);
+	chunks = file_kb / write_kb;
+
+	printf("%s: %u files of %lu KB, %lu writes of %lu KB%s, idle %u ms\n",
+	       argv[optind], nfiles, file_kb, writes, write_kb,
+	       sync_writes ? " with fdatasync" : "", idle_ms);
+	fflush(stdout);
+
+	for (i = 0; i < nfiles; i++) {
+		unsigned long n;
+
+		snprintf(path, sizeof(path), "%s/gc-latency.%lu",
+			 argv[optind], i);
+		fds[i] = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (fds[i] < 0)
+			pabort("can't create file");
+		for (n = 0; n < chunks; n++)
+			if (write(fds[i], buf, write_kb * 1024) < 0)
+				pabort("fill");
+		if (fsync(fds[i]))
+			pabort("fsync");
+	}
+
+	have_stats = !gc_stats_read(&before);
+	idle.tv_sec = idle_ms / 1000;
+	idle.tv_nsec = (idle_ms % 1000) * 1000000;
+	start = now();
+	for (i = 0; i < writes; i++) {
+		int fd = fds[rand_r(&seed) % nfiles];
+		off_t off = (off_t)(rand_r(&seed) % chunks) * write_kb * 1024;
+		double t = now();
+
+		if (pwrite(fd, buf, write_kb * 1024, off) < 0)
+			pabort("pwrite");
+		if (sync_writes && fdatasync(fd))
+			pabort("fdatasync");
+		lat[i] = now() - t;
+		total += lat[i];
+		if (idle_ms)
+			nanosleep(&idle, NULL);
+	}
+	elapsed = now() - start;
+	gc_stats_read(&after);
+
+	qsort(lat, writes, sizeof(*lat), cmp_double);
+	printf("%.0f writes/s, mean %.3f ms, p50 %.3f ms, p90 %.3f ms, "
+	       "p99 %.3f ms, p99.9 %.3f ms, max %.3f ms\n",
+	       writes / elapsed, total / writes * 1e3,
+	       percentile(lat, writes, 50), percentile(lat, writes, 90),
+	       percentile(lat, writes, 99), percentile(lat, writes, 99.9),
+	       lat[writes - 1] * 1e3);
+	if (have_stats)
+		printf("%lu garbage collections, %lu passive, %lu chunks "
+		       "copied\n", after.collections - before.collections,
+		       after.passive - before.passive,
+		       after.copies - before.copies);
+	else
+		printf("no /proc/yaffs\n");
+
+	for (i = 0; i < nfiles; i++) {
+		close(fds[i]);
+		snprintf(path, sizeof(path), "%s/gc-latency.%lu",
+			 argv[optind], i);
+		unlink(path);
+	}
+	return 0;
+}
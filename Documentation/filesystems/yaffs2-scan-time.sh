@@ -0,0 +1,103 @@
+#! /bin/sh
+# time YAFFS2 mount scans on nandsim partitions of several sizes
+#
+# For every size, loads nandsim as a 2KiB page, 128KiB block NAND of that
+# size, fills a YAFFS2 partition on it with files, deletes every fourth
+# one so the scan also meets obsolete chunks, and unmounts it. It then
+# times mounting it with no-checkpoint-read, which makes yaffs_ScanBackwards()
+# read the tags of every block as after an unclean shutdown, and, for
+# reference, mounting it from the checkpoint. The best of the runs is
+# printed for each.
+#
+# Usage: yaffs2-scan-time.sh [-f fill_percent] [-r runs] [-c cache_file]
+#                            [size_mb ...]
+#
+# Sizes are 128, 256, 512 or 1024 (all four by default). Needs root, the
+# nandsim, mtdblock and yaffs2 drivers and GNU date. nandsim keeps the
+# whole partition in RAM unless -c gives it a file to use instead.
+
+set -e
+me=`basename $0`
+fill=50
+runs=3
+cache=
+
+usage() {
+	echo "Usage: $me [-f fill_percent] [-r runs] [-c cache_file]" \
+	     "[size_mb ...]" 1>&2
+	exit 1
+}
+
+while getopts f:r:c: opt; do
+	case $opt in
+	f) fill=$OPTARG ;;
+	r) runs=$OPTARG ;;
+	c) cache="cache_file=$OPTARG" ;;
+	*) usage ;;
+	esac
+done
+shift $((OPTIND - 1))
+test $# -eq 0 && set 128 256 512 1024
+
+mnt=`mktemp -d`
+trap 'umount $mnt 2>/dev/null; rmdir $mnt; modprobe -r nandsim' EXIT
+
+# milliseconds since some fixed point
+ms() {
+	echo $((`date +%s%N` / 1000000))
+}
+
+# times one mount of $dev with the mount arguments given, in ms, then
+# unmounts it
+time_mount() {
+	start=`ms`
+	mount -t yaffs2 "$@" $dev $mnt
+	end=`ms`
+	umount $mnt
+	echo $((end - start))
+}
+
+# best of $runs mounts with the mount arguments given
+best_mount() {
+	best=
+	for run in `seq $runs`; do
+		t=`time_mount "$@"`
+		if [ -z "$best" ] || [ $t -lt $best ]; then
+			best=$t
+		fi
+	done
+	echo $best
+}
+
+for size in "$@"; do
+	case $size in
+	128) id=0xf1 ;;
+	256) id=0xda ;;
+	512) id=0xdc ;;
+	1024) id=0xd3 ;;
+	*) echo "$me: no nandsim chip of $size MB" 1>&2; exit 1 ;;
+	esac
+
+	modprobe -r nandsim 2>/dev/null || true
+	modprobe nandsim first_id_byte=0xec second_id_byte=$id \
+		third_id_byte=0x00 fourth_id_byte=0x15 $cache
+	mtd=`grep "NAND simulator" /proc/mtd | tail -1 | cut -d: -f1`
+	dev=/dev/mtdblock${mtd#mtd}
+	test -b $dev || mknod $dev b 31 ${mtd#mtd}
+
+	# 256KiB files, and every fourth one deleted again
+	mount -t yaffs2 $dev $mnt
+	files=$((size * fill * 4 / 100))
+	for i in `seq $files`; do
+		dd if=/dev/zero of=$mnt/f$i bs=4k count=64 2>/dev/null
+	done
+	for i in `seq 4 4 $files`; do
+		rm $mnt/f$i
+	done
+	umount $mnt
+
+	scan=`best_mount -o no-checkpoint-read`
+	checkpoint=`best_mount`
+	printf "%5s MB, %d%% full: scan %6d ms, checkpoint %6d ms\n" \
+		$size $fill $scan $checkpoint
+done
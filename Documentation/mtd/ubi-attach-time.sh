@@ -0,0 +1,130 @@
+#! /bin/sh
+# time UBI attach by full scan and by fastmap on nandsim of several sizes
+#
+# For every size, loads nandsim as a 2KiB page, 128KiB block NAND of that
+# size and writes it with ubiformat from an image holding one UBIFS volume,
+# filled with files to the given percentage. An image written that way has
+# no fastmap, so the first attach scans every PEB. Detaching then writes a
+# fastmap, and the next attach uses it. Each is done as many times as asked
+# and the best time printed, both as seen by ubiattach and as reported by
+# UBI itself ("attaching took").
+#
+# Usage: ubi-attach-time.sh [-f fill_percent] [-r runs] [size_mb ...]
+#
+# Sizes are 128, 256, 512 or 1024 (all four by default). Needs root, a
+# kernel with nandsim and UBI built as modules or in, CONFIG_MTD_UBI_FASTMAP
+# for the second number to mean anything, mtd-utils (ubiformat, ubiattach,
+# ubidetach, ubinize, mkfs.ubifs) and GNU date. nandsim keeps the whole
+# flash in RAM.
+
+set -e
+me=`basename $0`
+fill=50
+runs=3
+
+usage() {
+	echo "Usage: $me [-f fill_percent] [-r runs] [size_mb ...]" 1>&2
+	exit 1
+}
+
+while getopts f:r: opt; do
+	case $opt in
+	f) fill=$OPTARG ;;
+	r) runs=$OPTARG ;;
+	*) usage ;;
+	esac
+done
+shift $((OPTIND - 1))
+test $# -eq 0 && set 128 256 512 1024
+
+tmp=`mktemp -d`
+trap 'ubidetach -m $mtd 2>/dev/null; modprobe -r nandsim; rm -rf $tmp' EXIT
+modprobe ubi 2>/dev/null || true
+
+# milliseconds since some fixed point
+ms() {
+	echo $((`date +%s%N` / 1000000))
+}
+
+# the last value UBI printed after the given message
+ubi_msg() {
+	dmesg | grep "UBI: $1" | tail -1 | sed "s|.*$1 *||"
+}
+
+# attaches $mtd, prints the time ubiattach took and the one UBI reports,
+# and whether the fastmap was used, then detaches it again
+time_attach() {
+	start=`ms`
+	ubiattach -m $mtd >/dev/null
+	end=`ms`
+	fastmap=`dmesg | tail -40 | grep -c "attached using fastmap" || true`
+	took=`ubi_msg "attaching took" | sed "s/ ms//"`
+	ubidetach -m $mtd
+	echo $((end - start)) $took $fastmap
+}
+
+for size in "$@"; do
+	case $size in
+	128) id=0xf1 ;;
+	256) id=0xda ;;
+	512) id=0xdc ;;
+	1024) id=0xd3 ;;
+	*) echo "$me: no nandsim chip of $size MB" 1>&2; exit 1 ;;
+	esac
+
+	modprobe -r nandsim 2>/dev/null || true
+	modprobe nandsim first_id_byte=0xec second_id_byte=$id \
+		third_id_byte=0x00 fourth_id_byte=0x15
+	mtd=`grep "NAND simulator" /proc/mtd | tail -1 | cut -d: -f1`
+	mtd=${mtd#mtd}
+
+	# attach once to learn the geometry UBI uses on this flash
+	ubiformat -y -q /dev/mtd$mtd
+	ubiattach -m $mtd >/dev/null
+	leb=`ubi_msg "logical eraseblock size:" | sed "s/ bytes//"`
+	io=`ubi_msg "smallest flash I/O unit:"`
+	vid=`ubi_msg "VID header offset:" | cut -d" " -f1`
+	pebs=`ubi_msg "available PEBs:"`
+	ubidetach -m $mtd
+
+	rm -rf $tmp/root
+	mkdir $tmp/root
+	files=$((size * fill / 100))
+	for i in `seq $files`; do
+		dd if=/dev/urandom of=$tmp/root/f$i bs=64k count=16 2>/dev/null
+	done
+	mkfs.ubifs -q -r $tmp/root -m $io -e $leb -c $pebs -o $tmp/fs.img
+	cat > $tmp/ubinize.cfg <<EOF
+[data]
+mode=ubi
+image=$tmp/fs.img
+vol_id=0
+vol_type=dynamic
+vol_name=data
+vol_flags=autoresize
+EOF
+	ubinize -o $tmp/ubi.img -m $io -p 128KiB -s $vid -O $vid \
+		$tmp/ubinize.cfg
+
+	scan= fm= scan_ubi= fm_ubi= fm_used=0
+	for run in `seq $runs`; do
+		ubiformat -y -q -O $vid -f $tmp/ubi.img /dev/mtd$mtd
+		time_attach > $tmp/t
+		read t t_ubi used < $tmp/t
+		if [ -z "$scan" ] || [ $t -lt $scan ]; then
+			scan=$t
+			scan_ubi=$t_ubi
+		fi
+		time_attach > $tmp/t
+		read t t_ubi used < $tmp/t
+		if [ -z "$fm" ] || [ $t -lt $fm ]; then
+			fm=$t
+			fm_ubi=$t_ubi
+		fi
+		fm_used=$((fm_used + used))
+	done
+	printf "%5s MB, %d%% full: scan %6d ms (UBI %d), " \
+		$size $fill $scan $scan_ubi
+	printf "fastmap %6d ms (UBI %d), fastmap used %d of %d times\n" \
+		$fm $fm_ubi $fm_used $runs
+done
@@ -0,0 +1,232 @@
+/*
+ * Wakelock timeout stress test
+ *
+ * Starts threads that take, retake and drop timed wakelocks through
+ * /sys/power/wake_lock and /sys/power/wake_unlock as fast as they can,
+ * each on its own set of lock names, with timeouts picked at random
+ * between min_ms and max_ms. Retaking an active lock moves its expiry,
+ * dropping it takes it off the expiry order early, and the locks left
+ * alone expire on their own, so every path of the timed lock code runs
+ * at once. It prints the operations per second, in total and per thread,
+ * and the slowest single operation.
+ *
+ * Once the threads are done it waits for the longest timeout to pass and
+ * reads /proc/wakelocks: none of the test's locks may still be active,
+ * and the number that expired is printed. The locks stay listed there,
+ * as userspace wakelocks are never freed.
+ *
+ * Usage: wakelock-timeout-stress [-t threads] [-l locks] [-d seconds]
+ *                                [-m min_ms] [-M max_ms]
+ *
+ * -l is the number of lock names per thread. Needs write access to
+ * /sys/power/wake_lock, and keeps the system awake while it runs.
+ *
+ * Build with gcc -O2 -pthread.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ */
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_THREADS	256
+#define PREFIX		"wlstress"
+
+struct worker {
+	pthread_t thread;
+	unsigned int id;
+	unsigned long ops;
+	unsigned long failed;
+	double worst;
+};
+
+static unsigned int nthreads = 8;
+static unsigned int locks = 16;
+static unsigned int duration = 10;
+static unsigned int min_ms = 1;
+static unsigned int max_ms = 100;
+
+static volatile int stop;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void pabort(const char *s)
+{
+	perror(s);
+	exit(1);
+}
+
+static void *stress(void *arg)
+{
+	struct worker *w = arg;
+	unsigned int seed = w->id;
+	char buf[64];
+	int lock_fd, unlock_fd;
+	int len;
+
+	lock_fd = open("/sys/power/wake_lock", O_WRONLY);
+	unlock_fd = open("/sys/power/wake_unlock", O_WRONLY);
+	if (lock_fd < 0 || unlock_fd < 0)
+		pabort("can't open /sys/power/wake_lock");
+
+	while (!stop) {
+		unsigned int lock = rand_r(&seed) % locks;
+		unsigned long long timeout;
+		double t = now();
+		int fd;
+
+		/* one drop for every three takes, so most locks expire */
+		if (rand_r(&seed) % 4) {
+			timeout = min_ms + rand_r(&seed) % (max_ms - min_ms + 1);
+			len = snprintf(buf, sizeof(buf), PREFIX "_%d_%u_%u %llu",
+				       getpid(), w->id, lock,
+				       timeout * 1000000ULL);
+			fd = lock_fd;
+		} else {
+			len = snprintf(buf, sizeof(buf), PREFIX "_%d_%u_%u",
+				       getpid(), w->id, lock);
+			fd = unlock_fd;
+		}
+		if (write(fd, buf, len) != len)
+			w->failed++;
+		else
+			w->ops++;
+		t = now() - t;
+		if (t > w->worst)
+			w->worst = t;
+	}
+	close(lock_fd);
+	close(unlock_fd);
+	return NULL;
+}
+
+/*
+ * Counts the test's locks in /proc/wakelocks that are still active, and
+ * adds up how often they expired.
+ */
+static int check_locks(unsigned long *expired)
+{
+	char line[512], name[128];
+	char prefix[64];
+	unsigned int count, expire_count, wake_count;
+	long long active_since;
+	int active = 0;
+	FILE *f;
+
+	f = fopen("/proc/wakelocks", "r");
+	if (!f)
+		pabort("can't open /proc/wakelocks");
+	snprintf(prefix, sizeof(prefix), "\"" PREFIX "_%d_", getpid());
+	*expired = 0;
+	while (fgets(line, sizeof(line), f)) {
+		if (strncmp(line, prefix, strlen(prefix)))
+			continue;
+		if (sscanf(line, "%127s %u %u %u %lld", name, &count,
+			   &expire_count, &wake_count, &active_since) != 5)
+			continue;
+		*expired += expire_count;
+		if (active_since) {
+			fprintf(stderr, "%s still active\n", name);
+			active++;
+		}
+	}
+	fclose(f);
+	return active;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-t threads] [-l locks] [-d seconds] "
+		"[-m min_ms] [-M max_ms]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct worker workers[MAX_THREADS];
+	struct timespec wait;
+	unsigned long total = 0, failed = 0, expired;
+	double start, elapsed, worst = 0;
+	unsigned int i;
+	int active;
+	int c;
+
+	while ((c = getopt(argc, argv, "t:l:d:m:M:")) != -1) {
+		switch (c) {
+		case 't':
+			nthreads = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			locks = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			duration = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			min_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'M':
+			max_ms = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!nthreads || nthreads > MAX_THREADS || !locks || !min_ms ||
+	    max_ms < min_ms)
+		usage(argv[0]);
+
+	printf("%u threads, %u locks each, timeouts %u-%u ms, %u s, "
+	       "%ld cpus\n", nthreads, locks, min_ms, max_ms, duration,
+	       sysconf(_SC_NPROCESSORS_ONLN));
+	fflush(stdout);
+
+	memset(workers, 0, sizeof(workers));
+	start = now();
+	for (i = 0; i < nthreads; i++) {
+		workers[i].id = i;
+		if (pthread_create(&workers[i].thread, NULL, stress,
+				   &workers[i]))
+			pabort("pthread_create");
+	}
+	sleep(duration);
+	stop = 1;
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		total += workers[i].ops;
+		failed += workers[i].failed;
+		if (workers[i].worst > worst)
+			worst = workers[i].worst;
+	}
+	elapsed = now() - start;
+
+	printf("%.0f ops/s, %.0f ops/s per thread, worst op %.3f ms",
+	       total / elapsed, total / elapsed / nthreads, worst * 1e3);
+	if (failed)
+		printf(", %lu failed", failed);
+	printf("\n");
+	fflush(stdout);
+
+	/* every lock must have expired once the longest timeout is over */
+	wait.tv_sec = max_ms / 1000 + 1;
+	wait.tv_nsec = (max_ms % 1000) * 1000000;
+	nanosleep(&wait, NULL);
+	active = check_locks(&expired);
+	printf("%lu expired, %d still active: %s\n", expired, active,
+	       active || failed ? "FAILED" : "ok");
+	return active || failed ? 1 : 0;
+}
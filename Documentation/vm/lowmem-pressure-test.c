@@ -0,0 +1,202 @@
+/*
+ * Memory pressure notification test (using the Android lowmemorykiller
+ * /dev/lowmem_pressure device)
+ *
+ * A child process allocates and touches memory in steps, and reports the
+ * time of each step through a pipe. The parent polls the pressure device
+ * and, for every level it reads, prints how long after the last step the
+ * event arrived. Once the hog has reached max_mb, or been killed, the
+ * parent prints how long the device took to report level 0 again.
+ *
+ * Usage: lowmem-pressure-test [-d device] [-s step_mb] [-m max_mb]
+ *                             [-i interval_ms]
+ *
+ * Run it as a process that the killer may pick, for example after
+ * echo 15 > /proc/self/oom_adj in the shell that starts it.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+static const char *device = "/dev/lowmem_pressure";
+static unsigned long step_mb = 4;
+static unsigned long max_mb = 1024;
+static unsigned long interval_ms = 100;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void pabort(const char *s)
+{
+	perror(s);
+	exit(1);
+}
+
+/* the memory hog: one step every interval_ms, its time written to 'fd' */
+static void hog(int fd)
+{
+	unsigned long mb;
+	long page = sysconf(_SC_PAGESIZE);
+
+	for (mb = 0; mb < max_mb; mb += step_mb) {
+		size_t len = step_mb << 20;
+		char *p = malloc(len);
+		size_t i;
+		double t;
+
+		if (!p)
+			exit(1);
+		for (i = 0; i < len; i += page)
+			p[i] = 1;
+		t = now();
+		if (write(fd, &t, sizeof(t)) != sizeof(t))
+			break;
+		usleep(interval_ms * 1000);
+	}
+	/* hold it until the parent kills us */
+	for (;;)
+		pause();
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-d device] [-s step_mb] [-m max_mb] "
+		"[-i interval_ms]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct pollfd pfd[2];
+	int pipefd[2];
+	double last_step = 0, hog_gone = 0;
+	unsigned long steps = 0;
+	int level = 0, max_level = 0;
+	pid_t pid;
+	int c;
+
+	while ((c = getopt(argc, argv, "d:s:m:i:")) != -1) {
+		switch (c) {
+		case 'd':
+			device = optarg;
+			break;
+		case 's':
+			step_mb = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			max_mb = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			interval_ms = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!step_mb)
+		usage(argv[0]);
+
+	pfd[0].fd = open(device, O_RDONLY);
+	if (pfd[0].fd < 0)
+		pabort("can't open device");
+	pfd[0].events = POLLIN;
+
+	if (pipe(pipefd) < 0)
+		pabort("pipe");
+	pid = fork();
+	if (pid < 0)
+		pabort("fork");
+	if (pid == 0) {
+		close(pipefd[0]);
+		close(pfd[0].fd);
+		hog(pipefd[1]);
+	}
+	close(pipefd[1]);
+	pfd[1].fd = pipefd[0];
+	pfd[1].events = POLLIN;
+
+	for (;;) {
+		char line[80];
+		double t;
+		ssize_t n;
+
+		if (poll(pfd, pfd[1].fd >= 0 ? 2 : 1, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			pabort("poll");
+		}
+		t = now();
+
+		if (pfd[1].fd >= 0 && pfd[1].revents) {
+			n = read(pfd[1].fd, &last_step, sizeof(last_step));
+			if (n == sizeof(last_step) &&
+			    ++steps * step_mb >= max_mb && !hog_gone) {
+				/* reached max_mb: let go of the memory */
+				hog_gone = t;
+				kill(pid, SIGKILL);
+			} else if (n != sizeof(last_step)) {
+				/* killed, or out of memory */
+				close(pfd[1].fd);
+				pfd[1].fd = -1;
+				if (!hog_gone)
+					hog_gone = t;
+			}
+			if (hog_gone) {
+				printf("hog gone after %lu MB\n",
+				       steps * step_mb);
+				if (level == 0)
+					break;
+			}
+		}
+
+		if (!pfd[0].revents)
+			continue;
+		n = read(pfd[0].fd, line, sizeof(line) - 1);
+		if (n <= 0)
+			pabort("can't read device");
+		line[n] = '\0';
+		if (sscanf(line, "level %d", &level) != 1) {
+			fprintf(stderr, "bad line: %s", line);
+			return 1;
+		}
+		if (level > max_level)
+			max_level = level;
+
+		if (!steps) {
+			printf("start: %s", line);
+		} else if (!hog_gone) {
+			printf("%lu MB: %.3f ms after step: %s",
+			       steps * step_mb, (t - last_step) * 1e3, line);
+		} else {
+			printf("%.3f ms after release: %s",
+			       (t - hog_gone) * 1e3, line);
+			if (level == 0)
+				break;
+		}
+		fflush(stdout);
+	}
+
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+	printf("highest level %d\n", max_level);
+	return 0;
+}
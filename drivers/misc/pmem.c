@@ -23,16 +23,25 @@
 #include <linux/android_pmem.h>
 #include <linux/mempolicy.h>
 #include <linux/sched.h>
+#include <linux/moduleparam.h>
+#include <linux/ktime.h>
 #include <asm/io.h>
 #include <asm/uaccess.h>
 #include <asm/cacheflush.h>
 
 #define PMEM_MAX_DEVICES 10
 #define PMEM_MAX_ORDER 128
+/* indices are ints, so no free block is ever larger than this order */
+#define PMEM_NR_ORDERS 32
 #define PMEM_MIN_ALLOC PAGE_SIZE
 
 #define PMEM_DEBUG 1
 
+/* PMEM_CACHE_OP requests covering at least this many bytes do maintenance
+ * on the whole cache rather than walking each range */
+static unsigned long full_cache_threshold = 64 * 1024;
+module_param(full_cache_threshold, ulong, 0644);
+
 /* indicates that a refernce to this file has been taken via get_pmem_file,
  * the file should not be released until put_pmem_file is called */
 #define PMEM_FLAGS_BUSY 0x1
@@ -82,6 +91,10 @@ struct pmem_data {
 struct pmem_bits {
 	unsigned allocated:1;		/* 1 if allocated, 0 if free */
 	unsigned order:7;		/* size of the region in pmem space */
+	/* neighbours on the free list for this order, -1 terminated, only
+	 * valid for the first entry of a free region */
+	int next_free;
+	int prev_free;
 };
 
 struct pmem_region_node {
@@ -116,6 +129,22 @@ struct pmem_info {
 	/* the bitmap for the region indicating which entries are allocated
 	 * and which are free */
 	struct pmem_bits *bitmap;
+	/* the first entry of each free region of a given order, -1 if none */
+	int free_list[PMEM_NR_ORDERS];
+	/* allocator statistics, reported in debugfs */
+	unsigned long nr_free[PMEM_NR_ORDERS];
+	unsigned long allocs;
+	unsigned long alloc_fails;
+	unsigned long frees;
+	unsigned long splits;
+	unsigned long merges;
+	/* PMEM_CACHE_OP statistics, protected by cache_stats_lock */
+	spinlock_t cache_stats_lock;
+	unsigned long range_ops;
+	unsigned long range_bytes;
+	u64 range_ns;
+	unsigned long full_ops;
+	u64 full_ns;
 	/* indicates the region should not be managed with an allocator */
 	unsigned no_allocator;
 	/* indicates maps of this region should be cached, if a mix of
@@ -131,7 +160,7 @@ struct pmem_info {
 	 * needed */
 	struct semaphore data_list_sem;
 	struct list_head data_list;
-	/* pmem_sem protects the bitmap array
+	/* pmem_sem protects the bitmap array, free lists and statistics
 	 * a write lock should be held when modifying entries in bitmap
 	 * a read lock should be held when reading data from bits or
 	 * dereferencing a pointer into bitmap
@@ -232,6 +261,35 @@ static int is_master_owner(struct file *file)
 	return ret;
 }
 
+/* the free list helpers expect the write lock on pmem_sem to be held */
+static void pmem_free_list_add(int id, int index)
+{
+	int order = PMEM_ORDER(id, index);
+	int head = pmem[id].free_list[order];
+
+	pmem[id].bitmap[index].prev_free = -1;
+	pmem[id].bitmap[index].next_free = head;
+	if (head >= 0)
+		pmem[id].bitmap[head].prev_free = index;
+	pmem[id].free_list[order] = index;
+	pmem[id].nr_free[order]++;
+}
+
+static void pmem_free_list_del(int id, int index)
+{
+	int order = PMEM_ORDER(id, index);
+	int prev = pmem[id].bitmap[index].prev_free;
+	int next = pmem[id].bitmap[index].next_free;
+
+	if (prev >= 0)
+		pmem[id].bitmap[prev].next_free = next;
+	else
+		pmem[id].free_list[order] = next;
+	if (next >= 0)
+		pmem[id].bitmap[next].prev_free = prev;
+	pmem[id].nr_free[order]--;
+}
+
 static int pmem_free(int id, int index)
 {
 	/* caller should hold the write lock on pmem_sem! */
@@ -244,21 +302,25 @@ static int pmem_free(int id, int index)
 	}
 	/* clean up the bitmap, merging any buddies */
 	pmem[id].bitmap[curr].allocated = 0;
+	pmem[id].frees++;
 	/* find a slots buddy Buddy# = Slot# ^ (1 << order)
 	 * if the buddy is also free merge them
 	 * repeat until the buddy is not free or end of the bitmap is reached
+	 * the buddy is always the first entry of a region, so only those
+	 * entries need their order kept up to date
 	 */
-	do {
+	while (PMEM_ORDER(id, curr) < PMEM_NR_ORDERS - 1) {
 		buddy = PMEM_BUDDY_INDEX(id, curr);
-		if (PMEM_IS_FREE(id, buddy) &&
-				PMEM_ORDER(id, buddy) == PMEM_ORDER(id, curr)) {
-			PMEM_ORDER(id, buddy)++;
-			PMEM_ORDER(id, curr)++;
-			curr = min(buddy, curr);
-		} else {
+		if (buddy >= pmem[id].num_entries ||
+		    !PMEM_IS_FREE(id, buddy) ||
+		    PMEM_ORDER(id, buddy) != PMEM_ORDER(id, curr))
 			break;
-		}
-	} while (curr < pmem[id].num_entries);
+		pmem_free_list_del(id, buddy);
+		curr = min(buddy, curr);
+		PMEM_ORDER(id, curr)++;
+		pmem[id].merges++;
+	}
+	pmem_free_list_add(id, curr);
 
 	return 0;
 }
@@ -380,8 +442,7 @@ static int pmem_allocate(int id, unsigned long len)
 {
 	/* caller should hold the write lock on pmem_sem! */
 	/* return the corresponding pdata[] entry */
-	int curr = 0;
-	int end = pmem[id].num_entries;
+	int curr;
 	int best_fit = -1;
 	unsigned long order = pmem_order(len);
 
@@ -397,44 +458,42 @@ static int pmem_allocate(int id, unsigned long len)
 		return -1;
 	DLOG("order %lx\n", order);
 
-	/* look through the bitmap:
-	 * 	if you find a free slot of the correct order use it
-	 * 	otherwise, use the best fit (smallest with size > order) slot
+	/* take a free slot of the correct order if there is one,
+	 * otherwise the best fit (smallest with size > order) slot
 	 */
-	while (curr < end) {
-		if (PMEM_IS_FREE(id, curr)) {
-			if (PMEM_ORDER(id, curr) == (unsigned char)order) {
-				/* set the not free bit and clear others */
-				best_fit = curr;
-				break;
-			}
-			if (PMEM_ORDER(id, curr) > (unsigned char)order &&
-			    (best_fit < 0 ||
-			     PMEM_ORDER(id, curr) < PMEM_ORDER(id, best_fit)))
-				best_fit = curr;
+	for (curr = order; curr < PMEM_NR_ORDERS; curr++) {
+		if (pmem[id].free_list[curr] >= 0) {
+			best_fit = pmem[id].free_list[curr];
+			break;
 		}
-		curr = PMEM_NEXT_INDEX(id, curr);
 	}
 
 	/* if best_fit < 0, there are no suitable slots,
 	 * return an error
 	 */
 	if (best_fit < 0) {
+		pmem[id].alloc_fails++;
 		printk("pmem: no space left to allocate!\n");
 		return -1;
 	}
+	pmem_free_list_del(id, best_fit);
 
 	/* now partition the best fit:
 	 * 	split the slot into 2 buddies of order - 1
 	 * 	repeat until the slot is of the correct order
+	 * 	the upper buddies go back on the free lists
 	 */
 	while (PMEM_ORDER(id, best_fit) > (unsigned char)order) {
 		int buddy;
 		PMEM_ORDER(id, best_fit) -= 1;
 		buddy = PMEM_BUDDY_INDEX(id, best_fit);
 		PMEM_ORDER(id, buddy) = PMEM_ORDER(id, best_fit);
+		pmem[id].bitmap[buddy].allocated = 0;
+		pmem_free_list_add(id, buddy);
+		pmem[id].splits++;
 	}
 	pmem[id].bitmap[best_fit].allocated = 1;
+	pmem[id].allocs++;
 	return best_fit;
 }
 
@@ -821,6 +880,112 @@ end:
 	up_read(&data->sem);
 }
 
+/* whether @range lies within one of the regions mapped by a connected file */
+static int pmem_range_in_regions(struct pmem_data *data,
+				 struct pmem_region *range)
+{
+	struct pmem_region_node *region_node;
+
+	list_for_each_entry(region_node, &data->region_list, list) {
+		if (range->offset >= region_node->region.offset &&
+		    range->offset + range->len <=
+		    region_node->region.offset + region_node->region.len)
+			return 1;
+	}
+	return 0;
+}
+
+static int pmem_cache_op(struct file *file, unsigned long arg)
+{
+	struct pmem_data *data;
+	struct pmem_cache_op op;
+	struct pmem_region *ranges;
+	unsigned long total = 0, len;
+	void *vaddr;
+	ktime_t start;
+	u64 ns;
+	int id = get_id(file);
+	int i, ret = 0;
+
+	if (!has_allocation(file))
+		return -EINVAL;
+	if (copy_from_user(&op, (void __user *)arg, sizeof(op)))
+		return -EFAULT;
+	if (!op.op || (op.op & ~PMEM_CACHE_FLUSH) || !op.nr_ranges ||
+	    op.nr_ranges > PMEM_CACHE_MAX_RANGES)
+		return -EINVAL;
+
+	ranges = kmalloc(op.nr_ranges * sizeof(*ranges), GFP_KERNEL);
+	if (!ranges)
+		return -ENOMEM;
+	if (copy_from_user(ranges, (void __user *)op.ranges,
+			   op.nr_ranges * sizeof(*ranges))) {
+		ret = -EFAULT;
+		goto err_free;
+	}
+
+	data = (struct pmem_data *)file->private_data;
+	down_read(&data->sem);
+	len = pmem_len(id, data);
+	for (i = 0; i < op.nr_ranges; i++) {
+		if (ranges[i].offset > len ||
+		    ranges[i].len > len - ranges[i].offset) {
+			ret = -EINVAL;
+			goto err_up;
+		}
+		/* like flush_pmem_file(), connected files only get the
+		 * regions they have mapped */
+		if ((data->flags & PMEM_FLAGS_CONNECTED) &&
+		    !pmem_range_in_regions(data, &ranges[i])) {
+			ret = -EINVAL;
+			goto err_up;
+		}
+		total += ranges[i].len;
+	}
+
+	/* uncached regions have nothing to maintain */
+	if (!pmem[id].cached)
+		goto err_up;
+
+	vaddr = pmem_start_vaddr(id, data);
+	start = ktime_get();
+	if (total >= full_cache_threshold) {
+		/* a full clean+invalidate is also a valid clean or invalidate,
+		 * and it does not throw away anyone else's dirty lines */
+		flush_cache_all();
+	} else {
+		for (i = 0; i < op.nr_ranges; i++) {
+			void *range_start = vaddr + ranges[i].offset;
+			void *range_end = range_start + ranges[i].len;
+
+			if (op.op == PMEM_CACHE_CLEAN)
+				dmac_clean_range(range_start, range_end);
+			else if (op.op == PMEM_CACHE_INV)
+				dmac_inv_range(range_start, range_end);
+			else
+				dmac_flush_range(range_start, range_end);
+		}
+	}
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	spin_lock(&pmem[id].cache_stats_lock);
+	if (total >= full_cache_threshold) {
+		pmem[id].full_ops++;
+		pmem[id].full_ns += ns;
+	} else {
+		pmem[id].range_ops++;
+		pmem[id].range_bytes += total;
+		pmem[id].range_ns += ns;
+	}
+	spin_unlock(&pmem[id].cache_stats_lock);
+
+err_up:
+	up_read(&data->sem);
+err_free:
+	kfree(ranges);
+	return ret;
+}
+
 static int pmem_connect(unsigned long connect, struct file *file)
 {
 	struct pmem_data *data = (struct pmem_data *)file->private_data;
@@ -1141,13 +1306,18 @@ static long pmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			if (has_allocation(file))
 				return -EINVAL;
 			data = (struct pmem_data *)file->private_data;
+			down_write(&pmem[id].bitmap_sem);
 			data->index = pmem_allocate(id, arg);
+			up_write(&pmem[id].bitmap_sem);
 			break;
 		}
 	case PMEM_CONNECT:
 		DLOG("connect\n");
 		return pmem_connect(arg, file);
 		break;
+	case PMEM_CACHE_OP:
+		DLOG("cache op\n");
+		return pmem_cache_op(file, arg);
 	default:
 		if (pmem[id].ioctl)
 			return pmem[id].ioctl(file, cmd, arg);
@@ -1175,7 +1345,48 @@ static ssize_t debug_read(struct file *file, char __user *buf, size_t count,
 	int n = 0;
 
 	DLOG("debug open\n");
-	n = scnprintf(buffer, debug_bufmax,
+	if (!pmem[id].no_allocator) {
+		unsigned long free_pages = 0;
+		int order, largest = -1;
+
+		down_read(&pmem[id].bitmap_sem);
+		n += scnprintf(buffer + n, debug_bufmax - n,
+			       "allocs %lu fails %lu frees %lu splits %lu "
+			       "merges %lu\nfree regions by order:",
+			       pmem[id].allocs, pmem[id].alloc_fails,
+			       pmem[id].frees, pmem[id].splits,
+			       pmem[id].merges);
+		for (order = 0; order < PMEM_NR_ORDERS; order++) {
+			if (!pmem[id].nr_free[order])
+				continue;
+			n += scnprintf(buffer + n, debug_bufmax - n, " %d:%lu",
+				       order, pmem[id].nr_free[order]);
+			free_pages += pmem[id].nr_free[order] << order;
+			largest = order;
+		}
+		up_read(&pmem[id].bitmap_sem);
+		/* fragmentation: how much of the free space lies outside the
+		 * largest free region, in percent; in u64, as 100 times a
+		 * page count may not fit an unsigned long */
+		n += scnprintf(buffer + n, debug_bufmax - n,
+			       "\nfree pages %lu largest free order %d "
+			       "fragmentation %llu%%\n", free_pages, largest,
+			       free_pages ? div64_u64(100ULL * (free_pages -
+			       (1UL << largest)), free_pages) : 0ULL);
+	}
+	if (pmem[id].cached) {
+		spin_lock(&pmem[id].cache_stats_lock);
+		n += scnprintf(buffer + n, debug_bufmax - n,
+			       "cache ops: ranged %lu (%lu bytes, %llu us) "
+			       "full %lu (%llu us) threshold %lu\n",
+			       pmem[id].range_ops, pmem[id].range_bytes,
+			       div_u64(pmem[id].range_ns, NSEC_PER_USEC),
+			       pmem[id].full_ops,
+			       div_u64(pmem[id].full_ns, NSEC_PER_USEC),
+			       full_cache_threshold);
+		spin_unlock(&pmem[id].cache_stats_lock);
+	}
+	n += scnprintf(buffer + n, debug_bufmax - n,
 		      "pid #: mapped regions (offset, len) (offset,len)...\n");
 
 	down(&pmem[id].data_list_sem);
@@ -1232,6 +1443,7 @@ int pmem_setup(struct android_pmem_platform_data *pdata,
 	pmem[id].ioctl = ioctl;
 	pmem[id].release = release;
 	init_rwsem(&pmem[id].bitmap_sem);
+	spin_lock_init(&pmem[id].cache_stats_lock);
 	init_MUTEX(&pmem[id].data_list_sem);
 	INIT_LIST_HEAD(&pmem[id].data_list);
 	pmem[id].dev.name = pdata->name;
@@ -1254,9 +1466,15 @@ int pmem_setup(struct android_pmem_platform_data *pdata,
 	memset(pmem[id].bitmap, 0, sizeof(struct pmem_bits) *
 					  pmem[id].num_entries);
 
-	for (i = sizeof(pmem[id].num_entries) * 8 - 1; i >= 0; i--) {
-		if ((pmem[id].num_entries) &  1<<i) {
+	for (i = 0; i < PMEM_NR_ORDERS; i++) {
+		pmem[id].free_list[i] = -1;
+		pmem[id].nr_free[i] = 0;
+	}
+
+	for (i = PMEM_NR_ORDERS - 1; i >= 0; i--) {
+		if ((pmem[id].num_entries) &  1UL<<i) {
 			PMEM_ORDER(id, index) = i;
+			pmem_free_list_add(id, index);
 			index = PMEM_NEXT_INDEX(id, index);
 		}
 	}
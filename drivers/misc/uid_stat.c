@@ -13,44 +13,76 @@
  *
  */
 
-#include <asm/atomic.h>
-
 #include <linux/err.h>
+#include <linux/hash.h>
 #include <linux/init.h>
 #include <linux/kernel.h>
 #include <linux/list.h>
+#include <linux/percpu.h>
 #include <linux/proc_fs.h>
+#include <linux/rcupdate.h>
 #include <linux/slab.h>
+#include <linux/smp.h>
 #include <linux/spinlock.h>
 #include <linux/stat.h>
 #include <linux/uid_stat.h>
 
+#define UID_HASH_BITS	6
+#define UID_HASH_SIZE	(1 << UID_HASH_BITS)
+
+/*
+ * Entries are never removed, so lookups only need rcu_read_lock(). uid_lock
+ * serializes inserts so that racing first packets of a uid add one entry.
+ */
 static DEFINE_SPINLOCK(uid_lock);
-static LIST_HEAD(uid_list);
+static struct hlist_head uid_hash[UID_HASH_SIZE];
 static struct proc_dir_entry *parent;
 
+/*
+ * Byte counters wrap at 4GB, as before. Each cpu only adds to its own copy,
+ * and the copies are summed when the proc file is read.
+ */
+struct uid_stat_cpu {
+	unsigned int tcp_rcv;
+	unsigned int tcp_snd;
+};
+
 struct uid_stat {
-	struct list_head link;
+	struct hlist_node link;
 	uid_t uid;
-	atomic_t tcp_rcv;
-	atomic_t tcp_snd;
+	struct uid_stat_cpu *cpu;
 };
 
+static inline struct hlist_head *uid_hash_head(uid_t uid)
+{
+	return &uid_hash[hash_long((unsigned long)uid, UID_HASH_BITS)];
+}
+
+/* Caller must hold rcu_read_lock() or uid_lock. */
 static struct uid_stat *find_uid_stat(uid_t uid) {
-	unsigned long flags;
 	struct uid_stat *entry;
+	struct hlist_node *node;
 
-	spin_lock_irqsave(&uid_lock, flags);
-	list_for_each_entry(entry, &uid_list, link) {
-		if (entry->uid == uid) {
-			spin_unlock_irqrestore(&uid_lock, flags);
+	hlist_for_each_entry_rcu(entry, node, uid_hash_head(uid), link) {
+		if (entry->uid == uid)
 			return entry;
-		}
 	}
-	spin_unlock_irqrestore(&uid_lock, flags);
 	return NULL;
 }
 
+static unsigned int uid_stat_sum(struct uid_stat *uid_entry, bool snd)
+{
+	unsigned int bytes = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct uid_stat_cpu *c = per_cpu_ptr(uid_entry->cpu, cpu);
+
+		bytes += snd ? c->tcp_snd : c->tcp_rcv;
+	}
+	return bytes;
+}
+
 static int tcp_snd_read_proc(char *page, char **start, off_t off,
 				int count, int *eof, void *data)
 {
@@ -61,7 +93,7 @@ static int tcp_snd_read_proc(char *page, char **start, off_t off,
 	if (!data)
 		return 0;
 
-	bytes = (unsigned int) (atomic_read(&uid_entry->tcp_snd) + INT_MIN);
+	bytes = uid_stat_sum(uid_entry, true);
 	p += sprintf(p, "%u\n", bytes);
 	len = (p - page) - off;
 	*eof = (len <= count) ? 1 : 0;
@@ -79,7 +111,7 @@ static int tcp_rcv_read_proc(char *page, char **start, off_t off,
 	if (!data)
 		return 0;
 
-	bytes = (unsigned int) (atomic_read(&uid_entry->tcp_rcv) + INT_MIN);
+	bytes = uid_stat_sum(uid_entry, false);
 	p += sprintf(p, "%u\n", bytes);
 	len = (p - page) - off;
 	*eof = (len <= count) ? 1 : 0;
@@ -91,20 +123,31 @@ static int tcp_rcv_read_proc(char *page, char **start, off_t off,
 static struct uid_stat *create_stat(uid_t uid) {
 	unsigned long flags;
 	char uid_s[32];
-	struct uid_stat *new_uid;
+	struct uid_stat *new_uid, *old_uid;
 	struct proc_dir_entry *entry;
 
-	/* Create the uid stat struct and append it to the list. */
+	/* Create the uid stat struct and add it to the hash. */
 	if ((new_uid = kmalloc(sizeof(struct uid_stat), GFP_KERNEL)) == NULL)
 		return NULL;
 
 	new_uid->uid = uid;
-	/* Counters start at INT_MIN, so we can track 4GB of network traffic. */
-	atomic_set(&new_uid->tcp_rcv, INT_MIN);
-	atomic_set(&new_uid->tcp_snd, INT_MIN);
+	/* alloc_percpu() zeroes the counters */
+	new_uid->cpu = alloc_percpu(struct uid_stat_cpu);
+	if (!new_uid->cpu) {
+		kfree(new_uid);
+		return NULL;
+	}
 
 	spin_lock_irqsave(&uid_lock, flags);
-	list_add_tail(&new_uid->link, &uid_list);
+	old_uid = find_uid_stat(uid);
+	if (old_uid) {
+		/* lost the race with another first packet of this uid */
+		spin_unlock_irqrestore(&uid_lock, flags);
+		free_percpu(new_uid->cpu);
+		kfree(new_uid);
+		return old_uid;
+	}
+	hlist_add_head_rcu(&new_uid->link, uid_hash_head(uid));
 	spin_unlock_irqrestore(&uid_lock, flags);
 
 	sprintf(uid_s, "%d", uid);
@@ -120,23 +163,34 @@ static struct uid_stat *create_stat(uid_t uid) {
 	return new_uid;
 }
 
+static struct uid_stat *get_uid_stat(uid_t uid) {
+	struct uid_stat *entry;
+
+	rcu_read_lock();
+	entry = find_uid_stat(uid);
+	rcu_read_unlock();
+
+	/* entries are never freed, so it stays valid outside the rcu lock */
+	if (!entry)
+		entry = create_stat(uid);
+	return entry;
+}
+
 int update_tcp_snd(uid_t uid, int size) {
 	struct uid_stat *entry;
-	if ((entry = find_uid_stat(uid)) == NULL &&
-		((entry = create_stat(uid)) == NULL)) {
-			return -1;
-	}
-	atomic_add(size, &entry->tcp_snd);
+	if ((entry = get_uid_stat(uid)) == NULL)
+		return -1;
+	per_cpu_ptr(entry->cpu, get_cpu())->tcp_snd += size;
+	put_cpu();
 	return 0;
 }
 
 int update_tcp_rcv(uid_t uid, int size) {
 	struct uid_stat *entry;
-	if ((entry = find_uid_stat(uid)) == NULL &&
-		((entry = create_stat(uid)) == NULL)) {
-			return -1;
-	}
-	atomic_add(size, &entry->tcp_rcv);
+	if ((entry = get_uid_stat(uid)) == NULL)
+		return -1;
+	per_cpu_ptr(entry->cpu, get_cpu())->tcp_rcv += size;
+	put_cpu();
 	return 0;
 }
 
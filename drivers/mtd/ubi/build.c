@@ -41,6 +41,8 @@
 #include <linux/miscdevice.h>
 #include <linux/log2.h>
 #include <linux/kthread.h>
+#include <linux/debugfs.h>
+#include <linux/reboot.h>
 #include "ubi.h"
 
 /* Maximum length of the 'mtd=' parameter */
@@ -68,6 +70,9 @@ struct class *ubi_class;
 /* Slab cache for wear-leveling entries */
 struct kmem_cache *ubi_wl_entry_slab;
 
+/* Root UBI debugfs directory (corresponds to '/<debugfs>/ubi/') */
+struct dentry *ubi_debugfs_root;
+
 /* UBI control character device */
 static struct miscdevice ubi_ctrl_cdev = {
 	.minor = MISC_DYNAMIC_MINOR,
@@ -477,19 +482,21 @@ static void free_internal_volumes(struct ubi_device *ubi)
  * This function returns zero in case of success and a negative error code in
  * case of failure.
  *
- * Note, currently this is the only method to attach UBI devices. Hopefully in
- * the future we'll have more scalable attaching methods and avoid full media
- * scanning. But even in this case scanning will be needed as a fall-back
- * attaching method if there are some on-flash table corruptions.
+ * Note, if fastmap support is enabled, the fastmap is tried first, and full
+ * media scanning is only done if there is no valid fastmap on the flash.
  */
 static int attach_by_scanning(struct ubi_device *ubi)
 {
 	int err;
+	unsigned long start = jiffies;
 	struct ubi_scan_info *si;
 
-	si = ubi_scan(ubi);
+	si = ubi_scan_fastmap(ubi);
+	if (!si)
+		si = ubi_scan(ubi);
 	if (IS_ERR(si))
 		return PTR_ERR(si);
+	ubi_msg("attaching took %u ms", jiffies_to_msecs(jiffies - start));
 
 	ubi->bad_peb_count = si->bad_peb_count;
 	ubi->good_peb_count = ubi->peb_count - ubi->bad_peb_count;
@@ -808,6 +815,10 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 	mutex_init(&ubi->mult_mutex);
 	mutex_init(&ubi->volumes_mutex);
 	spin_lock_init(&ubi->volumes_lock);
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	init_rwsem(&ubi->fm_eba_sem);
+	mutex_init(&ubi->fm_mutex);
+#endif
 
 	ubi_msg("attaching mtd%d to ubi%d", mtd->index, ubi_num);
 
@@ -855,6 +866,8 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 		goto out_uif;
 	}
 
+	ubi_wl_debugfs_init(ubi);
+
 	ubi_msg("attached mtd%d to ubi%d", mtd->index, ubi_num);
 	ubi_msg("MTD device name:            \"%s\"", mtd->name);
 	ubi_msg("MTD device size:            %llu MiB", ubi->flash_size >> 20);
@@ -943,9 +956,22 @@ int ubi_detach_mtd_dev(int ubi_num, int anyway)
 	/*
 	 * Before freeing anything, we have to stop the background thread to
 	 * prevent it from doing anything on this device while we are freeing.
+	 * Nobody must wake it up after it has been stopped.
 	 */
-	if (ubi->bgt_thread)
+	if (ubi->bgt_thread) {
+		spin_lock(&ubi->wl_lock);
+		ubi->thread_enabled = 0;
+		spin_unlock(&ubi->wl_lock);
 		kthread_stop(ubi->bgt_thread);
+	}
+	ubi_wl_debugfs_exit(ubi);
+
+	if (!ubi->ref_count) {
+		int err = ubi_update_fastmap(ubi);
+
+		if (err)
+			ubi_err("cannot write fastmap, error %d", err);
+	}
 
 	uif_close(ubi);
 	ubi_wl_close(ubi);
@@ -990,6 +1016,42 @@ static struct mtd_info * __init open_mtd_device(const char *mtd_dev)
 	return mtd;
 }
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+/**
+ * ubi_reboot_notify - write the fastmap of all UBI devices before reboot.
+ * @nb: the notifier block
+ * @event: reboot event
+ * @unused: unused
+ *
+ * UBI devices carrying the root file-system are never detached, so this is
+ * where their fastmap is brought up to date.
+ */
+static int ubi_reboot_notify(struct notifier_block *nb, unsigned long event,
+			     void *unused)
+{
+	int i, err;
+	struct ubi_device *ubi;
+
+	for (i = 0; i < UBI_MAX_DEVICES; i++) {
+		ubi = ubi_get_device(i);
+		if (!ubi)
+			continue;
+
+		err = ubi_update_fastmap(ubi);
+		if (err)
+			ubi_err("cannot write fastmap of ubi%d, error %d", i,
+				err);
+		ubi_put_device(ubi);
+	}
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block ubi_reboot_nb = {
+	.notifier_call = ubi_reboot_notify,
+};
+#endif
+
 static int __init ubi_init(void)
 {
 	int err, i, k;
@@ -1029,6 +1091,13 @@ static int __init ubi_init(void)
 	if (!ubi_wl_entry_slab)
 		goto out_dev_unreg;
 
+#ifdef CONFIG_DEBUG_FS
+	ubi_debugfs_root = debugfs_create_dir(UBI_NAME_STR, NULL);
+#endif
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	register_reboot_notifier(&ubi_reboot_nb);
+#endif
+
 	/* Attach MTD devices */
 	for (i = 0; i < mtd_devs; i++) {
 		struct mtd_dev_param *p = &mtd_dev_param[i];
@@ -1062,6 +1131,11 @@ out_detach:
 			ubi_detach_mtd_dev(ubi_devices[k]->ubi_num, 1);
 			mutex_unlock(&ubi_devices_mutex);
 		}
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	unregister_reboot_notifier(&ubi_reboot_nb);
+#endif
+	if (ubi_debugfs_root)
+		debugfs_remove(ubi_debugfs_root);
 	kmem_cache_destroy(ubi_wl_entry_slab);
 out_dev_unreg:
 	misc_deregister(&ubi_ctrl_cdev);
@@ -1079,12 +1153,17 @@ static void __exit ubi_exit(void)
 {
 	int i;
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	unregister_reboot_notifier(&ubi_reboot_nb);
+#endif
 	for (i = 0; i < UBI_MAX_DEVICES; i++)
 		if (ubi_devices[i]) {
 			mutex_lock(&ubi_devices_mutex);
 			ubi_detach_mtd_dev(ubi_devices[i]->ubi_num, 1);
 			mutex_unlock(&ubi_devices_mutex);
 		}
+	if (ubi_debugfs_root)
+		debugfs_remove(ubi_debugfs_root);
 	kmem_cache_destroy(ubi_wl_entry_slab);
 	misc_deregister(&ubi_ctrl_cdev);
 	class_remove_file(ubi_class, &ubi_version);
@@ -241,16 +241,21 @@ static void leb_read_unlock(struct ubi_device *ubi, int vol_id, int lnum)
  * @vol_id: volume ID
  * @lnum: logical eraseblock number
  *
- * This function locks a logical eraseblock for writing. Returns zero in case
- * of success and a negative error code in case of failure.
+ * This function locks a logical eraseblock for writing. It also locks the EBA
+ * tables against the fastmap writer, because everything which takes the write
+ * lock changes them. Returns zero in case of success and a negative error code
+ * in case of failure.
  */
 static int leb_write_lock(struct ubi_device *ubi, int vol_id, int lnum)
 {
 	struct ubi_ltree_entry *le;
 
+	ubi_fm_eba_lock(ubi);
 	le = ltree_add_entry(ubi, vol_id, lnum);
-	if (IS_ERR(le))
+	if (IS_ERR(le)) {
+		ubi_fm_eba_unlock(ubi);
 		return PTR_ERR(le);
+	}
 	down_write(&le->mutex);
 	return 0;
 }
@@ -265,6 +270,10 @@ static int leb_write_lock(struct ubi_device *ubi, int vol_id, int lnum)
  * contention and does nothing if there is contention. Returns %0 in case of
  * success, %1 in case of contention, and and a negative error code in case of
  * failure.
+ *
+ * Note, this is only used by the WL worker, which is serialized with the
+ * fastmap writer by @ubi->move_mutex, so unlike 'leb_write_lock()' this
+ * function does not lock the EBA tables. Use '__leb_write_unlock()' to unlock.
  */
 static int leb_write_trylock(struct ubi_device *ubi, int vol_id, int lnum)
 {
@@ -290,12 +299,12 @@ static int leb_write_trylock(struct ubi_device *ubi, int vol_id, int lnum)
 }
 
 /**
- * leb_write_unlock - unlock logical eraseblock.
+ * __leb_write_unlock - unlock logical eraseblock.
  * @ubi: UBI device description object
  * @vol_id: volume ID
  * @lnum: logical eraseblock number
  */
-static void leb_write_unlock(struct ubi_device *ubi, int vol_id, int lnum)
+static void __leb_write_unlock(struct ubi_device *ubi, int vol_id, int lnum)
 {
 	struct ubi_ltree_entry *le;
 
@@ -311,6 +320,18 @@ static void leb_write_unlock(struct ubi_device *ubi, int vol_id, int lnum)
 	spin_unlock(&ubi->ltree_lock);
 }
 
+/**
+ * leb_write_unlock - unlock logical eraseblock locked by 'leb_write_lock()'.
+ * @ubi: UBI device description object
+ * @vol_id: volume ID
+ * @lnum: logical eraseblock number
+ */
+static void leb_write_unlock(struct ubi_device *ubi, int vol_id, int lnum)
+{
+	__leb_write_unlock(ubi, vol_id, lnum);
+	ubi_fm_eba_unlock(ubi);
+}
+
 /**
  * ubi_eba_unmap_leb - un-map logical eraseblock.
  * @ubi: UBI device description object
@@ -1131,7 +1152,7 @@ int ubi_eba_copy_leb(struct ubi_device *ubi, int from, int to,
 out_unlock_buf:
 	mutex_unlock(&ubi->buf_mutex);
 out_unlock_leb:
-	leb_write_unlock(ubi, vol_id, lnum);
+	__leb_write_unlock(ubi, vol_id, lnum);
 	return err;
 }
 
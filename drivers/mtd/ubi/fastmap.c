@@ -0,0 +1,822 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+ * the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * UBI fastmap sub-system.
+ *
+ * Scanning reads the EC and VID headers of every physical eraseblock, so the
+ * attach time grows linearly with the flash size. The fastmap is a snapshot
+ * of the scanning information: for each physical eraseblock it stores the
+ * erase counter and what the eraseblock is used for (free, mapped to a logical
+ * eraseblock, has to be erased, bad, etc). See &struct ubi_fm_hdr for the
+ * on-flash format.
+ *
+ * The fastmap is written by the background thread shortly after attach and
+ * whenever it has been invalidated, from a reboot notifier, and when the
+ * device is detached. Together with the fastmap, a pool of free physical
+ * eraseblocks is picked. While the fastmap is on the flash, the WL sub-system
+ * hands out only the pool eraseblocks and defers all erasures, so everything
+ * written after the fastmap is in the pool, and nothing the fastmap describes
+ * is destroyed. When the pool runs low, the fastmap is invalidated (the anchor
+ * is erased) and a new one is written. Things the fastmap cannot describe,
+ * like volume table changes or an explicit flush of the erasures, invalidate
+ * it as well.
+ *
+ * When the device is attached, only the VID headers of the first
+ * %UBI_FM_MAX_START physical eraseblocks are read in order to find the
+ * fastmap anchor. Then the fastmap itself is read and the pool eraseblocks are
+ * scanned, which gives a &struct ubi_scan_info object, exactly like the one
+ * 'ubi_scan()' would produce.
+ *
+ * The fastmap is consumed on attach: the anchor is synchronously erased before
+ * UBI starts writing anything, and the other fastmap eraseblocks are scheduled
+ * for erasure. If the fastmap is invalid, or some VID header in the first
+ * eraseblocks outside of the pool is newer than the fastmap, all the anchors
+ * found are erased and UBI falls back to full scanning.
+ */
+
+#include <linux/crc32.h>
+#include <linux/err.h>
+#include <linux/vmalloc.h>
+#include "ubi.h"
+
+/**
+ * fm_add_to_list - add physical eraseblock to a scanning list.
+ * @si: scanning information
+ * @pnum: physical eraseblock number to add
+ * @ec: erase counter of the physical eraseblock
+ * @list: the list to add to
+ *
+ * Returns zero in case of success and %-ENOMEM in case of failure.
+ */
+static int fm_add_to_list(struct ubi_scan_info *si, int pnum, int ec,
+			  struct list_head *list)
+{
+	struct ubi_scan_leb *seb;
+
+	seb = kmalloc(sizeof(struct ubi_scan_leb), GFP_KERNEL);
+	if (!seb)
+		return -ENOMEM;
+
+	seb->pnum = pnum;
+	seb->ec = ec;
+	list_add_tail(&seb->u.list, list);
+	return 0;
+}
+
+/**
+ * fm_size - calculate fastmap size.
+ * @ubi: UBI device description object
+ * @vol_count: count of volume records
+ *
+ * Returns the size of the fastmap data following the header.
+ */
+static int fm_size(const struct ubi_device *ubi, int vol_count)
+{
+	return vol_count * sizeof(struct ubi_fm_vol) +
+	       ubi->peb_count * sizeof(struct ubi_fm_peb);
+}
+
+/**
+ * fill_fm_pebs - classify all physical eraseblocks.
+ * @ubi: UBI device description object
+ * @fmv: volume records
+ * @fmp: physical eraseblock records to fill
+ * @vol_count: count of volume records is returned here
+ *
+ * This function fills the volume records and the physical eraseblock records
+ * using the EBA tables and the WL sub-system state. The fastmap and the pool
+ * eraseblocks are expected to be already marked in @fmp. Returns zero in case
+ * of success and %-EINVAL if the state is inconsistent.
+ */
+static int fill_fm_pebs(struct ubi_device *ubi, struct ubi_fm_vol *fmv,
+			struct ubi_fm_peb *fmp, int *vol_count)
+{
+	int i, lnum, pnum, state, ec, idx = 0;
+	struct ubi_volume *vol;
+
+	for (i = 0; i < ubi->vtbl_slots + UBI_INT_VOL_COUNT; i++) {
+		vol = ubi->volumes[i];
+		if (!vol)
+			continue;
+
+		fmv[idx].vol_id = cpu_to_be32(vol->vol_id);
+		fmv[idx].data_pad = cpu_to_be32(vol->data_pad);
+		if (vol->vol_type == UBI_DYNAMIC_VOLUME)
+			fmv[idx].vol_type = UBI_VID_DYNAMIC;
+		else {
+			fmv[idx].vol_type = UBI_VID_STATIC;
+			fmv[idx].used_ebs = cpu_to_be32(vol->used_ebs);
+			fmv[idx].last_eb_bytes =
+				cpu_to_be32(vol->last_eb_bytes);
+		}
+		if (vol->vol_id == UBI_LAYOUT_VOLUME_ID)
+			fmv[idx].compat = UBI_LAYOUT_VOLUME_COMPAT;
+
+		for (lnum = 0; lnum < vol->reserved_pebs; lnum++) {
+			pnum = vol->eba_tbl[lnum];
+			if (pnum < 0)
+				continue;
+
+			if (fmp[pnum].type) {
+				ubi_err("PEB %d is mapped twice", pnum);
+				return -EINVAL;
+			}
+			fmp[pnum].type = UBI_FM_PEB_USED;
+			fmp[pnum].vol_idx = cpu_to_be16(idx);
+			fmp[pnum].lnum = cpu_to_be32(lnum);
+		}
+		idx += 1;
+	}
+	*vol_count = idx;
+
+	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+		ec = 0;
+		state = ubi_wl_peb_state(ubi, pnum, &ec);
+
+		switch (fmp[pnum].type) {
+		case UBI_FM_PEB_USED:
+			if (state == UBI_WL_PEB_NONE ||
+			    state == UBI_WL_PEB_FREE) {
+				ubi_err("mapped PEB %d is not used", pnum);
+				return -EINVAL;
+			}
+			if (state == UBI_WL_PEB_SCRUB)
+				fmp[pnum].flags = UBI_FM_PEB_SCRUB_FLG;
+			break;
+		case UBI_FM_PEB_FM:
+			break;
+		case UBI_FM_PEB_POOL:
+			if (state != UBI_WL_PEB_FREE) {
+				ubi_err("pool PEB %d is not free", pnum);
+				return -EINVAL;
+			}
+			break;
+		default:
+			if (state == UBI_WL_PEB_FREE)
+				fmp[pnum].type = UBI_FM_PEB_FREE;
+			else if (state != UBI_WL_PEB_NONE)
+				fmp[pnum].type = UBI_FM_PEB_ERASE;
+			else if (ubi_io_is_bad(ubi, pnum) > 0)
+				fmp[pnum].type = UBI_FM_PEB_BAD;
+			else
+				fmp[pnum].type = UBI_FM_PEB_ALIEN;
+			break;
+		}
+		fmp[pnum].ec = cpu_to_be32(ec);
+	}
+
+	return 0;
+}
+
+/**
+ * write_fastmap - write a new fastmap.
+ * @ubi: UBI device description object
+ *
+ * This function picks the fastmap pool and writes the fastmap to free physical
+ * eraseblocks, the anchor is written last. Then it makes the WL sub-system
+ * respect the new fastmap. The caller has to make sure that there is no valid
+ * fastmap on the flash and that nothing changes the EBA tables or moves
+ * eraseblocks meanwhile. Returns zero in case of success or if the fastmap
+ * cannot be written for a legitimate reason, and a negative error code in case
+ * of failure.
+ */
+static int write_fastmap(struct ubi_device *ubi)
+{
+	int i, err, pnum, vol_count, fm_pebs, size, data_size, len, pool_size;
+	int got = 0, written = 0;
+	int pnums[UBI_FM_MAX_PEBS];
+	int *pool;
+	unsigned long long sqnum;
+	void *buf;
+	struct ubi_fm_hdr *fmh;
+	struct ubi_fm_vol *fmv;
+	struct ubi_fm_peb *fmp;
+	struct ubi_vid_hdr *vid_hdr;
+
+	for (i = 0; i < ubi->vtbl_slots; i++) {
+		struct ubi_volume *vol = ubi->volumes[i];
+
+		if (vol && (vol->corrupted || vol->upd_marker)) {
+			ubi_msg("volume %d is not consistent, do not write "
+				"fastmap", vol->vol_id);
+			return 0;
+		}
+	}
+
+	vol_count = ubi->vol_count;
+	size = sizeof(struct ubi_fm_hdr) + fm_size(ubi, vol_count);
+	fm_pebs = DIV_ROUND_UP(size, ubi->leb_size);
+	if (fm_pebs > UBI_FM_MAX_PEBS) {
+		ubi_warn("fastmap needs %d PEBs, max. is %d", fm_pebs,
+			 UBI_FM_MAX_PEBS);
+		return 0;
+	}
+
+	buf = vmalloc(fm_pebs * ubi->leb_size);
+	if (!buf)
+		return -ENOMEM;
+	memset(buf, 0, fm_pebs * ubi->leb_size);
+
+	err = -ENOMEM;
+	vid_hdr = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
+	if (!vid_hdr)
+		goto out_free;
+
+	pool = kmalloc(UBI_FM_MAX_POOL * sizeof(int), GFP_KERNEL);
+	if (!pool)
+		goto out_vid;
+
+	for (got = 0; got < fm_pebs; got++) {
+		pnum = ubi_wl_get_fm_peb(ubi, got ? ubi->peb_count :
+						    UBI_FM_MAX_START);
+		if (pnum < 0) {
+			ubi_warn("no free PEBs for fastmap");
+			err = 0;
+			goto out_put;
+		}
+		pnums[got] = pnum;
+	}
+
+	pool_size = clamp(ubi->peb_count / UBI_FM_POOL_DIV, UBI_FM_MIN_POOL,
+			  UBI_FM_MAX_POOL);
+	pool_size = ubi_wl_fm_pool(ubi, pool, pool_size);
+
+	fmh = buf;
+	fmv = buf + sizeof(struct ubi_fm_hdr);
+	fmp = (void *)fmv + vol_count * sizeof(struct ubi_fm_vol);
+
+	for (i = 0; i < fm_pebs; i++) {
+		fmp[pnums[i]].type = UBI_FM_PEB_FM;
+		fmp[pnums[i]].lnum = cpu_to_be32(i);
+		fmh->pnum[i] = cpu_to_be32(pnums[i]);
+	}
+	for (i = 0; i < pool_size; i++)
+		fmp[pool[i]].type = UBI_FM_PEB_POOL;
+
+	err = fill_fm_pebs(ubi, fmv, fmp, &i);
+	if (err)
+		goto out_put;
+	ubi_assert(i == vol_count);
+
+	/* Reserve sequence numbers, the anchor gets the highest one */
+	spin_lock(&ubi->ltree_lock);
+	sqnum = ubi->global_sqnum;
+	ubi->global_sqnum += fm_pebs;
+	spin_unlock(&ubi->ltree_lock);
+
+	data_size = fm_size(ubi, vol_count);
+	fmh->magic = cpu_to_be32(UBI_FM_HDR_MAGIC);
+	fmh->version = UBI_FM_VERSION;
+	fmh->peb_count = cpu_to_be32(ubi->peb_count);
+	fmh->leb_size = cpu_to_be32(ubi->leb_size);
+	fmh->vol_count = cpu_to_be32(vol_count);
+	fmh->fm_pebs = cpu_to_be32(fm_pebs);
+	fmh->data_size = cpu_to_be32(data_size);
+	fmh->data_crc = cpu_to_be32(crc32(UBI_CRC32_INIT, fmv, data_size));
+	fmh->sqnum = cpu_to_be64(sqnum + fm_pebs - 1);
+	fmh->hdr_crc = cpu_to_be32(crc32(UBI_CRC32_INIT, fmh,
+					 UBI_FM_HDR_SIZE_CRC));
+
+	vid_hdr->vol_type = UBI_FM_VOLUME_TYPE;
+	vid_hdr->vol_id = cpu_to_be32(UBI_FM_VOLUME_ID);
+	vid_hdr->compat = UBI_FM_VOLUME_COMPAT;
+
+	for (i = fm_pebs - 1; i >= 0; i--) {
+		pnum = pnums[i];
+		vid_hdr->lnum = cpu_to_be32(i);
+		vid_hdr->sqnum = cpu_to_be64(i ? sqnum + i - 1 :
+					     sqnum + fm_pebs - 1);
+
+		dbg_bld("write fastmap LEB %d to PEB %d", i, pnum);
+		written += 1;
+		err = ubi_io_write_vid_hdr(ubi, pnum, vid_hdr);
+		if (err)
+			goto out_put;
+
+		len = min(size - i * ubi->leb_size, ubi->leb_size);
+		len = ALIGN(len, ubi->min_io_size);
+		err = ubi_io_write_data(ubi, buf + i * ubi->leb_size, pnum, 0,
+					len);
+		if (err)
+			goto out_put;
+	}
+
+	ubi_wl_fm_commit(ubi, pnums, fm_pebs, pool, pool_size);
+	dbg_bld("fastmap written to %d PEBs, anchor at PEB %d, pool of %d "
+		"PEBs", fm_pebs, pnums[0], pool_size);
+	goto out_pool;
+
+out_put:
+	/* The PEBs are written in reverse order */
+	for (i = 0; i < got; i++)
+		ubi_wl_put_fm_peb(ubi, pnums[i], i >= fm_pebs - written);
+out_pool:
+	kfree(pool);
+out_vid:
+	ubi_free_vid_hdr(ubi, vid_hdr);
+out_free:
+	vfree(buf);
+	return err;
+}
+
+/**
+ * ubi_update_fastmap - write a new fastmap.
+ * @ubi: UBI device description object
+ *
+ * This function invalidates the fastmap which is on the flash and writes a new
+ * one. It is called by the background thread, by the reboot notifier, and when
+ * the device is detached. Returns zero in case of success or if the fastmap
+ * cannot be written for a legitimate reason, and a negative error code in case
+ * of failure.
+ */
+int ubi_update_fastmap(struct ubi_device *ubi)
+{
+	int err;
+
+	if (ubi->ro_mode)
+		return 0;
+
+	/*
+	 * Block volume creation, removal, re-sizing and update, EBA table
+	 * changes and eraseblock moves.
+	 */
+	mutex_lock(&ubi->volumes_mutex);
+	down_write(&ubi->fm_eba_sem);
+	mutex_lock(&ubi->move_mutex);
+
+	err = ubi_wl_invalidate_fm(ubi);
+	if (err)
+		goto out_unlock;
+
+	spin_lock(&ubi->wl_lock);
+	ubi->fm_needed = 0;
+	spin_unlock(&ubi->wl_lock);
+
+	mutex_lock(&ubi->fm_mutex);
+	err = write_fastmap(ubi);
+	mutex_unlock(&ubi->fm_mutex);
+
+out_unlock:
+	mutex_unlock(&ubi->move_mutex);
+	up_write(&ubi->fm_eba_sem);
+	mutex_unlock(&ubi->volumes_mutex);
+	return err;
+}
+
+/**
+ * find_anchor - find the newest fastmap anchor.
+ * @ubi: UBI device description object
+ * @anchors: bitmap of all anchors found is returned here
+ * @sqnums: sequence numbers of the physical eraseblocks are returned here
+ *
+ * This function reads the VID headers of the first %UBI_FM_MAX_START physical
+ * eraseblocks. The @sqnums array has to be zeroed by the caller. Returns the
+ * physical eraseblock of the newest anchor, %-ENOENT if there is no anchor,
+ * and a negative error code in case of failure.
+ */
+static int find_anchor(struct ubi_device *ubi, unsigned long *anchors,
+		       unsigned long long *sqnums)
+{
+	int err, pnum, anchor = -ENOENT;
+	unsigned long long sqnum, anchor_sqnum = 0;
+	struct ubi_vid_hdr *vid_hdr;
+
+	vid_hdr = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
+	if (!vid_hdr)
+		return -ENOMEM;
+
+	for (pnum = 0; pnum < min(ubi->peb_count, UBI_FM_MAX_START); pnum++) {
+		err = ubi_io_is_bad(ubi, pnum);
+		if (err < 0) {
+			anchor = err;
+			break;
+		} else if (err)
+			continue;
+
+		err = ubi_io_read_vid_hdr(ubi, pnum, vid_hdr, 0);
+		if (err < 0) {
+			anchor = err;
+			break;
+		} else if (err && err != UBI_IO_BITFLIPS)
+			continue;
+
+		sqnum = be64_to_cpu(vid_hdr->sqnum);
+		sqnums[pnum] = sqnum;
+
+		if (be32_to_cpu(vid_hdr->vol_id) != UBI_FM_VOLUME_ID ||
+		    be32_to_cpu(vid_hdr->lnum) != 0)
+			continue;
+
+		dbg_bld("fastmap anchor at PEB %d, sqnum %llu", pnum, sqnum);
+		set_bit(pnum, anchors);
+		if (anchor < 0 || sqnum > anchor_sqnum) {
+			anchor = pnum;
+			anchor_sqnum = sqnum;
+		}
+	}
+
+	ubi_free_vid_hdr(ubi, vid_hdr);
+	return anchor;
+}
+
+/**
+ * read_fastmap - read and check the fastmap.
+ * @ubi: UBI device description object
+ * @anchor: physical eraseblock of the anchor
+ *
+ * Returns the fastmap in case of success, %NULL if it is invalid and an error
+ * pointer in case of failure.
+ */
+static void *read_fastmap(struct ubi_device *ubi, int anchor)
+{
+	int i, err, pnum, fm_pebs, size, data_size, vol_count, len;
+	struct ubi_fm_hdr *fmh;
+	void *buf = NULL;
+
+	fmh = kmalloc(sizeof(struct ubi_fm_hdr), GFP_KERNEL);
+	if (!fmh)
+		return ERR_PTR(-ENOMEM);
+
+	err = ubi_io_read_data(ubi, fmh, anchor, 0, sizeof(struct ubi_fm_hdr));
+	if (err && err != UBI_IO_BITFLIPS)
+		goto out_bad;
+
+	if (be32_to_cpu(fmh->magic) != UBI_FM_HDR_MAGIC ||
+	    fmh->version != UBI_FM_VERSION ||
+	    be32_to_cpu(fmh->hdr_crc) != crc32(UBI_CRC32_INIT, fmh,
+					       UBI_FM_HDR_SIZE_CRC))
+		goto out_bad;
+
+	vol_count = be32_to_cpu(fmh->vol_count);
+	fm_pebs = be32_to_cpu(fmh->fm_pebs);
+	data_size = be32_to_cpu(fmh->data_size);
+	size = sizeof(struct ubi_fm_hdr) + data_size;
+	if (be32_to_cpu(fmh->peb_count) != ubi->peb_count ||
+	    be32_to_cpu(fmh->leb_size) != ubi->leb_size ||
+	    vol_count < 0 || vol_count > ubi->vtbl_slots + UBI_INT_VOL_COUNT ||
+	    data_size != fm_size(ubi, vol_count) ||
+	    fm_pebs != DIV_ROUND_UP(size, ubi->leb_size) ||
+	    fm_pebs > UBI_FM_MAX_PEBS ||
+	    be32_to_cpu(fmh->pnum[0]) != anchor) {
+		ubi_warn("fastmap at PEB %d does not match the device", anchor);
+		goto out_free;
+	}
+
+	buf = vmalloc(size);
+	if (!buf) {
+		kfree(fmh);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	for (i = 0; i < fm_pebs; i++) {
+		pnum = be32_to_cpu(fmh->pnum[i]);
+		if (pnum < 0 || pnum >= ubi->peb_count)
+			goto out_bad;
+
+		len = min(size - i * ubi->leb_size, ubi->leb_size);
+		err = ubi_io_read_data(ubi, buf + i * ubi->leb_size, pnum, 0,
+				       len);
+		if (err && err != UBI_IO_BITFLIPS)
+			goto out_bad;
+	}
+
+	if (memcmp(buf, fmh, sizeof(struct ubi_fm_hdr)) ||
+	    be32_to_cpu(fmh->data_crc) != crc32(UBI_CRC32_INIT,
+				buf + sizeof(struct ubi_fm_hdr), data_size))
+		goto out_bad;
+
+	kfree(fmh);
+	return buf;
+
+out_bad:
+	ubi_warn("corrupted fastmap at PEB %d", anchor);
+out_free:
+	vfree(buf);
+	kfree(fmh);
+	return NULL;
+}
+
+/**
+ * fm_is_stale - check whether the fastmap is older than the flash contents.
+ * @ubi: UBI device description object
+ * @fm: the fastmap
+ * @sqnums: sequence numbers found by 'find_anchor()'
+ *
+ * Only the pool physical eraseblocks may be written after the fastmap. Returns
+ * non-zero if one of the first %UBI_FM_MAX_START physical eraseblocks outside
+ * of the pool is newer than the fastmap.
+ */
+static int fm_is_stale(struct ubi_device *ubi, void *fm,
+		       const unsigned long long *sqnums)
+{
+	int pnum;
+	struct ubi_fm_hdr *fmh = fm;
+	struct ubi_fm_peb *fmp;
+	unsigned long long sqnum = be64_to_cpu(fmh->sqnum);
+
+	fmp = fm + sizeof(struct ubi_fm_hdr) +
+	      be32_to_cpu(fmh->vol_count) * sizeof(struct ubi_fm_vol);
+
+	for (pnum = 0; pnum < min(ubi->peb_count, UBI_FM_MAX_START); pnum++)
+		if (sqnums[pnum] > sqnum &&
+		    fmp[pnum].type != UBI_FM_PEB_POOL) {
+			ubi_msg("fastmap is out of date (sqnum %llu, PEB %d "
+				"has %llu)", sqnum, pnum, sqnums[pnum]);
+			return 1;
+		}
+
+	return 0;
+}
+
+/**
+ * fm_to_si - turn the fastmap into scanning information.
+ * @ubi: UBI device description object
+ * @fm: the fastmap
+ * @anchor_ec: erase counter of the anchor is returned here
+ *
+ * This function also scans the pool physical eraseblocks. Returns scanning
+ * information in case of success, %NULL if the fastmap turned out to be
+ * inconsistent, and an error pointer in case of failure.
+ */
+static struct ubi_scan_info *fm_to_si(struct ubi_device *ubi, void *fm,
+				      int *anchor_ec)
+{
+	int i, err, pnum, ec, lnum, idx, vol_id, vol_count, pool_size = 0;
+	int *pool;
+	struct ubi_fm_hdr *fmh = fm;
+	struct ubi_fm_vol *fmv = fm + sizeof(struct ubi_fm_hdr);
+	struct ubi_fm_peb *fmp;
+	struct ubi_vid_hdr *vhs;
+	struct ubi_scan_info *si;
+
+	vol_count = be32_to_cpu(fmh->vol_count);
+	fmp = (void *)fmv + vol_count * sizeof(struct ubi_fm_vol);
+
+	si = kzalloc(sizeof(struct ubi_scan_info), GFP_KERNEL);
+	if (!si)
+		return ERR_PTR(-ENOMEM);
+
+	INIT_LIST_HEAD(&si->corr);
+	INIT_LIST_HEAD(&si->free);
+	INIT_LIST_HEAD(&si->erase);
+	INIT_LIST_HEAD(&si->alien);
+	si->volumes = RB_ROOT;
+
+	/*
+	 * 'ubi_scan_add_used()' takes the volume information from VID headers,
+	 * so prepare one VID header template per volume.
+	 */
+	err = -ENOMEM;
+	pool = kmalloc(UBI_FM_MAX_POOL * sizeof(int), GFP_KERNEL);
+	if (!pool)
+		goto out_si;
+
+	vhs = kcalloc(vol_count ? vol_count : 1, sizeof(struct ubi_vid_hdr),
+		      GFP_KERNEL);
+	if (!vhs)
+		goto out_pool;
+
+	err = -EINVAL;
+	for (i = 0; i < vol_count; i++) {
+		vol_id = be32_to_cpu(fmv[i].vol_id);
+		if ((vol_id < 0 || vol_id >= ubi->vtbl_slots) &&
+		    vol_id != UBI_LAYOUT_VOLUME_ID)
+			goto out_vhs;
+		if (fmv[i].vol_type != UBI_VID_DYNAMIC &&
+		    fmv[i].vol_type != UBI_VID_STATIC)
+			goto out_vhs;
+
+		vhs[i].vol_type = fmv[i].vol_type;
+		vhs[i].compat = fmv[i].compat;
+		vhs[i].vol_id = fmv[i].vol_id;
+		vhs[i].used_ebs = fmv[i].used_ebs;
+		vhs[i].data_pad = fmv[i].data_pad;
+		vhs[i].data_size = fmv[i].last_eb_bytes;
+	}
+
+	*anchor_ec = -1;
+	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+		ec = be32_to_cpu(fmp[pnum].ec);
+		lnum = be32_to_cpu(fmp[pnum].lnum);
+		if (ec < 0 || ec > UBI_MAX_ERASECOUNTER)
+			goto out_vhs;
+
+		switch (fmp[pnum].type) {
+		case UBI_FM_PEB_FREE:
+			err = fm_add_to_list(si, pnum, ec, &si->free);
+			break;
+		case UBI_FM_PEB_USED:
+			idx = be16_to_cpu(fmp[pnum].vol_idx);
+			if (idx >= vol_count || lnum < 0)
+				goto out_vhs;
+			vhs[idx].lnum = cpu_to_be32(lnum);
+			err = ubi_scan_add_used(ubi, si, pnum, ec, &vhs[idx],
+				fmp[pnum].flags & UBI_FM_PEB_SCRUB_FLG);
+			break;
+		case UBI_FM_PEB_ERASE:
+			err = fm_add_to_list(si, pnum, ec, &si->erase);
+			break;
+		case UBI_FM_PEB_BAD:
+			si->bad_peb_count += 1;
+			continue;
+		case UBI_FM_PEB_ALIEN:
+			err = fm_add_to_list(si, pnum, ec, &si->alien);
+			si->alien_peb_count += 1;
+			break;
+		case UBI_FM_PEB_FM:
+			if (lnum < 0 || lnum >= be32_to_cpu(fmh->fm_pebs) ||
+			    be32_to_cpu(fmh->pnum[lnum]) != pnum)
+				goto out_vhs;
+			/* The anchor is added after it has been erased */
+			if (lnum == 0) {
+				*anchor_ec = ec;
+				continue;
+			}
+			err = fm_add_to_list(si, pnum, ec, &si->erase);
+			break;
+		case UBI_FM_PEB_POOL:
+			/* Scanned below */
+			if (pool_size == UBI_FM_MAX_POOL)
+				goto out_vhs;
+			pool[pool_size++] = pnum;
+			continue;
+		default:
+			goto out_vhs;
+		}
+		if (err)
+			goto out_vhs;
+		if (fmp[pnum].type == UBI_FM_PEB_ALIEN)
+			continue;
+
+		si->ec_sum += ec;
+		si->ec_count += 1;
+		if (ec > si->max_ec)
+			si->max_ec = ec;
+		if (ec < si->min_ec)
+			si->min_ec = ec;
+	}
+
+	if (*anchor_ec < 0)
+		goto out_vhs;
+
+	/*
+	 * The pool PEBs may have been written after the fastmap, and they win
+	 * over the fastmap records, whose sequence numbers are zero.
+	 */
+	si->max_sqnum = be64_to_cpu(fmh->sqnum);
+	err = ubi_scan_pebs(ubi, si, pool, pool_size);
+	if (err)
+		goto out_vhs;
+
+	kfree(vhs);
+	kfree(pool);
+	dbg_bld("scanned %d pool PEBs", pool_size);
+	return si;
+
+out_vhs:
+	kfree(vhs);
+out_pool:
+	kfree(pool);
+out_si:
+	ubi_scan_destroy_si(si);
+	if (err == -ENOMEM)
+		return ERR_PTR(err);
+	ubi_warn("inconsistent fastmap");
+	return NULL;
+}
+
+/**
+ * erase_stale_anchor - erase a fastmap anchor which is not going to be used.
+ * @ubi: UBI device description object
+ * @pnum: physical eraseblock to erase
+ *
+ * The erase counter header is preserved if it is readable. Returns zero in
+ * case of success and a negative error code in case of failure.
+ */
+static int erase_stale_anchor(struct ubi_device *ubi, int pnum)
+{
+	int err, ec = 0;
+	struct ubi_ec_hdr *ec_hdr;
+
+	dbg_bld("erase stale fastmap anchor at PEB %d", pnum);
+	ec_hdr = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
+	if (!ec_hdr)
+		return -ENOMEM;
+
+	err = ubi_io_read_ec_hdr(ubi, pnum, ec_hdr, 0);
+	if (err == 0 || err == UBI_IO_BITFLIPS)
+		ec = be64_to_cpu(ec_hdr->ec) + 1;
+	kfree(ec_hdr);
+
+	if (ec > 0 && ec < UBI_MAX_ERASECOUNTER)
+		return ubi_scan_erase_peb(ubi, NULL, pnum, ec);
+
+	err = ubi_io_sync_erase(ubi, pnum, 0);
+	return err < 0 ? err : 0;
+}
+
+/**
+ * ubi_scan_fastmap - attach an MTD device using the fastmap.
+ * @ubi: UBI device description object
+ *
+ * This function looks for the fastmap and turns it into scanning information.
+ * Returns scanning information in case of success, %NULL if there is no
+ * usable fastmap and full scanning has to be done, and an error pointer in
+ * case of failure.
+ */
+struct ubi_scan_info *ubi_scan_fastmap(struct ubi_device *ubi)
+{
+	int err, anchor, anchor_ec, pnum;
+	unsigned long long *sqnums;
+	DECLARE_BITMAP(anchors, UBI_FM_MAX_START);
+	struct ubi_scan_info *si = NULL;
+	void *fm;
+
+	if (ubi->ro_mode)
+		return NULL;
+
+	sqnums = kcalloc(UBI_FM_MAX_START, sizeof(unsigned long long),
+			 GFP_KERNEL);
+	if (!sqnums)
+		return ERR_PTR(-ENOMEM);
+
+	bitmap_zero(anchors, UBI_FM_MAX_START);
+	anchor = find_anchor(ubi, anchors, sqnums);
+	if (anchor < 0) {
+		kfree(sqnums);
+		return anchor == -ENOENT ? NULL : ERR_PTR(anchor);
+	}
+
+	fm = read_fastmap(ubi, anchor);
+	if (IS_ERR(fm)) {
+		kfree(sqnums);
+		return fm;
+	}
+
+	if (fm && !fm_is_stale(ubi, fm, sqnums)) {
+		si = fm_to_si(ubi, fm, &anchor_ec);
+		if (IS_ERR(si)) {
+			vfree(fm);
+			kfree(sqnums);
+			return si;
+		}
+	}
+	vfree(fm);
+	kfree(sqnums);
+
+	if (si) {
+		/*
+		 * Nothing may be written to the flash while the fastmap is
+		 * still there, so get rid of the anchor right now.
+		 */
+		clear_bit(anchor, anchors);
+		anchor_ec += 1;
+		err = ubi_scan_erase_peb(ubi, si, anchor, anchor_ec);
+		if (!err)
+			err = fm_add_to_list(si, anchor, anchor_ec, &si->free);
+		if (err) {
+			ubi_scan_destroy_si(si);
+			return ERR_PTR(err);
+		}
+
+		si->ec_sum += anchor_ec;
+		si->ec_count += 1;
+		if (anchor_ec > si->max_ec)
+			si->max_ec = anchor_ec;
+		ubi_scan_calc_mean_ec(si);
+	}
+
+	/*
+	 * Erase the stale anchors, otherwise they could be picked up on the
+	 * next attach.
+	 */
+	for (pnum = 0; pnum < UBI_FM_MAX_START; pnum++) {
+		if (!test_bit(pnum, anchors))
+			continue;
+
+		err = erase_stale_anchor(ubi, pnum);
+		if (err) {
+			if (si)
+				ubi_scan_destroy_si(si);
+			return ERR_PTR(err);
+		}
+	}
+
+	if (si)
+		ubi_msg("attached using fastmap at PEB %d", anchor);
+	return si;
+}
@@ -302,6 +302,17 @@ struct ubi_vid_hdr {
 #define UBI_LAYOUT_VOLUME_NAME   "layout volume"
 #define UBI_LAYOUT_VOLUME_COMPAT UBI_COMPAT_REJECT
 
+/*
+ * The fastmap volume is a "delete"-compatible internal volume which stores a
+ * snapshot of the eraseblock association and erase counters. Note, UBI
+ * implementations which put "delete"-compatible PEBs both to the corrupted
+ * and to the used list must not attach a flash with a fastmap, so the format
+ * is not backward compatible with them.
+ */
+#define UBI_FM_VOLUME_ID     (UBI_INTERNAL_VOL_START + 1)
+#define UBI_FM_VOLUME_TYPE   UBI_VID_DYNAMIC
+#define UBI_FM_VOLUME_COMPAT UBI_COMPAT_DELETE
+
 /* The maximum number of volumes per one UBI device */
 #define UBI_MAX_VOLUMES 128
 
@@ -365,4 +376,128 @@ struct ubi_vtbl_record {
 	__be32  crc;
 } __attribute__ ((packed));
 
+/* The fastmap header magic number ("UBIF") */
+#define UBI_FM_HDR_MAGIC 0x55424946
+
+/* Version of the fastmap on-flash format */
+#define UBI_FM_VERSION 2
+
+/* The fastmap anchor (LEB 0) is always within this many first PEBs */
+#define UBI_FM_MAX_START 64
+
+/* Maximum number of physical eraseblocks a fastmap may occupy */
+#define UBI_FM_MAX_PEBS 32
+
+/*
+ * Physical eraseblock types stored in the fastmap.
+ *
+ * @UBI_FM_PEB_FREE: free PEB with a valid EC header
+ * @UBI_FM_PEB_USED: PEB mapped to a logical eraseblock
+ * @UBI_FM_PEB_ERASE: PEB which has to be erased
+ * @UBI_FM_PEB_BAD: bad PEB
+ * @UBI_FM_PEB_ALIEN: PEB which UBI must not touch
+ * @UBI_FM_PEB_FM: PEB which stores the fastmap itself
+ * @UBI_FM_PEB_POOL: PEB from the pool, may have been written after the
+ *                   fastmap, so it has to be scanned
+ */
+enum {
+	UBI_FM_PEB_FREE = 1,
+	UBI_FM_PEB_USED,
+	UBI_FM_PEB_ERASE,
+	UBI_FM_PEB_BAD,
+	UBI_FM_PEB_ALIEN,
+	UBI_FM_PEB_FM,
+	UBI_FM_PEB_POOL
+};
+
+/* Fastmap PEB record flags */
+enum {
+	UBI_FM_PEB_SCRUB_FLG = 0x01,
+};
+
+/* Size of the fastmap header without the ending CRC */
+#define UBI_FM_HDR_SIZE_CRC (sizeof(struct ubi_fm_hdr) - sizeof(__be32))
+
+/**
+ * struct ubi_fm_hdr - fastmap header.
+ * @magic: fastmap header magic number (%UBI_FM_HDR_MAGIC)
+ * @version: fastmap format version (%UBI_FM_VERSION)
+ * @padding1: reserved for future, zeroes
+ * @peb_count: count of physical eraseblocks on the device
+ * @leb_size: logical eraseblock size of the fastmap volume
+ * @vol_count: count of &struct ubi_fm_vol records
+ * @fm_pebs: count of physical eraseblocks the fastmap occupies
+ * @data_size: size of the records following the header
+ * @data_crc: CRC checksum of the records following the header
+ * @sqnum: highest sequence number used on the device when the fastmap was
+ *         written
+ * @pnum: physical eraseblocks the fastmap occupies, in LEB order
+ * @padding2: reserved for future, zeroes
+ * @hdr_crc: fastmap header CRC checksum
+ *
+ * The fastmap is written to LEBs of the %UBI_FM_VOLUME_ID internal volume, LEB
+ * 0 (the anchor) is always placed to one of the first %UBI_FM_MAX_START
+ * physical eraseblocks and is written last. The header is followed by
+ * @vol_count &struct ubi_fm_vol records and then by @peb_count &struct
+ * ubi_fm_peb records indexed by physical eraseblock number. The data simply
+ * continues from the end of one fastmap LEB to the beginning of the next one.
+ *
+ * The fastmap stays valid while the device is used: as long as it is on the
+ * flash, UBI writes only to the %UBI_FM_PEB_POOL physical eraseblocks and does
+ * not erase anything. So when attaching, only the pool has to be scanned on
+ * top of what the fastmap says.
+ */
+struct ubi_fm_hdr {
+	__be32  magic;
+	__u8    version;
+	__u8    padding1[3];
+	__be32  peb_count;
+	__be32  leb_size;
+	__be32  vol_count;
+	__be32  fm_pebs;
+	__be32  data_size;
+	__be32  data_crc;
+	__be64  sqnum;
+	__be32  pnum[UBI_FM_MAX_PEBS];
+	__u8    padding2[16];
+	__be32  hdr_crc;
+} __attribute__ ((packed));
+
+/**
+ * struct ubi_fm_vol - fastmap volume record.
+ * @vol_id: volume ID
+ * @used_ebs: number of used logical eraseblocks (only for static volumes)
+ * @data_pad: how many bytes at the end of logical eraseblocks are not used
+ * @last_eb_bytes: how many bytes are stored in the last logical eraseblock
+ *                 (only for static volumes)
+ * @vol_type: volume type (%UBI_VID_DYNAMIC or %UBI_VID_STATIC)
+ * @compat: compatibility of this volume
+ * @padding: reserved for future, zeroes
+ */
+struct ubi_fm_vol {
+	__be32  vol_id;
+	__be32  used_ebs;
+	__be32  data_pad;
+	__be32  last_eb_bytes;
+	__u8    vol_type;
+	__u8    compat;
+	__u8    padding[6];
+} __attribute__ ((packed));
+
+/**
+ * struct ubi_fm_peb - fastmap physical eraseblock record.
+ * @type: what the physical eraseblock is used for (%UBI_FM_PEB_FREE, etc)
+ * @flags: %UBI_FM_PEB_SCRUB_FLG if the PEB has to be scrubbed
+ * @vol_idx: index of the &struct ubi_fm_vol record (only for used PEBs)
+ * @ec: erase counter
+ * @lnum: logical eraseblock number (for used and fastmap PEBs)
+ */
+struct ubi_fm_peb {
+	__u8    type;
+	__u8    flags;
+	__be16  vol_idx;
+	__be32  ec;
+	__be32  lnum;
+} __attribute__ ((packed));
+
 #endif /* !__UBI_MEDIA_H__ */
@@ -100,6 +100,30 @@ enum {
 	UBI_IO_BITFLIPS
 };
 
+/*
+ * The fastmap pool is 1/%UBI_FM_POOL_DIV of the physical eraseblocks, but at
+ * least %UBI_FM_MIN_POOL and at most %UBI_FM_MAX_POOL physical eraseblocks.
+ */
+#define UBI_FM_POOL_DIV 20
+#define UBI_FM_MIN_POOL 8
+#define UBI_FM_MAX_POOL 256
+
+/*
+ * Physical eraseblock states reported by 'ubi_wl_peb_state()'.
+ *
+ * UBI_WL_PEB_NONE: the WL sub-system does not know about this PEB (bad or
+ *                  alien)
+ * UBI_WL_PEB_FREE: the PEB is free (or held back because of the fastmap)
+ * UBI_WL_PEB_SCRUB: the PEB is used and has to be scrubbed
+ * UBI_WL_PEB_OTHER: the PEB is used, protected or pending erasure
+ */
+enum {
+	UBI_WL_PEB_NONE,
+	UBI_WL_PEB_FREE,
+	UBI_WL_PEB_SCRUB,
+	UBI_WL_PEB_OTHER
+};
+
 /**
  * struct ubi_wl_entry - wear-leveling entry.
  * @u.rb: link in the corresponding (free/used) RB-tree
@@ -336,6 +360,30 @@ struct ubi_wl_entry;
  * @bgt_thread: background thread description object
  * @thread_enabled: if the background thread is enabled
  * @bgt_name: background thread name
+ * @free_count: count of physical eraseblocks in the @free tree
+ * @free_min: lowest @free_count value seen since the device was attached
+ * @free_stalls: how many times 'ubi_wl_get_peb()' found no free physical
+ *               eraseblocks and had to do works synchronously
+ * @erase_in_flight: count of erasures in progress
+ * @erase_max_in_flight: highest @erase_in_flight value seen
+ * @erase_count: count of erasures done by the WL sub-system
+ * @erase_ns: total time spent in those erasures, in nanoseconds
+ * @erase_max_ns: longest erasure time, in nanoseconds
+ * @dbgfs_dir: debugfs directory of this UBI device
+ *
+ * @fm_eba_sem: taken in read mode while the EBA tables are changed, and in
+ *              write mode while the fastmap is written
+ * @fm_mutex: serializes writing and invalidating the fastmap
+ * @fm_pnum: physical eraseblocks of the fastmap which is on the flash, the
+ *           anchor first
+ * @fm_cnt: count of elements in @fm_pnum, zero if there is no valid fastmap
+ *          on the flash
+ * @fm_pool_size: count of physical eraseblocks in the fastmap pool
+ * @fm_hold: RB-tree of free physical eraseblocks which are not in the pool
+ *           and must not be used while the fastmap is valid
+ * @fm_deferred: erase works deferred while the fastmap is valid
+ * @fm_deferred_cnt: count of works in @fm_deferred
+ * @fm_needed: non-zero if the background thread has to write a new fastmap
  *
  * @flash_size: underlying MTD device size (in bytes)
  * @peb_count: count of physical eraseblocks on the MTD device
@@ -417,6 +465,28 @@ struct ubi_device {
 	struct task_struct *bgt_thread;
 	int thread_enabled;
 	char bgt_name[sizeof(UBI_BGT_NAME_PATTERN)+2];
+	int free_count;
+	int free_min;
+	unsigned long free_stalls;
+	int erase_in_flight;
+	int erase_max_in_flight;
+	unsigned long erase_count;
+	u64 erase_ns;
+	u64 erase_max_ns;
+	struct dentry *dbgfs_dir;
+
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	/* Fastmap stuff */
+	struct rw_semaphore fm_eba_sem;
+	struct mutex fm_mutex;
+	int fm_pnum[UBI_FM_MAX_PEBS];
+	int fm_cnt;
+	int fm_pool_size;
+	struct rb_root fm_hold;
+	struct list_head fm_deferred;
+	int fm_deferred_cnt;
+	int fm_needed;
+#endif
 
 	/* I/O sub-system's stuff */
 	long long flash_size;
@@ -454,6 +524,7 @@ extern struct file_operations ubi_cdev_operations;
 extern struct file_operations ubi_vol_cdev_operations;
 extern struct class *ubi_class;
 extern struct mutex ubi_devices_mutex;
+extern struct dentry *ubi_debugfs_root;
 
 /* vtbl.c */
 int ubi_change_vtbl_record(struct ubi_device *ubi, int idx,
@@ -497,6 +568,15 @@ void ubi_gluebi_updated(struct ubi_volume *vol);
 #define ubi_gluebi_updated(vol)
 #endif
 
+/* fastmap.c */
+#ifdef CONFIG_MTD_UBI_FASTMAP
+struct ubi_scan_info *ubi_scan_fastmap(struct ubi_device *ubi);
+int ubi_update_fastmap(struct ubi_device *ubi);
+#else
+#define ubi_scan_fastmap(ubi) NULL
+#define ubi_update_fastmap(ubi) 0
+#endif
+
 /* eba.c */
 int ubi_eba_unmap_leb(struct ubi_device *ubi, struct ubi_volume *vol,
 		      int lnum);
@@ -521,6 +601,19 @@ int ubi_wl_scrub_peb(struct ubi_device *ubi, int pnum);
 int ubi_wl_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si);
 void ubi_wl_close(struct ubi_device *ubi);
 int ubi_thread(void *u);
+int ubi_wl_debugfs_init(struct ubi_device *ubi);
+void ubi_wl_debugfs_exit(struct ubi_device *ubi);
+#ifdef CONFIG_MTD_UBI_FASTMAP
+int ubi_wl_get_fm_peb(struct ubi_device *ubi, int max_pnum);
+void ubi_wl_put_fm_peb(struct ubi_device *ubi, int pnum, int written);
+int ubi_wl_fm_pool(struct ubi_device *ubi, int *pool, int max);
+void ubi_wl_fm_commit(struct ubi_device *ubi, const int *fm_pnum, int fm_cnt,
+		      const int *pool, int pool_size);
+int ubi_wl_invalidate_fm(struct ubi_device *ubi);
+int ubi_wl_peb_state(struct ubi_device *ubi, int pnum, int *ec);
+#else
+#define ubi_wl_invalidate_fm(ubi) 0
+#endif
 
 /* io.c */
 int ubi_io_read(const struct ubi_device *ubi, void *buf, int pnum, int offset,
@@ -560,6 +653,29 @@ int ubi_major2num(int major);
 	     rb;                                                             \
 	     rb = rb_next(rb), pos = container_of(rb, typeof(*pos), member))
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+/**
+ * ubi_fm_eba_lock - lock the EBA tables against the fastmap writer.
+ * @ubi: UBI device description object
+ */
+static inline void ubi_fm_eba_lock(struct ubi_device *ubi)
+{
+	down_read(&ubi->fm_eba_sem);
+}
+
+/**
+ * ubi_fm_eba_unlock - unlock the EBA tables.
+ * @ubi: UBI device description object
+ */
+static inline void ubi_fm_eba_unlock(struct ubi_device *ubi)
+{
+	up_read(&ubi->fm_eba_sem);
+}
+#else
+static inline void ubi_fm_eba_lock(struct ubi_device *ubi) {}
+static inline void ubi_fm_eba_unlock(struct ubi_device *ubi) {}
+#endif
+
 /**
  * ubi_zalloc_vid_hdr - allocate a volume identifier header object.
  * @ubi: UBI device description object
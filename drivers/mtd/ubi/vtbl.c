@@ -78,8 +78,10 @@ static struct ubi_vtbl_record empty_vtbl_record;
  *
  * This function changes volume table record @idx. If @vtbl_rec is %NULL, empty
  * volume table record is written. The caller does not have to calculate CRC of
- * the record as it is done by this function. Returns zero in case of success
- * and a negative error code in case of failure.
+ * the record as it is done by this function. The fastmap is invalidated,
+ * because volume table changes go together with changes it cannot describe
+ * (e.g., volume removal). Returns zero in case of success and a negative error
+ * code in case of failure.
  */
 int ubi_change_vtbl_record(struct ubi_device *ubi, int idx,
 			   struct ubi_vtbl_record *vtbl_rec)
@@ -91,6 +93,10 @@ int ubi_change_vtbl_record(struct ubi_device *ubi, int idx,
 	ubi_assert(idx >= 0 && idx < ubi->vtbl_slots);
 	layout_vol = ubi->volumes[vol_id2idx(ubi, UBI_LAYOUT_VOLUME_ID)];
 
+	err = ubi_wl_invalidate_fm(ubi);
+	if (err)
+		return err;
+
 	if (!vtbl_rec)
 		vtbl_rec = &empty_vtbl_record;
 	else {
@@ -130,6 +136,10 @@ int ubi_vtbl_rename_volumes(struct ubi_device *ubi,
 	struct ubi_rename_entry *re;
 	struct ubi_volume *layout_vol;
 
+	err = ubi_wl_invalidate_fm(ubi);
+	if (err)
+		return err;
+
 	list_for_each_entry(re, rename_list, list) {
 		uint32_t crc;
 		struct ubi_volume *vol = re->desc->vol;
@@ -89,6 +89,12 @@
  * Depending on the sub-state, wear-leveling entries of the used physical
  * eraseblocks may be kept in one of those structures.
  *
+ * If fastmap support is enabled, there is a further restriction while the
+ * fastmap on the flash is valid: only the free physical eraseblocks from the
+ * fastmap pool may be used, the rest of them is held back in the @wl->fm_hold
+ * tree, and erasures are deferred to the @wl->fm_deferred list. Both are
+ * released when the fastmap is invalidated (see 'ubi_wl_invalidate_fm()').
+ *
  * Note, in this implementation, we keep a small in-RAM object for each physical
  * eraseblock. This is surely not a scalable solution. But it appears to be good
  * enough for moderately large flashes and it is simple. In future, one may
@@ -107,6 +113,10 @@
 #include <linux/crc32.h>
 #include <linux/freezer.h>
 #include <linux/kthread.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
 #include "ubi.h"
 
 /* Number of physical eraseblocks reserved for wear-leveling purposes */
@@ -206,6 +216,51 @@ static void wl_tree_add(struct ubi_wl_entry *e, struct rb_root *root)
 	rb_insert_color(&e->u.rb, root);
 }
 
+/**
+ * free_tree_add - add a physical eraseblock to the free tree.
+ * @ubi: UBI device description object
+ * @e: the wear-leveling entry to add
+ *
+ * Note, @ubi->wl_lock has to be locked.
+ */
+static void free_tree_add(struct ubi_device *ubi, struct ubi_wl_entry *e)
+{
+	wl_tree_add(e, &ubi->free);
+	ubi->free_count += 1;
+}
+
+/**
+ * free_tree_del - remove a physical eraseblock from the free tree.
+ * @ubi: UBI device description object
+ * @e: the wear-leveling entry to remove
+ *
+ * Note, @ubi->wl_lock has to be locked.
+ */
+static void free_tree_del(struct ubi_device *ubi, struct ubi_wl_entry *e)
+{
+	rb_erase(&e->u.rb, &ubi->free);
+	ubi->free_count -= 1;
+	if (ubi->free_count < ubi->free_min)
+		ubi->free_min = ubi->free_count;
+}
+
+#ifdef CONFIG_MTD_UBI_FASTMAP
+/**
+ * fm_request - ask the background thread to write a new fastmap.
+ * @ubi: UBI device description object
+ *
+ * Note, @ubi->wl_lock has to be locked.
+ */
+static void fm_request(struct ubi_device *ubi)
+{
+	if (ubi->fm_needed)
+		return;
+	ubi->fm_needed = 1;
+	if (ubi->thread_enabled)
+		wake_up_process(ubi->bgt_thread);
+}
+#endif
+
 /**
  * do_work - do one pending work.
  * @ubi: UBI device description object
@@ -393,12 +448,23 @@ int ubi_wl_get_peb(struct ubi_device *ubi, int dtype)
 retry:
 	spin_lock(&ubi->wl_lock);
 	if (!ubi->free.rb_node) {
+#ifdef CONFIG_MTD_UBI_FASTMAP
+		if (ubi->fm_cnt) {
+			/* The pool is exhausted, drop the fastmap */
+			spin_unlock(&ubi->wl_lock);
+			err = ubi_wl_invalidate_fm(ubi);
+			if (err)
+				return err;
+			goto retry;
+		}
+#endif
 		if (ubi->works_count == 0) {
 			ubi_assert(list_empty(&ubi->works));
 			ubi_err("no free eraseblocks");
 			spin_unlock(&ubi->wl_lock);
 			return -ENOSPC;
 		}
+		ubi->free_stalls += 1;
 		spin_unlock(&ubi->wl_lock);
 
 		err = produce_free_peb(ubi);
@@ -453,9 +519,14 @@ retry:
 	 * Move the physical eraseblock to the protection queue where it will
 	 * be protected from being moved for some time.
 	 */
-	rb_erase(&e->u.rb, &ubi->free);
+	free_tree_del(ubi, e);
 	dbg_wl("PEB %d EC %d", e->pnum, e->ec);
 	prot_queue_add(ubi, e);
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	/* Write the next fastmap before the pool runs out */
+	if (ubi->fm_cnt && ubi->free_count < ubi->fm_pool_size / 4)
+		fm_request(ubi);
+#endif
 	spin_unlock(&ubi->wl_lock);
 	return e->pnum;
 }
@@ -499,6 +570,8 @@ static int sync_erase(struct ubi_device *ubi, struct ubi_wl_entry *e,
 	int err;
 	struct ubi_ec_hdr *ec_hdr;
 	unsigned long long ec = e->ec;
+	ktime_t start;
+	u64 ns;
 
 	dbg_wl("erase PEB %d, old EC %llu", e->pnum, ec);
 
@@ -510,7 +583,25 @@ static int sync_erase(struct ubi_device *ubi, struct ubi_wl_entry *e,
 	if (!ec_hdr)
 		return -ENOMEM;
 
+	spin_lock(&ubi->wl_lock);
+	ubi->erase_in_flight += 1;
+	if (ubi->erase_in_flight > ubi->erase_max_in_flight)
+		ubi->erase_max_in_flight = ubi->erase_in_flight;
+	spin_unlock(&ubi->wl_lock);
+
+	start = ktime_get();
 	err = ubi_io_sync_erase(ubi, e->pnum, torture);
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	spin_lock(&ubi->wl_lock);
+	ubi->erase_in_flight -= 1;
+	if (err >= 0) {
+		ubi->erase_count += 1;
+		ubi->erase_ns += ns;
+		if (ns > ubi->erase_max_ns)
+			ubi->erase_max_ns = ns;
+	}
+	spin_unlock(&ubi->wl_lock);
 	if (err < 0)
 		goto out_free;
 
@@ -590,21 +681,34 @@ repeat:
 }
 
 /**
- * schedule_ubi_work - schedule a work.
+ * __schedule_ubi_work - schedule a work.
  * @ubi: UBI device description object
  * @wrk: the work to schedule
  *
  * This function adds a work defined by @wrk to the tail of the pending works
- * list.
+ * list. Note, @ubi->wl_lock has to be locked.
  */
-static void schedule_ubi_work(struct ubi_device *ubi, struct ubi_work *wrk)
+static void __schedule_ubi_work(struct ubi_device *ubi, struct ubi_work *wrk)
 {
-	spin_lock(&ubi->wl_lock);
 	list_add_tail(&wrk->list, &ubi->works);
 	ubi_assert(ubi->works_count >= 0);
 	ubi->works_count += 1;
 	if (ubi->thread_enabled)
 		wake_up_process(ubi->bgt_thread);
+}
+
+/**
+ * schedule_ubi_work - schedule a work.
+ * @ubi: UBI device description object
+ * @wrk: the work to schedule
+ *
+ * This function adds a work defined by @wrk to the tail of the pending works
+ * list.
+ */
+static void schedule_ubi_work(struct ubi_device *ubi, struct ubi_work *wrk)
+{
+	spin_lock(&ubi->wl_lock);
+	__schedule_ubi_work(ubi, wrk);
 	spin_unlock(&ubi->wl_lock);
 }
 
@@ -617,6 +721,7 @@ static int erase_worker(struct ubi_device *ubi, struct ubi_work *wl_wrk,
  * @e: the WL entry of the physical eraseblock to erase
  * @torture: if the physical eraseblock has to be tortured
  *
+ * While the fastmap is valid, the erasure is deferred until it is invalidated.
  * This function returns zero in case of success and a %-ENOMEM in case of
  * failure.
  */
@@ -636,10 +741,248 @@ static int schedule_erase(struct ubi_device *ubi, struct ubi_wl_entry *e,
 	wl_wrk->e = e;
 	wl_wrk->torture = torture;
 
-	schedule_ubi_work(ubi, wl_wrk);
+	spin_lock(&ubi->wl_lock);
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	if (ubi->fm_cnt) {
+		/* The fastmap may still say this PEB is used */
+		dbg_wl("defer erasure of PEB %d", e->pnum);
+		list_add_tail(&wl_wrk->list, &ubi->fm_deferred);
+		ubi->fm_deferred_cnt += 1;
+		/*
+		 * Unmaps do not use up the pool, so they alone would never
+		 * get a new fastmap written and the PEBs back. Do not let
+		 * more erasures pile up than there are PEBs in the pool.
+		 */
+		if (ubi->fm_deferred_cnt >= ubi->fm_pool_size)
+			fm_request(ubi);
+		spin_unlock(&ubi->wl_lock);
+		return 0;
+	}
+#endif
+	__schedule_ubi_work(ubi, wl_wrk);
+	spin_unlock(&ubi->wl_lock);
 	return 0;
 }
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+/**
+ * ubi_wl_get_fm_peb - get a physical eraseblock for the fastmap.
+ * @ubi: UBI device description object
+ * @max_pnum: only physical eraseblocks below this number may be picked
+ *
+ * This function picks the free physical eraseblock with the lowest erase
+ * counter among those which are below @max_pnum and removes it from the free
+ * tree. The physical eraseblock is not in any WL sub-system structure until
+ * it is passed to 'ubi_wl_fm_commit()' or 'ubi_wl_put_fm_peb()'. Unlike
+ * 'ubi_wl_get_peb()' this function does not try to produce free physical
+ * eraseblocks. Returns the physical eraseblock number in case of success and
+ * %-ENOSPC if there is no suitable free physical eraseblock.
+ */
+int ubi_wl_get_fm_peb(struct ubi_device *ubi, int max_pnum)
+{
+	struct rb_node *p;
+	struct ubi_wl_entry *e;
+
+	spin_lock(&ubi->wl_lock);
+	ubi_assert(!ubi->fm_cnt);
+	for (p = rb_first(&ubi->free); p; p = rb_next(p)) {
+		e = rb_entry(p, struct ubi_wl_entry, u.rb);
+		if (e->pnum < max_pnum)
+			break;
+	}
+
+	if (!p) {
+		spin_unlock(&ubi->wl_lock);
+		return -ENOSPC;
+	}
+
+	free_tree_del(ubi, e);
+	dbg_wl("PEB %d EC %d", e->pnum, e->ec);
+	spin_unlock(&ubi->wl_lock);
+	return e->pnum;
+}
+
+/**
+ * ubi_wl_put_fm_peb - return a physical eraseblock the fastmap did not use.
+ * @ubi: UBI device description object
+ * @pnum: physical eraseblock returned by 'ubi_wl_get_fm_peb()'
+ * @written: non-zero if something has been written to @pnum
+ */
+void ubi_wl_put_fm_peb(struct ubi_device *ubi, int pnum, int written)
+{
+	struct ubi_wl_entry *e = ubi->lookuptbl[pnum];
+
+	dbg_wl("PEB %d, written %d", pnum, written);
+	if (written) {
+		if (schedule_erase(ubi, e, 0))
+			ubi_ro_mode(ubi);
+		return;
+	}
+
+	spin_lock(&ubi->wl_lock);
+	free_tree_add(ubi, e);
+	spin_unlock(&ubi->wl_lock);
+}
+
+/**
+ * ubi_wl_fm_pool - pick the fastmap pool.
+ * @ubi: UBI device description object
+ * @pool: the physical eraseblocks of the pool are returned here
+ * @max: maximum pool size
+ *
+ * This function picks up to @max free physical eraseblocks with the lowest
+ * erase counters. They stay in the free tree. Returns the pool size.
+ */
+int ubi_wl_fm_pool(struct ubi_device *ubi, int *pool, int max)
+{
+	int cnt = 0;
+	struct rb_node *p;
+	struct ubi_wl_entry *e;
+
+	spin_lock(&ubi->wl_lock);
+	for (p = rb_first(&ubi->free); p && cnt < max; p = rb_next(p)) {
+		e = rb_entry(p, struct ubi_wl_entry, u.rb);
+		pool[cnt++] = e->pnum;
+	}
+	spin_unlock(&ubi->wl_lock);
+	return cnt;
+}
+
+/**
+ * ubi_wl_fm_commit - start using a freshly written fastmap.
+ * @ubi: UBI device description object
+ * @fm_pnum: physical eraseblocks of the fastmap, anchor first
+ * @fm_cnt: count of elements in @fm_pnum
+ * @pool: physical eraseblocks of the fastmap pool
+ * @pool_size: count of elements in @pool
+ *
+ * From now on and until 'ubi_wl_invalidate_fm()' only the pool physical
+ * eraseblocks are given out, the other free physical eraseblocks are held
+ * back and erasures are deferred. Note, @ubi->fm_mutex has to be locked.
+ */
+void ubi_wl_fm_commit(struct ubi_device *ubi, const int *fm_pnum, int fm_cnt,
+		      const int *pool, int pool_size)
+{
+	int i;
+	struct ubi_wl_entry *e;
+
+	spin_lock(&ubi->wl_lock);
+	ubi_assert(!ubi->fm_cnt && !ubi->fm_hold.rb_node);
+	ubi->fm_hold = ubi->free;
+	ubi->free = RB_ROOT;
+	ubi->free_count = 0;
+	for (i = 0; i < pool_size; i++) {
+		e = ubi->lookuptbl[pool[i]];
+		paranoid_check_in_wl_tree(e, &ubi->fm_hold);
+		rb_erase(&e->u.rb, &ubi->fm_hold);
+		free_tree_add(ubi, e);
+	}
+	if (ubi->free_count < ubi->free_min)
+		ubi->free_min = ubi->free_count;
+
+	memcpy(ubi->fm_pnum, fm_pnum, fm_cnt * sizeof(int));
+	ubi->fm_cnt = fm_cnt;
+	ubi->fm_pool_size = pool_size;
+	spin_unlock(&ubi->wl_lock);
+}
+
+/**
+ * ubi_wl_invalidate_fm - invalidate the fastmap on the flash.
+ * @ubi: UBI device description object
+ *
+ * This function erases the fastmap anchor, so that the fastmap is not used on
+ * the next attach, and lifts the restrictions the fastmap imposes: the held
+ * back physical eraseblocks become free, the deferred erasures are started and
+ * the other fastmap physical eraseblocks are scheduled for erasure. Then it
+ * asks the background thread to write a new fastmap. Returns zero in case of
+ * success and a negative error code in case of failure.
+ */
+int ubi_wl_invalidate_fm(struct ubi_device *ubi)
+{
+	int i, cnt, err = 0;
+	struct rb_node *rb;
+	struct ubi_wl_entry *e;
+
+	mutex_lock(&ubi->fm_mutex);
+	cnt = ubi->fm_cnt;
+	if (!cnt)
+		goto out_request;
+
+	dbg_wl("invalidate fastmap at PEB %d", ubi->fm_pnum[0]);
+	e = ubi->lookuptbl[ubi->fm_pnum[0]];
+	err = sync_erase(ubi, e, 0);
+	if (err) {
+		ubi_err("cannot erase fastmap anchor PEB %d", e->pnum);
+		ubi_ro_mode(ubi);
+		goto out_unlock;
+	}
+
+	spin_lock(&ubi->wl_lock);
+	free_tree_add(ubi, e);
+	while ((rb = rb_first(&ubi->fm_hold))) {
+		e = rb_entry(rb, struct ubi_wl_entry, u.rb);
+		rb_erase(rb, &ubi->fm_hold);
+		free_tree_add(ubi, e);
+	}
+	list_splice_tail_init(&ubi->fm_deferred, &ubi->works);
+	ubi->works_count += ubi->fm_deferred_cnt;
+	ubi->fm_deferred_cnt = 0;
+	ubi->fm_cnt = 0;
+	spin_unlock(&ubi->wl_lock);
+
+	for (i = 1; i < cnt; i++) {
+		err = schedule_erase(ubi, ubi->lookuptbl[ubi->fm_pnum[i]], 0);
+		if (err) {
+			ubi_ro_mode(ubi);
+			goto out_unlock;
+		}
+	}
+
+out_request:
+	spin_lock(&ubi->wl_lock);
+	ubi->fm_needed = 1;
+	if (ubi->thread_enabled)
+		wake_up_process(ubi->bgt_thread);
+	spin_unlock(&ubi->wl_lock);
+out_unlock:
+	mutex_unlock(&ubi->fm_mutex);
+	return err;
+}
+
+/**
+ * ubi_wl_peb_state - find out what the WL sub-system does with a PEB.
+ * @ubi: UBI device description object
+ * @pnum: the physical eraseblock to look at
+ * @ec: the erase counter is returned here
+ *
+ * This function returns %UBI_WL_PEB_NONE if the WL sub-system does not know
+ * about @pnum (it is bad or alien), %UBI_WL_PEB_FREE if it is free or held
+ * back, %UBI_WL_PEB_SCRUB if it has to be scrubbed and %UBI_WL_PEB_OTHER
+ * otherwise (it is used, protected or pending erasure).
+ */
+int ubi_wl_peb_state(struct ubi_device *ubi, int pnum, int *ec)
+{
+	int state;
+	struct ubi_wl_entry *e;
+
+	spin_lock(&ubi->wl_lock);
+	e = ubi->lookuptbl[pnum];
+	if (!e)
+		state = UBI_WL_PEB_NONE;
+	else {
+		*ec = e->ec;
+		if (in_wl_tree(e, &ubi->free) || in_wl_tree(e, &ubi->fm_hold))
+			state = UBI_WL_PEB_FREE;
+		else if (in_wl_tree(e, &ubi->scrub))
+			state = UBI_WL_PEB_SCRUB;
+		else
+			state = UBI_WL_PEB_OTHER;
+	}
+	spin_unlock(&ubi->wl_lock);
+	return state;
+}
+#endif
+
 /**
  * wear_leveling_worker - wear-leveling worker function.
  * @ubi: UBI device description object
@@ -716,7 +1059,7 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 	}
 
 	paranoid_check_in_wl_tree(e2, &ubi->free);
-	rb_erase(&e2->u.rb, &ubi->free);
+	free_tree_del(ubi, e2);
 	ubi->move_from = e1;
 	ubi->move_to = e2;
 	spin_unlock(&ubi->wl_lock);
@@ -982,7 +1325,17 @@ static int erase_worker(struct ubi_device *ubi, struct ubi_work *wl_wrk,
 		kfree(wl_wrk);
 
 		spin_lock(&ubi->wl_lock);
-		wl_tree_add(e, &ubi->free);
+#ifdef CONFIG_MTD_UBI_FASTMAP
+		/*
+		 * This erasure has been scheduled before the fastmap was
+		 * written, and the fastmap says the PEB has to be erased.
+		 * It is not in the pool, so hold it back.
+		 */
+		if (ubi->fm_cnt)
+			wl_tree_add(e, &ubi->fm_hold);
+		else
+#endif
+			free_tree_add(ubi, e);
 		spin_unlock(&ubi->wl_lock);
 
 		/*
@@ -1213,6 +1566,7 @@ retry:
  * ubi_wl_flush - flush all pending works.
  * @ubi: UBI device description object
  *
+ * The deferred erasures are flushed as well, so this invalidates the fastmap.
  * This function returns zero in case of success and a negative error code in
  * case of failure.
  */
@@ -1220,6 +1574,10 @@ int ubi_wl_flush(struct ubi_device *ubi)
 {
 	int err;
 
+	err = ubi_wl_invalidate_fm(ubi);
+	if (err)
+		return err;
+
 	/*
 	 * Erase while the pending works queue is not empty, but not more than
 	 * the number of currently pending works.
@@ -1306,6 +1664,17 @@ int ubi_thread(void *u)
 			continue;
 
 		spin_lock(&ubi->wl_lock);
+#ifdef CONFIG_MTD_UBI_FASTMAP
+		if (list_empty(&ubi->works) && ubi->fm_needed &&
+		    !ubi->ro_mode && ubi->thread_enabled) {
+			spin_unlock(&ubi->wl_lock);
+			err = ubi_update_fastmap(ubi);
+			if (err)
+				ubi_err("%s: cannot write fastmap, error %d",
+					ubi->bgt_name, err);
+			continue;
+		}
+#endif
 		if (list_empty(&ubi->works) || ubi->ro_mode ||
 			       !ubi->thread_enabled) {
 			set_current_state(TASK_INTERRUPTIBLE);
@@ -1379,6 +1748,12 @@ int ubi_wl_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si)
 	init_rwsem(&ubi->work_sem);
 	ubi->max_ec = si->max_ec;
 	INIT_LIST_HEAD(&ubi->works);
+#ifdef CONFIG_MTD_UBI_FASTMAP
+	ubi->fm_hold = RB_ROOT;
+	INIT_LIST_HEAD(&ubi->fm_deferred);
+	/* The fastmap is consumed on attach, write a new one */
+	ubi->fm_needed = 1;
+#endif
 
 	sprintf(ubi->bgt_name, UBI_BGT_NAME_PATTERN, ubi->ubi_num);
 
@@ -1417,9 +1792,10 @@ int ubi_wl_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si)
 		e->pnum = seb->pnum;
 		e->ec = seb->ec;
 		ubi_assert(e->ec >= 0);
-		wl_tree_add(e, &ubi->free);
+		free_tree_add(ubi, e);
 		ubi->lookuptbl[e->pnum] = e;
 	}
+	ubi->free_min = ubi->free_count;
 
 	list_for_each_entry(seb, &si->corr, u.list) {
 		cond_resched();
@@ -1501,6 +1877,31 @@ static void protection_queue_destroy(struct ubi_device *ubi)
 	}
 }
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+/**
+ * fm_destroy - free the fastmap related WL sub-system objects.
+ * @ubi: UBI device description object
+ */
+static void fm_destroy(struct ubi_device *ubi)
+{
+	int i;
+	struct ubi_work *wrk, *tmp;
+
+	list_for_each_entry_safe(wrk, tmp, &ubi->fm_deferred, list) {
+		list_del(&wrk->list);
+		wrk->func(ubi, wrk, 1);
+	}
+	ubi->fm_deferred_cnt = 0;
+	tree_destroy(&ubi->fm_hold);
+	for (i = 0; i < ubi->fm_cnt; i++)
+		kmem_cache_free(ubi_wl_entry_slab,
+				ubi->lookuptbl[ubi->fm_pnum[i]]);
+	ubi->fm_cnt = 0;
+}
+#else
+static inline void fm_destroy(struct ubi_device *ubi) {}
+#endif
+
 /**
  * ubi_wl_close - close the wear-leveling sub-system.
  * @ubi: UBI device description object
@@ -1509,6 +1910,7 @@ void ubi_wl_close(struct ubi_device *ubi)
 {
 	dbg_wl("close the WL sub-system");
 	cancel_pending(ubi);
+	fm_destroy(ubi);
 	protection_queue_destroy(ubi);
 	tree_destroy(&ubi->used);
 	tree_destroy(&ubi->free);
@@ -1516,6 +1918,98 @@ void ubi_wl_close(struct ubi_device *ubi)
 	kfree(ubi->lookuptbl);
 }
 
+#ifdef CONFIG_DEBUG_FS
+static int wl_stats_show(struct seq_file *m, void *v)
+{
+	struct ubi_device *ubi = m->private;
+	int free_count, free_min, in_flight, max_in_flight, works_count;
+	unsigned long stalls, erase_count;
+	u64 erase_ns, erase_max_ns;
+
+	spin_lock(&ubi->wl_lock);
+	free_count = ubi->free_count;
+	free_min = ubi->free_min;
+	stalls = ubi->free_stalls;
+	works_count = ubi->works_count;
+	in_flight = ubi->erase_in_flight;
+	max_in_flight = ubi->erase_max_in_flight;
+	erase_count = ubi->erase_count;
+	erase_ns = ubi->erase_ns;
+	erase_max_ns = ubi->erase_max_ns;
+	spin_unlock(&ubi->wl_lock);
+
+	if (erase_count)
+		erase_ns = div64_u64(erase_ns, erase_count);
+
+	seq_printf(m, "pending works:           %d\n", works_count);
+	seq_printf(m, "free PEBs:               %d\n", free_count);
+	seq_printf(m, "min. free PEBs:          %d\n", free_min);
+	seq_printf(m, "reserved PEBs:           %d\n", WL_RESERVED_PEBS);
+	seq_printf(m, "no free PEB stalls:      %lu\n", stalls);
+	seq_printf(m, "erasures:                %lu\n", erase_count);
+	seq_printf(m, "erasures in flight:      %d\n", in_flight);
+	seq_printf(m, "max. erasures in flight: %d\n", max_in_flight);
+	seq_printf(m, "avg. erase time:         %llu us\n",
+		   (unsigned long long)div_u64(erase_ns, NSEC_PER_USEC));
+	seq_printf(m, "max. erase time:         %llu us\n",
+		   (unsigned long long)div_u64(erase_max_ns, NSEC_PER_USEC));
+	return 0;
+}
+
+static int wl_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, wl_stats_show, inode->i_private);
+}
+
+static const struct file_operations wl_stats_fops = {
+	.open		= wl_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/**
+ * ubi_wl_debugfs_init - create debugfs files of the WL sub-system.
+ * @ubi: UBI device description object
+ *
+ * This function creates the "ubi/ubiX/wl" debugfs file which reports the
+ * free PEB reserve and erasure statistics. Failures are not fatal, so this
+ * function always returns zero.
+ */
+int ubi_wl_debugfs_init(struct ubi_device *ubi)
+{
+	if (!ubi_debugfs_root)
+		return 0;
+
+	ubi->dbgfs_dir = debugfs_create_dir(ubi->ubi_name, ubi_debugfs_root);
+	if (!ubi->dbgfs_dir)
+		return 0;
+
+	debugfs_create_file("wl", S_IRUGO, ubi->dbgfs_dir, ubi,
+			    &wl_stats_fops);
+	return 0;
+}
+
+/**
+ * ubi_wl_debugfs_exit - remove debugfs files of the WL sub-system.
+ * @ubi: UBI device description object
+ */
+void ubi_wl_debugfs_exit(struct ubi_device *ubi)
+{
+	if (ubi->dbgfs_dir)
+		debugfs_remove_recursive(ubi->dbgfs_dir);
+}
+#else
+int ubi_wl_debugfs_init(struct ubi_device *ubi)
+{
+	return 0;
+}
+
+void ubi_wl_debugfs_exit(struct ubi_device *ubi)
+{
+}
+#endif
+
 #ifdef CONFIG_MTD_UBI_DEBUG_PARANOID
 
 /**
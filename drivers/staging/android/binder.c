@@ -28,16 +28,52 @@
 #include <linux/poll.h>
 #include <linux/proc_fs.h>
 #include <linux/rbtree.h>
+#include <linux/rwsem.h>
 #include <linux/sched.h>
+#include <linux/spinlock.h>
 #include <linux/uaccess.h>
+#include <linux/uio.h>
 #include <linux/vmalloc.h>
+#include <trace/binder.h>
 #include "binder.h"
 
-static DEFINE_MUTEX(binder_lock);
+DEFINE_TRACE(binder_transaction_send);
+DEFINE_TRACE(binder_transaction_wakeup);
+DEFINE_TRACE(binder_transaction_reply);
+DEFINE_TRACE(binder_transaction_reply_delivered);
+
+/*
+ * Lock ordering:
+ *   binder_main_lock -> binder_proc.lock (by address, at most three)
+ *   -> binder_dead_nodes_lock -> binder_proc.alloc_lock -> mmap_sem
+ *
+ * binder_main_lock is held for read around every ioctl and poll, but
+ * not while a thread sleeps waiting for work. Each binder_proc's lock
+ * protects the state owned by that process: its threads, nodes, refs,
+ * todo lists and transaction stacks. It is taken for one command or one
+ * work item at a time, not for a whole ioctl.
+ *
+ * A ref is protected by the lock of the process holding it, a node by
+ * the lock of the process owning it. Once that process is gone the node
+ * is protected by binder_dead_nodes_lock instead. Translating an object
+ * locks the sender, the target and the owner of the node the object
+ * refers to; see binder_lock_owner(). The buffer allocator of each
+ * process has its own alloc_lock so that senders can reserve and fill
+ * buffers in a target without holding its proc lock.
+ *
+ * Operations that touch an unbounded set of processes (failing a reply
+ * back up a chain of dead threads, thread exit, process teardown, the
+ * proc files) take binder_main_lock for write instead. While it is held
+ * exclusively no other thread is inside the driver, so the other locks
+ * are skipped.
+ */
+static DECLARE_RWSEM(binder_main_lock);
+static struct task_struct *binder_main_lock_owner;
+static DEFINE_MUTEX(binder_dead_nodes_lock);
 static HLIST_HEAD(binder_procs);
 static struct binder_node *binder_context_mgr_node;
 static uid_t binder_context_mgr_uid = -1;
-static int binder_last_id;
+static atomic_t binder_last_id;
 static struct proc_dir_entry *binder_proc_dir_entry_root;
 static struct proc_dir_entry *binder_proc_dir_entry_proc;
 static struct hlist_head binder_dead_nodes;
@@ -96,6 +132,9 @@ static int binder_set_stop_on_user_error(
 }
 module_param_call(stop_on_user_error, binder_set_stop_on_user_error,
 	param_get_int, &binder_stop_on_user_error, S_IWUSR | S_IRUGO);
+static int binder_max_cached_pages = 16;
+module_param_named(max_cached_pages, binder_max_cached_pages, int,
+	S_IWUSR | S_IRUGO);
 
 #define binder_user_error(x...) \
 	do { \
@@ -105,7 +144,7 @@ module_param_call(stop_on_user_error, binder_set_stop_on_user_error,
 			binder_stop_on_user_error = 2; \
 	} while (0)
 
-enum {
+enum binder_stat_types {
 	BINDER_STAT_PROC,
 	BINDER_STAT_THREAD,
 	BINDER_STAT_NODE,
@@ -117,14 +156,39 @@ enum {
 };
 
 struct binder_stats {
-	int br[_IOC_NR(BR_FAILED_REPLY) + 1];
-	int bc[_IOC_NR(BC_DEAD_BINDER_DONE) + 1];
-	int obj_created[BINDER_STAT_COUNT];
-	int obj_deleted[BINDER_STAT_COUNT];
+	atomic_t br[_IOC_NR(BR_FAILED_REPLY) + 1];
+	atomic_t bc[_IOC_NR(BC_REPLY_SG) + 1];
+	atomic_t obj_created[BINDER_STAT_COUNT];
+	atomic_t obj_deleted[BINDER_STAT_COUNT];
 };
 
 static struct binder_stats binder_stats;
 
+static inline void binder_stats_deleted(enum binder_stat_types type)
+{
+	atomic_inc(&binder_stats.obj_deleted[type]);
+}
+
+static inline void binder_stats_created(enum binder_stat_types type)
+{
+	atomic_inc(&binder_stats.obj_created[type]);
+}
+
+/*
+ * Per-proc latency histograms. Bucket n counts samples of at least
+ * 2^(n-1) and less than 2^n microseconds, the last bucket everything
+ * above. Delivery is charged to the receiving proc, service time to the
+ * proc sending the reply and round trip to the proc receiving it.
+ */
+enum binder_latency_types {
+	BINDER_LATENCY_DELIVERY,
+	BINDER_LATENCY_SERVICE,
+	BINDER_LATENCY_ROUND_TRIP,
+	BINDER_LATENCY_COUNT
+};
+
+#define BINDER_LATENCY_BUCKETS 24
+
 struct binder_transaction_log_entry {
 	int debug_id;
 	int call_type;
@@ -144,11 +208,13 @@ struct binder_transaction_log {
 };
 struct binder_transaction_log binder_transaction_log;
 struct binder_transaction_log binder_transaction_log_failed;
+static DEFINE_SPINLOCK(binder_transaction_log_lock);
 
 static struct binder_transaction_log_entry *binder_transaction_log_add(
 	struct binder_transaction_log *log)
 {
 	struct binder_transaction_log_entry *e;
+	spin_lock(&binder_transaction_log_lock);
 	e = &log->entry[log->next];
 	memset(e, 0, sizeof(*e));
 	log->next++;
@@ -156,6 +222,7 @@ static struct binder_transaction_log_entry *binder_transaction_log_add(
 		log->next = 0;
 		log->full = 1;
 	}
+	spin_unlock(&binder_transaction_log_lock);
 	return e;
 }
 
@@ -240,8 +307,16 @@ enum {
 	BINDER_DEFERRED_RELEASE      = 0x04,
 };
 
+struct binder_lru_page {
+	struct list_head lru;
+	struct page *page_ptr;
+	struct binder_proc *proc;
+};
+
 struct binder_proc {
 	struct hlist_node proc_node;
+	struct mutex lock;
+	struct mutex alloc_lock;
 	struct rb_root threads;
 	struct rb_root nodes;
 	struct rb_root refs_by_desc;
@@ -260,7 +335,10 @@ struct binder_proc {
 	struct rb_root allocated_buffers;
 	size_t free_async_space;
 
-	struct page **pages;
+	struct binder_lru_page *pages;
+	int pages_cached;
+	unsigned int page_cache_hits;
+	unsigned int page_cache_misses;
 	size_t buffer_size;
 	uint32_t buffer_free;
 	struct list_head todo;
@@ -272,6 +350,7 @@ struct binder_proc {
 	int requested_threads_started;
 	int ready_threads;
 	long default_priority;
+	unsigned int latency[BINDER_LATENCY_COUNT][BINDER_LATENCY_BUCKETS];
 };
 
 enum {
@@ -315,10 +394,201 @@ struct binder_transaction {
 	long	priority;
 	long	saved_priority;
 	uid_t	sender_euid;
+	ktime_t	send_time;
+	ktime_t	wakeup_time;
+	ktime_t	call_time;	/* send_time of the call, for replies */
 };
 
 static void binder_defer_work(struct binder_proc *proc, int defer);
 
+static void binder_latency_add(struct binder_proc *proc,
+			       enum binder_latency_types type, s64 us)
+{
+	int bucket;
+
+	if (us <= 0)
+		bucket = 0;
+	else if (us >= 1 << (BINDER_LATENCY_BUCKETS - 2))
+		bucket = BINDER_LATENCY_BUCKETS - 1;
+	else
+		bucket = fls(us);
+	proc->latency[type][bucket]++;
+}
+
+static int binder_exclusive_held(void)
+{
+	return binder_main_lock_owner == current;
+}
+
+static void binder_lock_exclusive(void)
+{
+	down_write(&binder_main_lock);
+	binder_main_lock_owner = current;
+}
+
+static void binder_unlock_exclusive(void)
+{
+	binder_main_lock_owner = NULL;
+	up_write(&binder_main_lock);
+}
+
+/* Enter the driver from an ioctl or poll. */
+static void binder_lock_shared(void)
+{
+	down_read(&binder_main_lock);
+}
+
+static void binder_unlock_shared(void)
+{
+	up_read(&binder_main_lock);
+}
+
+/*
+ * Switch the calling thread from shared to exclusive access and back.
+ * @proc, if not NULL, is the process whose lock the caller holds.
+ * Anything looked up under the shared lock must be looked up again.
+ */
+static void binder_upgrade_lock(struct binder_proc *proc)
+{
+	if (proc)
+		mutex_unlock(&proc->lock);
+	binder_unlock_shared();
+	binder_lock_exclusive();
+}
+
+static void binder_downgrade_lock(struct binder_proc *proc)
+{
+	binder_main_lock_owner = NULL;
+	downgrade_write(&binder_main_lock);
+	if (proc)
+		mutex_lock(&proc->lock);
+}
+
+/*
+ * Lock up to three processes in address order. Any of @a, @b and @c may
+ * be NULL or the same as another.
+ */
+static void binder_lock_procs(struct binder_proc *a, struct binder_proc *b,
+			      struct binder_proc *c)
+{
+	struct binder_proc *procs[3];
+	int i, n = 0;
+
+	if (binder_exclusive_held())
+		return;
+	if (a)
+		procs[n++] = a;
+	if (b && b != a)
+		procs[n++] = b;
+	if (c && c != a && c != b)
+		procs[n++] = c;
+	if (n > 1 && procs[0] > procs[1])
+		swap(procs[0], procs[1]);
+	if (n > 2 && procs[1] > procs[2])
+		swap(procs[1], procs[2]);
+	if (n > 1 && procs[0] > procs[1])
+		swap(procs[0], procs[1]);
+	for (i = 0; i < n; i++)
+		mutex_lock_nested(&procs[i]->lock, i);
+}
+
+static void binder_unlock_procs(struct binder_proc *a, struct binder_proc *b,
+				struct binder_proc *c)
+{
+	if (binder_exclusive_held())
+		return;
+	if (c && c != a && c != b)
+		mutex_unlock(&c->lock);
+	if (b && b != a)
+		mutex_unlock(&b->lock);
+	if (a)
+		mutex_unlock(&a->lock);
+}
+
+/*
+ * Take the lock of @target in addition to that of @proc, which the
+ * caller holds. *@locked tracks which second lock is held, if any. If
+ * the lock cannot be taken without breaking the lock order both locks
+ * are dropped and re-taken in order and 1 is returned: the caller must
+ * then redo whatever it looked up with only @proc locked.
+ */
+static int binder_lock_target(struct binder_proc *proc,
+			      struct binder_proc *target,
+			      struct binder_proc **locked)
+{
+	if (*locked == target)
+		return 0;
+	if (*locked) {
+		mutex_unlock(&(*locked)->lock);
+		*locked = NULL;
+	}
+	if (target == NULL || target == proc || binder_exclusive_held())
+		return 0;
+	*locked = target;
+	if (mutex_trylock(&target->lock))
+		return 0;
+	mutex_unlock(&proc->lock);
+	binder_lock_procs(proc, target, NULL);
+	return 1;
+}
+
+/*
+ * Take the lock of @owner, the process owning a node that an object
+ * refers to, in addition to those of @proc and @target (which may be
+ * NULL), which the caller holds. *@locked tracks the owner lock held,
+ * if any, and is kept from one object to the next. Returns 1 if all the
+ * locks had to be dropped and re-taken in order: the caller must then
+ * look the node up again.
+ */
+static int binder_lock_owner(struct binder_proc *proc,
+			     struct binder_proc *target,
+			     struct binder_proc *owner,
+			     struct binder_proc **locked)
+{
+	if (*locked == owner)
+		return 0;
+	if (*locked) {
+		mutex_unlock(&(*locked)->lock);
+		*locked = NULL;
+	}
+	if (owner == NULL || owner == proc || owner == target ||
+	    binder_exclusive_held())
+		return 0;
+	*locked = owner;
+	if (mutex_trylock(&owner->lock))
+		return 0;
+	binder_unlock_procs(proc, target, NULL);
+	binder_lock_procs(proc, target, owner);
+	return 1;
+}
+
+static void binder_unlock_owner(struct binder_proc **locked)
+{
+	if (*locked) {
+		mutex_unlock(&(*locked)->lock);
+		*locked = NULL;
+	}
+}
+
+/*
+ * A node whose process is gone is protected by binder_dead_nodes_lock.
+ * node->proc only becomes NULL under exclusive access, so it can be
+ * tested under the shared lock. Returns whether the lock was taken.
+ */
+static int binder_lock_dead_node(struct binder_node *node)
+{
+	if (node == NULL || node->proc || binder_exclusive_held())
+		return 0;
+	mutex_lock(&binder_dead_nodes_lock);
+	return 1;
+}
+
+static void binder_unlock_dead_node(int locked)
+{
+	if (locked)
+		mutex_unlock(&binder_dead_nodes_lock);
+}
+
 /*
  * copied from get_unused_fd_flags
  */
@@ -542,7 +812,7 @@ static void binder_insert_allocated_buffer(
 	rb_insert_color(&new_buffer->rb_node, &proc->allocated_buffers);
 }
 
-static struct binder_buffer *binder_buffer_lookup(
+static struct binder_buffer *__binder_buffer_lookup(
 	struct binder_proc *proc, void __user *user_ptr)
 {
 	struct rb_node *n = proc->allocated_buffers.rb_node;
@@ -566,14 +836,50 @@ static struct binder_buffer *binder_buffer_lookup(
 	return NULL;
 }
 
+/*
+ * Pages backing freed buffers are not unmapped right away. Up to
+ * binder_max_cached_pages of them per process stay mapped, in the kernel and
+ * in the process, on binder_lru so the next buffer that covers them does not
+ * need mmap_sem, a page allocation and a remap. binder_shrink hands them back
+ * when the vm runs short of memory. The list is protected by binder_lru_lock,
+ * the page slots and proc->pages_cached by proc->alloc_lock.
+ */
+static LIST_HEAD(binder_lru);
+static DEFINE_SPINLOCK(binder_lru_lock);
+static int binder_lru_count;
+
+static int binder_lru_add_page(struct binder_proc *proc,
+			       struct binder_lru_page *page)
+{
+	if (proc->pages_cached >= binder_max_cached_pages)
+		return 0;
+	spin_lock(&binder_lru_lock);
+	list_add_tail(&page->lru, &binder_lru);
+	binder_lru_count++;
+	spin_unlock(&binder_lru_lock);
+	proc->pages_cached++;
+	return 1;
+}
+
+static void binder_lru_del_page(struct binder_proc *proc,
+				struct binder_lru_page *page)
+{
+	spin_lock(&binder_lru_lock);
+	list_del_init(&page->lru);
+	binder_lru_count--;
+	spin_unlock(&binder_lru_lock);
+	proc->pages_cached--;
+}
+
 static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	void *start, void *end, struct vm_area_struct *vma)
 {
 	void *page_addr;
 	unsigned long user_page_addr;
 	struct vm_struct tmp_area;
-	struct page **page;
+	struct binder_lru_page *page;
 	struct mm_struct *mm;
+	int need_mm = 0;
 
 	if (binder_debug_mask & BINDER_DEBUG_BUFFER_ALLOC)
 		printk(KERN_INFO "binder: %d: %s pages %p-%p\n",
@@ -582,6 +888,22 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	if (end <= start)
 		return 0;
 
+	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
+		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+		if (allocate) {
+			if (page->page_ptr) {
+				binder_lru_del_page(proc, page);
+				proc->page_cache_hits++;
+			} else {
+				proc->page_cache_misses++;
+				need_mm = 1;
+			}
+		} else if (page->page_ptr && !binder_lru_add_page(proc, page))
+			need_mm = 1;
+	}
+	if (!need_mm)
+		return 0;
+
 	if (vma)
 		mm = NULL;
 	else
@@ -598,7 +920,7 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	if (vma == NULL) {
 		printk(KERN_ERR "binder: %d: binder_alloc_buf failed to "
 		       "map pages in userspace, no vma\n", proc->pid);
-		goto err_no_vma;
+		goto free_range;
 	}
 
 	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
@@ -606,16 +928,17 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		struct page **page_array_ptr;
 		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
 
-		BUG_ON(*page);
-		*page = alloc_page(GFP_KERNEL | __GFP_ZERO);
-		if (*page == NULL) {
+		if (page->page_ptr)
+			continue;
+		page->page_ptr = alloc_page(GFP_KERNEL | __GFP_ZERO);
+		if (page->page_ptr == NULL) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
 			       "for page at %p\n", proc->pid, page_addr);
-			goto err_alloc_page_failed;
+			goto free_range;
 		}
 		tmp_area.addr = page_addr;
 		tmp_area.size = PAGE_SIZE + PAGE_SIZE /* guard page? */;
-		page_array_ptr = page;
+		page_array_ptr = &page->page_ptr;
 		ret = map_vm_area(&tmp_area, PAGE_KERNEL, &page_array_ptr);
 		if (ret) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
@@ -625,7 +948,7 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		}
 		user_page_addr =
 			(uintptr_t)page_addr + proc->user_buffer_offset;
-		ret = vm_insert_page(vma, user_page_addr, page[0]);
+		ret = vm_insert_page(vma, user_page_addr, page->page_ptr);
 		if (ret) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
 			       "to map page at %lx in userspace\n",
@@ -640,22 +963,29 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	}
 	return 0;
 
+err_vm_insert_page_failed:
+	unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+err_map_kernel_failed:
+	__free_page(page->page_ptr);
+	page->page_ptr = NULL;
 free_range:
+	/*
+	 * Release every mapped page in the range that is not on the lru. On
+	 * an allocation failure this also drops the cached pages that were
+	 * already taken off the lru above.
+	 */
 	for (page_addr = end - PAGE_SIZE; page_addr >= start;
 	     page_addr -= PAGE_SIZE) {
 		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+		if (page->page_ptr == NULL || !list_empty(&page->lru))
+			continue;
 		if (vma)
 			zap_page_range(vma, (uintptr_t)page_addr +
 				proc->user_buffer_offset, PAGE_SIZE, NULL);
-err_vm_insert_page_failed:
 		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
-err_map_kernel_failed:
-		__free_page(*page);
-		*page = NULL;
-err_alloc_page_failed:
-		;
+		__free_page(page->page_ptr);
+		page->page_ptr = NULL;
 	}
-err_no_vma:
 	if (mm) {
 		up_write(&mm->mmap_sem);
 		mmput(mm);
@@ -663,7 +993,87 @@ err_no_vma:
 	return -ENOMEM;
 }
 
-static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
+/*
+ * binder_shrink - called from mm/vmscan.c :: shrink_slab
+ *
+ * Unmaps and frees up to 'nr_to_scan' cached buffer pages, oldest first, and
+ * returns the number of pages still cached. Processes whose alloc_lock or
+ * mmap_sem is busy are skipped: the allocation that got us here may well be
+ * holding them.
+ */
+static int binder_shrink(int nr_to_scan, gfp_t gfp_mask)
+{
+	struct binder_lru_page *page;
+	struct binder_proc *proc;
+	struct mm_struct *mm;
+	void *page_addr;
+	int skipped = 0;
+
+	if (!nr_to_scan)
+		return binder_lru_count;
+
+	while (nr_to_scan-- > 0) {
+		spin_lock(&binder_lru_lock);
+		if (list_empty(&binder_lru) || skipped >= binder_lru_count) {
+			spin_unlock(&binder_lru_lock);
+			break;
+		}
+		page = list_first_entry(&binder_lru, struct binder_lru_page,
+					lru);
+		proc = page->proc;
+		if (!mutex_trylock(&proc->alloc_lock)) {
+			list_move_tail(&page->lru, &binder_lru);
+			spin_unlock(&binder_lru_lock);
+			skipped++;
+			continue;
+		}
+		spin_unlock(&binder_lru_lock);
+
+		mm = get_task_mm(proc->tsk);
+		if (mm && !down_write_trylock(&mm->mmap_sem)) {
+			spin_lock(&binder_lru_lock);
+			list_move_tail(&page->lru, &binder_lru);
+			spin_unlock(&binder_lru_lock);
+			mutex_unlock(&proc->alloc_lock);
+			mmput(mm);
+			skipped++;
+			continue;
+		}
+		binder_lru_del_page(proc, page);
+		page_addr = proc->buffer +
+			(page - proc->pages) * PAGE_SIZE;
+		if (mm && proc->vma)
+			zap_page_range(proc->vma, (uintptr_t)page_addr +
+				proc->user_buffer_offset, PAGE_SIZE, NULL);
+		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+		__free_page(page->page_ptr);
+		page->page_ptr = NULL;
+		if (mm)
+			up_write(&mm->mmap_sem);
+		mutex_unlock(&proc->alloc_lock);
+		if (mm)
+			mmput(mm);
+	}
+	return binder_lru_count;
+}
+
+static struct shrinker binder_shrinker = {
+	.shrink = binder_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
+static struct binder_buffer *binder_buffer_lookup(
+	struct binder_proc *proc, void __user *user_ptr)
+{
+	struct binder_buffer *buffer;
+
+	mutex_lock(&proc->alloc_lock);
+	buffer = __binder_buffer_lookup(proc, user_ptr);
+	mutex_unlock(&proc->alloc_lock);
+	return buffer;
+}
+
+static struct binder_buffer *__binder_alloc_buf(struct binder_proc *proc,
 	size_t data_size, size_t offsets_size, int is_async)
 {
 	struct rb_node *n = proc->free_buffers.rb_node;
@@ -756,6 +1166,7 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	buffer->data_size = data_size;
 	buffer->offsets_size = offsets_size;
 	buffer->async_transaction = is_async;
+	buffer->allow_user_free = 0;
 	if (is_async) {
 		proc->free_async_space -= size + sizeof(struct binder_buffer);
 		if (binder_debug_mask & BINDER_DEBUG_BUFFER_ALLOC_ASYNC)
@@ -767,6 +1178,17 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	return buffer;
 }
 
+static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
+	size_t data_size, size_t offsets_size, int is_async)
+{
+	struct binder_buffer *buffer;
+
+	mutex_lock(&proc->alloc_lock);
+	buffer = __binder_alloc_buf(proc, data_size, offsets_size, is_async);
+	mutex_unlock(&proc->alloc_lock);
+	return buffer;
+}
+
 static void *buffer_start_page(struct binder_buffer *buffer)
 {
 	return (void *)((uintptr_t)buffer & PAGE_MASK);
@@ -824,7 +1246,7 @@ static void binder_delete_free_buffer(
 	}
 }
 
-static void binder_free_buf(
+static void __binder_free_buf(
 	struct binder_proc *proc, struct binder_buffer *buffer)
 {
 	size_t size, buffer_size;
@@ -877,6 +1299,14 @@ static void binder_free_buf(
 	binder_insert_free_buffer(proc, buffer);
 }
 
+static void binder_free_buf(
+	struct binder_proc *proc, struct binder_buffer *buffer)
+{
+	mutex_lock(&proc->alloc_lock);
+	__binder_free_buf(proc, buffer);
+	mutex_unlock(&proc->alloc_lock);
+}
+
 static struct binder_node *
 binder_get_node(struct binder_proc *proc, void __user *ptr)
 {
@@ -918,10 +1348,10 @@ binder_new_node(struct binder_proc *proc, void __user *ptr, void __user *cookie)
 	node = kzalloc(sizeof(*node), GFP_KERNEL);
 	if (node == NULL)
 		return NULL;
-	binder_stats.obj_created[BINDER_STAT_NODE]++;
+	binder_stats_created(BINDER_STAT_NODE);
 	rb_link_node(&node->rb_node, parent, p);
 	rb_insert_color(&node->rb_node, &proc->nodes);
-	node->debug_id = ++binder_last_id;
+	node->debug_id = atomic_inc_return(&binder_last_id);
 	node->proc = proc;
 	node->ptr = ptr;
 	node->cookie = cookie;
@@ -1006,7 +1436,7 @@ binder_dec_node(struct binder_node *node, int strong, int internal)
 					printk(KERN_INFO "binder: dead node %d deleted\n", node->debug_id);
 			}
 			kfree(node);
-			binder_stats.obj_deleted[BINDER_STAT_NODE]++;
+			binder_stats_deleted(BINDER_STAT_NODE);
 		}
 	}
 
@@ -1055,8 +1485,8 @@ binder_get_ref_for_node(struct binder_proc *proc, struct binder_node *node)
 	new_ref = kzalloc(sizeof(*ref), GFP_KERNEL);
 	if (new_ref == NULL)
 		return NULL;
-	binder_stats.obj_created[BINDER_STAT_REF]++;
-	new_ref->debug_id = ++binder_last_id;
+	binder_stats_created(BINDER_STAT_REF);
+	new_ref->debug_id = atomic_inc_return(&binder_last_id);
 	new_ref->proc = proc;
 	new_ref->node = node;
 	rb_link_node(&new_ref->rb_node_node, parent, p);
@@ -1085,7 +1515,10 @@ binder_get_ref_for_node(struct binder_proc *proc, struct binder_node *node)
 	rb_link_node(&new_ref->rb_node_desc, parent, p);
 	rb_insert_color(&new_ref->rb_node_desc, &proc->refs_by_desc);
 	if (node) {
+		int dead = binder_lock_dead_node(node);
+
 		hlist_add_head(&new_ref->node_entry, &node->refs);
+		binder_unlock_dead_node(dead);
 		if (binder_debug_mask & BINDER_DEBUG_INTERNAL_REFS)
 			printk(KERN_INFO "binder: %d new ref %d desc %d for "
 				"node %d\n", proc->pid, new_ref->debug_id,
@@ -1119,38 +1552,37 @@ binder_delete_ref(struct binder_ref *ref)
 				ref->debug_id, ref->desc);
 		list_del(&ref->death->work.entry);
 		kfree(ref->death);
-		binder_stats.obj_deleted[BINDER_STAT_DEATH]++;
+		binder_stats_deleted(BINDER_STAT_DEATH);
 	}
 	kfree(ref);
-	binder_stats.obj_deleted[BINDER_STAT_REF]++;
+	binder_stats_deleted(BINDER_STAT_REF);
 }
 
 static int
 binder_inc_ref(
 	struct binder_ref *ref, int strong, struct list_head *target_list)
 {
-	int ret;
+	int ret = 0;
+	int dead = binder_lock_dead_node(ref->node);
+
 	if (strong) {
-		if (ref->strong == 0) {
+		if (ref->strong == 0)
 			ret = binder_inc_node(ref->node, 1, 1, target_list);
-			if (ret)
-				return ret;
-		}
-		ref->strong++;
+		if (ret == 0)
+			ref->strong++;
 	} else {
-		if (ref->weak == 0) {
+		if (ref->weak == 0)
 			ret = binder_inc_node(ref->node, 0, 1, target_list);
-			if (ret)
-				return ret;
-		}
-		ref->weak++;
+		if (ret == 0)
+			ref->weak++;
 	}
-	return 0;
+	binder_unlock_dead_node(dead);
+	return ret;
 }
 
 
 static int
-binder_dec_ref(struct binder_ref *ref, int strong)
+__binder_dec_ref(struct binder_ref *ref, int strong)
 {
 	if (strong) {
 		if (ref->strong == 0) {
@@ -1182,6 +1614,16 @@ binder_dec_ref(struct binder_ref *ref, int strong)
 	return 0;
 }
 
+static int
+binder_dec_ref(struct binder_ref *ref, int strong)
+{
+	int dead = binder_lock_dead_node(ref->node);
+	int ret = __binder_dec_ref(ref, strong);
+
+	binder_unlock_dead_node(dead);
+	return ret;
+}
+
 static void
 binder_pop_transaction(
 	struct binder_thread *target_thread, struct binder_transaction *t)
@@ -1197,7 +1639,7 @@ binder_pop_transaction(
 	if (t->buffer)
 		t->buffer->transaction = NULL;
 	kfree(t);
-	binder_stats.obj_deleted[BINDER_STAT_TRANSACTION]++;
+	binder_stats_deleted(BINDER_STAT_TRANSACTION);
 }
 
 static void
@@ -1255,11 +1697,51 @@ binder_send_failed_reply(struct binder_transaction *t, uint32_t error_code)
 
 static void
 binder_transaction_buffer_release(struct binder_proc *proc,
+			struct binder_proc *locked,
 			struct binder_buffer *buffer, size_t *failed_at);
 
+/*
+ * Failing a reply back up a chain of dead threads may touch any number
+ * of processes.
+ */
+static int
+binder_transaction_needs_exclusive(struct binder_thread *thread, int reply)
+{
+	struct binder_transaction *in_reply_to = thread->transaction_stack;
+
+	return reply && in_reply_to && in_reply_to->to_thread == thread &&
+		in_reply_to->from == NULL;
+}
+
+/*
+ * Gathers a TF_DATA_IOVEC payload into the target buffer. Each iovec is
+ * copied straight from where the sender keeps it, so the sender does not
+ * have to flatten large blobs into one parcel first.
+ */
+static int binder_copy_from_user_iovec(void *dst, size_t size,
+	const struct iovec __user *uiov, size_t count)
+{
+	struct iovec iov;
+	size_t i;
+
+	if (count > UIO_MAXIOV)
+		return -EINVAL;
+	for (i = 0; i < count; i++) {
+		if (copy_from_user(&iov, uiov + i, sizeof(iov)))
+			return -EFAULT;
+		if (iov.iov_len > size)
+			return -EINVAL;
+		if (copy_from_user(dst, iov.iov_base, iov.iov_len))
+			return -EFAULT;
+		dst += iov.iov_len;
+		size -= iov.iov_len;
+	}
+	return size ? -EINVAL : 0;
+}
+
 static void
 binder_transaction(struct binder_proc *proc, struct binder_thread *thread,
-	struct binder_transaction_data *tr, int reply)
+	struct binder_transaction_data *tr, int reply, size_t data_iov_count)
 {
 	struct binder_transaction *t;
 	struct binder_work *tcomplete;
@@ -1271,7 +1753,18 @@ binder_transaction(struct binder_proc *proc, struct binder_thread *thread,
 	wait_queue_head_t *target_wait;
 	struct binder_transaction *in_reply_to = NULL;
 	struct binder_transaction_log_entry *e;
+	struct binder_proc *locked_proc = NULL;
+	struct binder_proc *owner_proc = NULL;
 	uint32_t return_error;
+	int copy_failed = 0;
+
+	if (!binder_exclusive_held() &&
+	    binder_transaction_needs_exclusive(thread, reply)) {
+		binder_upgrade_lock(proc);
+		binder_transaction(proc, thread, tr, reply, data_iov_count);
+		binder_downgrade_lock(proc);
+		return;
+	}
 
 	e = binder_transaction_log_add(&binder_transaction_log);
 	e->call_type = reply ? 2 : !!(tr->flags & TF_ONE_WAY);
@@ -1281,6 +1774,9 @@ binder_transaction(struct binder_proc *proc, struct binder_thread *thread,
 	e->data_size = tr->data_size;
 	e->offsets_size = tr->offsets_size;
 
+retry:
+	target_thread = NULL;
+	target_node = NULL;
 	if (reply) {
 		in_reply_to = thread->transaction_stack;
 		if (in_reply_to == NULL) {
@@ -1304,25 +1800,12 @@ binder_transaction(struct binder_proc *proc, struct binder_thread *thread,
 			in_reply_to = NULL;
 			goto err_bad_call_stack;
 		}
-		thread->transaction_stack = in_reply_to->to_parent;
 		target_thread = in_reply_to->from;
 		if (target_thread == NULL) {
+			thread->transaction_stack = in_reply_to->to_parent;
 			return_error = BR_DEAD_REPLY;
 			goto err_dead_binder;
 		}
-		if (target_thread->transaction_stack != in_reply_to) {
-			binder_user_error("binder: %d:%d got reply transaction "
-				"with bad target transaction stack %d, "
-				"expected %d\n",
-				proc->pid, thread->pid,
-				target_thread->transaction_stack ?
-				target_thread->transaction_stack->debug_id : 0,
-				in_reply_to->debug_id);
-			return_error = BR_FAILED_REPLY;
-			in_reply_to = NULL;
-			target_thread = NULL;
-			goto err_dead_binder;
-		}
 		target_proc = target_thread->proc;
 	} else {
 		if (tr->target.handle) {
@@ -1370,6 +1853,10 @@ binder_transaction(struct binder_proc *proc, struct binder_thread *thread,
 			}
 		}
 	}
+	if (binder_lock_target(proc, target_proc, &locked_proc))
+		goto retry;
+	if (reply)
+		thread->transaction_stack = in_reply_to->to_parent;
 	if (target_thread) {
 		e->to_thread = target_thread->pid;
 		target_list = &target_thread->todo;
@@ -1386,16 +1873,16 @@ binder_transaction(struct binder_proc *proc, struct binder_thread *thread,
 		return_error = BR_FAILED_REPLY;
 		goto err_alloc_t_failed;
 	}
-	binder_stats.obj_created[BINDER_STAT_TRANSACTION]++;
+	binder_stats_created(BINDER_STAT_TRANSACTION);
 
 	tcomplete = kzalloc(sizeof(*tcomplete), GFP_KERNEL);
 	if (tcomplete == NULL) {
 		return_error = BR_FAILED_REPLY;
 		goto err_alloc_tcomplete_failed;
 	}
-	binder_stats.obj_created[BINDER_STAT_TRANSACTION_COMPLETE]++;
+	binder_stats_created(BINDER_STAT_TRANSACTION_COMPLETE);
 
-	t->debug_id = ++binder_last_id;
+	t->debug_id = atomic_inc_return(&binder_last_id);
 	e->debug_id = t->debug_id;
 
 	if (binder_debug_mask & BINDER_DEBUG_TRANSACTION) {
@@ -1423,32 +1910,54 @@ binder_transaction(struct binder_proc *proc, struct binder_thread *thread,
 	t->to_proc = target_proc;
 	t->to_thread = target_thread;
 	t->code = tr->code;
-	t->flags = tr->flags;
+	t->flags = tr->flags & ~TF_DATA_IOVEC;
 	t->priority = task_nice(current);
+	/* Keeps target_node alive while no proc lock is held below */
+	if (target_node)
+		binder_inc_node(target_node, 1, 0, NULL);
+
+	/*
+	 * Nothing can see the buffer until t is queued, so reserve it and
+	 * copy the payload in without holding either proc lock. This is
+	 * what lets many clients send to one server at the same time.
+	 */
+	binder_unlock_procs(proc, locked_proc, NULL);
 	t->buffer = binder_alloc_buf(target_proc, tr->data_size,
 		tr->offsets_size, !reply && (t->flags & TF_ONE_WAY));
 	if (t->buffer == NULL) {
+		binder_lock_procs(proc, locked_proc, NULL);
+		if (target_node)
+			binder_dec_node(target_node, 1, 0);
 		return_error = BR_FAILED_REPLY;
 		goto err_binder_alloc_buf_failed;
 	}
-	t->buffer->allow_user_free = 0;
 	t->buffer->debug_id = t->debug_id;
 	t->buffer->transaction = t;
 	t->buffer->target_node = target_node;
-	if (target_node)
-		binder_inc_node(target_node, 1, 0, NULL);
 
 	offp = (size_t *)(t->buffer->data + ALIGN(tr->data_size, sizeof(void *)));
 
-	if (copy_from_user(t->buffer->data, tr->data.ptr.buffer, tr->data_size)) {
+	if (tr->flags & TF_DATA_IOVEC) {
+		if (binder_copy_from_user_iovec(t->buffer->data, tr->data_size,
+		    tr->data.ptr.buffer, data_iov_count)) {
+			binder_user_error("binder: %d:%d got transaction with "
+				"invalid data iovec, %zd entries\n",
+				proc->pid, thread->pid, data_iov_count);
+			copy_failed = 1;
+		}
+	} else if (copy_from_user(t->buffer->data, tr->data.ptr.buffer, tr->data_size)) {
 		binder_user_error("binder: %d:%d got transaction with invalid "
 			"data ptr\n", proc->pid, thread->pid);
-		return_error = BR_FAILED_REPLY;
-		goto err_copy_data_failed;
+		copy_failed = 1;
 	}
-	if (copy_from_user(offp, tr->data.ptr.offsets, tr->offsets_size)) {
+	if (!copy_failed &&
+	    copy_from_user(offp, tr->data.ptr.offsets, tr->offsets_size)) {
 		binder_user_error("binder: %d:%d got transaction with invalid "
 			"offsets ptr\n", proc->pid, thread->pid);
+		copy_failed = 1;
+	}
+	binder_lock_procs(proc, locked_proc, NULL);
+	if (copy_failed) {
 		return_error = BR_FAILED_REPLY;
 		goto err_copy_data_failed;
 	}
@@ -1512,6 +2021,10 @@ binder_transaction(struct binder_proc *proc, struct binder_thread *thread,
 		case BINDER_TYPE_HANDLE:
 		case BINDER_TYPE_WEAK_HANDLE: {
 			struct binder_ref *ref = binder_get_ref(proc, fp->handle);
+			/* the node may belong to a third process */
+			while (ref && binder_lock_owner(proc, target_proc,
+					ref->node->proc, &owner_proc))
+				ref = binder_get_ref(proc, fp->handle);
 			if (ref == NULL) {
 				binder_user_error("binder: %d:%d got "
 					"transaction with invalid "
@@ -1592,8 +2105,36 @@ binder_transaction(struct binder_proc *proc, struct binder_thread *thread,
 			goto err_bad_object_type;
 		}
 	}
+	binder_unlock_owner(&owner_proc);
+	/*
+	 * The locks may have been dropped above, and a sender that gave
+	 * up waiting may have started another transaction meanwhile.
+	 */
+	if (reply && target_thread->transaction_stack != in_reply_to) {
+		binder_user_error("binder: %d:%d got reply transaction "
+			"with bad target transaction stack %d, "
+			"expected %d\n",
+			proc->pid, thread->pid,
+			target_thread->transaction_stack ?
+			target_thread->transaction_stack->debug_id : 0,
+			in_reply_to->debug_id);
+		return_error = BR_FAILED_REPLY;
+		in_reply_to = NULL;
+		target_thread = NULL;
+		goto err_bad_target_stack;
+	}
+	t->send_time = ktime_get();
 	if (reply) {
+		s64 service_us;
+
 		BUG_ON(t->buffer->async_transaction != 0);
+		t->call_time = in_reply_to->send_time;
+		service_us = ktime_us_delta(t->send_time,
+					    in_reply_to->wakeup_time);
+		binder_latency_add(proc, BINDER_LATENCY_SERVICE, service_us);
+		trace_binder_transaction_reply(t->debug_id,
+			in_reply_to->debug_id, proc->pid, target_proc->pid,
+			service_us);
 		binder_pop_transaction(target_thread, in_reply_to);
 	} else if (!(t->flags & TF_ONE_WAY)) {
 		BUG_ON(t->buffer->async_transaction != 0);
@@ -1609,12 +2150,17 @@ binder_transaction(struct binder_proc *proc, struct binder_thread *thread,
 		} else
 			target_node->has_async_transaction = 1;
 	}
+	if (!reply)
+		trace_binder_transaction_send(t->debug_id, proc->pid,
+			thread->pid, target_proc->pid, t->code, t->flags);
 	t->work.type = BINDER_WORK_TRANSACTION;
 	list_add_tail(&t->work.entry, target_list);
 	tcomplete->type = BINDER_WORK_TRANSACTION_COMPLETE;
 	list_add_tail(&tcomplete->entry, &thread->todo);
 	if (target_wait)
 		wake_up_interruptible(target_wait);
+	if (locked_proc)
+		mutex_unlock(&locked_proc->lock);
 	return;
 
 err_get_unused_fd_failed:
@@ -1626,15 +2172,17 @@ err_binder_new_node_failed:
 err_bad_object_type:
 err_bad_offset:
 err_copy_data_failed:
-	binder_transaction_buffer_release(target_proc, t->buffer, offp);
+	binder_unlock_owner(&owner_proc);
+err_bad_target_stack:
+	binder_transaction_buffer_release(target_proc, proc, t->buffer, offp);
 	t->buffer->transaction = NULL;
 	binder_free_buf(target_proc, t->buffer);
 err_binder_alloc_buf_failed:
 	kfree(tcomplete);
-	binder_stats.obj_deleted[BINDER_STAT_TRANSACTION_COMPLETE]++;
+	binder_stats_deleted(BINDER_STAT_TRANSACTION_COMPLETE);
 err_alloc_tcomplete_failed:
 	kfree(t);
-	binder_stats.obj_deleted[BINDER_STAT_TRANSACTION]++;
+	binder_stats_deleted(BINDER_STAT_TRANSACTION);
 err_alloc_t_failed:
 err_bad_call_stack:
 err_empty_call_stack:
@@ -1659,13 +2207,22 @@ err_no_context_mgr_node:
 		binder_send_failed_reply(in_reply_to, return_error);
 	} else
 		thread->return_error = return_error;
+	if (locked_proc)
+		mutex_unlock(&locked_proc->lock);
 }
 
+/*
+ * Drops the references held by the objects in @buffer, which belongs to
+ * @proc. The caller holds the lock of @proc and of @locked, if not NULL.
+ */
 static void
-binder_transaction_buffer_release(struct binder_proc *proc, struct binder_buffer *buffer, size_t *failed_at)
+binder_transaction_buffer_release(struct binder_proc *proc,
+			struct binder_proc *locked,
+			struct binder_buffer *buffer, size_t *failed_at)
 {
 	size_t *offp, *off_end;
 	int debug_id = buffer->debug_id;
+	struct binder_proc *owner_proc = NULL;
 
 	if (binder_debug_mask & BINDER_DEBUG_TRANSACTION)
 		printk(KERN_INFO "binder: %d buffer release %d, size %zd-%zd, failed at %p\n",
@@ -1706,6 +2263,9 @@ binder_transaction_buffer_release(struct binder_proc *proc, struct binder_buffer
 		case BINDER_TYPE_HANDLE:
 		case BINDER_TYPE_WEAK_HANDLE: {
 			struct binder_ref *ref = binder_get_ref(proc, fp->handle);
+			while (ref && binder_lock_owner(proc, locked,
+					ref->node->proc, &owner_proc))
+				ref = binder_get_ref(proc, fp->handle);
 			if (ref == NULL) {
 				printk(KERN_ERR "binder: transaction release %d bad handle %ld\n", debug_id, fp->handle);
 				break;
@@ -1728,6 +2288,122 @@ binder_transaction_buffer_release(struct binder_proc *proc, struct binder_buffer
 			break;
 		}
 	}
+	binder_unlock_owner(&owner_proc);
+}
+
+static void
+binder_update_ref_for_handle(struct binder_proc *proc,
+	struct binder_thread *thread, uint32_t cmd, uint32_t target)
+{
+	struct binder_ref *ref;
+	struct binder_node *node;
+	struct binder_proc *locked_proc = NULL;
+	const char *debug_string;
+
+retry:
+	if (target == 0 && binder_context_mgr_node &&
+	    (cmd == BC_INCREFS || cmd == BC_ACQUIRE)) {
+		ref = NULL;
+		node = binder_context_mgr_node;
+	} else {
+		ref = binder_get_ref(proc, target);
+		if (ref == NULL) {
+			binder_user_error("binder: %d:%d refcou"
+				"nt change on invalid ref %d\n",
+				proc->pid, thread->pid, target);
+			goto out;
+		}
+		node = ref->node;
+	}
+	if (binder_lock_target(proc, node->proc, &locked_proc))
+		goto retry;
+	if (ref == NULL) {
+		ref = binder_get_ref_for_node(proc, node);
+		if (ref == NULL) {
+			binder_user_error("binder: %d:%d refcou"
+				"nt change on invalid ref %d\n",
+				proc->pid, thread->pid, target);
+			goto out;
+		}
+		if (ref->desc != target) {
+			binder_user_error("binder: %d:"
+				"%d tried to acquire "
+				"reference to desc 0, "
+				"got %d instead\n",
+				proc->pid, thread->pid,
+				ref->desc);
+		}
+	}
+	switch (cmd) {
+	case BC_INCREFS:
+		debug_string = "IncRefs";
+		binder_inc_ref(ref, 0, NULL);
+		break;
+	case BC_ACQUIRE:
+		debug_string = "Acquire";
+		binder_inc_ref(ref, 1, NULL);
+		break;
+	case BC_RELEASE:
+		debug_string = "Release";
+		binder_dec_ref(ref, 1);
+		break;
+	case BC_DECREFS:
+	default:
+		debug_string = "DecRefs";
+		binder_dec_ref(ref, 0);
+		break;
+	}
+	if (binder_debug_mask & BINDER_DEBUG_USER_REFS)
+		printk(KERN_INFO "binder: %d:%d %s ref %d desc %d s %d w %d for node %d\n",
+		       proc->pid, thread->pid, debug_string, ref->debug_id, ref->desc, ref->strong, ref->weak, ref->node->debug_id);
+out:
+	if (locked_proc)
+		mutex_unlock(&locked_proc->lock);
+}
+
+static void
+binder_free_user_buffer(struct binder_proc *proc,
+	struct binder_thread *thread, void __user *data_ptr)
+{
+	struct binder_buffer *buffer;
+
+	buffer = binder_buffer_lookup(proc, data_ptr);
+	if (buffer == NULL) {
+		binder_user_error("binder: %d:%d "
+			"BC_FREE_BUFFER u%p no match\n",
+			proc->pid, thread->pid, data_ptr);
+		return;
+	}
+	if (!buffer->allow_user_free) {
+		binder_user_error("binder: %d:%d "
+			"BC_FREE_BUFFER u%p matched "
+			"unreturned buffer\n",
+			proc->pid, thread->pid, data_ptr);
+		return;
+	}
+	/*
+	 * Releasing the objects below may drop the proc lock for a while;
+	 * make sure no other thread frees the buffer meanwhile.
+	 */
+	buffer->allow_user_free = 0;
+	if (binder_debug_mask & BINDER_DEBUG_FREE_BUFFER)
+		printk(KERN_INFO "binder: %d:%d BC_FREE_BUFFER u%p found buffer %d for %s transaction\n",
+		       proc->pid, thread->pid, data_ptr, buffer->debug_id,
+		       buffer->transaction ? "active" : "finished");
+
+	if (buffer->transaction) {
+		buffer->transaction->buffer = NULL;
+		buffer->transaction = NULL;
+	}
+	if (buffer->async_transaction && buffer->target_node) {
+		BUG_ON(!buffer->target_node->has_async_transaction);
+		if (list_empty(&buffer->target_node->async_todo))
+			buffer->target_node->has_async_transaction = 0;
+		else
+			list_move_tail(buffer->target_node->async_todo.next, &thread->todo);
+	}
+	binder_transaction_buffer_release(proc, NULL, buffer, NULL);
+	binder_free_buf(proc, buffer);
 }
 
 int
@@ -1743,64 +2419,23 @@ binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			return -EFAULT;
 		ptr += sizeof(uint32_t);
 		if (_IOC_NR(cmd) < ARRAY_SIZE(binder_stats.bc)) {
-			binder_stats.bc[_IOC_NR(cmd)]++;
-			proc->stats.bc[_IOC_NR(cmd)]++;
-			thread->stats.bc[_IOC_NR(cmd)]++;
+			atomic_inc(&binder_stats.bc[_IOC_NR(cmd)]);
+			atomic_inc(&proc->stats.bc[_IOC_NR(cmd)]);
+			atomic_inc(&thread->stats.bc[_IOC_NR(cmd)]);
 		}
+		/* per command, so other threads of proc are not held off */
+		mutex_lock(&proc->lock);
 		switch (cmd) {
 		case BC_INCREFS:
 		case BC_ACQUIRE:
 		case BC_RELEASE:
 		case BC_DECREFS: {
 			uint32_t target;
-			struct binder_ref *ref;
-			const char *debug_string;
 
 			if (get_user(target, (uint32_t __user *)ptr))
-				return -EFAULT;
+				goto err_fault;
 			ptr += sizeof(uint32_t);
-			if (target == 0 && binder_context_mgr_node &&
-			    (cmd == BC_INCREFS || cmd == BC_ACQUIRE)) {
-				ref = binder_get_ref_for_node(proc,
-					       binder_context_mgr_node);
-				if (ref->desc != target) {
-					binder_user_error("binder: %d:"
-						"%d tried to acquire "
-						"reference to desc 0, "
-						"got %d instead\n",
-						proc->pid, thread->pid,
-						ref->desc);
-				}
-			} else
-				ref = binder_get_ref(proc, target);
-			if (ref == NULL) {
-				binder_user_error("binder: %d:%d refcou"
-					"nt change on invalid ref %d\n",
-					proc->pid, thread->pid, target);
-				break;
-			}
-			switch (cmd) {
-			case BC_INCREFS:
-				debug_string = "IncRefs";
-				binder_inc_ref(ref, 0, NULL);
-				break;
-			case BC_ACQUIRE:
-				debug_string = "Acquire";
-				binder_inc_ref(ref, 1, NULL);
-				break;
-			case BC_RELEASE:
-				debug_string = "Release";
-				binder_dec_ref(ref, 1);
-				break;
-			case BC_DECREFS:
-			default:
-				debug_string = "DecRefs";
-				binder_dec_ref(ref, 0);
-				break;
-			}
-			if (binder_debug_mask & BINDER_DEBUG_USER_REFS)
-				printk(KERN_INFO "binder: %d:%d %s ref %d desc %d s %d w %d for node %d\n",
-				       proc->pid, thread->pid, debug_string, ref->debug_id, ref->desc, ref->strong, ref->weak, ref->node->debug_id);
+			binder_update_ref_for_handle(proc, thread, cmd, target);
 			break;
 		}
 		case BC_INCREFS_DONE:
@@ -1810,10 +2445,10 @@ binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			struct binder_node *node;
 
 			if (get_user(node_ptr, (void * __user *)ptr))
-				return -EFAULT;
+				goto err_fault;
 			ptr += sizeof(void *);
 			if (get_user(cookie, (void * __user *)ptr))
-				return -EFAULT;
+				goto err_fault;
 			ptr += sizeof(void *);
 			node = binder_get_node(proc, node_ptr);
 			if (node == NULL) {
@@ -1865,51 +2500,18 @@ binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 		}
 		case BC_ATTEMPT_ACQUIRE:
 			printk(KERN_ERR "binder: BC_ATTEMPT_ACQUIRE not supported\n");
-			return -EINVAL;
+			goto err_inval;
 		case BC_ACQUIRE_RESULT:
 			printk(KERN_ERR "binder: BC_ACQUIRE_RESULT not supported\n");
-			return -EINVAL;
+			goto err_inval;
 
 		case BC_FREE_BUFFER: {
 			void __user *data_ptr;
-			struct binder_buffer *buffer;
 
 			if (get_user(data_ptr, (void * __user *)ptr))
-				return -EFAULT;
+				goto err_fault;
 			ptr += sizeof(void *);
-
-			buffer = binder_buffer_lookup(proc, data_ptr);
-			if (buffer == NULL) {
-				binder_user_error("binder: %d:%d "
-					"BC_FREE_BUFFER u%p no match\n",
-					proc->pid, thread->pid, data_ptr);
-				break;
-			}
-			if (!buffer->allow_user_free) {
-				binder_user_error("binder: %d:%d "
-					"BC_FREE_BUFFER u%p matched "
-					"unreturned buffer\n",
-					proc->pid, thread->pid, data_ptr);
-				break;
-			}
-			if (binder_debug_mask & BINDER_DEBUG_FREE_BUFFER)
-				printk(KERN_INFO "binder: %d:%d BC_FREE_BUFFER u%p found buffer %d for %s transaction\n",
-				       proc->pid, thread->pid, data_ptr, buffer->debug_id,
-				       buffer->transaction ? "active" : "finished");
-
-			if (buffer->transaction) {
-				buffer->transaction->buffer = NULL;
-				buffer->transaction = NULL;
-			}
-			if (buffer->async_transaction && buffer->target_node) {
-				BUG_ON(!buffer->target_node->has_async_transaction);
-				if (list_empty(&buffer->target_node->async_todo))
-					buffer->target_node->has_async_transaction = 0;
-				else
-					list_move_tail(buffer->target_node->async_todo.next, &thread->todo);
-			}
-			binder_transaction_buffer_release(proc, buffer, NULL);
-			binder_free_buf(proc, buffer);
+			binder_free_user_buffer(proc, thread, data_ptr);
 			break;
 		}
 
@@ -1918,9 +2520,21 @@ binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			struct binder_transaction_data tr;
 
 			if (copy_from_user(&tr, ptr, sizeof(tr)))
-				return -EFAULT;
+				goto err_fault;
 			ptr += sizeof(tr);
-			binder_transaction(proc, thread, &tr, cmd == BC_REPLY);
+			binder_transaction(proc, thread, &tr, cmd == BC_REPLY, 0);
+			break;
+		}
+
+		case BC_TRANSACTION_SG:
+		case BC_REPLY_SG: {
+			struct binder_transaction_data_sg tr;
+
+			if (copy_from_user(&tr, ptr, sizeof(tr)))
+				goto err_fault;
+			ptr += sizeof(tr);
+			binder_transaction(proc, thread, &tr.transaction_data,
+					   cmd == BC_REPLY_SG, tr.data_iov_count);
 			break;
 		}
 
@@ -1974,10 +2588,10 @@ binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			struct binder_ref_death *death;
 
 			if (get_user(target, (uint32_t __user *)ptr))
-				return -EFAULT;
+				goto err_fault;
 			ptr += sizeof(uint32_t);
 			if (get_user(cookie, (void __user * __user *)ptr))
-				return -EFAULT;
+				goto err_fault;
 			ptr += sizeof(void *);
 			ref = binder_get_ref(proc, target);
 			if (ref == NULL) {
@@ -2018,7 +2632,7 @@ binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 							proc->pid, thread->pid);
 					break;
 				}
-				binder_stats.obj_created[BINDER_STAT_DEATH]++;
+				binder_stats_created(BINDER_STAT_DEATH);
 				INIT_LIST_HEAD(&death->work.entry);
 				death->cookie = cookie;
 				ref->death = death;
@@ -2071,7 +2685,7 @@ binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			void __user *cookie;
 			struct binder_ref_death *death = NULL;
 			if (get_user(cookie, (void __user * __user *)ptr))
-				return -EFAULT;
+				goto err_fault;
 
 			ptr += sizeof(void *);
 			list_for_each_entry(w, &proc->delivered_death, entry) {
@@ -2105,20 +2719,28 @@ binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 
 		default:
 			printk(KERN_ERR "binder: %d:%d unknown command %d\n", proc->pid, thread->pid, cmd);
-			return -EINVAL;
+			goto err_inval;
 		}
+		mutex_unlock(&proc->lock);
 		*consumed = ptr - buffer;
 	}
 	return 0;
+
+err_fault:
+	mutex_unlock(&proc->lock);
+	return -EFAULT;
+err_inval:
+	mutex_unlock(&proc->lock);
+	return -EINVAL;
 }
 
 void
 binder_stat_br(struct binder_proc *proc, struct binder_thread *thread, uint32_t cmd)
 {
 	if (_IOC_NR(cmd) < ARRAY_SIZE(binder_stats.br)) {
-		binder_stats.br[_IOC_NR(cmd)]++;
-		proc->stats.br[_IOC_NR(cmd)]++;
-		thread->stats.br[_IOC_NR(cmd)]++;
+		atomic_inc(&binder_stats.br[_IOC_NR(cmd)]);
+		atomic_inc(&proc->stats.br[_IOC_NR(cmd)]);
+		atomic_inc(&thread->stats.br[_IOC_NR(cmd)]);
 	}
 }
 
@@ -2135,8 +2757,12 @@ binder_has_thread_work(struct binder_thread *thread)
 		(thread->looper & BINDER_LOOPER_STATE_NEED_RETURN);
 }
 
+/*
+ * Called with proc->lock held. Drops it, and binder_main_lock, while
+ * waiting for work.
+ */
 static int
-binder_thread_read(struct binder_proc *proc, struct binder_thread *thread,
+__binder_thread_read(struct binder_proc *proc, struct binder_thread *thread,
 	void  __user *buffer, int size, signed long *consumed, int non_block)
 {
 	void __user *ptr = buffer + *consumed;
@@ -2174,7 +2800,8 @@ retry:
 	thread->looper |= BINDER_LOOPER_STATE_WAITING;
 	if (wait_for_proc_work)
 		proc->ready_threads++;
-	mutex_unlock(&binder_lock);
+	mutex_unlock(&proc->lock);
+	binder_unlock_shared();
 	if (wait_for_proc_work) {
 		if (!(thread->looper & (BINDER_LOOPER_STATE_REGISTERED |
 					BINDER_LOOPER_STATE_ENTERED))) {
@@ -2197,7 +2824,8 @@ retry:
 		} else
 			ret = wait_event_interruptible(thread->wait, binder_has_thread_work(thread));
 	}
-	mutex_lock(&binder_lock);
+	binder_lock_shared();
+	mutex_lock(&proc->lock);
 	if (wait_for_proc_work)
 		proc->ready_threads--;
 	thread->looper &= ~BINDER_LOOPER_STATE_WAITING;
@@ -2210,6 +2838,8 @@ retry:
 		struct binder_transaction_data tr;
 		struct binder_work *w;
 		struct binder_transaction *t = NULL;
+		ktime_t now;
+		s64 delivery_us;
 
 		if (!list_empty(&thread->todo))
 			w = list_first_entry(&thread->todo, struct binder_work, entry);
@@ -2241,7 +2871,7 @@ retry:
 
 			list_del(&w->entry);
 			kfree(w);
-			binder_stats.obj_deleted[BINDER_STAT_TRANSACTION_COMPLETE]++;
+			binder_stats_deleted(BINDER_STAT_TRANSACTION_COMPLETE);
 		} break;
 		case BINDER_WORK_NODE: {
 			struct binder_node *node = container_of(w, struct binder_node, work);
@@ -2293,7 +2923,7 @@ retry:
 						       proc->pid, thread->pid, node->debug_id, node->ptr, node->cookie);
 					rb_erase(&node->rb_node, &proc->nodes);
 					kfree(node);
-					binder_stats.obj_deleted[BINDER_STAT_NODE]++;
+					binder_stats_deleted(BINDER_STAT_NODE);
 				} else {
 					if (binder_debug_mask & BINDER_DEBUG_INTERNAL_REFS)
 						printk(KERN_INFO "binder: %d:%d node %d u%p c%p state unchanged\n",
@@ -2327,7 +2957,7 @@ retry:
 			if (w->type == BINDER_WORK_CLEAR_DEATH_NOTIFICATION) {
 				list_del(&w->entry);
 				kfree(death);
-				binder_stats.obj_deleted[BINDER_STAT_DEATH]++;
+				binder_stats_deleted(BINDER_STAT_DEATH);
 			} else
 				list_move(&w->entry, &proc->delivered_death);
 			if (cmd == BR_DEAD_BINDER)
@@ -2392,6 +3022,20 @@ retry:
 
 		list_del(&t->work.entry);
 		t->buffer->allow_user_free = 1;
+		now = ktime_get();
+		delivery_us = ktime_us_delta(now, t->send_time);
+		binder_latency_add(proc, BINDER_LATENCY_DELIVERY, delivery_us);
+		if (cmd == BR_TRANSACTION) {
+			t->wakeup_time = now;
+			trace_binder_transaction_wakeup(t->debug_id, proc->pid,
+				thread->pid, delivery_us);
+		} else {
+			s64 round_trip_us = ktime_us_delta(now, t->call_time);
+			binder_latency_add(proc, BINDER_LATENCY_ROUND_TRIP,
+					   round_trip_us);
+			trace_binder_transaction_reply_delivered(t->debug_id,
+				proc->pid, thread->pid, round_trip_us);
+		}
 		if (cmd == BR_TRANSACTION && !(t->flags & TF_ONE_WAY)) {
 			t->to_parent = thread->transaction_stack;
 			t->to_thread = thread;
@@ -2399,7 +3043,7 @@ retry:
 		} else {
 			t->buffer->transaction = NULL;
 			kfree(t);
-			binder_stats.obj_deleted[BINDER_STAT_TRANSACTION]++;
+			binder_stats_deleted(BINDER_STAT_TRANSACTION);
 		}
 		break;
 	}
@@ -2422,6 +3066,19 @@ done:
 	return 0;
 }
 
+static int
+binder_thread_read(struct binder_proc *proc, struct binder_thread *thread,
+	void  __user *buffer, int size, signed long *consumed, int non_block)
+{
+	int ret;
+
+	mutex_lock(&proc->lock);
+	ret = __binder_thread_read(proc, thread, buffer, size, consumed,
+				   non_block);
+	mutex_unlock(&proc->lock);
+	return ret;
+}
+
 static void binder_release_work(struct list_head *list)
 {
 	struct binder_work *w;
@@ -2436,7 +3093,7 @@ static void binder_release_work(struct list_head *list)
 		} break;
 		case BINDER_WORK_TRANSACTION_COMPLETE: {
 			kfree(w);
-			binder_stats.obj_deleted[BINDER_STAT_TRANSACTION_COMPLETE]++;
+			binder_stats_deleted(BINDER_STAT_TRANSACTION_COMPLETE);
 		} break;
 		default:
 			break;
@@ -2466,7 +3123,7 @@ static struct binder_thread *binder_get_thread(struct binder_proc *proc)
 		thread = kzalloc(sizeof(*thread), GFP_KERNEL);
 		if (thread == NULL)
 			return NULL;
-		binder_stats.obj_created[BINDER_STAT_THREAD]++;
+		binder_stats_created(BINDER_STAT_THREAD);
 		thread->proc = proc;
 		thread->pid = current->pid;
 		init_waitqueue_head(&thread->wait);
@@ -2513,7 +3170,7 @@ static int binder_free_thread(struct binder_proc *proc, struct binder_thread *th
 		binder_send_failed_reply(send_reply, BR_DEAD_REPLY);
 	binder_release_work(&thread->todo);
 	kfree(thread);
-	binder_stats.obj_deleted[BINDER_STAT_THREAD]++;
+	binder_stats_deleted(BINDER_STAT_THREAD);
 	return active_transactions;
 }
 
@@ -2523,12 +3180,14 @@ static unsigned int binder_poll(struct file *filp, struct poll_table_struct *wai
 	struct binder_thread *thread = NULL;
 	int wait_for_proc_work;
 
-	mutex_lock(&binder_lock);
+	binder_lock_shared();
+	mutex_lock(&proc->lock);
 	thread = binder_get_thread(proc);
 
 	wait_for_proc_work = thread->transaction_stack == NULL &&
 		list_empty(&thread->todo) && thread->return_error == BR_OK;
-	mutex_unlock(&binder_lock);
+	mutex_unlock(&proc->lock);
+	binder_unlock_shared();
 
 	if (wait_for_proc_work) {
 		if (binder_has_proc_work(proc, thread))
@@ -2546,6 +3205,32 @@ static unsigned int binder_poll(struct file *filp, struct poll_table_struct *wai
 	return 0;
 }
 
+static int binder_set_context_mgr(struct binder_proc *proc)
+{
+	if (binder_context_mgr_node != NULL) {
+		printk(KERN_ERR "binder: BINDER_SET_CONTEXT_MGR already set\n");
+		return -EBUSY;
+	}
+	if (binder_context_mgr_uid != -1) {
+		if (binder_context_mgr_uid != task_euid(current)) {
+			printk(KERN_ERR "binder: BINDER_SET_"
+			       "CONTEXT_MGR bad uid %d != %d\n",
+			       task_euid(current),
+			       binder_context_mgr_uid);
+			return -EPERM;
+		}
+	} else
+		binder_context_mgr_uid = task_euid(current);
+	binder_context_mgr_node = binder_new_node(proc, NULL, NULL);
+	if (binder_context_mgr_node == NULL)
+		return -ENOMEM;
+	binder_context_mgr_node->local_weak_refs++;
+	binder_context_mgr_node->local_strong_refs++;
+	binder_context_mgr_node->has_strong_ref = 1;
+	binder_context_mgr_node->has_weak_ref = 1;
+	return 0;
+}
+
 static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 {
 	int ret;
@@ -2560,8 +3245,10 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	if (ret)
 		return ret;
 
-	mutex_lock(&binder_lock);
+	binder_lock_shared();
+	mutex_lock(&proc->lock);
 	thread = binder_get_thread(proc);
+	mutex_unlock(&proc->lock);
 	if (thread == NULL) {
 		ret = -ENOMEM;
 		goto err;
@@ -2609,44 +3296,32 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		}
 		break;
 	}
-	case BINDER_SET_MAX_THREADS:
-		if (copy_from_user(&proc->max_threads, ubuf, sizeof(proc->max_threads))) {
+	case BINDER_SET_MAX_THREADS: {
+		int max_threads;
+
+		if (copy_from_user(&max_threads, ubuf, sizeof(max_threads))) {
 			ret = -EINVAL;
 			goto err;
 		}
+		mutex_lock(&proc->lock);
+		proc->max_threads = max_threads;
+		mutex_unlock(&proc->lock);
 		break;
+	}
 	case BINDER_SET_CONTEXT_MGR:
-		if (binder_context_mgr_node != NULL) {
-			printk(KERN_ERR "binder: BINDER_SET_CONTEXT_MGR already set\n");
-			ret = -EBUSY;
+		binder_upgrade_lock(NULL);
+		ret = binder_set_context_mgr(proc);
+		binder_downgrade_lock(NULL);
+		if (ret)
 			goto err;
-		}
-		if (binder_context_mgr_uid != -1) {
-			if (binder_context_mgr_uid != task_euid(current)) {
-				printk(KERN_ERR "binder: BINDER_SET_"
-				       "CONTEXT_MGR bad uid %d != %d\n",
-				       task_euid(current),
-				       binder_context_mgr_uid);
-				ret = -EPERM;
-				goto err;
-			}
-		} else
-			binder_context_mgr_uid = task_euid(current);
-		binder_context_mgr_node = binder_new_node(proc, NULL, NULL);
-		if (binder_context_mgr_node == NULL) {
-			ret = -ENOMEM;
-			goto err;
-		}
-		binder_context_mgr_node->local_weak_refs++;
-		binder_context_mgr_node->local_strong_refs++;
-		binder_context_mgr_node->has_strong_ref = 1;
-		binder_context_mgr_node->has_weak_ref = 1;
 		break;
 	case BINDER_THREAD_EXIT:
 		if (binder_debug_mask & BINDER_DEBUG_THREADS)
 			printk(KERN_INFO "binder: %d:%d exit\n",
 			       proc->pid, thread->pid);
+		binder_upgrade_lock(NULL);
 		binder_free_thread(proc, thread);
+		binder_downgrade_lock(NULL);
 		thread = NULL;
 		break;
 	case BINDER_VERSION:
@@ -2667,7 +3342,7 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 err:
 	if (thread)
 		thread->looper &= ~BINDER_LOOPER_STATE_NEED_RETURN;
-	mutex_unlock(&binder_lock);
+	binder_unlock_shared();
 	wait_event_interruptible(binder_user_error_wait, binder_stop_on_user_error < 2);
 	if (ret && ret != -ERESTARTSYS)
 		printk(KERN_INFO "binder: %d:%d ioctl %x %lx returned %d\n", proc->pid, current->pid, cmd, arg, ret);
@@ -2710,6 +3385,7 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 	struct vm_struct *area;
 	struct binder_proc *proc = filp->private_data;
 	const char *failure_string;
+	int i;
 	struct binder_buffer *buffer;
 
 	if ((vma->vm_end - vma->vm_start) > SZ_4M)
@@ -2759,6 +3435,10 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 		goto err_alloc_pages_failed;
 	}
 	proc->buffer_size = vma->vm_end - vma->vm_start;
+	for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++) {
+		INIT_LIST_HEAD(&proc->pages[i].lru);
+		proc->pages[i].proc = proc;
+	}
 
 	vma->vm_ops = &binder_vm_ops;
 	vma->vm_private_data = proc;
@@ -2809,13 +3489,15 @@ static int binder_open(struct inode *nodp, struct file *filp)
 	INIT_LIST_HEAD(&proc->todo);
 	init_waitqueue_head(&proc->wait);
 	proc->default_priority = task_nice(current);
-	mutex_lock(&binder_lock);
-	binder_stats.obj_created[BINDER_STAT_PROC]++;
+	mutex_init(&proc->lock);
+	mutex_init(&proc->alloc_lock);
+	binder_lock_exclusive();
+	binder_stats_created(BINDER_STAT_PROC);
 	hlist_add_head(&proc->proc_node, &binder_procs);
 	proc->pid = current->group_leader->pid;
 	INIT_LIST_HEAD(&proc->delivered_death);
 	filp->private_data = proc;
-	mutex_unlock(&binder_lock);
+	binder_unlock_exclusive();
 
 	if (binder_proc_dir_entry_proc) {
 		char strbuf[11];
@@ -2902,7 +3584,7 @@ static void binder_deferred_release(struct binder_proc *proc)
 		list_del_init(&node->work.entry);
 		if (hlist_empty(&node->refs)) {
 			kfree(node);
-			binder_stats.obj_deleted[BINDER_STAT_NODE]++;
+			binder_stats_deleted(BINDER_STAT_NODE);
 		} else {
 			struct binder_ref *ref;
 			int death = 0;
@@ -2950,19 +3632,24 @@ static void binder_deferred_release(struct binder_proc *proc)
 		buffers++;
 	}
 
-	binder_stats.obj_deleted[BINDER_STAT_PROC]++;
+	binder_stats_deleted(BINDER_STAT_PROC);
 
 	page_count = 0;
 	if (proc->pages) {
 		int i;
+		mutex_lock(&proc->alloc_lock);
 		for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++) {
-			if (proc->pages[i]) {
-				if (binder_debug_mask & BINDER_DEBUG_BUFFER_ALLOC)
-					printk(KERN_INFO "binder_release: %d: page %d at %p not freed\n", proc->pid, i, proc->buffer + i * PAGE_SIZE);
-				__free_page(proc->pages[i]);
-				page_count++;
-			}
+			struct binder_lru_page *page = &proc->pages[i];
+			if (!page->page_ptr)
+				continue;
+			if (!list_empty(&page->lru))
+				binder_lru_del_page(proc, page);
+			else if (binder_debug_mask & BINDER_DEBUG_BUFFER_ALLOC)
+				printk(KERN_INFO "binder_release: %d: page %d at %p not freed\n", proc->pid, i, proc->buffer + i * PAGE_SIZE);
+			__free_page(page->page_ptr);
+			page_count++;
 		}
+		mutex_unlock(&proc->alloc_lock);
 		kfree(proc->pages);
 		vfree(proc->buffer);
 	}
@@ -2983,7 +3670,7 @@ static void binder_deferred_func(struct work_struct *work)
 
 	int defer;
 	do {
-		mutex_lock(&binder_lock);
+		binder_lock_exclusive();
 		mutex_lock(&binder_deferred_lock);
 		if (!hlist_empty(&binder_deferred_list)) {
 			proc = hlist_entry(binder_deferred_list.first,
@@ -3008,7 +3695,7 @@ static void binder_deferred_func(struct work_struct *work)
 		if (defer & BINDER_DEFERRED_RELEASE)
 			binder_deferred_release(proc); /* frees proc */
 	
-		mutex_unlock(&binder_lock);
+		binder_unlock_exclusive();
 		if (files)
 			put_files_struct(files);
 	} while (proc);
@@ -3259,7 +3946,9 @@ static const char *binder_command_strings[] = {
 	"BC_EXIT_LOOPER",
 	"BC_REQUEST_DEATH_NOTIFICATION",
 	"BC_CLEAR_DEATH_NOTIFICATION",
-	"BC_DEAD_BINDER_DONE"
+	"BC_DEAD_BINDER_DONE",
+	"BC_TRANSACTION_SG",
+	"BC_REPLY_SG"
 };
 
 static const char *binder_objstat_strings[] = {
@@ -3278,18 +3967,20 @@ static char *print_binder_stats(char *buf, char *end, const char *prefix, struct
 
 	BUILD_BUG_ON(ARRAY_SIZE(stats->bc) != ARRAY_SIZE(binder_command_strings));
 	for (i = 0; i < ARRAY_SIZE(stats->bc); i++) {
-		if (stats->bc[i])
+		int temp = atomic_read(&stats->bc[i]);
+		if (temp)
 			buf += snprintf(buf, end - buf, "%s%s: %d\n", prefix,
-					binder_command_strings[i], stats->bc[i]);
+					binder_command_strings[i], temp);
 		if (buf >= end)
 			return buf;
 	}
 
 	BUILD_BUG_ON(ARRAY_SIZE(stats->br) != ARRAY_SIZE(binder_return_strings));
 	for (i = 0; i < ARRAY_SIZE(stats->br); i++) {
-		if (stats->br[i])
+		int temp = atomic_read(&stats->br[i]);
+		if (temp)
 			buf += snprintf(buf, end - buf, "%s%s: %d\n", prefix,
-					binder_return_strings[i], stats->br[i]);
+					binder_return_strings[i], temp);
 		if (buf >= end)
 			return buf;
 	}
@@ -3297,11 +3988,12 @@ static char *print_binder_stats(char *buf, char *end, const char *prefix, struct
 	BUILD_BUG_ON(ARRAY_SIZE(stats->obj_created) != ARRAY_SIZE(binder_objstat_strings));
 	BUILD_BUG_ON(ARRAY_SIZE(stats->obj_created) != ARRAY_SIZE(stats->obj_deleted));
 	for (i = 0; i < ARRAY_SIZE(stats->obj_created); i++) {
-		if (stats->obj_created[i] || stats->obj_deleted[i])
+		int created = atomic_read(&stats->obj_created[i]);
+		int deleted = atomic_read(&stats->obj_deleted[i]);
+		if (created || deleted)
 			buf += snprintf(buf, end - buf, "%s%s: active %d total %d\n", prefix,
 					binder_objstat_strings[i],
-					stats->obj_created[i] - stats->obj_deleted[i],
-					stats->obj_created[i]);
+					created - deleted, created);
 		if (buf >= end)
 			return buf;
 	}
@@ -3355,6 +4047,11 @@ static char *print_binder_proc_stats(char *buf, char *end, struct binder_proc *p
 	buf += snprintf(buf, end - buf, "  buffers: %d\n", count);
 	if (buf >= end)
 		return buf;
+	buf += snprintf(buf, end - buf, "  pages cached: %d hit %u miss %u\n",
+			proc->pages_cached, proc->page_cache_hits,
+			proc->page_cache_misses);
+	if (buf >= end)
+		return buf;
 
 	count = 0;
 	list_for_each_entry(w, &proc->todo, entry) {
@@ -3391,7 +4088,7 @@ static int binder_read_proc_state(
 		return 0;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		binder_lock_exclusive();
 
 	buf += snprintf(buf, end - buf, "binder state:\n");
 
@@ -3409,7 +4106,7 @@ static int binder_read_proc_state(
 		buf = print_binder_proc(buf, end, proc, 1);
 	}
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		binder_unlock_exclusive();
 	if (buf > page + PAGE_SIZE)
 		buf = page + PAGE_SIZE;
 
@@ -3437,7 +4134,7 @@ static int binder_read_proc_stats(
 		return 0;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		binder_lock_exclusive();
 
 	p += snprintf(p, PAGE_SIZE, "binder stats:\n");
 
@@ -3449,7 +4146,88 @@ static int binder_read_proc_stats(
 		p = print_binder_proc_stats(p, page + PAGE_SIZE, proc);
 	}
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		binder_unlock_exclusive();
+	if (p > page + PAGE_SIZE)
+		p = page + PAGE_SIZE;
+
+	*start = page + off;
+
+	len = p - page;
+	if (len > off)
+		len -= off;
+	else
+		len = 0;
+
+	return len < count ? len  : count;
+}
+
+static const char *binder_latency_strings[] = {
+	"delivery",
+	"service",
+	"round trip"
+};
+
+static char *print_binder_proc_latency(char *buf, char *end,
+				       struct binder_proc *proc)
+{
+	int i, j;
+	char *start_buf = buf;
+	int printed = 0;
+
+	BUILD_BUG_ON(ARRAY_SIZE(proc->latency) !=
+		     ARRAY_SIZE(binder_latency_strings));
+	buf += snprintf(buf, end - buf, "proc %d\n", proc->pid);
+	for (i = 0; i < ARRAY_SIZE(proc->latency); i++) {
+		if (buf >= end)
+			return buf;
+		buf += snprintf(buf, end - buf, "  %s:",
+				binder_latency_strings[i]);
+		for (j = 0; j < BINDER_LATENCY_BUCKETS; j++) {
+			if (!proc->latency[i][j])
+				continue;
+			if (buf >= end)
+				return buf;
+			if (j == BINDER_LATENCY_BUCKETS - 1)
+				buf += snprintf(buf, end - buf, " >=%uus %u",
+						1U << (j - 1),
+						proc->latency[i][j]);
+			else
+				buf += snprintf(buf, end - buf, " <%uus %u",
+						1U << j, proc->latency[i][j]);
+			printed = 1;
+		}
+		if (buf >= end)
+			return buf;
+		buf += snprintf(buf, end - buf, "\n");
+	}
+	if (!printed)
+		buf = start_buf;
+	return buf;
+}
+
+static int binder_read_proc_latency(
+	char *page, char **start, off_t off, int count, int *eof, void *data)
+{
+	struct binder_proc *proc;
+	struct hlist_node *pos;
+	int len = 0;
+	char *p = page;
+	int do_lock = !binder_debug_no_lock;
+
+	if (off)
+		return 0;
+
+	if (do_lock)
+		binder_lock_exclusive();
+
+	p += snprintf(p, PAGE_SIZE, "binder latency:\n");
+	hlist_for_each_entry(proc, pos, &binder_procs, proc_node) {
+		if (p >= page + PAGE_SIZE)
+			break;
+		p = print_binder_proc_latency(p, page + PAGE_SIZE, proc);
+	}
+	if (do_lock)
+		binder_unlock_exclusive();
 	if (p > page + PAGE_SIZE)
 		p = page + PAGE_SIZE;
 
@@ -3478,7 +4256,7 @@ static int binder_read_proc_transactions(
 		return 0;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		binder_lock_exclusive();
 
 	buf += snprintf(buf, end - buf, "binder transactions:\n");
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node) {
@@ -3487,7 +4265,7 @@ static int binder_read_proc_transactions(
 		buf = print_binder_proc(buf, end, proc, 0);
 	}
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		binder_unlock_exclusive();
 	if (buf > page + PAGE_SIZE)
 		buf = page + PAGE_SIZE;
 
@@ -3514,11 +4292,11 @@ static int binder_read_proc_proc(
 		return 0;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		binder_lock_exclusive();
 	p += snprintf(p, PAGE_SIZE, "binder proc state:\n");
 	p = print_binder_proc(p, page + PAGE_SIZE, proc, 1);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		binder_unlock_exclusive();
 
 	if (p > page + PAGE_SIZE)
 		p = page + PAGE_SIZE;
@@ -3603,9 +4381,12 @@ static int __init binder_init(void)
 	if (binder_proc_dir_entry_root)
 		binder_proc_dir_entry_proc = proc_mkdir("proc", binder_proc_dir_entry_root);
 	ret = misc_register(&binder_miscdev);
+	if (!ret)
+		register_shrinker(&binder_shrinker);
 	if (binder_proc_dir_entry_root) {
 		create_proc_read_entry("state", S_IRUGO, binder_proc_dir_entry_root, binder_read_proc_state, NULL);
 		create_proc_read_entry("stats", S_IRUGO, binder_proc_dir_entry_root, binder_read_proc_stats, NULL);
+		create_proc_read_entry("latency", S_IRUGO, binder_proc_dir_entry_root, binder_read_proc_latency, NULL);
 		create_proc_read_entry("transactions", S_IRUGO, binder_proc_dir_entry_root, binder_read_proc_transactions, NULL);
 		create_proc_read_entry("transaction_log", S_IRUGO, binder_proc_dir_entry_root, binder_read_proc_transaction_log, &binder_transaction_log);
 		create_proc_read_entry("failed_transaction_log", S_IRUGO, binder_proc_dir_entry_root, binder_read_proc_transaction_log, &binder_transaction_log_failed);
@@ -112,6 +112,7 @@ enum transaction_flags {
 	TF_ROOT_OBJECT	= 0x04,	/* contents are the component's root object */
 	TF_STATUS_CODE	= 0x08,	/* contents are a 32-bit status code */
 	TF_ACCEPT_FDS	= 0x10,	/* allow replies with file descriptors */
+	TF_DATA_IOVEC	= 0x20,	/* data.ptr.buffer is an array of iovecs */
 };
 
 struct binder_transaction_data {
@@ -147,6 +148,16 @@ struct binder_transaction_data {
 	} data;
 };
 
+/* Sent with bcTRANSACTION_SG and bcREPLY_SG. */
+struct binder_transaction_data_sg {
+	struct binder_transaction_data	transaction_data;
+
+	/* Number of struct iovec at transaction_data.data.ptr.buffer
+	 * when TF_DATA_IOVEC is set.
+	 */
+	size_t		data_iov_count;
+};
+
 struct binder_ptr_cookie {
 	void *ptr;
 	void *cookie;
@@ -324,6 +335,15 @@ enum BinderDriverCommandProtocol {
 	/*
 	 * void *: cookie
 	 */
+
+	BC_TRANSACTION_SG = _IOW('c', 17, struct binder_transaction_data_sg),
+	BC_REPLY_SG = _IOW('c', 18, struct binder_transaction_data_sg),
+	/*
+	 * binder_transaction_data_sg: the sent command.  With TF_DATA_IOVEC
+	 * set, the data is gathered from data_iov_count iovecs straight
+	 * into the target's buffer instead of from one flat buffer.
+	 * data_size must be the sum of their lengths.
+	 */
 };
 
 #endif /* _LINUX_BINDER_H */
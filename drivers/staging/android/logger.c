@@ -23,6 +23,11 @@
 #include <linux/uaccess.h>
 #include <linux/poll.h>
 #include <linux/time.h>
+#include <linux/spinlock.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/lzo.h>
+#include <asm/unaligned.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
@@ -31,35 +36,66 @@
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
  * This structure lives from module insertion until module removal, so it does
- * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * not need additional reference counting.
+ *
+ * The offsets are free-running and only wrapped into the buffer by
+ * logger_offset(). Writers reserve [w_off, w_off + len) under the spinlock
+ * 'lock', then copy their payload in without any lock held. An entry becomes
+ * readable once it and every entry before it have been committed, which moves
+ * c_off. The offsets are protected by 'lock'.
  */
 struct logger_log {
 	unsigned char *		buffer;	/* the ring buffer itself */
 	struct miscdevice	misc;	/* misc device representing the log */
-	wait_queue_head_t	wq;	/* wait queue for readers */
-	struct list_head	readers; /* this log's readers */
-	struct mutex		mutex;	/* mutex protecting buffer */
-	size_t			w_off;	/* current write head offset */
+	wait_queue_head_t	wq;	/* wait queue for readers and writers */
+	spinlock_t		lock;	/* lock protecting the offsets */
+	size_t			w_off;	/* reserved write head offset */
+	size_t			c_off;	/* committed write head offset */
 	size_t			head;	/* new readers start here */
 	size_t			size;	/* size of the log */
+	int			compress; /* store new entries compressed */
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+	struct mutex		zmutex;	/* serializes compressed writers */
+	unsigned char *		zbuf;	/* their payload buffer */
+#endif
 };
 
 /*
  * struct logger_reader - a logging device open for reading
  *
  * This object lives from open to release, so we don't need additional
- * reference counting. The structure is protected by log->mutex.
+ * reference counting. The structure is protected by 'mutex'.
  */
 struct logger_reader {
 	struct logger_log *	log;	/* associated log */
-	struct list_head	list;	/* entry in logger_log's list */
+	struct mutex		mutex;	/* mutex protecting the fields below */
 	size_t			r_off;	/* current read head offset */
+	unsigned char *		buf;	/* the entry being read */
+	unsigned char *		zbuf;	/* decompression buffer */
+	int			batch;	/* read() returns all entries that fit */
 };
 
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
 #define logger_offset(n)	((n) & (log->size - 1))
 
+/*
+ * While an entry is in the ring, the first byte of its __pad holds its state
+ * and the second how its payload is stored. Readers see the padding zeroed,
+ * as before.
+ */
+#define LOGGER_STATE_BYTE	offsetof(struct logger_entry, __pad)
+#define LOGGER_FORMAT_BYTE	(LOGGER_STATE_BYTE + 1)
+
+#define LOGGER_ENTRY_PENDING	0	/* reserved, payload being copied */
+#define LOGGER_ENTRY_COMMITTED	1	/* complete */
+#define LOGGER_ENTRY_DISCARDED	2	/* the copy failed, skip it */
+
+#define LOGGER_FORMAT_RAW	0	/* the payload as written */
+#define LOGGER_FORMAT_LZO	1	/* __u16 payload length, lzo1x data */
+
+#define logger_state(off) \
+	(log->buffer[logger_offset((off) + LOGGER_STATE_BYTE)])
+
 /*
  * file_get_log - Given a file structure, return the associated log
  *
@@ -83,16 +119,20 @@ static inline struct logger_log * file_get_log(struct file *file)
 		return file->private_data;
 }
 
+static void do_read_log(struct logger_log *, size_t, void *, size_t);
+
 /*
  * get_entry_len - Grabs the length of the payload of the next entry starting
  * from 'off'.
  *
- * Caller needs to hold log->mutex.
+ * Caller needs to hold log->lock, or check logger_lapped() afterwards.
  */
 static __u32 get_entry_len(struct logger_log *log, size_t off)
 {
 	__u16 val;
 
+	off = logger_offset(off);
+
 	switch (log->size - off) {
 	case 1:
 		memcpy(&val, log->buffer + off, 1);
@@ -106,40 +146,237 @@ static __u32 get_entry_len(struct logger_log *log, size_t off)
 }
 
 /*
- * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
- * user-space buffer 'buf'. Returns 'count' on success.
+ * get_user_entry_len - Grabs the length the entry starting from 'off' will
+ * have once it is read, that is after decompression.
+ *
+ * Caller needs to hold log->lock.
+ */
+static __u32 get_user_entry_len(struct logger_log *log, size_t off)
+{
+	__u16 val;
+
+	if (log->buffer[logger_offset(off + LOGGER_FORMAT_BYTE)] !=
+	    LOGGER_FORMAT_LZO)
+		return get_entry_len(log, off);
+
+	do_read_log(log, off + sizeof(struct logger_entry), &val, sizeof(val));
+	return sizeof(struct logger_entry) + get_unaligned(&val);
+}
+
+/*
+ * logger_lapped - has a writer reserved space over the byte at 'off'?
+ *
+ * Readers copy entries out without any lock held and call this afterwards;
+ * if it returns true the copy may be torn and has to be thrown away.
+ */
+static inline int logger_lapped(struct logger_log *log, size_t off)
+{
+	smp_rmb();
+	return (long)(ACCESS_ONCE(log->w_off) - log->size - off) > 0;
+}
+
+/*
+ * fix_up_reader - pull a reader that was lapped by the writers forward to the
+ * oldest entry still in the log.
+ *
+ * Writers only move log->head; each reader notices it fell behind the next
+ * time it looks at the log, instead of every write walking all the readers.
  *
- * Caller must hold log->mutex.
+ * Caller must hold reader->mutex and log->lock.
+ */
+static inline void fix_up_reader(struct logger_log *log,
+				 struct logger_reader *reader)
+{
+	if ((long)(log->head - reader->r_off) > 0)
+		reader->r_off = log->head;
+}
+
+/*
+ * do_read_log - copies exactly 'count' bytes at 'off' out of the log into the
+ * kernel buffer 'buf'.
  */
-static ssize_t do_read_log_to_user(struct logger_log *log,
-				   struct logger_reader *reader,
-				   char __user *buf,
-				   size_t count)
+static void do_read_log(struct logger_log *log, size_t off, void *buf,
+			size_t count)
 {
 	size_t len;
 
 	/*
 	 * We read from the log in two disjoint operations. First, we read from
-	 * the current read head offset up to 'count' bytes or to the end of
-	 * the log, whichever comes first.
+	 * 'off' up to 'count' bytes or to the end of the log, whichever comes
+	 * first.
 	 */
-	len = min(count, log->size - reader->r_off);
-	if (copy_to_user(buf, log->buffer + reader->r_off, len))
-		return -EFAULT;
+	off = logger_offset(off);
+	len = min(count, log->size - off);
+	memcpy(buf, log->buffer + off, len);
 
 	/*
 	 * Second, we read any remaining bytes, starting back at the head of
 	 * the log.
 	 */
 	if (count != len)
-		if (copy_to_user(buf + len, log->buffer, count - len))
-			return -EFAULT;
+		memcpy(buf + len, log->buffer, count - len);
+}
+
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+/*
+ * Per-cpu lzo scratch space, allocated the first time a log is switched to
+ * compressed storage, along with that log's payload buffer.
+ */
+struct logger_lzo {
+	void *			wrkmem;	/* LZO1X_1_MEM_COMPRESS bytes */
+	unsigned char *		out;	/* compressed payload */
+};
+
+static DEFINE_PER_CPU(struct logger_lzo, logger_lzo);
+static DEFINE_MUTEX(logger_lzo_mutex);
+static int logger_lzo_ready;
+
+static int logger_lzo_init(struct logger_log *log)
+{
+	int cpu;
+	int ret = 0;
+
+	mutex_lock(&logger_lzo_mutex);
+	if (!log->zbuf) {
+		log->zbuf = kmalloc(LOGGER_ENTRY_MAX_PAYLOAD, GFP_KERNEL);
+		if (!log->zbuf) {
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+	if (logger_lzo_ready)
+		goto out;
+
+	for_each_possible_cpu(cpu) {
+		struct logger_lzo *lzo = &per_cpu(logger_lzo, cpu);
+
+		if (!lzo->wrkmem)
+			lzo->wrkmem = vmalloc(LZO1X_1_MEM_COMPRESS);
+		if (!lzo->out)
+			lzo->out = kmalloc(lzo1x_worst_compress(
+				LOGGER_ENTRY_MAX_PAYLOAD), GFP_KERNEL);
+		if (!lzo->wrkmem || !lzo->out) {
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+	logger_lzo_ready = 1;
+out:
+	mutex_unlock(&logger_lzo_mutex);
+	return ret;
+}
 
-	reader->r_off = logger_offset(reader->r_off + count);
+/*
+ * logger_compress - compresses the 'count' byte payload in 'buf' in place
+ *
+ * Returns the new payload length, or 'count' if the payload is stored as is.
+ */
+static size_t logger_compress(struct logger_entry *header, unsigned char *buf,
+			      size_t count)
+{
+	struct logger_lzo *lzo = &get_cpu_var(logger_lzo);
+	size_t len;
+
+	if (lzo1x_1_compress(buf, count, lzo->out, &len, lzo->wrkmem) ==
+	    LZO_E_OK && len + sizeof(__u16) < count) {
+		put_unaligned((__u16) count, (__u16 *) buf);
+		memcpy(buf + sizeof(__u16), lzo->out, len);
+		((unsigned char *) header)[LOGGER_FORMAT_BYTE] =
+			LOGGER_FORMAT_LZO;
+		count = len + sizeof(__u16);
+	}
+	put_cpu_var(logger_lzo);
 
 	return count;
 }
 
+/*
+ * logger_decompress - expands the lzo entry of 'len' bytes in reader->buf
+ *
+ * Returns the length of the expanded entry, now in reader->buf, or a
+ * negative error code if the entry is corrupt.
+ */
+static ssize_t logger_decompress(struct logger_reader *reader, size_t len)
+{
+	struct logger_entry *entry = (struct logger_entry *) reader->zbuf;
+	unsigned char *payload = reader->buf + sizeof(struct logger_entry);
+	size_t count = LOGGER_ENTRY_MAX_PAYLOAD;
+
+	if (len < sizeof(struct logger_entry) + sizeof(__u16))
+		return -EINVAL;
+	memcpy(entry, reader->buf, sizeof(struct logger_entry));
+	if (lzo1x_decompress_safe(payload + sizeof(__u16),
+			len - sizeof(struct logger_entry) - sizeof(__u16),
+			entry->msg, &count) != LZO_E_OK ||
+	    count != get_unaligned((__u16 *) payload))
+		return -EINVAL;
+	entry->len = count;
+	swap(reader->buf, reader->zbuf);
+
+	return sizeof(struct logger_entry) + count;
+}
+#else
+static inline int logger_lzo_init(struct logger_log *log)
+{
+	return -EOPNOTSUPP;
+}
+
+static inline ssize_t logger_decompress(struct logger_reader *reader,
+					size_t len)
+{
+	return -EINVAL;
+}
+#endif
+
+/*
+ * logger_read_entry - copies the next entry out of the log into reader->buf
+ * without blocking the writers, then makes sure none of them started
+ * overwriting it meanwhile. Discarded and corrupt entries are skipped.
+ *
+ * Returns the entry's length and sets 'next' to the offset following it, or
+ * returns zero if there is nothing to read.
+ *
+ * Caller must hold reader->mutex.
+ */
+static ssize_t logger_read_entry(struct logger_log *log,
+				 struct logger_reader *reader, size_t *next)
+{
+	ssize_t ret;
+	size_t off;
+
+	while (1) {
+		spin_lock(&log->lock);
+		fix_up_reader(log, reader);
+		ret = (log->c_off == reader->r_off);
+		spin_unlock(&log->lock);
+		if (ret)
+			return 0;
+
+		off = reader->r_off;
+		ret = get_entry_len(log, off);
+		if (ret <= LOGGER_ENTRY_MAX_LEN)
+			do_read_log(log, off, reader->buf, ret);
+		if (unlikely(ret > LOGGER_ENTRY_MAX_LEN ||
+			     logger_lapped(log, off)))
+			continue;
+
+		*next = off + ret;
+		if (reader->buf[LOGGER_STATE_BYTE] == LOGGER_ENTRY_DISCARDED) {
+			reader->r_off = *next;
+			continue;
+		}
+		if (reader->buf[LOGGER_FORMAT_BYTE] == LOGGER_FORMAT_LZO) {
+			ret = logger_decompress(reader, ret);
+			if (ret < 0) {
+				reader->r_off = *next;
+				continue;
+			}
+		}
+		((struct logger_entry *) reader->buf)->__pad = 0;
+		return ret;
+	}
+}
+
 /*
  * logger_read - our log's read() method
  *
@@ -147,7 +384,8 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
  *
  * 	- O_NONBLOCK works
  * 	- If there are no log entries to read, blocks until log is written to
- * 	- Atomically reads exactly one log entry
+ * 	- Atomically reads exactly one log entry, or as many whole entries as
+ * 	  fit in 'buf' after LOGGER_SET_BATCH_READ
  *
  * Optimal read size is LOGGER_ENTRY_MAX_LEN. Will set errno to EINVAL if read
  * buffer is insufficient to hold next entry.
@@ -157,16 +395,20 @@ static ssize_t logger_read(struct file *file, char __user *buf,
 {
 	struct logger_reader *reader = file->private_data;
 	struct logger_log *log = reader->log;
-	ssize_t ret;
+	ssize_t ret, copied;
+	size_t next;
 	DEFINE_WAIT(wait);
 
 start:
 	while (1) {
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
-		mutex_lock(&log->mutex);
-		ret = (log->w_off == reader->r_off);
-		mutex_unlock(&log->mutex);
+		mutex_lock(&reader->mutex);
+		spin_lock(&log->lock);
+		fix_up_reader(log, reader);
+		ret = (log->c_off == reader->r_off);
+		spin_unlock(&log->lock);
+		mutex_unlock(&reader->mutex);
 		if (!ret)
 			break;
 
@@ -187,145 +429,217 @@ start:
 	if (ret)
 		return ret;
 
-	mutex_lock(&log->mutex);
+	mutex_lock(&reader->mutex);
 
 	/* is there still something to read or did we race? */
-	if (unlikely(log->w_off == reader->r_off)) {
-		mutex_unlock(&log->mutex);
+	ret = logger_read_entry(log, reader, &next);
+	if (unlikely(!ret)) {
+		mutex_unlock(&reader->mutex);
 		goto start;
 	}
 
-	/* get the size of the next entry */
-	ret = get_entry_len(log, reader->r_off);
 	if (count < ret) {
 		ret = -EINVAL;
 		goto out;
 	}
 
-	/* get exactly one entry from the log */
-	ret = do_read_log_to_user(log, reader, buf, ret);
+	/* get exactly one entry from the log, or as many as fit */
+	copied = 0;
+	do {
+		if (copy_to_user(buf + copied, reader->buf, ret)) {
+			if (!copied)
+				copied = -EFAULT;
+			break;
+		}
+		reader->r_off = next;
+		copied += ret;
+		if (!reader->batch)
+			break;
+		ret = logger_read_entry(log, reader, &next);
+	} while (ret && ret <= count - copied);
+	ret = copied;
 
 out:
-	mutex_unlock(&log->mutex);
+	mutex_unlock(&reader->mutex);
 
 	return ret;
 }
 
 /*
- * get_next_entry - return the offset of the first valid entry at least 'len'
- * bytes after 'off'.
- *
- * Caller must hold log->mutex.
+ * do_write_log - writes 'len' bytes from 'buf' to 'log' at 'off'
  */
-static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
+static void do_write_log(struct logger_log *log, size_t off, const void *buf,
+			 size_t count)
 {
-	size_t count = 0;
+	size_t len;
 
-	do {
-		size_t nr = get_entry_len(log, off);
-		off = logger_offset(off + nr);
-		count += nr;
-	} while (count < len);
+	off = logger_offset(off);
+	len = min(count, log->size - off);
+	memcpy(log->buffer + off, buf, len);
 
-	return off;
+	if (count != len)
+		memcpy(log->buffer, buf + len, count - len);
 }
 
+/* how long a writer that laps a pending entry waits before giving up */
+#define LOGGER_LAP_TIMEOUT	(HZ / 10)
+
 /*
- * clock_interval - is a < c < b in mod-space? Put another way, does the line
- * from a to b cross c?
+ * logger_reserve - reserves 'len' bytes for a new entry and writes its header
+ * there. Stores the entry's offset in 'off'.
+ *
+ * The oldest entries are dropped to make room by moving log->head past them;
+ * readers still pointing at them catch up in fix_up_reader(). An entry whose
+ * payload is still being copied is never dropped: should the writers lap it,
+ * they wait for it to be committed first, for at most LOGGER_LAP_TIMEOUT.
+ *
+ * Returns 0 on success, or -EAGAIN or -ERESTARTSYS if the wait timed out or
+ * was interrupted; the new entry is then dropped.
  */
-static inline int clock_interval(size_t a, size_t b, size_t c)
+static int logger_reserve(struct logger_log *log, struct logger_entry *header,
+			  size_t len, size_t *off)
 {
-	if (b < a) {
-		if (a < c || b >= c)
-			return 1;
-	} else {
-		if (a < c && b >= c)
-			return 1;
+	long ret;
+
+	spin_lock(&log->lock);
+	while ((long)(log->w_off + len - log->size - log->head) > 0) {
+		if (log->head == log->c_off) {
+			size_t c_off = log->c_off;
+
+			spin_unlock(&log->lock);
+			ret = wait_event_interruptible_timeout(log->wq,
+					ACCESS_ONCE(log->c_off) != c_off,
+					LOGGER_LAP_TIMEOUT);
+			if (ret <= 0)
+				return ret ? ret : -EAGAIN;
+			spin_lock(&log->lock);
+			continue;
+		}
+		log->head += get_entry_len(log, log->head);
 	}
+	*off = log->w_off;
+	log->w_off += len;
+	/* readers checking logger_lapped() must see w_off before the data */
+	smp_wmb();
+	((unsigned char *) header)[LOGGER_STATE_BYTE] = LOGGER_ENTRY_PENDING;
+	do_write_log(log, *off, header, sizeof(struct logger_entry));
+	spin_unlock(&log->lock);
 
 	return 0;
 }
 
 /*
- * fix_up_readers - walk the list of all readers and "fix up" any who were
- * lapped by the writer; also do the same for the default "start head".
- * We do this by "pulling forward" the readers and start head to the first
- * entry after the new write head.
- *
- * The caller needs to hold log->mutex.
+ * logger_commit - marks the entry at 'off' as complete (or as discarded) and
+ * makes every complete entry up to the first pending one readable.
  */
-static void fix_up_readers(struct logger_log *log, size_t len)
+static void logger_commit(struct logger_log *log, size_t off, int state)
 {
-	size_t old = log->w_off;
-	size_t new = logger_offset(old + len);
-	struct logger_reader *reader;
-
-	if (clock_interval(old, new, log->head))
-		log->head = get_next_entry(log, log->head, len);
-
-	list_for_each_entry(reader, &log->readers, list)
-		if (clock_interval(old, new, reader->r_off))
-			reader->r_off = get_next_entry(log, reader->r_off, len);
+	spin_lock(&log->lock);
+	logger_state(off) = state;
+	while (log->c_off != log->w_off &&
+	       logger_state(log->c_off) != LOGGER_ENTRY_PENDING)
+		log->c_off += get_entry_len(log, log->c_off);
+	spin_unlock(&log->lock);
+
+	/* wake up any blocked readers, and writers waiting for room */
+	wake_up(&log->wq);
 }
 
 /*
- * do_write_log - writes 'len' bytes from 'buf' to 'log'
+ * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
+ * the log 'log' at 'off'
+ *
+ * The caller must have reserved the space with logger_reserve().
  *
- * The caller needs to hold log->mutex.
+ * Returns 'count' on success, negative error code on failure.
  */
-static void do_write_log(struct logger_log *log, const void *buf, size_t count)
+static ssize_t do_write_log_from_user(struct logger_log *log, size_t off,
+				      const void __user *buf, size_t count)
 {
 	size_t len;
 
-	len = min(count, log->size - log->w_off);
-	memcpy(log->buffer + log->w_off, buf, len);
+	off = logger_offset(off);
+	len = min(count, log->size - off);
+	if (len && copy_from_user(log->buffer + off, buf, len))
+		return -EFAULT;
 
 	if (count != len)
-		memcpy(log->buffer, buf + len, count - len);
-
-	log->w_off = logger_offset(log->w_off + count);
+		if (copy_from_user(log->buffer, buf + len, count - len))
+			return -EFAULT;
 
+	return count;
 }
 
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
 /*
- * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
- *
- * The caller needs to hold log->mutex.
+ * logger_write_compressed - the write path for logs in compressed mode
  *
- * Returns 'count' on success, negative error code on failure.
+ * The payload is gathered and compressed in the log's buffer first, so the
+ * entry's final size is known before space is reserved for it. Writers of
+ * the log take turns with that buffer.
  */
-static ssize_t do_write_log_from_user(struct logger_log *log,
-				      const void __user *buf, size_t count)
+static ssize_t logger_write_compressed(struct logger_log *log,
+				       struct logger_entry *header,
+				       const struct iovec *iov,
+				       unsigned long nr_segs)
 {
-	size_t len;
+	unsigned char *buf;
+	size_t off, len;
+	ssize_t ret = 0;
+	int err;
 
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
-		return -EFAULT;
+	mutex_lock(&log->zmutex);
+	buf = log->zbuf;
 
-	if (count != len)
-		if (copy_from_user(log->buffer, buf + len, count - len))
-			return -EFAULT;
+	while (nr_segs-- > 0 && ret < header->len) {
+		len = min_t(size_t, iov->iov_len, header->len - ret);
+		if (copy_from_user(buf + ret, iov->iov_base, len)) {
+			ret = -EFAULT;
+			goto out;
+		}
+		iov++;
+		ret += len;
+	}
 
-	log->w_off = logger_offset(log->w_off + count);
+	header->len = logger_compress(header, buf, ret);
+	err = logger_reserve(log, header,
+			     sizeof(struct logger_entry) + header->len, &off);
+	if (unlikely(err)) {
+		ret = err;
+		goto out;
+	}
+	do_write_log(log, off + sizeof(struct logger_entry), buf, header->len);
+	logger_commit(log, off, LOGGER_ENTRY_COMMITTED);
 
-	return count;
+out:
+	mutex_unlock(&log->zmutex);
+	return ret;
+}
+#else
+static inline ssize_t logger_write_compressed(struct logger_log *log,
+					      struct logger_entry *header,
+					      const struct iovec *iov,
+					      unsigned long nr_segs)
+{
+	return -EINVAL;
 }
+#endif
 
 /*
  * logger_aio_write - our write method, implementing support for write(),
  * writev(), and aio_write(). Writes are our fast path, and we try to optimize
  * them above all else.
+ *
+ * Concurrent writers only share the short reservation in logger_reserve()
+ * and logger_commit(); their payloads are copied in parallel.
  */
 ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
 	struct logger_entry header;
 	struct timespec now;
+	size_t off;
 	ssize_t ret = 0;
 
 	now = current_kernel_time();
@@ -335,22 +649,19 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	header.sec = now.tv_sec;
 	header.nsec = now.tv_nsec;
 	header.len = min_t(size_t, iocb->ki_left, LOGGER_ENTRY_MAX_PAYLOAD);
+	header.__pad = 0;
 
 	/* null writes succeed, return zero */
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
+	if (ACCESS_ONCE(log->compress))
+		return logger_write_compressed(log, &header, iov, nr_segs);
 
-	/*
-	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
-	 * because if we partially fail, we can end up with clobbered log
-	 * entries that encroach on readable buffer.
-	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
-
-	do_write_log(log, &header, sizeof(struct logger_entry));
+	ret = logger_reserve(log, &header,
+			     sizeof(struct logger_entry) + header.len, &off);
+	if (unlikely(ret))
+		return ret;
 
 	while (nr_segs-- > 0) {
 		size_t len;
@@ -360,10 +671,11 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 		len = min_t(size_t, iov->iov_len, header.len - ret);
 
 		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
+		nr = do_write_log_from_user(log,
+			off + sizeof(struct logger_entry) + ret,
+			iov->iov_base, len);
 		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
+			logger_commit(log, off, LOGGER_ENTRY_DISCARDED);
 			return nr;
 		}
 
@@ -371,10 +683,7 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 		ret += nr;
 	}
 
-	mutex_unlock(&log->mutex);
-
-	/* wake up any blocked readers */
-	wake_up_interruptible(&log->wq);
+	logger_commit(log, off, LOGGER_ENTRY_COMMITTED);
 
 	return ret;
 }
@@ -406,13 +715,22 @@ static int logger_open(struct inode *inode, struct file *file)
 		if (!reader)
 			return -ENOMEM;
 
+		reader->buf = kmalloc(LOGGER_ENTRY_MAX_LEN, GFP_KERNEL);
+		reader->zbuf = kmalloc(LOGGER_ENTRY_MAX_LEN, GFP_KERNEL);
+		if (!reader->buf || !reader->zbuf) {
+			kfree(reader->buf);
+			kfree(reader->zbuf);
+			kfree(reader);
+			return -ENOMEM;
+		}
+
 		reader->log = log;
-		INIT_LIST_HEAD(&reader->list);
+		reader->batch = 0;
+		mutex_init(&reader->mutex);
 
-		mutex_lock(&log->mutex);
+		spin_lock(&log->lock);
 		reader->r_off = log->head;
-		list_add_tail(&reader->list, &log->readers);
-		mutex_unlock(&log->mutex);
+		spin_unlock(&log->lock);
 
 		file->private_data = reader;
 	} else
@@ -430,7 +748,8 @@ static int logger_release(struct inode *ignored, struct file *file)
 {
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader = file->private_data;
-		list_del(&reader->list);
+		kfree(reader->buf);
+		kfree(reader->zbuf);
 		kfree(reader);
 	}
 
@@ -460,10 +779,13 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 
 	poll_wait(file, &log->wq, wait);
 
-	mutex_lock(&log->mutex);
-	if (log->w_off != reader->r_off)
+	mutex_lock(&reader->mutex);
+	spin_lock(&log->lock);
+	fix_up_reader(log, reader);
+	if (log->c_off != reader->r_off)
 		ret |= POLLIN | POLLRDNORM;
-	mutex_unlock(&log->mutex);
+	spin_unlock(&log->lock);
+	mutex_unlock(&reader->mutex);
 
 	return ret;
 }
@@ -471,50 +793,81 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct logger_log *log = file_get_log(file);
-	struct logger_reader *reader;
+	struct logger_reader *reader = NULL;
 	long ret = -ENOTTY;
 
-	mutex_lock(&log->mutex);
+	if (file->f_mode & FMODE_READ) {
+		reader = file->private_data;
+		mutex_lock(&reader->mutex);
+	}
 
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
 		ret = log->size;
 		break;
 	case LOGGER_GET_LOG_LEN:
-		if (!(file->f_mode & FMODE_READ)) {
+		if (!reader) {
 			ret = -EBADF;
 			break;
 		}
-		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
-			ret = log->w_off - reader->r_off;
-		else
-			ret = (log->size - reader->r_off) + log->w_off;
+		spin_lock(&log->lock);
+		fix_up_reader(log, reader);
+		ret = log->c_off - reader->r_off;
+		spin_unlock(&log->lock);
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
-		if (!(file->f_mode & FMODE_READ)) {
+		if (!reader) {
 			ret = -EBADF;
 			break;
 		}
-		reader = file->private_data;
-		if (log->w_off != reader->r_off)
-			ret = get_entry_len(log, reader->r_off);
+		spin_lock(&log->lock);
+		fix_up_reader(log, reader);
+		if (log->c_off != reader->r_off)
+			ret = get_user_entry_len(log, reader->r_off);
 		else
 			ret = 0;
+		spin_unlock(&log->lock);
 		break;
 	case LOGGER_FLUSH_LOG:
 		if (!(file->f_mode & FMODE_WRITE)) {
 			ret = -EBADF;
 			break;
 		}
-		list_for_each_entry(reader, &log->readers, list)
-			reader->r_off = log->w_off;
-		log->head = log->w_off;
+		/* readers are pulled forward lazily by fix_up_reader() */
+		spin_lock(&log->lock);
+		log->head = log->c_off;
+		spin_unlock(&log->lock);
+		ret = 0;
+		break;
+	case LOGGER_SET_BATCH_READ:
+		if (!reader) {
+			ret = -EBADF;
+			break;
+		}
+		reader->batch = !!arg;
 		ret = 0;
 		break;
+	case LOGGER_SET_COMPRESSION:
+		if (!(file->f_mode & FMODE_WRITE)) {
+			ret = -EBADF;
+			break;
+		}
+		/* it costs memory and CPU for every writer of the log */
+		if (!capable(CAP_SYS_ADMIN)) {
+			ret = -EPERM;
+			break;
+		}
+		ret = arg ? logger_lzo_init(log) : 0;
+		if (!ret) {
+			/* the buffer is seen before the mode */
+			smp_wmb();
+			log->compress = !!arg;
+		}
+		break;
 	}
 
-	mutex_unlock(&log->mutex);
+	if (reader)
+		mutex_unlock(&reader->mutex);
 
 	return ret;
 }
@@ -546,9 +899,10 @@ static struct logger_log VAR = { \
 		.parent = NULL, \
 	}, \
 	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
-	.readers = LIST_HEAD_INIT(VAR .readers), \
-	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
+	.lock = __SPIN_LOCK_UNLOCKED(VAR .lock), \
 	.w_off = 0, \
+	.c_off = 0, \
+	.compress = 0, \
 	.head = 0, \
 	.size = SIZE, \
 };
@@ -572,6 +926,9 @@ static int __init init_log(struct logger_log *log)
 {
 	int ret;
 
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+	mutex_init(&log->zmutex);
+#endif
 	ret = misc_register(&log->misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "logger: failed to register misc "
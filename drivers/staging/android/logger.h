@@ -44,5 +44,7 @@ struct logger_entry {
 #define LOGGER_GET_LOG_LEN		_IO(__LOGGERIO, 2) /* used log len */
 #define LOGGER_GET_NEXT_ENTRY_LEN	_IO(__LOGGERIO, 3) /* next entry len */
 #define LOGGER_FLUSH_LOG		_IO(__LOGGERIO, 4) /* flush log */
+#define LOGGER_SET_BATCH_READ		_IO(__LOGGERIO, 5) /* read() all entries that fit */
+#define LOGGER_SET_COMPRESSION		_IO(__LOGGERIO, 6) /* store new entries lzo compressed, CAP_SYS_ADMIN */
 
 #endif /* _LINUX_LOGGER_H */
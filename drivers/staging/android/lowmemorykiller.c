@@ -15,9 +15,20 @@
 
 #include <linux/module.h>
 #include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
 #include <linux/mm.h>
 #include <linux/oom.h>
 #include <linux/sched.h>
+#include <linux/hash.h>
+#include <linux/notifier.h>
+#include <linux/pid.h>
+#include <linux/poll.h>
+#include <linux/rcupdate.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/uaccess.h>
+#include <linux/workqueue.h>
 
 static int lowmem_shrink(int nr_to_scan, gfp_t gfp_mask);
 
@@ -40,6 +51,45 @@ static size_t lowmem_minfree[6] = {
 	16*1024, // 64MB
 };
 static int lowmem_minfree_size = 4;
+static int lowmem_notify_margin = 25;
+static unsigned int lowmem_notify_poll_ms = 500;
+
+/*
+ * Processes are kept in one bucket per oom_adj, with their rss as of the
+ * last time we looked at them, so a victim can be picked from the highest
+ * non-empty bucket instead of walking every process under tasklist_lock.
+ * The oom_adj notifier adds a process when it forks and moves it when its
+ * oom_adj is written; it drops it when the process exits. Entries hold the
+ * struct pid, not the task, and come from their own slab cache since one is
+ * allocated for every fork. If an entry could not be allocated the process
+ * is counted in lowmem_untracked, and the full walk is done as well until
+ * lowmem_retrack_work has found it an entry.
+ */
+struct lowmem_task {
+	struct hlist_node hash;		/* in lowmem_hash, by pid */
+	struct list_head bucket;	/* in lowmem_buckets[adj - OOM_ADJUST_MIN] */
+	struct pid *pid;
+	int adj;
+	int rss;
+};
+
+#define LOWMEM_BUCKETS (OOM_ADJUST_MAX - OOM_ADJUST_MIN + 1)
+#define LOWMEM_HASH_BITS 8
+
+static struct list_head lowmem_buckets[LOWMEM_BUCKETS];
+static struct hlist_head lowmem_hash[1 << LOWMEM_HASH_BITS];
+static DEFINE_SPINLOCK(lowmem_lock);
+static int lowmem_untracked;
+static struct kmem_cache *lowmem_task_cachep;
+
+#define LOWMEM_RETRACK_DELAY HZ
+
+static void lowmem_retrack(struct work_struct *work);
+static DECLARE_DELAYED_WORK(lowmem_retrack_work, lowmem_retrack);
+
+/* the last victim, until it has released its memory or the timeout passes */
+static struct task_struct *lowmem_deathpending;
+static unsigned long lowmem_deathpending_timeout;
 
 #define lowmem_print(level, x...) do { if(lowmem_debug_level >= (level)) printk(x); } while(0)
 
@@ -47,23 +97,432 @@ module_param_named(cost, lowmem_shrinker.seeks, int, S_IRUGO | S_IWUSR);
 module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size, S_IRUGO | S_IWUSR);
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size, S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_named(notify_margin, lowmem_notify_margin, int, S_IRUGO | S_IWUSR);
+module_param_named(notify_poll_ms, lowmem_notify_poll_ms, uint, S_IRUGO | S_IWUSR);
 
-static int lowmem_shrink(int nr_to_scan, gfp_t gfp_mask)
+/*
+ * Memory pressure notification. Each minfree level is reported through
+ * /dev/lowmem_pressure once free and file pages drop below it plus
+ * notify_margin percent, that is before the killer acts on that level.
+ * Level 0 means no pressure, level n the n-th highest minfree.
+ *
+ * The shrinker only runs while the kernel reclaims, so it sees the level
+ * rise but not fall. While the level is above 0 it is also re-evaluated
+ * every notify_poll_ms from a delayed work, until it is back to 0.
+ */
+struct lowmem_pressure {
+	int level;
+	int adj;	/* the oom_adj the killer will go for at this level */
+	int other_free;
+	int other_file;
+	unsigned int seq;
+};
+
+static struct lowmem_pressure lowmem_pressure = {
+	.adj = OOM_ADJUST_MAX + 1,
+};
+static DEFINE_SPINLOCK(lowmem_pressure_lock);
+static DECLARE_WAIT_QUEUE_HEAD(lowmem_pressure_wait);
+
+static void lowmem_pressure_poll_work(struct work_struct *work);
+static DECLARE_DELAYED_WORK(lowmem_pressure_work, lowmem_pressure_poll_work);
+
+static int lowmem_array_size(void)
+{
+	int array_size = ARRAY_SIZE(lowmem_adj);
+
+	if (lowmem_adj_size < array_size)
+		array_size = lowmem_adj_size;
+	if (lowmem_minfree_size < array_size)
+		array_size = lowmem_minfree_size;
+	return array_size;
+}
+
+static void lowmem_pressure_update(int array_size, int other_free,
+				   int other_file)
+{
+	int i;
+	int level = 0;
+	int adj = OOM_ADJUST_MAX + 1;
+	int changed = 0;
+
+	for (i = 0; i < array_size; i++) {
+		int minfree = lowmem_minfree[i] +
+			lowmem_minfree[i] * lowmem_notify_margin / 100;
+		if (other_free < minfree && other_file < minfree) {
+			level = array_size - i;
+			adj = lowmem_adj[i];
+			break;
+		}
+	}
+
+	spin_lock(&lowmem_pressure_lock);
+	if (level != lowmem_pressure.level) {
+		lowmem_pressure.level = level;
+		lowmem_pressure.adj = adj;
+		lowmem_pressure.other_free = other_free;
+		lowmem_pressure.other_file = other_file;
+		lowmem_pressure.seq++;
+		changed = 1;
+	}
+	spin_unlock(&lowmem_pressure_lock);
+
+	if (changed) {
+		lowmem_print(3, "lowmem pressure level %d, adj %d, ofree %d %d\n",
+		             level, adj, other_free, other_file);
+		wake_up_interruptible(&lowmem_pressure_wait);
+	}
+	if (level && lowmem_notify_poll_ms)
+		schedule_delayed_work(&lowmem_pressure_work,
+				      msecs_to_jiffies(lowmem_notify_poll_ms));
+}
+
+static void lowmem_pressure_poll_work(struct work_struct *work)
+{
+	lowmem_pressure_update(lowmem_array_size(),
+			       global_page_state(NR_FREE_PAGES),
+			       global_page_state(NR_FILE_PAGES));
+}
+
+/* file->private_data holds the last seq the file returned */
+static inline unsigned int lowmem_pressure_seen(struct file *file)
+{
+	return (unsigned long)file->private_data;
+}
+
+/*
+ * lowmem_pressure_read - returns the current level as one line of text,
+ * blocking (unless O_NONBLOCK) until it differs from the last one this file
+ * returned. The first read returns immediately.
+ */
+static ssize_t lowmem_pressure_read(struct file *file, char __user *buf,
+				    size_t count, loff_t *pos)
+{
+	struct lowmem_pressure p;
+	char line[80];
+	int len;
+	int ret;
+
+	if (file->f_flags & O_NONBLOCK) {
+		if (ACCESS_ONCE(lowmem_pressure.seq) ==
+		    lowmem_pressure_seen(file))
+			return -EAGAIN;
+	} else {
+		ret = wait_event_interruptible(lowmem_pressure_wait,
+			ACCESS_ONCE(lowmem_pressure.seq) !=
+			lowmem_pressure_seen(file));
+		if (ret)
+			return ret;
+	}
+
+	spin_lock(&lowmem_pressure_lock);
+	p = lowmem_pressure;
+	spin_unlock(&lowmem_pressure_lock);
+
+	len = snprintf(line, sizeof(line), "level %d adj %d free %d file %d\n",
+		       p.level, p.adj, p.other_free, p.other_file);
+	if (count < len)
+		return -EINVAL;
+	if (copy_to_user(buf, line, len))
+		return -EFAULT;
+	file->private_data = (void *)(unsigned long)p.seq;
+	return len;
+}
+
+static unsigned int lowmem_pressure_poll(struct file *file, poll_table *wait)
+{
+	poll_wait(file, &lowmem_pressure_wait, wait);
+	if (ACCESS_ONCE(lowmem_pressure.seq) != lowmem_pressure_seen(file))
+		return POLLIN | POLLRDNORM;
+	return 0;
+}
+
+static int lowmem_pressure_open(struct inode *inode, struct file *file)
+{
+	/* make the first read return at once */
+	file->private_data = (void *)(unsigned long)
+		(ACCESS_ONCE(lowmem_pressure.seq) - 1);
+	return nonseekable_open(inode, file);
+}
+
+static const struct file_operations lowmem_pressure_fops = {
+	.owner = THIS_MODULE,
+	.open = lowmem_pressure_open,
+	.read = lowmem_pressure_read,
+	.poll = lowmem_pressure_poll,
+};
+
+static struct miscdevice lowmem_pressure_misc = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "lowmem_pressure",
+	.fops = &lowmem_pressure_fops,
+};
+
+static int lowmem_task_rss(struct task_struct *p)
+{
+	int rss = 0;
+
+	task_lock(p);
+	if (p->mm)
+		rss = get_mm_rss(p->mm);
+	task_unlock(p);
+	return rss;
+}
+
+static struct hlist_head *lowmem_hash_head(struct pid *pid)
+{
+	return &lowmem_hash[hash_ptr(pid, LOWMEM_HASH_BITS)];
+}
+
+static struct lowmem_task *lowmem_task_find(struct pid *pid)
+{
+	struct lowmem_task *lt;
+	struct hlist_node *pos;
+
+	hlist_for_each_entry(lt, pos, lowmem_hash_head(pid), hash)
+		if (lt->pid == pid)
+			return lt;
+	return NULL;
+}
+
+static void lowmem_task_free(struct lowmem_task *lt)
+{
+	hlist_del(&lt->hash);
+	list_del(&lt->bucket);
+	put_pid(lt->pid);
+	kmem_cache_free(lowmem_task_cachep, lt);
+}
+
+/*
+ * lowmem_task_alive - returns the live task of 'lt' with its rss refreshed,
+ * or NULL after freeing 'lt' if the process is gone.
+ *
+ * Caller holds lowmem_lock and rcu_read_lock.
+ */
+static struct task_struct *lowmem_task_alive(struct lowmem_task *lt)
+{
+	struct task_struct *p = pid_task(lt->pid, PIDTYPE_PID);
+
+	if (p && p->oomkilladj == lt->adj) {
+		lt->rss = lowmem_task_rss(p);
+		if (lt->rss > 0)
+			return p;
+	}
+	if (!p || !p->mm) {
+		lowmem_task_free(lt);
+		return NULL;
+	}
+	return NULL;
+}
+
+/*
+ * lowmem_track - puts process 'p' in the bucket of 'adj', or drops it if
+ * 'adj' is below OOM_ADJUST_MIN. An entry is only allocated the first time
+ * the process is seen; if that fails it is counted in lowmem_untracked.
+ */
+static void lowmem_track(struct task_struct *p, int adj, gfp_t gfp_mask)
+{
+	struct lowmem_task *lt, *new_lt = NULL;
+	struct list_head *bucket;
+
+	spin_lock(&lowmem_lock);
+	lt = lowmem_task_find(task_pid(p));
+	if (adj < OOM_ADJUST_MIN) {
+		if (lt)
+			lowmem_task_free(lt);
+		goto out;
+	}
+	if (!lt) {
+		spin_unlock(&lowmem_lock);
+		new_lt = kmem_cache_alloc(lowmem_task_cachep, gfp_mask);
+		spin_lock(&lowmem_lock);
+		lt = lowmem_task_find(task_pid(p));
+	}
+	if (!lt) {
+		if (!new_lt) {
+			lowmem_untracked++;
+			schedule_delayed_work(&lowmem_retrack_work,
+					      LOWMEM_RETRACK_DELAY);
+			goto out;
+		}
+		lt = new_lt;
+		new_lt = NULL;
+		lt->pid = get_pid(task_pid(p));
+		hlist_add_head(&lt->hash, lowmem_hash_head(lt->pid));
+		INIT_LIST_HEAD(&lt->bucket);
+	}
+	bucket = &lowmem_buckets[adj - OOM_ADJUST_MIN];
+	lt->adj = adj;
+	lt->rss = lowmem_task_rss(p);
+	list_move_tail(&lt->bucket, bucket);
+
+	/* drop one stale entry per update, so buckets do not pile them up */
+	lt = list_first_entry(bucket, struct lowmem_task, bucket);
+	rcu_read_lock();
+	if (!pid_task(lt->pid, PIDTYPE_PID))
+		lowmem_task_free(lt);
+	else
+		list_move_tail(&lt->bucket, bucket);
+	rcu_read_unlock();
+out:
+	spin_unlock(&lowmem_lock);
+	if (new_lt)
+		kmem_cache_free(lowmem_task_cachep, new_lt);
+}
+
+/*
+ * lowmem_retrack - finds an entry for the processes counted in
+ * lowmem_untracked. Only the count seen before the walk is taken off, so
+ * an allocation that fails meanwhile keeps its process counted and queues
+ * the work again.
+ */
+static void lowmem_retrack(struct work_struct *work)
+{
+	struct task_struct *p;
+	int untracked;
+	int tracked;
+
+	spin_lock(&lowmem_lock);
+	untracked = lowmem_untracked;
+	spin_unlock(&lowmem_lock);
+	if (!untracked)
+		return;
+
+	rcu_read_lock();
+	for_each_process(p) {
+		if (!p->mm)
+			continue;
+		spin_lock(&lowmem_lock);
+		tracked = lowmem_task_find(task_pid(p)) != NULL;
+		spin_unlock(&lowmem_lock);
+		if (!tracked)
+			lowmem_track(p, p->oomkilladj, GFP_ATOMIC);
+	}
+	rcu_read_unlock();
+
+	spin_lock(&lowmem_lock);
+	lowmem_untracked -= untracked;
+	spin_unlock(&lowmem_lock);
+	lowmem_print(3, "lowmem_retrack: walked for %d untracked\n", untracked);
+}
+
+static int lowmem_adj_notify(struct notifier_block *self,
+			     unsigned long adj, void *data)
+{
+	struct task_struct *p = data;
+
+	if (!thread_group_leader(p))
+		return NOTIFY_DONE;
+	lowmem_track(p, adj, GFP_KERNEL);
+	return NOTIFY_OK;
+}
+
+static struct notifier_block lowmem_adj_nb = {
+	.notifier_call = lowmem_adj_notify,
+};
+
+/*
+ * lowmem_deathpending_busy - is the last victim still releasing its memory?
+ *
+ * Caller holds lowmem_lock.
+ */
+static int lowmem_deathpending_busy(void)
+{
+	struct task_struct *p = lowmem_deathpending;
+
+	if (!p)
+		return 0;
+	if (time_before_eq(jiffies, lowmem_deathpending_timeout)) {
+		int exiting;
+
+		task_lock(p);
+		exiting = p->mm != NULL;
+		task_unlock(p);
+		if (exiting)
+			return 1;
+	}
+	lowmem_deathpending = NULL;
+	put_task_struct(p);
+	return 0;
+}
+
+/*
+ * lowmem_select_tracked - picks the largest process from the highest bucket
+ * at or above 'min_adj' that has a live one.
+ *
+ * Caller holds lowmem_lock and rcu_read_lock.
+ */
+static struct task_struct *lowmem_select_tracked(int min_adj, int *tasksize)
+{
+	struct lowmem_task *lt, *next;
+	struct task_struct *p, *selected = NULL;
+	int adj;
+
+	for (adj = OOM_ADJUST_MAX; adj >= min_adj && adj >= OOM_ADJUST_MIN;
+	     adj--) {
+		list_for_each_entry_safe(lt, next,
+				&lowmem_buckets[adj - OOM_ADJUST_MIN], bucket) {
+			p = lowmem_task_alive(lt);
+			if (!p || (selected && lt->rss <= *tasksize))
+				continue;
+			selected = p;
+			*tasksize = lt->rss;
+			lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
+			             p->pid, p->comm, p->oomkilladj, *tasksize);
+		}
+		if (selected)
+			break;
+	}
+	return selected;
+}
+
+/*
+ * lowmem_select_any - the full walk, for when some process is untracked:
+ * returns a process that beats 'selected', or NULL. The rss is only read
+ * for processes at or above the best oom_adj found so far.
+ *
+ * Caller holds rcu_read_lock, but not lowmem_lock.
+ */
+static struct task_struct *lowmem_select_any(struct task_struct *selected,
+					     int min_adj, int *tasksize)
 {
 	struct task_struct *p;
+	struct task_struct *found = NULL;
+	int size;
+
+	for_each_process(p) {
+		if (p->oomkilladj < min_adj || !p->mm)
+			continue;
+		if (selected && p->oomkilladj < selected->oomkilladj)
+			continue;
+		size = lowmem_task_rss(p);
+		if (size <= 0)
+			continue;
+		if (selected && p->oomkilladj == selected->oomkilladj &&
+		    size <= *tasksize)
+			continue;
+		found = p;
+		selected = p;
+		*tasksize = size;
+		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
+		             p->pid, p->comm, p->oomkilladj, size);
+	}
+	return found;
+}
+
+static int lowmem_shrink(int nr_to_scan, gfp_t gfp_mask)
+{
 	struct task_struct *selected = NULL;
+	struct task_struct *p;
 	int rem = 0;
-	int tasksize;
 	int i;
+	int untracked;
 	int min_adj = OOM_ADJUST_MAX + 1;
 	int selected_tasksize = 0;
-	int array_size = ARRAY_SIZE(lowmem_adj);
+	int array_size = lowmem_array_size();
 	int other_free = global_page_state(NR_FREE_PAGES);
 	int other_file = global_page_state(NR_FILE_PAGES);
-	if(lowmem_adj_size < array_size)
-		array_size = lowmem_adj_size;
-	if(lowmem_minfree_size < array_size)
-		array_size = lowmem_minfree_size;
+	lowmem_pressure_update(array_size, other_free, other_file);
 	for(i = 0; i < array_size; i++) {
 		if (other_free < lowmem_minfree[i] &&
 		    other_file < lowmem_minfree[i]) {
@@ -82,46 +541,102 @@ static int lowmem_shrink(int nr_to_scan, gfp_t gfp_mask)
 		return rem;
 	}
 
-	read_lock(&tasklist_lock);
-	for_each_process(p) {
-		if (p->oomkilladj < min_adj || !p->mm)
-			continue;
-		tasksize = get_mm_rss(p->mm);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (p->oomkilladj < selected->oomkilladj)
-				continue;
-			if (p->oomkilladj == selected->oomkilladj &&
-			    tasksize <= selected_tasksize)
-				continue;
+	spin_lock(&lowmem_lock);
+	if (lowmem_deathpending_busy()) {
+		lowmem_print(3, "lowmem_shrink %d, %x, %d (%s) still exiting, return %d\n",
+		             nr_to_scan, gfp_mask, lowmem_deathpending->pid,
+		             lowmem_deathpending->comm, rem);
+		spin_unlock(&lowmem_lock);
+		return rem;
+	}
+	rcu_read_lock();
+	selected = lowmem_select_tracked(min_adj, &selected_tasksize);
+	if (selected)
+		get_task_struct(selected);
+	rcu_read_unlock();
+	untracked = lowmem_untracked;
+	spin_unlock(&lowmem_lock);
+
+	if (untracked) {
+		rcu_read_lock();
+		p = lowmem_select_any(selected, min_adj, &selected_tasksize);
+		if (p) {
+			get_task_struct(p);
+			if (selected)
+				put_task_struct(selected);
+			selected = p;
 		}
-		selected = p;
-		selected_tasksize = tasksize;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-		             p->pid, p->comm, p->oomkilladj, tasksize);
+		rcu_read_unlock();
 	}
-	if(selected != NULL) {
-		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
-		             selected->pid, selected->comm,
-		             selected->oomkilladj, selected_tasksize);
-		force_sig(SIGKILL, selected);
-		rem -= selected_tasksize;
+	if (selected == NULL)
+		goto out;
+
+	spin_lock(&lowmem_lock);
+	if (lowmem_deathpending_busy()) {
+		/* another shrinker call killed something meanwhile */
+		spin_unlock(&lowmem_lock);
+		put_task_struct(selected);
+		goto out;
 	}
+	lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
+	             selected->pid, selected->comm,
+	             selected->oomkilladj, selected_tasksize);
+	force_sig(SIGKILL, selected);
+	lowmem_deathpending = selected;
+	lowmem_deathpending_timeout = jiffies + HZ;
+	rem -= selected_tasksize;
+	spin_unlock(&lowmem_lock);
+out:
 	lowmem_print(4, "lowmem_shrink %d, %x, return %d\n", nr_to_scan, gfp_mask, rem);
-	read_unlock(&tasklist_lock);
 	return rem;
 }
 
+/* processes forked before the notifier was registered */
+static void __init lowmem_track_existing(void)
+{
+	struct task_struct *p;
+
+	rcu_read_lock();
+	for_each_process(p)
+		if (p->mm)
+			lowmem_track(p, p->oomkilladj, GFP_ATOMIC);
+	rcu_read_unlock();
+}
+
 static int __init lowmem_init(void)
 {
+	int i;
+
+	lowmem_task_cachep = KMEM_CACHE(lowmem_task, 0);
+	if (!lowmem_task_cachep)
+		return -ENOMEM;
+	for (i = 0; i < LOWMEM_BUCKETS; i++)
+		INIT_LIST_HEAD(&lowmem_buckets[i]);
+	register_oom_adj_notifier(&lowmem_adj_nb);
+	lowmem_track_existing();
 	register_shrinker(&lowmem_shrinker);
+	if (misc_register(&lowmem_pressure_misc))
+		printk(KERN_ERR "lowmemorykiller: failed to register "
+		       "pressure device\n");
 	return 0;
 }
 
 static void __exit lowmem_exit(void)
 {
+	struct lowmem_task *lt, *next;
+	int i;
+
+	misc_deregister(&lowmem_pressure_misc);
 	unregister_shrinker(&lowmem_shrinker);
+	cancel_delayed_work_sync(&lowmem_pressure_work);
+	unregister_oom_adj_notifier(&lowmem_adj_nb);
+	cancel_delayed_work_sync(&lowmem_retrack_work);
+	for (i = 0; i < LOWMEM_BUCKETS; i++)
+		list_for_each_entry_safe(lt, next, &lowmem_buckets[i], bucket)
+			lowmem_task_free(lt);
+	if (lowmem_deathpending)
+		put_task_struct(lowmem_deathpending);
+	kmem_cache_destroy(lowmem_task_cachep);
 }
 
 module_init(lowmem_init);
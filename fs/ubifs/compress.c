@@ -25,9 +25,16 @@
 /*
  * This file provides a single place to access to compression and
  * decompression.
+ *
+ * Compressors which have several compression contexts may compress on
+ * several CPUs at once. 'ubifs_compress_reqs()' makes use of this: it spreads
+ * a set of compression requests over the online CPUs using the
+ * @ubifs_compr_wq work-queue, and the caller compresses too.
  */
 
 #include <linux/crypto.h>
+#include <linux/cpu.h>
+#include <linux/workqueue.h>
 #include "ubifs.h"
 
 /* Fake description object for the "none" compressor */
@@ -43,6 +50,7 @@ static DEFINE_MUTEX(lzo_mutex);
 static struct ubifs_compressor lzo_compr = {
 	.compr_type = UBIFS_COMPR_LZO,
 	.comp_mutex = &lzo_mutex,
+	.max_ctx = UBIFS_MAX_COMPR_CTX,
 	.name = "lzo",
 	.capi_name = "lzo",
 };
@@ -74,6 +82,35 @@ static struct ubifs_compressor zlib_compr = {
 /* All UBIFS compressors */
 struct ubifs_compressor *ubifs_compressors[UBIFS_COMPR_TYPES_CNT];
 
+/* Work-queue used to compress on several CPUs at once */
+static struct workqueue_struct *ubifs_compr_wq;
+
+/**
+ * struct compr_batch - a set of compression requests being compressed.
+ * @reqs: the requests
+ * @cnt: count of requests
+ * @next: index of the next request to pick
+ * @pending: how many helpers (including the caller) are still running
+ * @done: completed when the last helper finishes
+ */
+struct compr_batch {
+	struct ubifs_compr_req *reqs;
+	int cnt;
+	atomic_t next;
+	atomic_t pending;
+	struct completion done;
+};
+
+/**
+ * struct compr_work - a work-queue helper compressing a batch.
+ * @work: the work
+ * @batch: the batch to help with
+ */
+struct compr_work {
+	struct work_struct work;
+	struct compr_batch *batch;
+};
+
 /**
  * ubifs_compress - compress data.
  * @in_buf: data to compress
@@ -105,12 +142,26 @@ void ubifs_compress(const void *in_buf, int in_len, void *out_buf, int *out_len,
 	if (in_len < UBIFS_MIN_COMPR_LEN)
 		goto no_compr;
 
-	if (compr->comp_mutex)
-		mutex_lock(compr->comp_mutex);
-	err = crypto_comp_compress(compr->cc, in_buf, in_len, out_buf,
-				   (unsigned int *)out_len);
-	if (compr->comp_mutex)
-		mutex_unlock(compr->comp_mutex);
+	if (compr->ctx) {
+		struct ubifs_compr_ctx *ctx;
+
+		/*
+		 * Any context would do, the CPU number is merely a hint which
+		 * keeps concurrent compressors off each other's mutex.
+		 */
+		ctx = &compr->ctx[raw_smp_processor_id() % compr->ctx_cnt];
+		mutex_lock(&ctx->mutex);
+		err = crypto_comp_compress(ctx->cc, in_buf, in_len, out_buf,
+					   (unsigned int *)out_len);
+		mutex_unlock(&ctx->mutex);
+	} else {
+		if (compr->comp_mutex)
+			mutex_lock(compr->comp_mutex);
+		err = crypto_comp_compress(compr->cc, in_buf, in_len, out_buf,
+					   (unsigned int *)out_len);
+		if (compr->comp_mutex)
+			mutex_unlock(compr->comp_mutex);
+	}
 	if (unlikely(err)) {
 		ubifs_warn("cannot compress %d bytes, compressor %s, "
 			   "error %d, leave data uncompressed",
@@ -133,6 +184,103 @@ no_compr:
 	*compr_type = UBIFS_COMPR_NONE;
 }
 
+/**
+ * compr_batch_run - compress requests of a batch until none is left.
+ * @b: the batch
+ */
+static void compr_batch_run(struct compr_batch *b)
+{
+	int i;
+
+	while ((i = atomic_inc_return(&b->next) - 1) < b->cnt) {
+		struct ubifs_compr_req *req = &b->reqs[i];
+
+		ubifs_compress(req->in_buf, req->in_len, req->out_buf,
+			       &req->out_len, &req->compr_type);
+	}
+}
+
+/**
+ * compr_work_func - work-queue helper function.
+ * @work: the &struct compr_work
+ *
+ * Note, the batch lives on the stack of the waiter, so it must not be
+ * touched after it has been completed.
+ */
+static void compr_work_func(struct work_struct *work)
+{
+	struct compr_work *cw = container_of(work, struct compr_work, work);
+	struct compr_batch *b = cw->batch;
+
+	compr_batch_run(b);
+	if (atomic_dec_and_test(&b->pending))
+		complete(&b->done);
+}
+
+/**
+ * ubifs_compress_reqs - compress several buffers in parallel.
+ * @reqs: compression requests
+ * @cnt: count of compression requests
+ *
+ * This function does the same as 'ubifs_compress()' for each element of
+ * @reqs, but if there is more than one online CPU, the requests are
+ * compressed on up to %UBIFS_MAX_COMPR_CTX CPUs at once. The caller takes
+ * part in compression as well, and the function returns when all requests
+ * have been compressed. The order in which requests are compressed is not
+ * defined.
+ */
+void ubifs_compress_reqs(struct ubifs_compr_req *reqs, int cnt)
+{
+	struct compr_work works[UBIFS_MAX_COMPR_CTX - 1];
+	struct compr_batch b;
+	int cpu, this_cpu, i, helpers;
+
+	helpers = min_t(int, num_online_cpus(), UBIFS_MAX_COMPR_CTX) - 1;
+	helpers = min(helpers, cnt - 1);
+	if (!ubifs_compr_wq || helpers <= 0) {
+		for (i = 0; i < cnt; i++)
+			ubifs_compress(reqs[i].in_buf, reqs[i].in_len,
+				       reqs[i].out_buf, &reqs[i].out_len,
+				       &reqs[i].compr_type);
+		return;
+	}
+
+	b.reqs = reqs;
+	b.cnt = cnt;
+	atomic_set(&b.next, 0);
+	init_completion(&b.done);
+
+	get_online_cpus();
+	this_cpu = raw_smp_processor_id();
+	i = 0;
+	for_each_online_cpu(cpu) {
+		if (i == helpers)
+			break;
+		if (cpu == this_cpu)
+			continue;
+		works[i].batch = &b;
+		INIT_WORK(&works[i].work, compr_work_func);
+		i += 1;
+	}
+	/* Count the caller as well */
+	helpers = i;
+	atomic_set(&b.pending, helpers + 1);
+	i = 0;
+	for_each_online_cpu(cpu) {
+		if (i == helpers)
+			break;
+		if (cpu == this_cpu)
+			continue;
+		queue_work_on(cpu, ubifs_compr_wq, &works[i].work);
+		i += 1;
+	}
+	put_online_cpus();
+
+	compr_batch_run(&b);
+	if (!atomic_dec_and_test(&b.pending))
+		wait_for_completion(&b.done);
+}
+
 /**
  * ubifs_decompress - decompress data.
  * @in_buf: data to decompress
@@ -182,6 +330,46 @@ int ubifs_decompress(const void *in_buf, int in_len, void *out_buf,
 	return err;
 }
 
+/**
+ * compr_ctx_init - allocate per-CPU compression contexts.
+ * @compr: compressor description object
+ *
+ * This function allocates one compression context per possible CPU, but not
+ * more than @compr->max_ctx. This is only an optimization, so if there is
+ * only one CPU or the contexts cannot be allocated, the compressor simply
+ * keeps using its single context.
+ */
+static void __init compr_ctx_init(struct ubifs_compressor *compr)
+{
+	int i, cnt = min_t(int, num_possible_cpus(), compr->max_ctx);
+
+	if (cnt < 2)
+		return;
+
+	compr->ctx = kcalloc(cnt, sizeof(struct ubifs_compr_ctx), GFP_KERNEL);
+	if (!compr->ctx)
+		return;
+
+	for (i = 0; i < cnt; i++) {
+		compr->ctx[i].cc = crypto_alloc_comp(compr->capi_name, 0, 0);
+		if (IS_ERR(compr->ctx[i].cc))
+			break;
+		mutex_init(&compr->ctx[i].mutex);
+	}
+
+	if (i < 2) {
+		if (i)
+			crypto_free_comp(compr->ctx[0].cc);
+		kfree(compr->ctx);
+		compr->ctx = NULL;
+		return;
+	}
+
+	compr->ctx_cnt = i;
+	dbg_gen("compressor %s uses %d compression contexts",
+		compr->name, compr->ctx_cnt);
+}
+
 /**
  * compr_init - initialize a compressor.
  * @compr: compressor description object
@@ -198,6 +386,7 @@ static int __init compr_init(struct ubifs_compressor *compr)
 				  compr->name, PTR_ERR(compr->cc));
 			return PTR_ERR(compr->cc);
 		}
+		compr_ctx_init(compr);
 	}
 
 	ubifs_compressors[compr->compr_type] = compr;
@@ -210,8 +399,14 @@ static int __init compr_init(struct ubifs_compressor *compr)
  */
 static void compr_exit(struct ubifs_compressor *compr)
 {
-	if (compr->capi_name)
+	int i;
+
+	if (compr->capi_name) {
+		for (i = 0; i < compr->ctx_cnt; i++)
+			crypto_free_comp(compr->ctx[i].cc);
+		kfree(compr->ctx);
 		crypto_free_comp(compr->cc);
+	}
 	return;
 }
 
@@ -234,6 +429,16 @@ int __init ubifs_compressors_init(void)
 		goto out_lzo;
 
 	ubifs_compressors[UBIFS_COMPR_NONE] = &none_compr;
+
+	/*
+	 * Parallel compression is an optimization, so carry on without it if
+	 * the work-queue cannot be created.
+	 */
+	if (lzo_compr.ctx_cnt > 1) {
+		ubifs_compr_wq = create_workqueue("ubifs_compr");
+		if (!ubifs_compr_wq)
+			ubifs_warn("cannot create compression work-queue");
+	}
 	return 0;
 
 out_lzo:
@@ -246,6 +451,8 @@ out_lzo:
  */
 void ubifs_compressors_exit(void)
 {
+	if (ubifs_compr_wq)
+		destroy_workqueue(ubifs_compr_wq);
 	compr_exit(&lzo_compr);
 	compr_exit(&zlib_compr);
 }
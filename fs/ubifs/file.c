@@ -54,6 +54,7 @@
 #include "ubifs.h"
 #include <linux/mount.h>
 #include <linux/namei.h>
+#include <linux/writeback.h>
 
 static int read_block(struct inode *inode, void *addr, unsigned int block,
 		      struct ubifs_data_node *dn)
@@ -880,6 +881,39 @@ static int ubifs_readpage(struct file *file, struct page *page)
 	return 0;
 }
 
+/**
+ * end_writepage - finish writing back a page.
+ * @c: UBIFS file-system description object
+ * @page: the page which has been written back
+ * @err: error code of the write-back
+ *
+ * This is a helper function which releases the budget of a kmapped, locked
+ * page under write-back, and unlocks it.
+ */
+static void end_writepage(struct ubifs_info *c, struct page *page, int err)
+{
+	if (err) {
+		SetPageError(page);
+		ubifs_err("cannot write page %lu of inode %lu, error %d",
+			  page->index, page->mapping->host->i_ino, err);
+		ubifs_ro_mode(c, err);
+	}
+
+	ubifs_assert(PagePrivate(page));
+	if (PageChecked(page))
+		release_new_page_budget(c);
+	else
+		release_existing_page_budget(c);
+
+	atomic_long_dec(&c->dirty_pg_cnt);
+	ClearPagePrivate(page);
+	ClearPageChecked(page);
+
+	kunmap(page);
+	unlock_page(page);
+	end_page_writeback(page);
+}
+
 static int do_writepage(struct page *page, int len)
 {
 	int err = 0, i, blen;
@@ -913,26 +947,7 @@ static int do_writepage(struct page *page, int len)
 		addr += blen;
 		len -= blen;
 	}
-	if (err) {
-		SetPageError(page);
-		ubifs_err("cannot write page %lu of inode %lu, error %d",
-			  page->index, inode->i_ino, err);
-		ubifs_ro_mode(c, err);
-	}
-
-	ubifs_assert(PagePrivate(page));
-	if (PageChecked(page))
-		release_new_page_budget(c);
-	else
-		release_existing_page_budget(c);
-
-	atomic_long_dec(&c->dirty_pg_cnt);
-	ClearPagePrivate(page);
-	ClearPageChecked(page);
-
-	kunmap(page);
-	unlock_page(page);
-	end_page_writeback(page);
+	end_writepage(c, page, err);
 	return err;
 }
 
@@ -1044,6 +1059,307 @@ out_unlock:
 	return err;
 }
 
+/*
+ * Write-back of many pages ('ubifs_writepages()') is done in batches: fully
+ * written pages which are within both @i_size and the synchronized inode size
+ * are collected in a batch, all the data nodes of the batch are compressed in
+ * parallel by 'ubifs_compress_reqs()', and then written to the journal one by
+ * one in page order, just like 'do_writepage()' would have written them. So
+ * the journal looks exactly as without batching, only compression is done on
+ * several CPUs. Other pages are handed to 'ubifs_writepage()' after the
+ * current batch has been written.
+ *
+ * The batch and its data node buffers are allocated once per file-system, at
+ * mount time, and used by one 'ubifs_writepages()' at a time; others fall back
+ * to 'generic_writepages()'.
+ *
+ * The pages of a batch stay locked until they are written, like in
+ * 'ubifs_writepage()'. This means we hold several page locks at a time, which
+ * is fine as long as they are taken in ascending index order. This is why
+ * 'ubifs_writepages()' does range-cyclic write-back by hand: it writes the
+ * batch out before wrapping around to the beginning of the file.
+ */
+
+/* Maximum count of pages in a write-back batch */
+#define WB_BATCH_PAGES (UBIFS_WB_BATCH_BLOCKS / UBIFS_BLOCKS_PER_PAGE)
+
+/**
+ * struct wb_batch - a write-back batch.
+ * @c: UBIFS file-system description object
+ * @inode: the inode which is written back
+ * @page_cnt: count of pages in the batch
+ * @next_index: index of the page after the last one seen by write-back
+ * @written: count of pages handed to write-back by 'write_cache_pages()'
+ * @pages: the pages of the batch, locked and in ascending index order
+ * @keys: data node keys
+ * @nodes: data node buffers
+ * @reqs: compression requests
+ */
+struct wb_batch {
+	struct ubifs_info *c;
+	struct inode *inode;
+	int page_cnt;
+	pgoff_t next_index;
+	long written;
+	struct page *pages[WB_BATCH_PAGES];
+	union ubifs_key keys[UBIFS_WB_BATCH_BLOCKS];
+	struct ubifs_data_node *nodes[UBIFS_WB_BATCH_BLOCKS];
+	struct ubifs_compr_req reqs[UBIFS_WB_BATCH_BLOCKS];
+};
+
+/**
+ * flush_wb_batch - write out a write-back batch.
+ * @b: the batch to write
+ *
+ * This function compresses all data nodes of the batch in parallel and writes
+ * them to the journal in page order. If a data node cannot be written, the
+ * file-system switches to R/O mode and the rest of the batch is dropped like
+ * 'do_writepage()' does. Returns zero in case of success and a negative error
+ * code in case of failure.
+ */
+static int flush_wb_batch(struct wb_batch *b)
+{
+	int i, j, n, dlen, err = 0;
+	unsigned int block;
+	void *addr;
+	struct ubifs_info *c = b->c;
+	struct ubifs_compr_req *req;
+
+	if (!b->page_cnt)
+		return 0;
+
+	dbg_gen("ino %lu, %d pages from %lu", b->inode->i_ino, b->page_cnt,
+		b->pages[0]->index);
+
+	for (i = n = 0; i < b->page_cnt; i++) {
+		struct page *page = b->pages[i];
+
+		/* Update radix tree tags */
+		set_page_writeback(page);
+
+		addr = kmap(page);
+		block = page->index << UBIFS_BLOCKS_PER_PAGE_SHIFT;
+		for (j = 0; j < UBIFS_BLOCKS_PER_PAGE; j++, n++) {
+			req = &b->reqs[n];
+			data_key_init(c, &b->keys[n], b->inode->i_ino, block + j);
+			req->compr_type = ubifs_jnl_prep_data(c, b->inode,
+							      b->nodes[n],
+							      &b->keys[n],
+							      UBIFS_BLOCK_SIZE);
+			req->in_buf = addr + j * UBIFS_BLOCK_SIZE;
+			req->in_len = UBIFS_BLOCK_SIZE;
+			req->out_buf = &b->nodes[n]->data;
+			req->out_len = UBIFS_BLOCK_SIZE * WORST_COMPR_FACTOR;
+		}
+	}
+
+	ubifs_compress_reqs(b->reqs, n);
+
+	for (i = n = 0; i < b->page_cnt; i++) {
+		for (j = 0; j < UBIFS_BLOCKS_PER_PAGE; j++, n++) {
+			if (err)
+				continue;
+			req = &b->reqs[n];
+			ubifs_assert(req->out_len <= UBIFS_BLOCK_SIZE);
+			b->nodes[n]->compr_type = cpu_to_le16(req->compr_type);
+			dlen = UBIFS_DATA_NODE_SZ + req->out_len;
+			err = ubifs_jnl_write_data_node(c, &b->keys[n],
+							b->nodes[n], dlen);
+		}
+		end_writepage(c, b->pages[i], err);
+	}
+
+	b->page_cnt = 0;
+	return err;
+}
+
+/**
+ * add_to_wb_batch - add a page to a write-back batch.
+ * @b: the batch
+ * @page: locked page to add
+ *
+ * This function returns zero if the page has been added, and a negative error
+ * code if the batch became full and writing it failed.
+ */
+static int add_to_wb_batch(struct wb_batch *b, struct page *page)
+{
+	b->pages[b->page_cnt++] = page;
+	if (b->page_cnt == WB_BATCH_PAGES)
+		return flush_wb_batch(b);
+	return 0;
+}
+
+/**
+ * ubifs_writepage_batched - 'write_cache_pages()' call-back.
+ * @page: locked page to write back
+ * @wbc: write-back control
+ * @data: the &struct wb_batch
+ *
+ * This function adds @page to the current write-back batch if it can be
+ * written like that. Otherwise it writes the batch out and then writes the
+ * page using 'ubifs_writepage()'.
+ */
+static int ubifs_writepage_batched(struct page *page,
+				   struct writeback_control *wbc, void *data)
+{
+	struct wb_batch *b = data;
+	struct ubifs_inode *ui = ubifs_inode(b->inode);
+	loff_t i_size = i_size_read(b->inode), synced_i_size;
+	pgoff_t end_index = i_size >> PAGE_CACHE_SHIFT;
+	int err, err1;
+
+	ubifs_assert(PagePrivate(page));
+	b->next_index = page->index + 1;
+	b->written += 1;
+
+	spin_lock(&ui->ui_lock);
+	synced_i_size = ui->synced_i_size;
+	spin_unlock(&ui->ui_lock);
+
+	if (page->index < end_index &&
+	    page->index < synced_i_size >> PAGE_CACHE_SHIFT)
+		return add_to_wb_batch(b, page);
+
+	err = flush_wb_batch(b);
+	err1 = ubifs_writepage(page, wbc);
+	return err ? err : err1;
+}
+
+/**
+ * writepages_range - write back a range of pages in batches.
+ * @mapping: the address space to write back
+ * @wbc: write-back control, not range-cyclic
+ * @b: write-back batch to use
+ */
+static int writepages_range(struct address_space *mapping,
+			    struct writeback_control *wbc, struct wb_batch *b)
+{
+	int err, err1;
+
+	err = write_cache_pages(mapping, wbc, ubifs_writepage_batched, b);
+	err1 = flush_wb_batch(b);
+	if (!err)
+		err = err1;
+	mapping_set_error(mapping, err);
+	return err;
+}
+
+static int ubifs_writepages(struct address_space *mapping,
+			    struct writeback_control *wbc)
+{
+	struct inode *inode = mapping->host;
+	struct ubifs_inode *ui = ubifs_inode(inode);
+	struct ubifs_info *c = inode->i_sb->s_fs_info;
+	loff_t range_start, range_end;
+	long nr_to_write = wbc->nr_to_write;
+	struct wb_batch *b;
+	pgoff_t index;
+	int err;
+
+	/*
+	 * Without compression, a compressor which can run on several CPUs, or
+	 * a second CPU there is nothing to gain.
+	 */
+	if (!(ui->flags & UBIFS_COMPR_FL) ||
+	    !ubifs_compressors[ui->compr_type]->ctx || num_online_cpus() < 2)
+		return generic_writepages(mapping, wbc);
+
+	/* Another inode is being written back in batches already */
+	if (!c->wb_batch || !mutex_trylock(&c->wb_batch_mutex))
+		return generic_writepages(mapping, wbc);
+	b = c->wb_batch;
+	b->inode = inode;
+	b->written = 0;
+
+	if (!wbc->range_cyclic) {
+		err = writepages_range(mapping, wbc, b);
+		goto out;
+	}
+
+	range_start = wbc->range_start;
+	range_end = wbc->range_end;
+	index = b->next_index = mapping->writeback_index;
+
+	wbc->range_cyclic = 0;
+	wbc->range_start = (loff_t)index << PAGE_CACHE_SHIFT;
+	wbc->range_end = LLONG_MAX;
+	err = writepages_range(mapping, wbc, b);
+	/*
+	 * 'write_cache_pages()' restores @wbc->nr_to_write when it returns, so
+	 * what is left of the budget is worked out from the pages it handed to
+	 * us.
+	 */
+	if (!err && index && !wbc->encountered_congestion &&
+	    (wbc->sync_mode != WB_SYNC_NONE || b->written < nr_to_write)) {
+		/* Wrap back to the start of the file */
+		if (wbc->sync_mode == WB_SYNC_NONE)
+			wbc->nr_to_write = nr_to_write - b->written;
+		wbc->range_start = 0;
+		wbc->range_end = ((loff_t)index << PAGE_CACHE_SHIFT) - 1;
+		err = writepages_range(mapping, wbc, b);
+		wbc->nr_to_write = nr_to_write;
+	}
+
+	wbc->range_cyclic = 1;
+	wbc->range_start = range_start;
+	wbc->range_end = range_end;
+	mapping->writeback_index = b->next_index;
+
+out:
+	mutex_unlock(&c->wb_batch_mutex);
+	return err;
+}
+
+/**
+ * ubifs_wb_batch_init - allocate the write-back batch of a file-system.
+ * @c: UBIFS file-system description object
+ *
+ * Batching only pays off with a second CPU to compress on, so nothing is
+ * allocated without one. If the memory cannot be allocated, write-back is
+ * just not batched.
+ */
+void ubifs_wb_batch_init(struct ubifs_info *c)
+{
+	int i, dlen = UBIFS_DATA_NODE_SZ + UBIFS_BLOCK_SIZE * WORST_COMPR_FACTOR;
+	struct wb_batch *b;
+
+	if (c->wb_batch || num_possible_cpus() < 2)
+		return;
+
+	b = kzalloc(sizeof(struct wb_batch), GFP_KERNEL);
+	if (!b)
+		goto out_warn;
+	b->c = c;
+	c->wb_batch = b;
+	for (i = 0; i < UBIFS_WB_BATCH_BLOCKS; i++) {
+		b->nodes[i] = kmalloc(dlen, GFP_KERNEL | __GFP_NOWARN);
+		if (!b->nodes[i]) {
+			ubifs_wb_batch_free(c);
+			goto out_warn;
+		}
+	}
+	return;
+
+out_warn:
+	ubifs_warn("cannot allocate write-back batch, not batching write-back");
+}
+
+/**
+ * ubifs_wb_batch_free - free the write-back batch of a file-system.
+ * @c: UBIFS file-system description object
+ */
+void ubifs_wb_batch_free(struct ubifs_info *c)
+{
+	int i;
+
+	if (!c->wb_batch)
+		return;
+	for (i = 0; i < UBIFS_WB_BATCH_BLOCKS; i++)
+		kfree(c->wb_batch->nodes[i]);
+	kfree(c->wb_batch);
+	c->wb_batch = NULL;
+}
+
 /**
  * do_attr_changes - change inode attributes.
  * @inode: inode to change attributes for
@@ -1544,6 +1860,7 @@ static int ubifs_file_mmap(struct file *file, struct vm_area_struct *vma)
 struct address_space_operations ubifs_file_address_operations = {
 	.readpage       = ubifs_readpage,
 	.writepage      = ubifs_writepage,
+	.writepages     = ubifs_writepages,
 	.write_begin    = ubifs_write_begin,
 	.write_end      = ubifs_write_end,
 	.invalidatepage = ubifs_invalidatepage,
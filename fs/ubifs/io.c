@@ -326,6 +326,30 @@ static void cancel_wbuf_timer_nolock(struct ubifs_wbuf *wbuf)
 	del_timer(&wbuf->timer);
 }
 
+/**
+ * wbufs_clear_dirt - clear the superblock dirty flag if no wbuf has data.
+ * @c: UBIFS file-system description object
+ *
+ * @c->vfs_sb->s_dirt tells others, e.g. the suspend path, that a write-buffer
+ * has data. 'ubifs_wbuf_write_nolock()' sets it after it has made the
+ * write-buffer non-empty, and this function clears it only while holding the
+ * locks of all write-buffers, so a write that races with it either is seen
+ * here or sets the flag again afterwards.
+ */
+static void wbufs_clear_dirt(struct ubifs_info *c)
+{
+	int i, used = 0;
+
+	for (i = 0; i < c->jhead_cnt; i++)
+		spin_lock_nested(&c->jheads[i].wbuf.lock, i);
+	for (i = 0; i < c->jhead_cnt; i++)
+		used |= c->jheads[i].wbuf.used;
+	if (!used)
+		c->vfs_sb->s_dirt = 0;
+	for (i = c->jhead_cnt - 1; i >= 0; i--)
+		spin_unlock(&c->jheads[i].wbuf.lock);
+}
+
 /**
  * ubifs_wbuf_sync_nolock - synchronize write-buffer.
  * @wbuf: write-buffer to synchronize
@@ -371,6 +395,9 @@ int ubifs_wbuf_sync_nolock(struct ubifs_wbuf *wbuf)
 	wbuf->next_ino = 0;
 	spin_unlock(&wbuf->lock);
 
+	if (c->vfs_sb->s_dirt)
+		wbufs_clear_dirt(c);
+
 	if (wbuf->sync_callback)
 		err = wbuf->sync_callback(c, wbuf->lnum,
 					  c->leb_size - wbuf->offs, dirt);
@@ -612,8 +639,11 @@ exit:
 			goto out;
 	}
 
-	if (wbuf->used)
+	if (wbuf->used) {
 		new_wbuf_timer_nolock(wbuf);
+		c->vfs_sb->s_dirt = 1;
+	} else if (c->vfs_sb->s_dirt)
+		wbufs_clear_dirt(c);
 
 	return 0;
 
@@ -672,33 +672,28 @@ out_ro:
 }
 
 /**
- * ubifs_jnl_write_data - write a data node to the journal.
+ * ubifs_jnl_prep_data - prepare a data node.
  * @c: UBIFS file-system description object
  * @inode: inode the data node belongs to
+ * @data: data node to prepare
  * @key: node key
- * @buf: buffer to write
- * @len: data length (must not exceed %UBIFS_BLOCK_SIZE)
+ * @len: uncompressed data length (must not exceed %UBIFS_BLOCK_SIZE)
  *
- * This function writes a data node to the journal. Returns %0 if the data node
- * was successfully written, and a negative error code in case of failure.
+ * This function initializes all the fields of data node @data except of the
+ * data itself and the compression type. Returns the compression type which
+ * should be used for the data. The caller has to compress the data to
+ * @data->data, set @data->compr_type and then write the node using
+ * 'ubifs_jnl_write_data_node()'. Note, @data has to be able to fit
+ * %UBIFS_BLOCK_SIZE * %WORST_COMPR_FACTOR bytes of data.
  */
-int ubifs_jnl_write_data(struct ubifs_info *c, const struct inode *inode,
-			 const union ubifs_key *key, const void *buf, int len)
+int ubifs_jnl_prep_data(struct ubifs_info *c, const struct inode *inode,
+			struct ubifs_data_node *data,
+			const union ubifs_key *key, int len)
 {
-	struct ubifs_data_node *data;
-	int err, lnum, offs, compr_type, out_len;
-	int dlen = UBIFS_DATA_NODE_SZ + UBIFS_BLOCK_SIZE * WORST_COMPR_FACTOR;
 	struct ubifs_inode *ui = ubifs_inode(inode);
 
-	dbg_jnl("ino %lu, blk %u, len %d, key %s",
-		(unsigned long)key_inum(c, key), key_block(c, key), len,
-		DBGKEY(key));
 	ubifs_assert(len <= UBIFS_BLOCK_SIZE);
 
-	data = kmalloc(dlen, GFP_NOFS);
-	if (!data)
-		return -ENOMEM;
-
 	data->ch.node_type = UBIFS_DATA_NODE;
 	key_write(c, key, &data->key);
 	data->size = cpu_to_le32(len);
@@ -706,21 +701,35 @@ int ubifs_jnl_write_data(struct ubifs_info *c, const struct inode *inode,
 
 	if (!(ui->flags & UBIFS_COMPR_FL))
 		/* Compression is disabled for this inode */
-		compr_type = UBIFS_COMPR_NONE;
-	else
-		compr_type = ui->compr_type;
+		return UBIFS_COMPR_NONE;
+	return ui->compr_type;
+}
 
-	out_len = dlen - UBIFS_DATA_NODE_SZ;
-	ubifs_compress(buf, len, &data->data, &out_len, &compr_type);
-	ubifs_assert(out_len <= UBIFS_BLOCK_SIZE);
+/**
+ * ubifs_jnl_write_data_node - write a prepared data node to the journal.
+ * @c: UBIFS file-system description object
+ * @key: node key
+ * @data: the data node, prepared by 'ubifs_jnl_prep_data()' and with the data
+ *        already compressed
+ * @dlen: data node length
+ *
+ * This function writes a data node to the journal. Returns %0 if the data node
+ * was successfully written, and a negative error code in case of failure.
+ */
+int ubifs_jnl_write_data_node(struct ubifs_info *c, const union ubifs_key *key,
+			      struct ubifs_data_node *data, int dlen)
+{
+	int err, lnum, offs;
 
-	dlen = UBIFS_DATA_NODE_SZ + out_len;
-	data->compr_type = cpu_to_le16(compr_type);
+	dbg_jnl("ino %lu, blk %u, len %d, key %s",
+		(unsigned long)key_inum(c, key), key_block(c, key),
+		le32_to_cpu(data->size), DBGKEY(key));
+	ubifs_assert(dlen <= UBIFS_DATA_NODE_SZ + UBIFS_BLOCK_SIZE);
 
 	/* Make reservation before allocating sequence numbers */
 	err = make_reservation(c, DATAHD, dlen);
 	if (err)
-		goto out_free;
+		return err;
 
 	err = write_node(c, DATAHD, data, dlen, &lnum, &offs);
 	if (err)
@@ -733,7 +742,6 @@ int ubifs_jnl_write_data(struct ubifs_info *c, const struct inode *inode,
 		goto out_ro;
 
 	finish_reservation(c);
-	kfree(data);
 	return 0;
 
 out_release:
@@ -741,7 +749,40 @@ out_release:
 out_ro:
 	ubifs_ro_mode(c, err);
 	finish_reservation(c);
-out_free:
+	return err;
+}
+
+/**
+ * ubifs_jnl_write_data - write a data node to the journal.
+ * @c: UBIFS file-system description object
+ * @inode: inode the data node belongs to
+ * @key: node key
+ * @buf: buffer to write
+ * @len: data length (must not exceed %UBIFS_BLOCK_SIZE)
+ *
+ * This function writes a data node to the journal. Returns %0 if the data node
+ * was successfully written, and a negative error code in case of failure.
+ */
+int ubifs_jnl_write_data(struct ubifs_info *c, const struct inode *inode,
+			 const union ubifs_key *key, const void *buf, int len)
+{
+	struct ubifs_data_node *data;
+	int err, compr_type, out_len;
+	int dlen = UBIFS_DATA_NODE_SZ + UBIFS_BLOCK_SIZE * WORST_COMPR_FACTOR;
+
+	data = kmalloc(dlen, GFP_NOFS);
+	if (!data)
+		return -ENOMEM;
+
+	compr_type = ubifs_jnl_prep_data(c, inode, data, key, len);
+	out_len = dlen - UBIFS_DATA_NODE_SZ;
+	ubifs_compress(buf, len, &data->data, &out_len, &compr_type);
+	ubifs_assert(out_len <= UBIFS_BLOCK_SIZE);
+
+	dlen = UBIFS_DATA_NODE_SZ + out_len;
+	data->compr_type = cpu_to_le16(compr_type);
+
+	err = ubifs_jnl_write_data_node(c, key, data, dlen);
 	kfree(data);
 	return err;
 }
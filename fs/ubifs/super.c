@@ -1172,6 +1172,7 @@ static int mount_ubifs(struct ubifs_info *c)
 
 	if (c->bulk_read == 1)
 		bu_init(c);
+	ubifs_wb_batch_init(c);
 
 	/*
 	 * We have to check all CRCs, even for data nodes, when we mount the FS
@@ -1418,6 +1419,7 @@ out_wbufs:
 out_cbuf:
 	kfree(c->cbuf);
 out_free:
+	ubifs_wb_batch_free(c);
 	kfree(c->bu.buf);
 	vfree(c->ileb_buf);
 	vfree(c->sbuf);
@@ -1456,6 +1458,7 @@ static void ubifs_umount(struct ubifs_info *c)
 	kfree(c->cbuf);
 	kfree(c->rcvrd_mst_node);
 	kfree(c->mst_node);
+	ubifs_wb_batch_free(c);
 	kfree(c->bu.buf);
 	vfree(c->ileb_buf);
 	vfree(c->sbuf);
@@ -1865,6 +1868,7 @@ static int ubifs_fill_super(struct super_block *sb, void *data, int silent)
 	mutex_init(&c->mst_mutex);
 	mutex_init(&c->umount_mutex);
 	mutex_init(&c->bu_mutex);
+	mutex_init(&c->wb_batch_mutex);
 	init_waitqueue_head(&c->cmt_wq);
 	c->buds = RB_ROOT;
 	c->old_idx = RB_ROOT;
@@ -153,6 +153,12 @@
 /* Maximum number of data nodes to bulk-read */
 #define UBIFS_MAX_BULK_READ 32
 
+/* Maximum number of compression contexts (and CPUs) a compressor may use */
+#define UBIFS_MAX_COMPR_CTX 8
+
+/* Maximum number of data nodes compressed in one write-back batch */
+#define UBIFS_WB_BATCH_BLOCKS 16
+
 /*
  * Lockdep classes for UBIFS inode @ui_mutex.
  */
@@ -800,24 +806,67 @@ struct ubifs_node_range {
 	int max_len;
 };
 
+/**
+ * struct ubifs_compr_ctx - compression context.
+ * @cc: cryptoapi compressor handle
+ * @mutex: serializes users of @cc
+ */
+struct ubifs_compr_ctx {
+	struct crypto_comp *cc;
+	struct mutex mutex;
+};
+
 /**
  * struct ubifs_compressor - UBIFS compressor description structure.
  * @compr_type: compressor type (%UBIFS_COMPR_LZO, etc)
  * @cc: cryptoapi compressor handle
  * @comp_mutex: mutex used during compression
  * @decomp_mutex: mutex used during decompression
+ * @ctx: compression contexts, used instead of @cc and @comp_mutex for
+ *       compression if not %NULL
+ * @ctx_cnt: count of elements in @ctx
+ * @max_ctx: how many compression contexts the compressor may use (%0 means
+ *           a single context is enough)
  * @name: compressor name
  * @capi_name: cryptoapi compressor name
+ *
+ * Compressors which are cheap to instantiate (LZO) get one compression
+ * context per possible CPU, up to @max_ctx, so that several CPUs may
+ * compress at the same time.
  */
 struct ubifs_compressor {
 	int compr_type;
 	struct crypto_comp *cc;
 	struct mutex *comp_mutex;
 	struct mutex *decomp_mutex;
+	struct ubifs_compr_ctx *ctx;
+	int ctx_cnt;
+	int max_ctx;
 	const char *name;
 	const char *capi_name;
 };
 
+/**
+ * struct ubifs_compr_req - compression request.
+ * @in_buf: data to compress
+ * @in_len: length of the data to compress
+ * @out_buf: output buffer
+ * @out_len: output buffer length on enter, compressed data length on exit
+ * @compr_type: type of compression to use on enter, actually used compression
+ *              type on exit
+ *
+ * A set of these is handed to 'ubifs_compress_reqs()' which compresses them
+ * in parallel. The fields have the same meaning as the 'ubifs_compress()'
+ * arguments.
+ */
+struct ubifs_compr_req {
+	const void *in_buf;
+	int in_len;
+	void *out_buf;
+	int out_len;
+	int compr_type;
+};
+
 /**
  * struct ubifs_budget_req - budget requirements of an operation.
  *
@@ -921,6 +970,7 @@ struct ubifs_mount_opts {
 };
 
 struct ubifs_debug_info;
+struct wb_batch;
 
 /**
  * struct ubifs_info - UBIFS file-system description data structure
@@ -992,6 +1042,8 @@ struct ubifs_debug_info;
  * @max_bu_buf_len: maximum bulk-read buffer length
  * @bu_mutex: protects the pre-allocated bulk-read buffer and @c->bu
  * @bu: pre-allocated bulk-read information
+ * @wb_batch_mutex: protects @wb_batch
+ * @wb_batch: pre-allocated write-back batch, %NULL if batching is disabled
  *
  * @log_lebs: number of logical eraseblocks in the log
  * @log_bytes: log size in bytes
@@ -1231,6 +1283,8 @@ struct ubifs_info {
 	int max_bu_buf_len;
 	struct mutex bu_mutex;
 	struct bu_info bu;
+	struct mutex wb_batch_mutex;
+	struct wb_batch *wb_batch;
 
 	int log_lebs;
 	long long log_bytes;
@@ -1470,6 +1524,11 @@ int ubifs_jnl_update(struct ubifs_info *c, const struct inode *dir,
 		     int deletion, int xent);
 int ubifs_jnl_write_data(struct ubifs_info *c, const struct inode *inode,
 			 const union ubifs_key *key, const void *buf, int len);
+int ubifs_jnl_prep_data(struct ubifs_info *c, const struct inode *inode,
+			struct ubifs_data_node *data,
+			const union ubifs_key *key, int len);
+int ubifs_jnl_write_data_node(struct ubifs_info *c, const union ubifs_key *key,
+			      struct ubifs_data_node *data, int dlen);
 int ubifs_jnl_write_inode(struct ubifs_info *c, const struct inode *inode);
 int ubifs_jnl_delete_inode(struct ubifs_info *c, const struct inode *inode);
 int ubifs_jnl_rename(struct ubifs_info *c, const struct inode *old_dir,
@@ -1667,6 +1726,8 @@ const struct ubifs_lprops *ubifs_fast_find_frdi_idx(struct ubifs_info *c);
 /* file.c */
 int ubifs_fsync(struct file *file, struct dentry *dentry, int datasync);
 int ubifs_setattr(struct dentry *dentry, struct iattr *attr);
+void ubifs_wb_batch_init(struct ubifs_info *c);
+void ubifs_wb_batch_free(struct ubifs_info *c);
 
 /* dir.c */
 struct inode *ubifs_new_inode(struct ubifs_info *c, const struct inode *dir,
@@ -1712,6 +1773,7 @@ int __init ubifs_compressors_init(void);
 void ubifs_compressors_exit(void);
 void ubifs_compress(const void *in_buf, int in_len, void *out_buf, int *out_len,
 		    int *compr_type);
+void ubifs_compress_reqs(struct ubifs_compr_req *reqs, int cnt);
 int ubifs_decompress(const void *buf, int len, void *out, int *out_len,
 		     int compr_type);
 
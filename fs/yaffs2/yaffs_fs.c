@@ -51,6 +51,8 @@ extern const char *yaffs_guts_c_version;
 #include <linux/interrupt.h>
 #include <linux/string.h>
 #include <linux/ctype.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
 
 #include "asm/div64.h"
 
@@ -122,15 +124,40 @@ unsigned int yaffs_traceMask = YAFFS_TRACE_BAD_BLOCKS;
 unsigned int yaffs_wr_attempts = YAFFS_WR_ATTEMPTS;
 unsigned int yaffs_auto_checkpoint = 1;
 
+/*
+ * Background GC: with yaffs_bg_gc set when a partition is mounted, a
+ * "yaffs-gc" thread per device takes over the passive GC from the write
+ * path. It sleeps until a write leaves GC to it, then, while fewer than
+ * yaffs_bg_gc_passive_pct percent of the blocks are erased, collects a
+ * little whenever the device is idle, retrying every
+ * yaffs_bg_gc_interval_ms while it is busy. Writes still collect inline,
+ * and aggressively, when they are about to run out of erased blocks. The
+ * thread collects aggressively then too, and also below
+ * yaffs_bg_gc_aggressive_pct percent of erased blocks, if that is set.
+ */
+unsigned int yaffs_bg_gc;
+unsigned int yaffs_bg_gc_interval_ms = 500;
+unsigned int yaffs_bg_gc_passive_pct = 25;
+unsigned int yaffs_bg_gc_aggressive_pct;
+
+/* Number of short op cache chunks per device, capped at YAFFS_MAX_SHORT_OP_CACHES */
+unsigned int yaffs_cache_chunks = 10;
+
 /* Module Parameters */
 #if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 5, 0))
 module_param(yaffs_traceMask, uint, 0644);
 module_param(yaffs_wr_attempts, uint, 0644);
 module_param(yaffs_auto_checkpoint, uint, 0644);
+module_param(yaffs_bg_gc, uint, 0644);
+module_param(yaffs_bg_gc_interval_ms, uint, 0644);
+module_param(yaffs_bg_gc_passive_pct, uint, 0644);
+module_param(yaffs_bg_gc_aggressive_pct, uint, 0644);
+module_param(yaffs_cache_chunks, uint, 0644);
 #else
 MODULE_PARM(yaffs_traceMask, "i");
 MODULE_PARM(yaffs_wr_attempts, "i");
 MODULE_PARM(yaffs_auto_checkpoint, "i");
+MODULE_PARM(yaffs_cache_chunks, "i");
 #endif
 
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 25))
@@ -262,8 +289,16 @@ static void *yaffs_follow_link(struct dentry *dentry, struct nameidata *nd);
 static int yaffs_follow_link(struct dentry *dentry, struct nameidata *nd);
 #endif
 
+#if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 0))
+static int yaffs_readpages(struct file *f, struct address_space *mapping,
+			   struct list_head *pages, unsigned nr_pages);
+#endif
+
 static struct address_space_operations yaffs_file_address_operations = {
 	.readpage = yaffs_readpage,
+#if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 0))
+	.readpages = yaffs_readpages,
+#endif
 	.writepage = yaffs_writepage,
 #if (YAFFS_USE_WRITE_BEGIN_END > 0)
 	.write_begin = yaffs_write_begin,
@@ -657,6 +692,85 @@ static int yaffs_readpage(struct file *f, struct page *pg)
 	return yaffs_readpage_unlock(f, pg);
 }
 
+#if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 0))
+/*
+ * readpages: read-ahead pages are first added to the page cache (and so
+ * locked), then read in batches under a single hold of the gross lock so a
+ * sequential read walks the file's chunks back to back. Taking the page
+ * locks before the gross lock keeps the same order as readpage.
+ */
+#define YAFFS_READPAGES_BATCH 16
+
+static void yaffs_readpages_batch(yaffs_Device *dev, yaffs_Object *obj,
+				  struct page **batch, int n)
+{
+	unsigned char *pg_buf;
+	struct page *pg;
+	int ret;
+	int i;
+
+	yaffs_GrossLock(dev);
+
+	for (i = 0; i < n; i++) {
+		pg = batch[i];
+		pg_buf = kmap(pg);
+
+		ret = yaffs_ReadDataFromFile(obj, pg_buf,
+					pg->index << PAGE_CACHE_SHIFT,
+					PAGE_CACHE_SIZE);
+		if (ret < 0) {
+			ClearPageUptodate(pg);
+			SetPageError(pg);
+		} else {
+			SetPageUptodate(pg);
+			ClearPageError(pg);
+		}
+
+		flush_dcache_page(pg);
+		kunmap(pg);
+	}
+
+	yaffs_GrossUnlock(dev);
+
+	for (i = 0; i < n; i++) {
+		unlock_page(batch[i]);
+		page_cache_release(batch[i]);
+	}
+}
+
+static int yaffs_readpages(struct file *f, struct address_space *mapping,
+			   struct list_head *pages, unsigned nr_pages)
+{
+	yaffs_Object *obj = yaffs_DentryToObject(f->f_dentry);
+	yaffs_Device *dev = obj->myDev;
+	struct page *batch[YAFFS_READPAGES_BATCH];
+	struct page *pg;
+	unsigned i;
+	int n = 0;
+
+	T(YAFFS_TRACE_OS, ("yaffs_readpages %u pages\n", nr_pages));
+
+	for (i = 0; i < nr_pages; i++) {
+		pg = list_entry(pages->prev, struct page, lru);
+		list_del(&pg->lru);
+		if (add_to_page_cache_lru(pg, mapping, pg->index, GFP_KERNEL)) {
+			/* Someone else has it in the cache already */
+			page_cache_release(pg);
+			continue;
+		}
+		batch[n++] = pg;
+		if (n == YAFFS_READPAGES_BATCH) {
+			yaffs_readpages_batch(dev, obj, batch, n);
+			n = 0;
+		}
+	}
+	if (n)
+		yaffs_readpages_batch(dev, obj, batch, n);
+
+	return 0;
+}
+#endif
+
 /* writepage inspired by/stolen from smbfs */
 
 #if (LINUX_VERSION_CODE > KERNEL_VERSION(2, 5, 0))
@@ -1727,12 +1841,109 @@ static int yaffs_remount_fs(struct super_block *sb, int *flags, char *data)
 }
 #endif
 
+static int yaffs_BackgroundGC(void *data)
+{
+	yaffs_Device *dev = (yaffs_Device *)data;
+	struct super_block *sb = (struct super_block *)dev->superBlock;
+	int nBlocks = dev->internalEndBlock - dev->internalStartBlock + 1;
+	int worked;
+	int busy;
+
+	T(YAFFS_TRACE_GC, ("yaffs: background GC thread started\n"));
+
+	set_freezable();
+
+	while (!kthread_should_stop()) {
+		worked = 0;
+		busy = 0;
+
+		/* Only collect when no one else is using the device */
+		if (!(sb->s_flags & MS_RDONLY)) {
+			if (!down_trylock(&dev->grossLock)) {
+				worked = yaffs_BackgroundGarbageCollect(dev,
+					nBlocks * yaffs_bg_gc_passive_pct / 100,
+					nBlocks * yaffs_bg_gc_aggressive_pct / 100);
+				if (!worked)
+					dev->bgGcWanted = 0;
+				up(&dev->grossLock);
+			} else
+				busy = 1;
+		}
+
+		try_to_freeze();
+
+		/* Keep going while there is work, but let others in */
+		if (worked)
+			schedule_timeout_interruptible(1);
+		else if (busy)
+			schedule_timeout_interruptible(
+				msecs_to_jiffies(yaffs_bg_gc_interval_ms));
+		else {
+			/* Nothing to do until a write wakes us */
+			set_current_state(TASK_INTERRUPTIBLE);
+			if (!dev->bgGcWanted && !kthread_should_stop())
+				schedule();
+			__set_current_state(TASK_RUNNING);
+		}
+	}
+
+	T(YAFFS_TRACE_GC, ("yaffs: background GC thread stopped\n"));
+	return 0;
+}
+
+static void yaffs_WakeBackgroundGC(yaffs_Device *dev)
+{
+	if (dev->bgGcThread)
+		wake_up_process(dev->bgGcThread);
+}
+
+static void yaffs_StartBackgroundGC(yaffs_Device *dev)
+{
+	struct task_struct *tsk;
+
+	if (!yaffs_bg_gc ||
+	    (((struct super_block *)dev->superBlock)->s_flags & MS_RDONLY))
+		return;
+
+	tsk = kthread_run(yaffs_BackgroundGC, dev, "yaffs-gc/%s", dev->name);
+	if (IS_ERR(tsk)) {
+		T(YAFFS_TRACE_ALWAYS,
+		  ("yaffs: could not start background GC thread\n"));
+		return;
+	}
+
+	yaffs_GrossLock(dev);
+	dev->bgGcThread = tsk;
+	dev->wakeBackgroundGC = yaffs_WakeBackgroundGC;
+	dev->bgGcWanted = 1;
+	dev->backgroundGC = 1;
+	yaffs_GrossUnlock(dev);
+	wake_up_process(tsk);
+}
+
+static void yaffs_StopBackgroundGC(yaffs_Device *dev)
+{
+	if (!dev->bgGcThread)
+		return;
+
+	yaffs_GrossLock(dev);
+	dev->backgroundGC = 0;
+	dev->wakeBackgroundGC = NULL;
+	yaffs_GrossUnlock(dev);
+
+	/* The thread may be waiting for the lock, so don't hold it here */
+	kthread_stop(dev->bgGcThread);
+	dev->bgGcThread = NULL;
+}
+
 static void yaffs_put_super(struct super_block *sb)
 {
 	yaffs_Device *dev = yaffs_SuperToDevice(sb);
 
 	T(YAFFS_TRACE_OS, ("yaffs_put_super\n"));
 
+	yaffs_StopBackgroundGC(dev);
+
 	yaffs_GrossLock(dev);
 
 	yaffs_FlushEntireDeviceCache(dev);
@@ -2021,7 +2232,7 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 	dev->nChunksPerBlock = YAFFS_CHUNKS_PER_BLOCK;
 	dev->totalBytesPerChunk = YAFFS_BYTES_PER_CHUNK;
 	dev->nReservedBlocks = 5;
-	dev->nShortOpCaches = (options.no_cache) ? 0 : 10;
+	dev->nShortOpCaches = (options.no_cache) ? 0 : yaffs_cache_chunks;
 	dev->inbandTags = options.inband_tags;
 
 	/* ... and the functions. */
@@ -2120,6 +2331,8 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 	}
 	sb->s_root = root;
 	sb->s_dirt = !dev->isCheckpointed;
+
+	yaffs_StartBackgroundGC(dev);
 	T(YAFFS_TRACE_ALWAYS,
 	  ("yaffs_read_super: isCheckpointed %d\n", dev->isCheckpointed));
 
@@ -2255,6 +2468,9 @@ static char *yaffs_dump_dev(char *buf, yaffs_Device * dev)
 	buf += sprintf(buf, "tagsEccFixed....... %d\n", dev->tagsEccFixed);
 	buf += sprintf(buf, "tagsEccUnfixed..... %d\n", dev->tagsEccUnfixed);
 	buf += sprintf(buf, "cacheHits.......... %d\n", dev->cacheHits);
+	buf += sprintf(buf, "cacheMisses........ %d\n", dev->cacheMisses);
+	buf += sprintf(buf, "cacheEvictions..... %d\n", dev->cacheEvictions);
+	buf += sprintf(buf, "cacheWriteBacks.... %d\n", dev->cacheWriteBacks);
 	buf += sprintf(buf, "nDeletedFiles...... %d\n", dev->nDeletedFiles);
 	buf += sprintf(buf, "nUnlinkedFiles..... %d\n", dev->nUnlinkedFiles);
 	buf +=
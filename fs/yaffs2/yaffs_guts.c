@@ -3184,6 +3184,22 @@ static int yaffs_GarbageCollectBlock(yaffs_Device *dev, int block,
 	return retVal;
 }
 
+/*
+ * Below this many erased blocks a write is about to run short, so GC must
+ * collect aggressively: the reserved blocks, the blocks the next checkpoint
+ * still needs, and a little slack.
+ */
+static int yaffs_GcAggressiveBlocks(yaffs_Device *dev)
+{
+	int checkpointBlockAdjust;
+
+	checkpointBlockAdjust = yaffs_CalcCheckpointBlocksRequired(dev) - dev->blocksInCheckpoint;
+	if (checkpointBlockAdjust < 0)
+		checkpointBlockAdjust = 0;
+
+	return dev->nReservedBlocks + checkpointBlockAdjust + 2;
+}
+
 /* New garbage collector
  * If we're very low on erased blocks then we do aggressive garbage collection
  * otherwise we do "leasurely" garbage collection.
@@ -3200,8 +3216,6 @@ static int yaffs_CheckGarbageCollection(yaffs_Device *dev)
 	int gcOk = YAFFS_OK;
 	int maxTries = 0;
 
-	int checkpointBlockAdjust;
-
 	if (dev->isDoingGC) {
 		/* Bail out so we don't get recursive gc */
 		return YAFFS_OK;
@@ -3214,16 +3228,21 @@ static int yaffs_CheckGarbageCollection(yaffs_Device *dev)
 	do {
 		maxTries++;
 
-		checkpointBlockAdjust = yaffs_CalcCheckpointBlocksRequired(dev) - dev->blocksInCheckpoint;
-		if (checkpointBlockAdjust < 0)
-			checkpointBlockAdjust = 0;
-
-		if (dev->nErasedBlocks < (dev->nReservedBlocks + checkpointBlockAdjust + 2)) {
+		if (dev->nErasedBlocks < yaffs_GcAggressiveBlocks(dev)) {
 			/* We need a block soon...*/
 			aggressive = 1;
 		} else {
 			/* We're in no hurry */
 			aggressive = 0;
+
+			/* Leave it to the background thread, awake it if asleep */
+			if (dev->backgroundGC) {
+				if (!dev->bgGcWanted && dev->wakeBackgroundGC) {
+					dev->bgGcWanted = 1;
+					dev->wakeBackgroundGC(dev);
+				}
+				return YAFFS_OK;
+			}
 		}
 
 		if (dev->gcBlock <= 0) {
@@ -3259,6 +3278,52 @@ static int yaffs_CheckGarbageCollection(yaffs_Device *dev)
 	return aggressive ? gcOk : YAFFS_OK;
 }
 
+/*
+ * yaffs_BackgroundGarbageCollect
+ * Called from the background GC thread, with the device otherwise idle.
+ * Does one step of garbage collection if fewer than passiveBlocks blocks
+ * are erased, or if a block is part way through being collected. As in the
+ * write path, the step is aggressive (any dirty block, whole block at once)
+ * when the device is about to run short of erased blocks, or if fewer than
+ * aggressiveBlocks are erased; otherwise the passive selection keeps write
+ * amplification down.
+ * Returns 1 if some collection was done, 0 if there was nothing to do.
+ */
+int yaffs_BackgroundGarbageCollect(yaffs_Device *dev, int passiveBlocks,
+				   int aggressiveBlocks)
+{
+	int aggressive;
+
+	if (dev->isDoingGC)
+		return 0;
+
+	if (dev->gcBlock <= 0 && dev->nErasedBlocks >= passiveBlocks)
+		return 0;
+
+	aggressive = (dev->nErasedBlocks < yaffs_GcAggressiveBlocks(dev) ||
+		      dev->nErasedBlocks < aggressiveBlocks);
+
+	if (dev->gcBlock <= 0) {
+		dev->gcBlock = yaffs_FindBlockForGarbageCollection(dev, aggressive);
+		dev->gcChunk = 0;
+	}
+
+	if (dev->gcBlock <= 0)
+		return 0;
+
+	dev->garbageCollections++;
+	if (!aggressive)
+		dev->passiveGarbageCollections++;
+
+	T(YAFFS_TRACE_GC,
+	  (TSTR("yaffs: background GC erasedBlocks %d aggressive %d" TENDSTR),
+	   dev->nErasedBlocks, aggressive));
+
+	yaffs_GarbageCollectBlock(dev, dev->gcBlock, aggressive);
+
+	return 1;
+}
+
 /*-------------------------  TAGS --------------------------------*/
 
 static int yaffs_TagsMatch(const yaffs_ExtendedTags *tags, int objectId,
@@ -3518,7 +3583,40 @@ static int yaffs_PutChunkIntoFile(yaffs_Object *in, int chunkInInode,
 static int yaffs_ReadChunkDataFromObject(yaffs_Object *in, int chunkInInode,
 					__u8 *buffer)
 {
-	int chunkInNAND = yaffs_FindChunkInFile(in, chunkInInode, NULL);
+	yaffs_Device *dev = in->myDev;
+	int chunkInNAND;
+
+	/*
+	 * With one chunk per group the tnode names the chunk exactly, so read
+	 * the data together with the tags that confirm it in one NAND access
+	 * rather than reading the tags first and the data second.
+	 */
+	if (dev->chunkGroupSize == 1 && !dev->inbandTags) {
+		yaffs_Tnode *tn;
+		yaffs_ExtendedTags tags;
+		int result;
+
+		tn = yaffs_FindLevel0Tnode(dev, &in->variant.fileVariant,
+					chunkInInode);
+		chunkInNAND = tn ? yaffs_GetChunkGroupBase(dev, tn, chunkInInode) : 0;
+
+		if (chunkInNAND &&
+		    yaffs_CheckChunkBit(dev, chunkInNAND / dev->nChunksPerBlock,
+					chunkInNAND % dev->nChunksPerBlock)) {
+			result = yaffs_ReadChunkWithTagsFromNAND(dev, chunkInNAND,
+								buffer, &tags);
+			if (yaffs_TagsMatch(&tags, in->objectId, chunkInInode))
+				return result;
+		}
+
+		T(YAFFS_TRACE_NANDACCESS,
+		  (TSTR("Chunk %d not found zero instead" TENDSTR),
+		   chunkInInode));
+		memset(buffer, 0, dev->nDataBytesPerChunk);
+		return 0;
+	}
+
+	chunkInNAND = yaffs_FindChunkInFile(in, chunkInInode, NULL);
 
 	if (chunkInNAND >= 0)
 		return yaffs_ReadChunkWithTagsFromNAND(in->myDev, chunkInNAND,
@@ -3826,19 +3924,39 @@ int yaffs_UpdateObjectHeader(yaffs_Object *in, const YCHAR *name, int force,
  *   In Linux, the page cache provides read buffering aand the short op cache provides write
  *   buffering.
  *
- *   There are a limited number (~10) of cache chunks per device so that we don't
- *   need a very intelligent search.
+ *   The cache entries are hashed on (object, chunk) and kept on an LRU list
+ *   so that larger caches (eg. for databases doing many small writes) stay
+ *   cheap to search. Unused entries sit on a free list.
  */
 
+static int yaffs_ChunkCacheHash(const yaffs_Object *obj, int chunkId)
+{
+	return (obj->objectId * 31 + chunkId) & obj->myDev->srCacheHashMask;
+}
+
+/* Unhash an entry, dropping any dirty data, and put it on the free list. */
+static void yaffs_ReleaseChunkCache(yaffs_Device *dev, yaffs_ChunkCache *cache)
+{
+	if (cache->dirty)
+		dev->srCacheDirty--;
+	cache->dirty = 0;
+	cache->object = NULL;
+	ylist_del_init(&cache->hashLink);
+	ylist_del(&cache->lruLink);
+	ylist_add(&cache->lruLink, &dev->srCacheFree);
+}
+
 static int yaffs_ObjectHasCachedWriteData(yaffs_Object *obj)
 {
 	yaffs_Device *dev = obj->myDev;
-	int i;
+	struct ylist_head *i;
 	yaffs_ChunkCache *cache;
-	int nCaches = obj->myDev->nShortOpCaches;
 
-	for (i = 0; i < nCaches; i++) {
-		cache = &dev->srCache[i];
+	if (!dev->srCacheDirty)
+		return 0;
+
+	ylist_for_each(i, &dev->srCacheLru) {
+		cache = ylist_entry(i, yaffs_ChunkCache, lruLink);
 		if (cache->object == obj &&
 		    cache->dirty)
 			return 1;
@@ -3847,56 +3965,61 @@ static int yaffs_ObjectHasCachedWriteData(yaffs_Object *obj)
 	return 0;
 }
 
+static int yaffs_ChunkCacheCompare(const void *a, const void *b)
+{
+	const yaffs_ChunkCache *ca = *(yaffs_ChunkCache * const *)a;
+	const yaffs_ChunkCache *cb = *(yaffs_ChunkCache * const *)b;
+
+	return ca->chunkId - cb->chunkId;
+}
 
 static void yaffs_FlushFilesChunkCache(yaffs_Object *obj)
 {
 	yaffs_Device *dev = obj->myDev;
-	int lowest = -99;	/* Stop compiler whining. */
-	int i;
+	yaffs_ChunkCache **flushList = dev->srFlushList;
 	yaffs_ChunkCache *cache;
-	int chunkWritten = 0;
-	int nCaches = obj->myDev->nShortOpCaches;
-
-	if (nCaches > 0) {
-		do {
-			cache = NULL;
-
-			/* Find the dirty cache for this object with the lowest chunk id. */
-			for (i = 0; i < nCaches; i++) {
-				if (dev->srCache[i].object == obj &&
-				    dev->srCache[i].dirty) {
-					if (!cache
-					    || dev->srCache[i].chunkId <
-					    lowest) {
-						cache = &dev->srCache[i];
-						lowest = cache->chunkId;
-					}
-				}
-			}
+	struct ylist_head *i;
+	int chunkWritten = 1;
+	int nDirty = 0;
+	int n;
 
-			if (cache && !cache->locked) {
-				/* Write it out and free it up */
+	if (dev->nShortOpCaches < 1 || !dev->srCacheDirty)
+		return;
 
-				chunkWritten =
-				    yaffs_WriteChunkDataToObject(cache->object,
-								 cache->chunkId,
-								 cache->data,
-								 cache->nBytes,
-								 1);
-				cache->dirty = 0;
-				cache->object = NULL;
-			}
+	/* Gather the object's dirty chunks and write them back in chunk order. */
+	ylist_for_each(i, &dev->srCacheLru) {
+		cache = ylist_entry(i, yaffs_ChunkCache, lruLink);
+		if (cache->object == obj &&
+		    cache->dirty &&
+		    !cache->locked)
+			flushList[nDirty++] = cache;
+	}
 
-		} while (cache && chunkWritten > 0);
+	if (nDirty > 1)
+		yaffs_qsort(flushList, nDirty, sizeof(yaffs_ChunkCache *),
+			yaffs_ChunkCacheCompare);
 
-		if (cache) {
-			/* Hoosterman, disk full while writing cache out. */
-			T(YAFFS_TRACE_ERROR,
-			  (TSTR("yaffs tragedy: no space during cache write" TENDSTR)));
+	for (n = 0; n < nDirty && chunkWritten > 0; n++) {
+		cache = flushList[n];
+		if (cache->object != obj || !cache->dirty)
+			continue;
 
-		}
+		/* Write it out and free it up */
+		chunkWritten =
+		    yaffs_WriteChunkDataToObject(cache->object,
+						 cache->chunkId,
+						 cache->data,
+						 cache->nBytes,
+						 1);
+		dev->cacheWriteBacks++;
+		yaffs_ReleaseChunkCache(dev, cache);
 	}
 
+	if (chunkWritten <= 0) {
+		/* Hoosterman, disk full while writing cache out. */
+		T(YAFFS_TRACE_ERROR,
+		  (TSTR("yaffs tragedy: no space during cache write" TENDSTR)));
+	}
 }
 
 /*yaffs_FlushEntireDeviceCache(dev)
@@ -3907,19 +4030,25 @@ static void yaffs_FlushFilesChunkCache(yaffs_Object *obj)
 void yaffs_FlushEntireDeviceCache(yaffs_Device *dev)
 {
 	yaffs_Object *obj;
-	int nCaches = dev->nShortOpCaches;
-	int i;
+	yaffs_ChunkCache *cache;
+	struct ylist_head *i;
+
+	if (dev->nShortOpCaches < 1)
+		return;
 
 	/* Find a dirty object in the cache and flush it...
 	 * until there are no further dirty objects.
 	 */
 	do {
 		obj = NULL;
-		for (i = 0; i < nCaches && !obj; i++) {
-			if (dev->srCache[i].object &&
-			    dev->srCache[i].dirty)
-				obj = dev->srCache[i].object;
-
+		if (dev->srCacheDirty) {
+			ylist_for_each(i, &dev->srCacheLru) {
+				cache = ylist_entry(i, yaffs_ChunkCache, lruLink);
+				if (cache->dirty) {
+					obj = cache->object;
+					break;
+				}
+			}
 		}
 		if (obj)
 			yaffs_FlushFilesChunkCache(obj);
@@ -3929,74 +4058,60 @@ void yaffs_FlushEntireDeviceCache(yaffs_Device *dev)
 }
 
 
-/* Grab us a cache chunk for use.
+/* Grab us a cache chunk for obj/chunkId and make it the most recently used.
  * First look for an empty one.
  * Then look for the least recently used non-dirty one.
- * Then look for the least recently used dirty one...., flush and look again.
+ * Then take the least recently used dirty one and write back all of its
+ * object's dirty chunks, which frees it up.
  */
-static yaffs_ChunkCache *yaffs_GrabChunkCacheWorker(yaffs_Device *dev)
-{
-	int i;
-
-	if (dev->nShortOpCaches > 0) {
-		for (i = 0; i < dev->nShortOpCaches; i++) {
-			if (!dev->srCache[i].object)
-				return &dev->srCache[i];
-		}
-	}
-
-	return NULL;
-}
-
-static yaffs_ChunkCache *yaffs_GrabChunkCache(yaffs_Device *dev)
+static yaffs_ChunkCache *yaffs_GrabChunkCache(yaffs_Object *obj, int chunkId)
 {
+	yaffs_Device *dev = obj->myDev;
 	yaffs_ChunkCache *cache;
-	yaffs_Object *theObj;
-	int usage;
-	int i;
-	int pushout;
-
-	if (dev->nShortOpCaches > 0) {
-		/* Try find a non-dirty one... */
-
-		cache = yaffs_GrabChunkCacheWorker(dev);
+	yaffs_ChunkCache *victim = NULL;
+	struct ylist_head *i;
 
-		if (!cache) {
-			/* They were all dirty, find the last recently used object and flush
-			 * its cache, then  find again.
-			 * NB what's here is not very accurate, we actually flush the object
-			 * the last recently used page.
-			 */
+	if (dev->nShortOpCaches < 1)
+		return NULL;
 
-			/* With locking we can't assume we can use entry zero */
+	if (ylist_empty(&dev->srCacheFree)) {
+		for (i = dev->srCacheLru.prev; i != &dev->srCacheLru; i = i->prev) {
+			cache = ylist_entry(i, yaffs_ChunkCache, lruLink);
+			if (cache->locked)
+				continue;
+			if (!cache->dirty) {
+				victim = cache;
+				break;
+			}
+			if (!victim)
+				victim = cache;
+		}
 
-			theObj = NULL;
-			usage = -1;
-			cache = NULL;
-			pushout = -1;
+		if (!victim)
+			return NULL;
 
-			for (i = 0; i < dev->nShortOpCaches; i++) {
-				if (dev->srCache[i].object &&
-				    !dev->srCache[i].locked &&
-				    (dev->srCache[i].lastUse < usage || !cache)) {
-					usage = dev->srCache[i].lastUse;
-					theObj = dev->srCache[i].object;
-					cache = &dev->srCache[i];
-					pushout = i;
-				}
-			}
+		dev->cacheEvictions++;
+		if (victim->dirty)
+			yaffs_FlushFilesChunkCache(victim->object);
+		else
+			yaffs_ReleaseChunkCache(dev, victim);
 
-			if (!cache || cache->dirty) {
-				/* Flush and try again */
-				yaffs_FlushFilesChunkCache(theObj);
-				cache = yaffs_GrabChunkCacheWorker(dev);
-			}
+		if (ylist_empty(&dev->srCacheFree))
+			return NULL;
+	}
 
-		}
-		return cache;
-	} else
-		return NULL;
+	cache = ylist_entry(dev->srCacheFree.next, yaffs_ChunkCache, lruLink);
+	cache->object = obj;
+	cache->chunkId = chunkId;
+	cache->dirty = 0;
+	cache->locked = 0;
+	cache->nBytes = 0;
+	ylist_add(&cache->hashLink,
+		&dev->srCacheHash[yaffs_ChunkCacheHash(obj, chunkId)]);
+	ylist_del(&cache->lruLink);
+	ylist_add(&cache->lruLink, &dev->srCacheLru);
 
+	return cache;
 }
 
 /* Find a cached chunk */
@@ -4004,41 +4119,37 @@ static yaffs_ChunkCache *yaffs_FindChunkCache(const yaffs_Object *obj,
 					      int chunkId)
 {
 	yaffs_Device *dev = obj->myDev;
-	int i;
+	yaffs_ChunkCache *cache;
+	struct ylist_head *i;
+
 	if (dev->nShortOpCaches > 0) {
-		for (i = 0; i < dev->nShortOpCaches; i++) {
-			if (dev->srCache[i].object == obj &&
-			    dev->srCache[i].chunkId == chunkId) {
+		ylist_for_each(i, &dev->srCacheHash[yaffs_ChunkCacheHash(obj, chunkId)]) {
+			cache = ylist_entry(i, yaffs_ChunkCache, hashLink);
+			if (cache->object == obj &&
+			    cache->chunkId == chunkId) {
 				dev->cacheHits++;
 
-				return &dev->srCache[i];
+				return cache;
 			}
 		}
+		dev->cacheMisses++;
 	}
 	return NULL;
 }
 
-/* Mark the chunk for the least recently used algorithym */
+/* Mark the chunk as the most recently used one */
 static void yaffs_UseChunkCache(yaffs_Device *dev, yaffs_ChunkCache *cache,
 				int isAWrite)
 {
 
 	if (dev->nShortOpCaches > 0) {
-		if (dev->srLastUse < 0 || dev->srLastUse > 100000000) {
-			/* Reset the cache usages */
-			int i;
-			for (i = 1; i < dev->nShortOpCaches; i++)
-				dev->srCache[i].lastUse = 0;
-
-			dev->srLastUse = 0;
-		}
+		ylist_del(&cache->lruLink);
+		ylist_add(&cache->lruLink, &dev->srCacheLru);
 
-		dev->srLastUse++;
-
-		cache->lastUse = dev->srLastUse;
-
-		if (isAWrite)
+		if (isAWrite && !cache->dirty) {
 			cache->dirty = 1;
+			dev->srCacheDirty++;
+		}
 	}
 }
 
@@ -4052,7 +4163,7 @@ static void yaffs_InvalidateChunkCache(yaffs_Object *object, int chunkId)
 		yaffs_ChunkCache *cache = yaffs_FindChunkCache(object, chunkId);
 
 		if (cache)
-			cache->object = NULL;
+			yaffs_ReleaseChunkCache(object->myDev, cache);
 	}
 }
 
@@ -4061,14 +4172,17 @@ static void yaffs_InvalidateChunkCache(yaffs_Object *object, int chunkId)
  */
 static void yaffs_InvalidateWholeChunkCache(yaffs_Object *in)
 {
-	int i;
 	yaffs_Device *dev = in->myDev;
+	yaffs_ChunkCache *cache;
+	struct ylist_head *i;
+	struct ylist_head *n;
 
 	if (dev->nShortOpCaches > 0) {
 		/* Invalidate it. */
-		for (i = 0; i < dev->nShortOpCaches; i++) {
-			if (dev->srCache[i].object == in)
-				dev->srCache[i].object = NULL;
+		ylist_for_each_safe(i, n, &dev->srCacheLru) {
+			cache = ylist_entry(i, yaffs_ChunkCache, lruLink);
+			if (cache->object == in)
+				yaffs_ReleaseChunkCache(dev, cache);
 		}
 	}
 }
@@ -4690,15 +4804,10 @@ int yaffs_ReadDataFromFile(yaffs_Object *in, __u8 *buffer, loff_t offset,
 				/* If we can't find the data in the cache, then load it up. */
 
 				if (!cache) {
-					cache = yaffs_GrabChunkCache(in->myDev);
-					cache->object = in;
-					cache->chunkId = chunk;
-					cache->dirty = 0;
-					cache->locked = 0;
+					cache = yaffs_GrabChunkCache(in, chunk);
 					yaffs_ReadChunkDataFromObject(in, chunk,
 								      cache->
 								      data);
-					cache->nBytes = 0;
 				}
 
 				yaffs_UseChunkCache(dev, cache, 0);
@@ -4820,11 +4929,7 @@ int yaffs_WriteDataToFile(yaffs_Object *in, const __u8 *buffer, loff_t offset,
 				if (!cache
 				    && yaffs_CheckSpaceForAllocation(in->
 								     myDev)) {
-					cache = yaffs_GrabChunkCache(in->myDev);
-					cache->object = in;
-					cache->chunkId = chunk;
-					cache->dirty = 0;
-					cache->locked = 0;
+					cache = yaffs_GrabChunkCache(in, chunk);
 					yaffs_ReadChunkDataFromObject(in, chunk,
 								      cache->
 								      data);
@@ -4857,6 +4962,7 @@ int yaffs_WriteDataToFile(yaffs_Object *in, const __u8 *buffer, loff_t offset,
 						     cache->data, cache->nBytes,
 						     1);
 						cache->dirty = 0;
+						dev->srCacheDirty--;
 					}
 
 				} else {
@@ -5391,6 +5497,88 @@ static int ybicmp(const void *a, const void *b)
 		return aseq - bseq;
 }
 
+/*
+ * Sort the block index into the order given by ybicmp() with an LSD radix
+ * sort on the sequence number, a byte at a time. The index is built in
+ * ascending block order and each pass is stable, so blocks with equal
+ * sequence numbers stay in block order. Sequence numbers are offset by the
+ * lowest one found, so bytes that are the same in every block are skipped;
+ * a partition written since its last format usually needs only two passes.
+ *
+ * Returns YAFFS_FAIL if the scratch buffer cannot be allocated, in which
+ * case the caller falls back to a comparison sort.
+ */
+static int yaffs_RadixSortBlockIndex(yaffs_BlockIndex *blockIndex, int n)
+{
+	yaffs_BlockIndex *scratch;
+	yaffs_BlockIndex *src;
+	yaffs_BlockIndex *dst;
+	yaffs_BlockIndex *swap;
+	int *count;
+	int altScratch = 0;
+	__u32 minSeq;
+	__u32 maxSeq;
+	__u32 digit;
+	int shift;
+	int sum;
+	int i;
+	int c;
+
+	if (n < 2)
+		return YAFFS_OK;
+
+	minSeq = maxSeq = (__u32)blockIndex[0].seq;
+	for (i = 1; i < n; i++) {
+		if ((__u32)blockIndex[i].seq < minSeq)
+			minSeq = blockIndex[i].seq;
+		if ((__u32)blockIndex[i].seq > maxSeq)
+			maxSeq = blockIndex[i].seq;
+	}
+
+	/* The bucket counts live after the scratch index to spare the stack */
+	scratch = YMALLOC(n * sizeof(yaffs_BlockIndex) + 256 * sizeof(int));
+	if (!scratch) {
+		scratch = YMALLOC_ALT(n * sizeof(yaffs_BlockIndex) +
+				      256 * sizeof(int));
+		altScratch = 1;
+	}
+	if (!scratch)
+		return YAFFS_FAIL;
+	count = (int *)(scratch + n);
+
+	src = blockIndex;
+	dst = scratch;
+	for (shift = 0; shift < 32 && ((maxSeq - minSeq) >> shift); shift += 8) {
+		memset(count, 0, 256 * sizeof(int));
+		for (i = 0; i < n; i++) {
+			digit = (((__u32)src[i].seq - minSeq) >> shift) & 0xff;
+			count[digit]++;
+		}
+		for (sum = 0, i = 0; i < 256; i++) {
+			c = count[i];
+			count[i] = sum;
+			sum += c;
+		}
+		for (i = 0; i < n; i++) {
+			digit = (((__u32)src[i].seq - minSeq) >> shift) & 0xff;
+			dst[count[digit]++] = src[i];
+		}
+		swap = src;
+		src = dst;
+		dst = swap;
+	}
+
+	if (src != blockIndex)
+		memcpy(blockIndex, src, n * sizeof(yaffs_BlockIndex));
+
+	if (altScratch)
+		YFREE_ALT(scratch);
+	else
+		YFREE(scratch);
+
+	return YAFFS_OK;
+}
+
 
 struct yaffs_ShadowFixerStruct {
 	int objectId;
@@ -6053,13 +6241,11 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 	YYIELD();
 
 	/* Sort the blocks */
+	if (!yaffs_RadixSortBlockIndex(blockIndex, nBlocksToScan)) {
 #ifndef CONFIG_YAFFS_USE_OWN_SORT
-	{
 		/* Use qsort now. */
 		yaffs_qsort(blockIndex, nBlocksToScan, sizeof(yaffs_BlockIndex), ybicmp);
-	}
 #else
-	{
 		/* Dungy old bubble sort... */
 
 		yaffs_BlockIndex temp;
@@ -6073,8 +6259,8 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 					blockIndex[j] = blockIndex[i];
 					blockIndex[i] = temp;
 				}
-	}
 #endif
+	}
 
 	YYIELD();
 
@@ -7277,38 +7463,64 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 		init_failed = 1;
 
 	dev->srCache = NULL;
+	dev->srCacheHash = NULL;
+	dev->srFlushList = NULL;
+	dev->srCacheDirty = 0;
 	dev->gcCleanupList = NULL;
 
+	YINIT_LIST_HEAD(&dev->srCacheLru);
+	YINIT_LIST_HEAD(&dev->srCacheFree);
 
 	if (!init_failed &&
 	    dev->nShortOpCaches > 0) {
 		int i;
+		int nBuckets;
 		void *buf;
-		int srCacheBytes = dev->nShortOpCaches * sizeof(yaffs_ChunkCache);
+		int srCacheBytes;
 
 		if (dev->nShortOpCaches > YAFFS_MAX_SHORT_OP_CACHES)
 			dev->nShortOpCaches = YAFFS_MAX_SHORT_OP_CACHES;
 
+		srCacheBytes = dev->nShortOpCaches * sizeof(yaffs_ChunkCache);
+
+		for (nBuckets = 1; nBuckets < dev->nShortOpCaches; nBuckets <<= 1)
+			;
+		dev->srCacheHashMask = nBuckets - 1;
+
 		dev->srCache =  YMALLOC(srCacheBytes);
+		dev->srCacheHash = YMALLOC(nBuckets * sizeof(struct ylist_head));
+		dev->srFlushList = YMALLOC(dev->nShortOpCaches *
+					sizeof(yaffs_ChunkCache *));
 
 		buf = (__u8 *) dev->srCache;
 
 		if (dev->srCache)
 			memset(dev->srCache, 0, srCacheBytes);
 
+		if (dev->srCacheHash) {
+			for (i = 0; i < nBuckets; i++)
+				YINIT_LIST_HEAD(&dev->srCacheHash[i]);
+		}
+
+		if (!dev->srCacheHash || !dev->srFlushList)
+			buf = NULL;
+
 		for (i = 0; i < dev->nShortOpCaches && buf; i++) {
 			dev->srCache[i].object = NULL;
-			dev->srCache[i].lastUse = 0;
 			dev->srCache[i].dirty = 0;
+			YINIT_LIST_HEAD(&dev->srCache[i].hashLink);
+			ylist_add_tail(&dev->srCache[i].lruLink,
+				&dev->srCacheFree);
 			dev->srCache[i].data = buf = YMALLOC_DMA(dev->totalBytesPerChunk);
 		}
 		if (!buf)
 			init_failed = 1;
-
-		dev->srLastUse = 0;
 	}
 
 	dev->cacheHits = 0;
+	dev->cacheMisses = 0;
+	dev->cacheEvictions = 0;
+	dev->cacheWriteBacks = 0;
 
 	if (!init_failed) {
 		dev->gcCleanupList = YMALLOC(dev->nChunksPerBlock * sizeof(__u32));
@@ -7422,6 +7634,11 @@ void yaffs_Deinitialise(yaffs_Device *dev)
 			dev->srCache = NULL;
 		}
 
+		YFREE(dev->srCacheHash);
+		dev->srCacheHash = NULL;
+		YFREE(dev->srFlushList);
+		dev->srFlushList = NULL;
+
 		YFREE(dev->gcCleanupList);
 
 		for (i = 0; i < YAFFS_N_TEMP_BUFFERS; i++)
@@ -7467,9 +7684,7 @@ int yaffs_GetNumberOfFreeChunks(yaffs_Device *dev)
 	/* This is what we report to the outside world */
 
 	int nFree;
-	int nDirtyCacheChunks;
 	int blocksForCheckpoint;
-	int i;
 
 #if 1
 	nFree = dev->nFreeChunks;
@@ -7479,14 +7694,8 @@ int yaffs_GetNumberOfFreeChunks(yaffs_Device *dev)
 
 	nFree += dev->nDeletedFiles;
 
-	/* Now count the number of dirty chunks in the cache and subtract those */
-
-	for (nDirtyCacheChunks = 0, i = 0; i < dev->nShortOpCaches; i++) {
-		if (dev->srCache[i].dirty)
-			nDirtyCacheChunks++;
-	}
-
-	nFree -= nDirtyCacheChunks;
+	/* Now subtract the dirty chunks in the cache */
+	nFree -= dev->srCacheDirty;
 
 	nFree -= ((dev->nReservedBlocks + 1) * dev->nChunksPerBlock);
 
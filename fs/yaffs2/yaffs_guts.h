@@ -88,7 +88,7 @@
 
 /* */
 
-#define YAFFS_MAX_SHORT_OP_CACHES	20
+#define YAFFS_MAX_SHORT_OP_CACHES	256
 
 #define YAFFS_N_TEMP_BUFFERS		6
 
@@ -115,7 +115,8 @@
 typedef struct {
 	struct yaffs_ObjectStruct *object;
 	int chunkId;
-	int lastUse;
+	struct ylist_head hashLink;	/* entries in this (object, chunk) bucket */
+	struct ylist_head lruLink;	/* LRU position, or on the free list */
 	int dirty;
 	int nBytes;		/* Only valid if the cache is dirty */
 	int locked;		/* Can't push out or flush while locked. */
@@ -637,10 +638,23 @@ struct yaffs_DeviceStruct {
 				 * at compile time so we have to allocate it.
 				 */
 	void (*putSuperFunc) (struct super_block *sb);
+	struct task_struct *bgGcThread;	/* Background GC thread, or NULL */
 #endif
 
 	int isMounted;
 
+	/* Set while a background thread does the passive GC; the write path
+	 * then only collects when it is short of erased blocks.
+	 */
+	int backgroundGC;
+
+	/* Set by the write path when it leaves GC to the background thread,
+	 * which clears it once there is nothing left to collect and then
+	 * sleeps until wakeBackgroundGC is called again.
+	 */
+	int bgGcWanted;
+	void (*wakeBackgroundGC)(struct yaffs_DeviceStruct *dev);
+
 	int isCheckpointed;
 
 
@@ -741,9 +755,17 @@ struct yaffs_DeviceStruct {
 	int doingBufferedBlockRewrite;
 
 	yaffs_ChunkCache *srCache;
-	int srLastUse;
+	struct ylist_head *srCacheHash;	/* srCacheHashMask + 1 buckets */
+	int srCacheHashMask;
+	struct ylist_head srCacheLru;	/* in use, most recently used first */
+	struct ylist_head srCacheFree;
+	yaffs_ChunkCache **srFlushList;	/* scratch for ordered write back */
+	int srCacheDirty;		/* number of dirty cache entries */
 
 	int cacheHits;
+	int cacheMisses;
+	int cacheEvictions;
+	int cacheWriteBacks;
 
 	/* Stuff for background deletion and unlinked files.*/
 	yaffs_Object *unlinkedDir;	/* Directory where unlinked and deleted files live. */
@@ -815,6 +837,8 @@ int yaffs_GutsInitialise(yaffs_Device *dev);
 void yaffs_Deinitialise(yaffs_Device *dev);
 
 int yaffs_GetNumberOfFreeChunks(yaffs_Device *dev);
+int yaffs_BackgroundGarbageCollect(yaffs_Device *dev, int passiveBlocks,
+				   int aggressiveBlocks);
 
 int yaffs_RenameObject(yaffs_Object *oldDir, const YCHAR *oldName,
 		       yaffs_Object *newDir, const YCHAR *newName);
@@ -39,6 +39,16 @@
 #define HW3D_REVOKE_GPU		_IOW(PMEM_IOCTL_MAGIC, 8, unsigned int)
 #define HW3D_GRANT_GPU		_IOW(PMEM_IOCTL_MAGIC, 9, unsigned int)
 #define HW3D_WAIT_FOR_INTERRUPT	_IOW(PMEM_IOCTL_MAGIC, 10, unsigned int)
+/* Does cache maintenance on a list of ranges of the allocation backing the
+ * file in one call. Pass a pointer to a pmem_cache_op struct, the ranges
+ * are given as offsets into the allocation.
+ */
+#define PMEM_CACHE_OP		_IOW(PMEM_IOCTL_MAGIC, 11, unsigned int)
+
+#define PMEM_CACHE_CLEAN	0x1
+#define PMEM_CACHE_INV		0x2
+#define PMEM_CACHE_FLUSH	(PMEM_CACHE_CLEAN | PMEM_CACHE_INV)
+#define PMEM_CACHE_MAX_RANGES	64
 
 int get_pmem_file(int fd, unsigned long *start, unsigned long *vstart,
 		  unsigned long *end, struct file **filp);
@@ -69,6 +79,14 @@ struct pmem_region {
 	unsigned long len;
 };
 
+struct pmem_cache_op {
+	/* PMEM_CACHE_CLEAN, PMEM_CACHE_INV or PMEM_CACHE_FLUSH */
+	unsigned int op;
+	/* number of entries in ranges, at most PMEM_CACHE_MAX_RANGES */
+	unsigned int nr_ranges;
+	struct pmem_region *ranges;
+};
+
 int pmem_setup(struct android_pmem_platform_data *pdata,
 	       long (*ioctl)(struct file *, unsigned int, unsigned long),
 	       int (*release)(struct inode *, struct file *));
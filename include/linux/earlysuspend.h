@@ -18,6 +18,7 @@
 
 #ifdef CONFIG_HAS_EARLYSUSPEND
 #include <linux/list.h>
+#include <linux/types.h>
 #endif
 
 /* The early_suspend structure defines suspend and resume hooks to be called
@@ -29,6 +30,11 @@
  * the suspend handlers have already been called without a matching call to the
  * resume handlers, the suspend handler will be called directly from
  * register_early_suspend. This direct call can violate the normal level order.
+ * A handler that sets parallel may be called concurrently with the other
+ * handlers of its level that set it and were registered next to it, so it
+ * must not depend on them. Handlers that leave it clear are called on their
+ * own, in registration order. suspend_us and resume_us are filled in with
+ * how long the last call of each handler took.
  */
 enum {
 	EARLY_SUSPEND_LEVEL_BLANK_SCREEN = 50,
@@ -41,6 +47,9 @@ struct early_suspend {
 	int level;
 	void (*suspend)(struct early_suspend *h);
 	void (*resume)(struct early_suspend *h);
+	bool parallel;
+	s64 suspend_us;
+	s64 resume_us;
 #endif
 };
 
@@ -17,7 +17,10 @@
 #define _LINUX_WAKELOCK_H
 
 #include <linux/list.h>
+#include <linux/rbtree.h>
 #include <linux/ktime.h>
+#include <linux/spinlock.h>
+#include <linux/wakelock_stat.h>
 
 /* A wake_lock prevents the system from entering suspend or other low power
  * states when active. If the type is set to WAKE_LOCK_SUSPEND, the wake_lock
@@ -38,8 +41,10 @@ struct wake_lock {
 	int                 flags;
 	const char         *name;
 	unsigned long       expires;
+	struct rb_node      expire_node;
 #ifdef CONFIG_WAKELOCK_STAT
 	struct {
+		spinlock_t      lock;
 		int             count;
 		int             expire_count;
 		int             wakeup_count;
@@ -47,6 +52,8 @@ struct wake_lock {
 		ktime_t         prevent_suspend_time;
 		ktime_t         max_time;
 		ktime_t         last_time;
+		ktime_t         prevent_suspend_start;
+		unsigned int    sleep_hist[WAKE_LOCK_HIST_BUCKETS];
 	} stat;
 #endif
 #endif
@@ -0,0 +1,48 @@
+/* include/linux/wakelock_stat.h
+ *
+ * Copyright (C) 2007-2008 Google, Inc.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef _LINUX_WAKELOCK_STAT_H
+#define _LINUX_WAKELOCK_STAT_H
+
+#include <linux/types.h>
+
+/* For each hold that kept a pending suspend from happening, the time it did
+ * so (its share of prevent_suspend_time) is histogrammed in log2 millisecond
+ * buckets: bucket 0 counts under 1ms, bucket n [2^(n-1), 2^n) ms, and the
+ * last bucket everything longer.
+ */
+#define WAKE_LOCK_HIST_BUCKETS 16
+#define WAKE_LOCK_STAT_NAME_LEN 32
+
+/* One record of /proc/wakelocks_bin. Times are in nanoseconds and match the
+ * columns of /proc/wakelocks; the name is truncated and NUL terminated. The
+ * layout is the same for 32 and 64 bit readers: pad keeps the times 8 byte
+ * aligned on ABIs that only align __s64 to 4 bytes, such as i386.
+ */
+struct wake_lock_stat_record {
+	char  name[WAKE_LOCK_STAT_NAME_LEN];
+	__u32 count;
+	__u32 expire_count;
+	__u32 wakeup_count;
+	__u32 sleep_hist[WAKE_LOCK_HIST_BUCKETS];
+	__u32 pad;
+	__s64 active_time;
+	__s64 total_time;
+	__s64 prevent_suspend_time;
+	__s64 max_time;
+	__s64 last_change;
+};
+
+#endif
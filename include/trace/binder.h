@@ -0,0 +1,29 @@
+#ifndef _TRACE_BINDER_H
+#define _TRACE_BINDER_H
+
+#include <linux/tracepoint.h>
+
+/*
+ * Latencies are in microseconds. A transaction is "sent" when it is queued
+ * on the target, and "woken" when a target thread returns it from read.
+ */
+DECLARE_TRACE(binder_transaction_send,
+	TPPROTO(int debug_id, int from_pid, int from_tid, int to_pid,
+		unsigned int code, unsigned int flags),
+		TPARGS(debug_id, from_pid, from_tid, to_pid, code, flags));
+
+DECLARE_TRACE(binder_transaction_wakeup,
+	TPPROTO(int debug_id, int pid, int tid, s64 delivery_us),
+		TPARGS(debug_id, pid, tid, delivery_us));
+
+DECLARE_TRACE(binder_transaction_reply,
+	TPPROTO(int debug_id, int reply_to_debug_id, int from_pid,
+		int to_pid, s64 service_us),
+		TPARGS(debug_id, reply_to_debug_id, from_pid, to_pid,
+		       service_us));
+
+DECLARE_TRACE(binder_transaction_reply_delivered,
+	TPPROTO(int debug_id, int pid, int tid, s64 round_trip_us),
+		TPARGS(debug_id, pid, tid, round_trip_us));
+
+#endif
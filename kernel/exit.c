@@ -47,6 +47,7 @@
 #include <linux/task_io_accounting_ops.h>
 #include <linux/tracehook.h>
 #include <linux/init_task.h>
+#include <linux/oom.h>
 #include <trace/sched.h>
 
 #include <asm/uaccess.h>
@@ -1056,6 +1057,7 @@ NORET_TYPE void do_exit(long code)
 	if (group_dead) {
 		hrtimer_cancel(&tsk->signal->real_timer);
 		exit_itimers(tsk->signal);
+		oom_adj_exit(tsk->group_leader);
 	}
 	acct_collect(code, group_dead);
 	if (group_dead)
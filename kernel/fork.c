@@ -60,6 +60,7 @@
 #include <linux/tty.h>
 #include <linux/proc_fs.h>
 #include <linux/blkdev.h>
+#include <linux/oom.h>
 #include <trace/sched.h>
 
 #include <asm/pgtable.h>
@@ -1416,6 +1417,8 @@ long do_fork(unsigned long clone_flags,
 		}
 
 		audit_finish_fork(p);
+		if (!(clone_flags & CLONE_THREAD) && p->mm)
+			oom_adj_changed(p);
 		tracehook_report_clone(trace, regs, clone_flags, nr, p);
 
 		/*
@@ -13,10 +13,14 @@
  *
  */
 
+#include <linux/completion.h>
 #include <linux/earlysuspend.h>
+#include <linux/ktime.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
+#include <linux/proc_fs.h>
 #include <linux/rtc.h>
+#include <linux/seq_file.h>
 #include <linux/syscalls.h> /* sys_sync */
 #include <linux/wakelock.h>
 #include <linux/workqueue.h>
@@ -44,6 +48,128 @@ enum {
 };
 static int state;
 
+/*
+ * Neighbouring handlers of the same level that set parallel form a batch,
+ * run by the early_suspend/late_resume work together with up to
+ * parallel_handlers - 1 helper threads, each pulling the next handler of
+ * the batch from handler_batch. Every other handler is a batch of its own.
+ * The next batch only starts once every handler of the current one has
+ * returned.
+ */
+#define EARLY_SUSPEND_MAX_HELPERS 3
+static int parallel_handlers = EARLY_SUSPEND_MAX_HELPERS + 1;
+module_param_named(parallel_handlers, parallel_handlers, int,
+		   S_IRUGO | S_IWUSR | S_IWGRP);
+
+static struct handler_batch {
+	spinlock_t lock;
+	struct list_head *next;		/* next handler to call */
+	struct list_head *end;		/* first handler past this batch */
+	int resume;			/* call resume, walking backwards */
+	atomic_t helpers;		/* helpers still running */
+	struct completion done;
+} handler_batch = {
+	.lock = __SPIN_LOCK_UNLOCKED(handler_batch.lock),
+};
+
+static char helper_name[EARLY_SUSPEND_MAX_HELPERS][20];
+static struct workqueue_struct *helper_wq[EARLY_SUSPEND_MAX_HELPERS];
+static struct work_struct helper_work[EARLY_SUSPEND_MAX_HELPERS];
+static int nr_helpers;
+
+static void call_handler(struct early_suspend *h, int resume)
+{
+	ktime_t start = ktime_get();
+
+	if (resume) {
+		h->resume(h);
+		h->resume_us = ktime_us_delta(ktime_get(), start);
+	} else {
+		h->suspend(h);
+		h->suspend_us = ktime_us_delta(ktime_get(), start);
+	}
+}
+
+static struct early_suspend *batch_next(void)
+{
+	struct handler_batch *b = &handler_batch;
+	struct early_suspend *h = NULL;
+
+	spin_lock(&b->lock);
+	while (!h && b->next != b->end) {
+		h = list_entry(b->next, struct early_suspend, link);
+		b->next = b->resume ? b->next->prev : b->next->next;
+		if (!(b->resume ? h->resume : h->suspend))
+			h = NULL;
+	}
+	spin_unlock(&b->lock);
+	return h;
+}
+
+static void run_batch(void)
+{
+	struct early_suspend *h;
+
+	while ((h = batch_next()))
+		call_handler(h, handler_batch.resume);
+}
+
+static void helper_func(struct work_struct *work)
+{
+	run_batch();
+	if (atomic_dec_and_test(&handler_batch.helpers))
+		complete(&handler_batch.done);
+}
+
+/*
+ * call_handlers - calls every suspend (or, walking backwards, resume)
+ * handler, batch by batch. Caller must hold early_suspend_lock.
+ */
+static void call_handlers(int resume)
+{
+	struct list_head *head = &early_suspend_handlers;
+	struct list_head *first, *end;
+	struct early_suspend *f, *h;
+	int count, helpers, i;
+	ktime_t start;
+
+	first = resume ? head->prev : head->next;
+	while (first != head) {
+		f = list_entry(first, struct early_suspend, link);
+		count = 0;
+		for (end = first; end != head;
+		     end = resume ? end->prev : end->next) {
+			h = list_entry(end, struct early_suspend, link);
+			if (count && (h->level != f->level ||
+				      !f->parallel || !h->parallel))
+				break;
+			count++;
+		}
+
+		start = ktime_get();
+		handler_batch.next = first;
+		handler_batch.end = end;
+		handler_batch.resume = resume;
+		helpers = min(min(count, parallel_handlers) - 1, nr_helpers);
+		if (helpers > 0) {
+			INIT_COMPLETION(handler_batch.done);
+			atomic_set(&handler_batch.helpers, helpers);
+			for (i = 0; i < helpers; i++)
+				queue_work(helper_wq[i], &helper_work[i]);
+		}
+		run_batch();
+		if (helpers > 0)
+			wait_for_completion(&handler_batch.done);
+
+		if (debug_mask & DEBUG_SUSPEND)
+			pr_info("%s: level %d, %d handlers, %d helpers, %lld us\n",
+				resume ? "late_resume" : "early_suspend",
+				f->level, count, helpers > 0 ? helpers : 0,
+				ktime_us_delta(ktime_get(), start));
+		first = end;
+	}
+}
+
 void register_early_suspend(struct early_suspend *handler)
 {
 	struct list_head *pos;
@@ -72,7 +198,6 @@ EXPORT_SYMBOL(unregister_early_suspend);
 
 static void early_suspend(struct work_struct *work)
 {
-	struct early_suspend *pos;
 	unsigned long irqflags;
 	int abort = 0;
 
@@ -93,10 +218,7 @@ static void early_suspend(struct work_struct *work)
 
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("early_suspend: call handlers\n");
-	list_for_each_entry(pos, &early_suspend_handlers, link) {
-		if (pos->suspend != NULL)
-			pos->suspend(pos);
-	}
+	call_handlers(0);
 	mutex_unlock(&early_suspend_lock);
 
 	if (debug_mask & DEBUG_SUSPEND)
@@ -112,7 +234,6 @@ abort:
 
 static void late_resume(struct work_struct *work)
 {
-	struct early_suspend *pos;
 	unsigned long irqflags;
 	int abort = 0;
 
@@ -131,9 +252,7 @@ static void late_resume(struct work_struct *work)
 	}
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("late_resume: call handlers\n");
-	list_for_each_entry_reverse(pos, &early_suspend_handlers, link)
-		if (pos->resume != NULL)
-			pos->resume(pos);
+	call_handlers(1);
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("late_resume: done\n");
 abort:
@@ -176,3 +295,79 @@ suspend_state_t get_suspend_state(void)
 {
 	return requested_suspend_state;
 }
+
+static void *early_suspend_stat_start(struct seq_file *m, loff_t *pos)
+{
+	mutex_lock(&early_suspend_lock);
+	return seq_list_start_head(&early_suspend_handlers, *pos);
+}
+
+static void *early_suspend_stat_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	return seq_list_next(v, &early_suspend_handlers, pos);
+}
+
+static void early_suspend_stat_stop(struct seq_file *m, void *v)
+{
+	mutex_unlock(&early_suspend_lock);
+}
+
+static int early_suspend_stat_show(struct seq_file *m, void *v)
+{
+	struct early_suspend *h;
+
+	if (v == &early_suspend_handlers) {
+		seq_puts(m, "level\tsuspend_us\tresume_us\thandler\n");
+		return 0;
+	}
+	h = list_entry(v, struct early_suspend, link);
+	seq_printf(m, "%d\t%lld\t%lld\t%pF\n", h->level, h->suspend_us,
+		   h->resume_us, h->suspend ? (void *)h->suspend :
+		   (void *)h->resume);
+	return 0;
+}
+
+static const struct seq_operations early_suspend_stat_ops = {
+	.start = early_suspend_stat_start,
+	.next = early_suspend_stat_next,
+	.stop = early_suspend_stat_stop,
+	.show = early_suspend_stat_show,
+};
+
+static int early_suspend_stat_open(struct inode *inode, struct file *file)
+{
+	return seq_open(file, &early_suspend_stat_ops);
+}
+
+static const struct file_operations early_suspend_stat_fops = {
+	.owner = THIS_MODULE,
+	.open = early_suspend_stat_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = seq_release,
+};
+
+static int __init early_suspend_init(void)
+{
+	int i;
+
+	init_completion(&handler_batch.done);
+	for (i = 0; i < EARLY_SUSPEND_MAX_HELPERS; i++) {
+		/* the workqueue keeps a pointer to its name */
+		snprintf(helper_name[i], sizeof(helper_name[i]),
+			 "early_suspend/%d", i);
+		helper_wq[i] = create_singlethread_workqueue(helper_name[i]);
+		if (!helper_wq[i]) {
+			/* run with the helpers we got, or serially */
+			pr_err("early_suspend_init: only %d helper threads\n", i);
+			break;
+		}
+		INIT_WORK(&helper_work[i], helper_func);
+	}
+	nr_helpers = i;
+
+	proc_create("early_suspend", S_IRUGO, NULL, &early_suspend_stat_fops);
+	return 0;
+}
+
+core_initcall(early_suspend_init);
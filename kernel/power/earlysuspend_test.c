@@ -0,0 +1,177 @@
+/* kernel/power/earlysuspend_test.c
+ *
+ * Copyright (C) 2008 Google, Inc.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * Slow early suspend handler test. Registers two levels of handlers that
+ * each sleep for delay_ms, and checks on every early suspend and late
+ * resume that:
+ *
+ *  - every handler is called exactly once,
+ *  - no handler of a level starts before all handlers of the level called
+ *    before it have returned,
+ *  - with parallel=0 no two handlers ever run at the same time.
+ *
+ * A wake lock is held while the module is loaded, so requesting sleep
+ * runs the early suspend handlers without suspending the system. Load it
+ * while the screen is on:
+ *
+ *   insmod earlysuspend_test.ko handlers=8 delay_ms=100 parallel=1
+ *   echo mem > /sys/power/state; sleep 3; echo on > /sys/power/state
+ *   dmesg | grep earlysuspend_test
+ *   cat /sys/module/earlysuspend_test/parameters/errors
+ *
+ * Each pass logs the number of handlers called, how many ran at once at
+ * most and how long the pass took. With parallel=1 and the default
+ * earlysuspend parallel_handlers, each level should take about a quarter
+ * of handlers * delay_ms; with parallel=0, all of it.
+ */
+
+#include <linux/delay.h>
+#include <linux/earlysuspend.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/wakelock.h>
+
+#define TEST_LEVEL	(EARLY_SUSPEND_LEVEL_DISABLE_FB + 100)
+#define TEST_LEVELS	2
+
+static int handlers = 8;
+module_param(handlers, int, S_IRUGO);
+static int delay_ms = 100;
+module_param(delay_ms, int, S_IRUGO);
+static int parallel = 1;
+module_param(parallel, bool, S_IRUGO);
+static int errors;
+module_param(errors, int, S_IRUGO);
+
+struct test_handler {
+	struct early_suspend es;
+	int calls[2];
+};
+
+/* the state of one pass, early suspend (0) or late resume (1) */
+static struct test_pass {
+	int started;
+	int done[TEST_LEVELS];
+	int running;
+	int max_running;
+	ktime_t start;
+} passes[2];
+
+static DEFINE_SPINLOCK(test_lock);
+static struct test_handler *test_handlers;
+static struct wake_lock test_wake_lock;
+
+static void test_error(const char *msg, struct test_handler *t, int resume)
+{
+	pr_err("earlysuspend_test: %s: handler %d at level %d, %s\n",
+	       resume ? "late_resume" : "early_suspend",
+	       (int)(t - test_handlers), t->es.level, msg);
+	errors++;
+}
+
+static void test_call(struct early_suspend *h, int resume)
+{
+	struct test_handler *t = container_of(h, struct test_handler, es);
+	struct test_pass *p = &passes[resume];
+	int level = h->level - TEST_LEVEL;
+	int before = resume ? level + 1 : level - 1;
+	int total = handlers * TEST_LEVELS;
+	int i;
+
+	spin_lock(&test_lock);
+	if (!p->started++)
+		p->start = ktime_get();
+	if (before >= 0 && before < TEST_LEVELS &&
+	    p->done[before] != handlers)
+		test_error("called before the previous level returned",
+			   t, resume);
+	if (++t->calls[resume] != 1)
+		test_error("called more than once", t, resume);
+	if (++p->running > p->max_running)
+		p->max_running = p->running;
+	if (!parallel && p->running > 1)
+		test_error("called while another handler ran", t, resume);
+	spin_unlock(&test_lock);
+
+	msleep(delay_ms);
+
+	spin_lock(&test_lock);
+	p->running--;
+	p->done[level]++;
+	if (p->done[0] + p->done[1] == total) {
+		pr_info("earlysuspend_test: %s: %d handlers, %d at once, "
+			"%lld ms, %d errors\n",
+			resume ? "late_resume" : "early_suspend", total,
+			p->max_running,
+			ktime_us_delta(ktime_get(), p->start) / 1000, errors);
+		/* get the other pass ready */
+		memset(&passes[!resume], 0, sizeof(passes[!resume]));
+		for (i = 0; i < total; i++)
+			test_handlers[i].calls[!resume] = 0;
+	}
+	spin_unlock(&test_lock);
+}
+
+static void test_suspend(struct early_suspend *h)
+{
+	test_call(h, 0);
+}
+
+static void test_resume(struct early_suspend *h)
+{
+	test_call(h, 1);
+}
+
+static int __init earlysuspend_test_init(void)
+{
+	int total = handlers * TEST_LEVELS;
+	int i;
+
+	if (handlers <= 0 || delay_ms < 0)
+		return -EINVAL;
+	test_handlers = kzalloc(sizeof(*test_handlers) * total, GFP_KERNEL);
+	if (!test_handlers)
+		return -ENOMEM;
+
+	wake_lock_init(&test_wake_lock, WAKE_LOCK_SUSPEND, "earlysuspend_test");
+	wake_lock(&test_wake_lock);
+	for (i = 0; i < total; i++) {
+		test_handlers[i].es.level = TEST_LEVEL + i / handlers;
+		test_handlers[i].es.suspend = test_suspend;
+		test_handlers[i].es.resume = test_resume;
+		test_handlers[i].es.parallel = parallel;
+		register_early_suspend(&test_handlers[i].es);
+	}
+	return 0;
+}
+
+static void __exit earlysuspend_test_exit(void)
+{
+	int i;
+
+	for (i = 0; i < handlers * TEST_LEVELS; i++)
+		unregister_early_suspend(&test_handlers[i].es);
+	wake_lock_destroy(&test_wake_lock);
+	kfree(test_handlers);
+}
+
+module_init(earlysuspend_test_init);
+module_exit(earlysuspend_test_exit);
+MODULE_DESCRIPTION("Slow early suspend handler test");
+MODULE_LICENSE("GPL");
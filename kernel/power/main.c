@@ -410,13 +410,15 @@ static inline int valid_state(suspend_state_t state)
  *	enter_state - Do common work of entering low-power state.
  *	@state:		pm_state structure for state we're entering.
  *
+ *	@sync:		sync filesystems first.
+ *
  *	Make sure we're the only ones trying to enter a sleep state. Fail
  *	if someone has beat us to it, since we don't want anything weird to
  *	happen when we wake up.
  *	Then, do the setup for suspend, enter the state, and cleaup (after
  *	we've woken up).
  */
-static int enter_state(suspend_state_t state)
+static int enter_state(suspend_state_t state, int sync)
 {
 	int error;
 
@@ -426,9 +428,11 @@ static int enter_state(suspend_state_t state)
 	if (!mutex_trylock(&pm_mutex))
 		return -EBUSY;
 
-	printk(KERN_INFO "PM: Syncing filesystems ... ");
-	sys_sync();
-	printk("done.\n");
+	if (sync) {
+		printk(KERN_INFO "PM: Syncing filesystems ... ");
+		sys_sync();
+		printk("done.\n");
+	}
 
 	pr_debug("PM: Preparing system for %s sleep\n", pm_states[state]);
 	error = suspend_prepare();
@@ -461,12 +465,28 @@ static int enter_state(suspend_state_t state)
 int pm_suspend(suspend_state_t state)
 {
 	if (state > PM_SUSPEND_ON && state <= PM_SUSPEND_MAX)
-		return enter_state(state);
+		return enter_state(state, 1);
 	return -EINVAL;
 }
 
 EXPORT_SYMBOL(pm_suspend);
 
+#ifdef CONFIG_WAKELOCK
+/**
+ *	pm_suspend_synced - pm_suspend() for a caller that has just synced
+ *	filesystems itself, with a bounded wait, and so skips the unbounded
+ *	sys_sync() in enter_state().
+ *	@state:		Enumerated value of state to enter.
+ */
+
+int pm_suspend_synced(suspend_state_t state)
+{
+	if (state > PM_SUSPEND_ON && state <= PM_SUSPEND_MAX)
+		return enter_state(state, 0);
+	return -EINVAL;
+}
+#endif
+
 #endif /* CONFIG_SUSPEND */
 
 struct kobject *power_kobj;
@@ -540,7 +560,7 @@ static ssize_t state_store(struct kobject *kobj, struct kobj_attribute *attr,
 			request_suspend_state(state);
 		}
 #else
-		error = enter_state(state);
+		error = enter_state(state, 1);
 #endif
 #endif
 
@@ -229,6 +229,8 @@ static inline void suspend_thaw_processes(void)
 extern struct workqueue_struct *suspend_work_queue;
 extern struct wake_lock main_wake_lock;
 extern suspend_state_t requested_suspend_state;
+/* kernel/power/main.c */
+extern int pm_suspend_synced(suspend_state_t state);
 #endif
 
 #ifdef CONFIG_USER_WAKELOCK
@@ -13,14 +13,18 @@
  *
  */
 
+#include <linux/fs.h> /* super_blocks */
 #include <linux/module.h>
 #include <linux/platform_device.h>
 #include <linux/rtc.h>
 #include <linux/suspend.h>
 #include <linux/syscalls.h> /* sys_sync */
+#include <linux/vmstat.h>
+#include <linux/wait.h>
 #include <linux/wakelock.h>
 #ifdef CONFIG_WAKELOCK_STAT
 #include <linux/proc_fs.h>
+#include <linux/seq_file.h>
 #endif
 #include "power.h"
 
@@ -43,18 +47,64 @@ module_param_named(debug_mask, debug_mask, int, S_IRUGO | S_IWUSR | S_IWGRP);
 static DEFINE_SPINLOCK(list_lock);
 static LIST_HEAD(inactive_locks);
 static struct list_head active_wake_locks[WAKE_LOCK_TYPE_COUNT];
+/*
+ * Active locks with a timeout (WAKE_LOCK_AUTO_EXPIRE set) are also kept in
+ * expire_locks[type], ordered by expires, so the next lock to expire and the
+ * last one are found without scanning. Locks without a timeout are kept at
+ * the head of active_wake_locks[type], so checking for one is O(1).
+ */
+static struct rb_root expire_locks[WAKE_LOCK_TYPE_COUNT];
 static int current_event_num;
 struct workqueue_struct *suspend_work_queue;
 struct wake_lock main_wake_lock;
 suspend_state_t requested_suspend_state = PM_SUSPEND_MEM;
 static struct wake_lock unknown_wakeup;
 
+/*
+ * Filesystems are synced from suspend_sync_work_queue, started as soon as
+ * the main wake lock is released, so most writeback is done by the time the
+ * last suspend wake lock goes away. suspend() waits for at most
+ * sync_timeout_ms; if the sync is still running it gives up the attempt and
+ * the sync work queues a new one when it finishes.
+ */
+static int sync_timeout_ms = 1000;
+module_param_named(sync_timeout_ms, sync_timeout_ms, int,
+		   S_IRUGO | S_IWUSR | S_IWGRP);
+static struct workqueue_struct *suspend_sync_work_queue;
+static DEFINE_SPINLOCK(suspend_sync_lock);
+static DECLARE_WAIT_QUEUE_HEAD(suspend_sync_wait);
+static int suspend_sync_running;
+static int suspend_sync_retry;
+static void suspend_sync(struct work_struct *work);
+static DECLARE_WORK(suspend_sync_work, suspend_sync);
+
 #ifdef CONFIG_WAKELOCK_STAT
+/*
+ * The stats of a lock are protected by its own stat.lock rather than by
+ * list_lock. wake_lock_internal() and wake_unlock() note what the state
+ * change did in a wake_lock_stat_change under list_lock, take stat.lock
+ * before they drop list_lock, so the changes of one lock are applied in
+ * order, and update the stats after. Anything else that touches the stats
+ * nests stat.lock inside list_lock.
+ */
+struct wake_lock_stat_change {
+	int ended;		/* a hold ended... */
+	int expired;		/* ...by timing out, at expires */
+	int preventing;		/* ...while it kept a suspend from happening */
+	int started;		/* a new hold started */
+	int wakeup;		/* the first suspend lock taken after a wakeup */
+	unsigned long expires;
+	ktime_t sleep_time_update;
+};
+
 static struct wake_lock deleted_wake_locks;
 static ktime_t last_sleep_time_update;
 static int wait_for_wakeup;
+/* the change wake_lock_internal() has not applied yet, for expire_wake_lock */
+static struct wake_lock *stat_pending_lock;
+static struct wake_lock_stat_change *stat_pending;
 
-int get_expired_time(struct wake_lock *lock, ktime_t *expire_time)
+static int expired_time(unsigned long expires, ktime_t *expire_time)
 {
 	struct timespec ts;
 	struct timespec kt;
@@ -63,11 +113,9 @@ int get_expired_time(struct wake_lock *lock, ktime_t *expire_time)
 	unsigned long seq;
 	long timeout;
 
-	if (!(lock->flags & WAKE_LOCK_AUTO_EXPIRE))
-		return 0;
 	do {
 		seq = read_seqbegin(&xtime_lock);
-		timeout = lock->expires - jiffies;
+		timeout = expires - jiffies;
 		if (timeout > 0)
 			return 0;
 		kt = current_kernel_time();
@@ -80,15 +128,33 @@ int get_expired_time(struct wake_lock *lock, ktime_t *expire_time)
 	return 1;
 }
 
+int get_expired_time(struct wake_lock *lock, ktime_t *expire_time)
+{
+	if (!(lock->flags & WAKE_LOCK_AUTO_EXPIRE))
+		return 0;
+	return expired_time(lock->expires, expire_time);
+}
+
 
-static int print_lock_stat(char *buf, struct wake_lock *lock)
+/* Caller holds list_lock. */
+static void get_lock_stat(struct wake_lock *lock,
+			  struct wake_lock_stat_record *rec)
 {
-	int lock_count = lock->stat.count;
-	int expire_count = lock->stat.expire_count;
+	int lock_count;
+	int expire_count;
 	ktime_t active_time = ktime_set(0, 0);
-	ktime_t total_time = lock->stat.total_time;
-	ktime_t max_time = lock->stat.max_time;
-	ktime_t prevent_suspend_time = lock->stat.prevent_suspend_time;
+	ktime_t total_time;
+	ktime_t max_time;
+	ktime_t prevent_suspend_time;
+
+	/* the record is copied to userspace as is, padding and all */
+	memset(rec, 0, sizeof(*rec));
+	spin_lock(&lock->stat.lock);
+	lock_count = lock->stat.count;
+	expire_count = lock->stat.expire_count;
+	total_time = lock->stat.total_time;
+	max_time = lock->stat.max_time;
+	prevent_suspend_time = lock->stat.prevent_suspend_time;
 	if (lock->flags & WAKE_LOCK_ACTIVE) {
 		ktime_t now, add_time;
 		int expired = get_expired_time(lock, &now);
@@ -108,74 +174,324 @@ static int print_lock_stat(char *buf, struct wake_lock *lock)
 			max_time = add_time;
 	}
 
-	return sprintf(buf, "\"%s\"\t%d\t%d\t%d\t%lld\t%lld\t%lld\t%lld\t"
-		       "%lld\n", lock->name, lock_count, expire_count,
-		       lock->stat.wakeup_count, ktime_to_ns(active_time),
-		       ktime_to_ns(total_time),
-		       ktime_to_ns(prevent_suspend_time), ktime_to_ns(max_time),
-		       ktime_to_ns(lock->stat.last_time));
+	strlcpy(rec->name, lock->name, sizeof(rec->name));
+	rec->count = lock_count;
+	rec->expire_count = expire_count;
+	rec->wakeup_count = lock->stat.wakeup_count;
+	memcpy(rec->sleep_hist, lock->stat.sleep_hist, sizeof(rec->sleep_hist));
+	rec->active_time = ktime_to_ns(active_time);
+	rec->total_time = ktime_to_ns(total_time);
+	rec->prevent_suspend_time = ktime_to_ns(prevent_suspend_time);
+	rec->max_time = ktime_to_ns(max_time);
+	rec->last_change = ktime_to_ns(lock->stat.last_time);
+	spin_unlock(&lock->stat.lock);
 }
 
+/*
+ * /proc/wakelocks and /proc/wakelocks_bin walk inactive_locks and then each
+ * active_wake_locks list through seq_file, so list_lock is only held while
+ * one buffer is filled rather than across the whole dump. A lock is on
+ * active_wake_locks[type] exactly when WAKE_LOCK_ACTIVE is set.
+ */
+#define WAKE_LOCK_LIST_COUNT (1 + WAKE_LOCK_TYPE_COUNT)
 
-static int wakelocks_read_proc(char *page, char **start, off_t off,
-			       int count, int *eof, void *data)
+static struct list_head *wakelock_stat_list(int i)
+{
+	return i ? &active_wake_locks[i - 1] : &inactive_locks;
+}
+
+static struct wake_lock *wakelock_stat_first(int i)
+{
+	for (; i < WAKE_LOCK_LIST_COUNT; i++) {
+		struct list_head *head = wakelock_stat_list(i);
+		if (!list_empty(head))
+			return list_first_entry(head, struct wake_lock, link);
+	}
+	return NULL;
+}
+
+static struct wake_lock *wakelock_stat_seek(loff_t n)
 {
-	unsigned long irqflags;
 	struct wake_lock *lock;
-	int len = 0;
-	char *p = page;
-	int type;
+	int i;
 
-	spin_lock_irqsave(&list_lock, irqflags);
+	for (i = 0; i < WAKE_LOCK_LIST_COUNT; i++) {
+		list_for_each_entry(lock, wakelock_stat_list(i), link) {
+			if (n-- == 0)
+				return lock;
+		}
+	}
+	return NULL;
+}
 
-	p += sprintf(p, "name\tcount\texpire_count\twake_count\tactive_since"
-		     "\ttotal_time\tsleep_time\tmax_time\tlast_change\n");
-	list_for_each_entry(lock, &inactive_locks, link) {
-		p += print_lock_stat(p, lock);
+static void *wakelock_stat_start(struct seq_file *m, loff_t *pos)
+{
+	spin_lock_irq(&list_lock);
+	if (*pos == 0)
+		return SEQ_START_TOKEN;
+	return wakelock_stat_seek(*pos - 1);
+}
+
+static void *wakelock_stat_bin_start(struct seq_file *m, loff_t *pos)
+{
+	spin_lock_irq(&list_lock);
+	return wakelock_stat_seek(*pos);
+}
+
+static void *wakelock_stat_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	struct wake_lock *lock = v;
+	int i;
+
+	++*pos;
+	if (v == SEQ_START_TOKEN)
+		return wakelock_stat_first(0);
+	i = (lock->flags & WAKE_LOCK_ACTIVE) ?
+		1 + (lock->flags & WAKE_LOCK_TYPE_MASK) : 0;
+	if (lock->link.next != wakelock_stat_list(i))
+		return list_entry(lock->link.next, struct wake_lock, link);
+	return wakelock_stat_first(i + 1);
+}
+
+static void wakelock_stat_stop(struct seq_file *m, void *v)
+{
+	spin_unlock_irq(&list_lock);
+}
+
+static int wakelock_stat_show(struct seq_file *m, void *v)
+{
+	struct wake_lock *lock = v;
+	struct wake_lock_stat_record rec;
+
+	if (v == SEQ_START_TOKEN) {
+		seq_puts(m, "name\tcount\texpire_count\twake_count\t"
+			 "active_since\ttotal_time\tsleep_time\tmax_time\t"
+			 "last_change\n");
+		return 0;
 	}
-	for (type = 0; type < WAKE_LOCK_TYPE_COUNT; type++) {
-		list_for_each_entry(lock, &active_wake_locks[type], link)
-			p += print_lock_stat(p, lock);
+	get_lock_stat(lock, &rec);
+	seq_printf(m, "\"%s\"\t%u\t%u\t%u\t%lld\t%lld\t%lld\t%lld\t%lld\n",
+		   lock->name, rec.count, rec.expire_count, rec.wakeup_count,
+		   rec.active_time, rec.total_time, rec.prevent_suspend_time,
+		   rec.max_time, rec.last_change);
+	return 0;
+}
+
+static int wakelock_stat_show_bin(struct seq_file *m, void *v)
+{
+	struct wake_lock_stat_record rec;
+
+	/* like seq_printf, a full buffer makes seq_read retry the record */
+	if (m->count + sizeof(rec) >= m->size) {
+		m->count = m->size;
+		return 0;
 	}
-	spin_unlock_irqrestore(&list_lock, irqflags);
+	get_lock_stat(v, &rec);
+	memcpy(m->buf + m->count, &rec, sizeof(rec));
+	m->count += sizeof(rec);
+	return 0;
+}
 
-	*start = page + off;
+static const struct seq_operations wakelock_stat_ops = {
+	.start = wakelock_stat_start,
+	.next = wakelock_stat_next,
+	.stop = wakelock_stat_stop,
+	.show = wakelock_stat_show,
+};
 
-	len = p - page;
-	if (len > off)
-		len -= off;
-	else
-		len = 0;
+static const struct seq_operations wakelock_stat_bin_ops = {
+	.start = wakelock_stat_bin_start,
+	.next = wakelock_stat_next,
+	.stop = wakelock_stat_stop,
+	.show = wakelock_stat_show_bin,
+};
 
-	return len < count ? len  : count;
+static int wakelock_stat_open(struct inode *inode, struct file *file)
+{
+	return seq_open(file, &wakelock_stat_ops);
 }
 
-static void wake_unlock_stat_locked(struct wake_lock *lock, int expired)
+static int wakelock_stat_bin_open(struct inode *inode, struct file *file)
+{
+	return seq_open(file, &wakelock_stat_bin_ops);
+}
+
+static const struct file_operations wakelock_stat_fops = {
+	.owner = THIS_MODULE,
+	.open = wakelock_stat_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = seq_release,
+};
+
+static const struct file_operations wakelock_stat_bin_fops = {
+	.owner = THIS_MODULE,
+	.open = wakelock_stat_bin_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = seq_release,
+};
+
+/*
+ * Time spent in each phase of an automatic suspend, in /proc/suspend_phases:
+ * the early sys_sync(), suspend() waiting for it, and pm_suspend().
+ */
+enum {
+	SUSPEND_PHASE_SYNC,
+	SUSPEND_PHASE_SYNC_WAIT,
+	SUSPEND_PHASE_PM_SUSPEND,
+	SUSPEND_PHASE_COUNT
+};
+
+static struct suspend_phase_stat {
+	const char *name;
+	unsigned int count;
+	s64 last_us;
+	s64 max_us;
+	s64 total_us;
+} suspend_phase_stats[SUSPEND_PHASE_COUNT] = {
+	[SUSPEND_PHASE_SYNC] = { .name = "sync" },
+	[SUSPEND_PHASE_SYNC_WAIT] = { .name = "sync_wait" },
+	[SUSPEND_PHASE_PM_SUSPEND] = { .name = "pm_suspend" },
+};
+static unsigned int suspend_sync_timeouts;
+static DEFINE_SPINLOCK(suspend_phase_lock);
+
+static void suspend_phase_add(int phase, ktime_t start, ktime_t end)
+{
+	struct suspend_phase_stat *stat = &suspend_phase_stats[phase];
+	s64 us = ktime_us_delta(end, start);
+	unsigned long irqflags;
+
+	spin_lock_irqsave(&suspend_phase_lock, irqflags);
+	stat->count++;
+	stat->last_us = us;
+	if (us > stat->max_us)
+		stat->max_us = us;
+	stat->total_us += us;
+	spin_unlock_irqrestore(&suspend_phase_lock, irqflags);
+}
+
+static int suspend_phase_show(struct seq_file *m, void *v)
+{
+	struct suspend_phase_stat stats[SUSPEND_PHASE_COUNT];
+	unsigned int timeouts;
+	int i;
+
+	spin_lock_irq(&suspend_phase_lock);
+	memcpy(stats, suspend_phase_stats, sizeof(stats));
+	timeouts = suspend_sync_timeouts;
+	spin_unlock_irq(&suspend_phase_lock);
+
+	seq_puts(m, "phase\tcount\tlast_us\tmax_us\ttotal_us\n");
+	for (i = 0; i < SUSPEND_PHASE_COUNT; i++)
+		seq_printf(m, "%s\t%u\t%lld\t%lld\t%lld\n", stats[i].name,
+			   stats[i].count, stats[i].last_us, stats[i].max_us,
+			   stats[i].total_us);
+	seq_printf(m, "sync_timeouts\t%u\n", timeouts);
+	return 0;
+}
+
+static int suspend_phase_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, suspend_phase_show, NULL);
+}
+
+static const struct file_operations suspend_phase_fops = {
+	.owner = THIS_MODULE,
+	.open = suspend_phase_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void wake_lock_hist_add(struct wake_lock *lock, ktime_t duration)
+{
+	struct timeval tv = ktime_to_timeval(duration);
+	unsigned long ms;
+	int bucket;
+
+	if (tv.tv_sec >= (1 << (WAKE_LOCK_HIST_BUCKETS - 1)) / MSEC_PER_SEC)
+		bucket = WAKE_LOCK_HIST_BUCKETS - 1;
+	else {
+		ms = tv.tv_sec * MSEC_PER_SEC + tv.tv_usec / USEC_PER_MSEC;
+		bucket = min(fls(ms), WAKE_LOCK_HIST_BUCKETS - 1);
+	}
+	lock->stat.sleep_hist[bucket]++;
+}
+
+/*
+ * wake_lock_stat_end - notes in 'change' that the hold of 'lock' ends, if it
+ * is active. Caller holds list_lock.
+ */
+static void wake_lock_stat_end(struct wake_lock *lock,
+			       struct wake_lock_stat_change *change,
+			       int expired)
 {
-	ktime_t duration;
-	ktime_t now;
 	if (!(lock->flags & WAKE_LOCK_ACTIVE))
 		return;
-	if (get_expired_time(lock, &now))
-		expired = 1;
-	else
-		now = ktime_get();
-	lock->stat.count++;
-	if (expired)
-		lock->stat.expire_count++;
-	duration = ktime_sub(now, lock->stat.last_time);
-	lock->stat.total_time = ktime_add(lock->stat.total_time, duration);
-	if (ktime_to_ns(duration) > ktime_to_ns(lock->stat.max_time))
-		lock->stat.max_time = duration;
-	lock->stat.last_time = ktime_get();
-	if (lock->flags & WAKE_LOCK_PREVENTING_SUSPEND) {
-		duration = ktime_sub(now, last_sleep_time_update);
-		lock->stat.prevent_suspend_time = ktime_add(
-			lock->stat.prevent_suspend_time, duration);
-		lock->flags &= ~WAKE_LOCK_PREVENTING_SUSPEND;
+	change->ended = 1;
+	change->expired = expired || ((lock->flags & WAKE_LOCK_AUTO_EXPIRE) &&
+				      (long)(lock->expires - jiffies) <= 0);
+	change->expires = lock->expires;
+	change->preventing = !!(lock->flags & WAKE_LOCK_PREVENTING_SUSPEND);
+	change->sleep_time_update = last_sleep_time_update;
+	lock->flags &= ~WAKE_LOCK_PREVENTING_SUSPEND;
+}
+
+/* Caller holds lock->stat.lock. */
+static void wake_lock_stat_apply(struct wake_lock *lock,
+				 struct wake_lock_stat_change *change)
+{
+	ktime_t duration;
+	ktime_t now;
+
+	if (change->wakeup)
+		lock->stat.wakeup_count++;
+	if (change->ended) {
+		if (!change->expired || !expired_time(change->expires, &now))
+			now = ktime_get();
+		lock->stat.count++;
+		if (change->expired)
+			lock->stat.expire_count++;
+		duration = ktime_sub(now, lock->stat.last_time);
+		lock->stat.total_time = ktime_add(lock->stat.total_time,
+						  duration);
+		if (ktime_to_ns(duration) > ktime_to_ns(lock->stat.max_time))
+			lock->stat.max_time = duration;
+		lock->stat.last_time = ktime_get();
+		if (change->preventing) {
+			duration = ktime_sub(now, change->sleep_time_update);
+			lock->stat.prevent_suspend_time = ktime_add(
+				lock->stat.prevent_suspend_time, duration);
+		}
+		/* only holds that kept a suspend from happening count */
+		duration = ktime_sub(lock->stat.prevent_suspend_time,
+				     lock->stat.prevent_suspend_start);
+		if (ktime_to_ns(duration) > 0)
+			wake_lock_hist_add(lock, duration);
+	}
+	if (change->started) {
+		lock->stat.last_time = ktime_get();
+		lock->stat.prevent_suspend_start =
+			lock->stat.prevent_suspend_time;
 	}
 }
 
+/*
+ * wake_lock_stat_unlock - drops list_lock, then applies 'change' to the
+ * stats of 'lock' and restores the interrupt state.
+ */
+static void wake_lock_stat_unlock(struct wake_lock *lock,
+				  struct wake_lock_stat_change *change,
+				  unsigned long irqflags)
+{
+	spin_lock(&lock->stat.lock);
+	spin_unlock(&list_lock);
+	wake_lock_stat_apply(lock, change);
+	spin_unlock_irqrestore(&lock->stat.lock, irqflags);
+}
+
 static void update_sleep_wait_stats_locked(int done)
 {
 	struct wake_lock *lock;
@@ -191,8 +507,10 @@ static void update_sleep_wait_stats_locked(int done)
 				add = ktime_sub(etime, last_sleep_time_update);
 			else
 				add = elapsed;
+			spin_lock(&lock->stat.lock);
 			lock->stat.prevent_suspend_time = ktime_add(
 				lock->stat.prevent_suspend_time, add);
+			spin_unlock(&lock->stat.lock);
 		}
 		if (done || expired)
 			lock->flags &= ~WAKE_LOCK_PREVENTING_SUSPEND;
@@ -201,14 +519,53 @@ static void update_sleep_wait_stats_locked(int done)
 	}
 	last_sleep_time_update = now;
 }
+#else
+static inline void suspend_phase_add(int phase, ktime_t start, ktime_t end)
+{
+}
 #endif
 
 
+static void expire_lock_add(struct wake_lock *lock, int type)
+{
+	struct rb_node **p = &expire_locks[type].rb_node;
+	struct rb_node *parent = NULL;
+	struct wake_lock *entry;
+
+	while (*p) {
+		parent = *p;
+		entry = rb_entry(parent, struct wake_lock, expire_node);
+		if (time_before(lock->expires, entry->expires))
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&lock->expire_node, parent, p);
+	rb_insert_color(&lock->expire_node, &expire_locks[type]);
+}
+
+static void expire_lock_del(struct wake_lock *lock, int type)
+{
+	if (lock->flags & WAKE_LOCK_AUTO_EXPIRE)
+		rb_erase(&lock->expire_node, &expire_locks[type]);
+}
+
 static void expire_wake_lock(struct wake_lock *lock)
 {
 #ifdef CONFIG_WAKELOCK_STAT
-	wake_unlock_stat_locked(lock, 1);
+	struct wake_lock_stat_change change = {};
+
+	wake_lock_stat_end(lock, &change, 1);
+	spin_lock(&lock->stat.lock);
+	if (lock == stat_pending_lock) {
+		/* it expired in the wake_lock_timeout() that took it */
+		wake_lock_stat_apply(lock, stat_pending);
+		memset(stat_pending, 0, sizeof(*stat_pending));
+	}
+	wake_lock_stat_apply(lock, &change);
+	spin_unlock(&lock->stat.lock);
 #endif
+	expire_lock_del(lock, lock->flags & WAKE_LOCK_TYPE_MASK);
 	lock->flags &= ~(WAKE_LOCK_ACTIVE | WAKE_LOCK_AUTO_EXPIRE);
 	list_del(&lock->link);
 	list_add(&lock->link, &inactive_locks);
@@ -239,21 +596,27 @@ static void print_active_locks(int type)
 
 static long has_wake_lock_locked(int type)
 {
-	struct wake_lock *lock, *n;
-	long max_timeout = 0;
+	struct wake_lock *lock;
+	struct rb_node *node;
+	unsigned long now = jiffies;
 
 	BUG_ON(type >= WAKE_LOCK_TYPE_COUNT);
-	list_for_each_entry_safe(lock, n, &active_wake_locks[type], link) {
-		if (lock->flags & WAKE_LOCK_AUTO_EXPIRE) {
-			long timeout = lock->expires - jiffies;
-			if (timeout <= 0)
-				expire_wake_lock(lock);
-			else if (timeout > max_timeout)
-				max_timeout = timeout;
-		} else
+	if (!list_empty(&active_wake_locks[type])) {
+		lock = list_first_entry(&active_wake_locks[type],
+					struct wake_lock, link);
+		if (!(lock->flags & WAKE_LOCK_AUTO_EXPIRE))
 			return -1;
 	}
-	return max_timeout;
+	while ((node = rb_first(&expire_locks[type]))) {
+		lock = rb_entry(node, struct wake_lock, expire_node);
+		if ((long)(lock->expires - now) > 0)
+			break;
+		expire_wake_lock(lock);
+	}
+	node = rb_last(&expire_locks[type]);
+	if (!node)
+		return 0;
+	return rb_entry(node, struct wake_lock, expire_node)->expires - now;
 }
 
 long has_wake_lock(int type)
@@ -266,10 +629,80 @@ long has_wake_lock(int type)
 	return ret;
 }
 
+/*
+ * Besides dirty pages, a filesystem may keep data of its own that only
+ * ->sync_fs() or ->write_super() writes out, e.g. the yaffs short-op cache
+ * and checkpoint or the UBIFS write-buffers; those filesystems set s_dirt
+ * while they do.
+ */
+static int suspend_sync_dirty(void)
+{
+	struct super_block *sb;
+	int dirty;
+
+	if (global_page_state(NR_FILE_DIRTY) +
+	    global_page_state(NR_WRITEBACK) +
+	    global_page_state(NR_UNSTABLE_NFS))
+		return 1;
+
+	dirty = 0;
+	spin_lock(&sb_lock);
+	list_for_each_entry(sb, &super_blocks, s_list) {
+		if (sb->s_root && sb->s_dirt) {
+			dirty = 1;
+			break;
+		}
+	}
+	spin_unlock(&sb_lock);
+	return dirty;
+}
+
+static void suspend_sync_start(void)
+{
+	unsigned long irqflags;
+
+	spin_lock_irqsave(&suspend_sync_lock, irqflags);
+	if (!suspend_sync_running && suspend_sync_work_queue) {
+		suspend_sync_running = 1;
+		queue_work(suspend_sync_work_queue, &suspend_sync_work);
+	}
+	spin_unlock_irqrestore(&suspend_sync_lock, irqflags);
+}
+
+/*
+ * suspend_sync_wait_bounded - returns 0 once no sync is running, or -EBUSY
+ * if one is still running after sync_timeout_ms; in that case the sync work
+ * requeues suspend_work when it completes.
+ */
+static int suspend_sync_wait_bounded(void)
+{
+	unsigned long irqflags;
+	int ret = 0;
+
+	if (wait_event_timeout(suspend_sync_wait, !suspend_sync_running,
+			       msecs_to_jiffies(sync_timeout_ms)))
+		return 0;
+	spin_lock_irqsave(&suspend_sync_lock, irqflags);
+	if (suspend_sync_running) {
+		suspend_sync_retry = 1;
+		ret = -EBUSY;
+	}
+	spin_unlock_irqrestore(&suspend_sync_lock, irqflags);
+#ifdef CONFIG_WAKELOCK_STAT
+	if (ret) {
+		spin_lock_irqsave(&suspend_phase_lock, irqflags);
+		suspend_sync_timeouts++;
+		spin_unlock_irqrestore(&suspend_phase_lock, irqflags);
+	}
+#endif
+	return ret;
+}
+
 static void suspend(struct work_struct *work)
 {
 	int ret;
 	int entry_event_num;
+	ktime_t start, synced, resumed;
 
 	if (has_wake_lock(WAKE_LOCK_SUSPEND)) {
 		if (debug_mask & DEBUG_SUSPEND)
@@ -278,10 +711,34 @@ static void suspend(struct work_struct *work)
 	}
 
 	entry_event_num = current_event_num;
-	sys_sync();
+	start = ktime_get();
+	/*
+	 * The sync is done here, with a bounded wait, so pm_suspend_synced()
+	 * skips the unbounded one in enter_state(). Nothing dirty and no sync
+	 * in flight: skip it altogether.
+	 */
+	if (suspend_sync_dirty() || suspend_sync_running) {
+		suspend_sync_start();
+		ret = suspend_sync_wait_bounded();
+		suspend_phase_add(SUSPEND_PHASE_SYNC_WAIT, start, ktime_get());
+		if (ret) {
+			if (debug_mask & DEBUG_SUSPEND)
+				pr_info("suspend: sync still running after "
+					"%d ms, retry when done\n",
+					sync_timeout_ms);
+			return;
+		}
+	}
+	synced = ktime_get();
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("suspend: enter suspend\n");
-	ret = pm_suspend(requested_suspend_state);
+	ret = pm_suspend_synced(requested_suspend_state);
+	resumed = ktime_get();
+	suspend_phase_add(SUSPEND_PHASE_PM_SUSPEND, synced, resumed);
+	if (debug_mask & DEBUG_SUSPEND)
+		pr_info("suspend: sync wait %lld us, pm_suspend %lld us\n",
+			ktime_us_delta(synced, start),
+			ktime_us_delta(resumed, synced));
 	if (debug_mask & DEBUG_EXIT_SUSPEND) {
 		struct timespec ts;
 		struct rtc_time tm;
@@ -300,6 +757,31 @@ static void suspend(struct work_struct *work)
 }
 static DECLARE_WORK(suspend_work, suspend);
 
+static void suspend_sync(struct work_struct *work)
+{
+	unsigned long irqflags;
+	int retry;
+	ktime_t start = ktime_get();
+	ktime_t end;
+
+	sys_sync();
+	end = ktime_get();
+	suspend_phase_add(SUSPEND_PHASE_SYNC, start, end);
+	if (debug_mask & DEBUG_SUSPEND)
+		pr_info("suspend: sync done in %lld us\n",
+			ktime_us_delta(end, start));
+
+	spin_lock_irqsave(&suspend_sync_lock, irqflags);
+	suspend_sync_running = 0;
+	retry = suspend_sync_retry;
+	suspend_sync_retry = 0;
+	spin_unlock_irqrestore(&suspend_sync_lock, irqflags);
+	wake_up(&suspend_sync_wait);
+
+	if (retry && !has_wake_lock(WAKE_LOCK_SUSPEND))
+		queue_work(suspend_work_queue, &suspend_work);
+}
+
 static void expire_wake_locks(unsigned long data)
 {
 	long has_lock;
@@ -348,6 +830,7 @@ void wake_lock_init(struct wake_lock *lock, int type, const char *name)
 	if (debug_mask & DEBUG_WAKE_LOCK)
 		pr_info("wake_lock_init name=%s\n", lock->name);
 #ifdef CONFIG_WAKELOCK_STAT
+	spin_lock_init(&lock->stat.lock);
 	lock->stat.count = 0;
 	lock->stat.expire_count = 0;
 	lock->stat.wakeup_count = 0;
@@ -355,6 +838,8 @@ void wake_lock_init(struct wake_lock *lock, int type, const char *name)
 	lock->stat.prevent_suspend_time = ktime_set(0, 0);
 	lock->stat.max_time = ktime_set(0, 0);
 	lock->stat.last_time = ktime_set(0, 0);
+	lock->stat.prevent_suspend_start = ktime_set(0, 0);
+	memset(lock->stat.sleep_hist, 0, sizeof(lock->stat.sleep_hist));
 #endif
 	lock->flags = (type & WAKE_LOCK_TYPE_MASK) | WAKE_LOCK_INITIALIZED;
 
@@ -368,12 +853,19 @@ EXPORT_SYMBOL(wake_lock_init);
 void wake_lock_destroy(struct wake_lock *lock)
 {
 	unsigned long irqflags;
+#ifdef CONFIG_WAKELOCK_STAT
+	int i;
+#endif
 	if (debug_mask & DEBUG_WAKE_LOCK)
 		pr_info("wake_lock_destroy name=%s\n", lock->name);
 	spin_lock_irqsave(&list_lock, irqflags);
 	lock->flags &= ~WAKE_LOCK_INITIALIZED;
 #ifdef CONFIG_WAKELOCK_STAT
-	if (lock->stat.count) {
+	spin_lock(&lock->stat.lock);
+	if (lock != &deleted_wake_locks)
+		spin_lock_nested(&deleted_wake_locks.stat.lock,
+				 SINGLE_DEPTH_NESTING);
+	if (lock != &deleted_wake_locks && lock->stat.count) {
 		deleted_wake_locks.stat.count += lock->stat.count;
 		deleted_wake_locks.stat.expire_count += lock->stat.expire_count;
 		deleted_wake_locks.stat.total_time =
@@ -385,8 +877,16 @@ void wake_lock_destroy(struct wake_lock *lock)
 		deleted_wake_locks.stat.max_time =
 			ktime_add(deleted_wake_locks.stat.max_time,
 				  lock->stat.max_time);
+		for (i = 0; i < WAKE_LOCK_HIST_BUCKETS; i++)
+			deleted_wake_locks.stat.sleep_hist[i] +=
+				lock->stat.sleep_hist[i];
 	}
+	if (lock != &deleted_wake_locks)
+		spin_unlock(&deleted_wake_locks.stat.lock);
+	spin_unlock(&lock->stat.lock);
 #endif
+	expire_lock_del(lock, lock->flags & WAKE_LOCK_TYPE_MASK);
+	lock->flags &= ~WAKE_LOCK_AUTO_EXPIRE;
 	list_del(&lock->link);
 	spin_unlock_irqrestore(&list_lock, irqflags);
 }
@@ -398,6 +898,9 @@ static void wake_lock_internal(
 	int type;
 	unsigned long irqflags;
 	long expire_in;
+#ifdef CONFIG_WAKELOCK_STAT
+	struct wake_lock_stat_change change = {};
+#endif
 
 	spin_lock_irqsave(&list_lock, irqflags);
 	type = lock->flags & WAKE_LOCK_TYPE_MASK;
@@ -408,20 +911,21 @@ static void wake_lock_internal(
 		if (debug_mask & DEBUG_WAKEUP)
 			pr_info("wakeup wake lock: %s\n", lock->name);
 		wait_for_wakeup = 0;
-		lock->stat.wakeup_count++;
+		change.wakeup = 1;
 	}
 	if ((lock->flags & WAKE_LOCK_AUTO_EXPIRE) &&
 	    (long)(lock->expires - jiffies) <= 0) {
-		wake_unlock_stat_locked(lock, 0);
-		lock->stat.last_time = ktime_get();
+		wake_lock_stat_end(lock, &change, 0);
+		change.started = 1;
 	}
 #endif
 	if (!(lock->flags & WAKE_LOCK_ACTIVE)) {
 		lock->flags |= WAKE_LOCK_ACTIVE;
 #ifdef CONFIG_WAKELOCK_STAT
-		lock->stat.last_time = ktime_get();
+		change.started = 1;
 #endif
 	}
+	expire_lock_del(lock, type);
 	list_del(&lock->link);
 	if (has_timeout) {
 		if (debug_mask & DEBUG_WAKE_LOCK)
@@ -431,6 +935,7 @@ static void wake_lock_internal(
 		lock->expires = jiffies + timeout;
 		lock->flags |= WAKE_LOCK_AUTO_EXPIRE;
 		list_add_tail(&lock->link, &active_wake_locks[type]);
+		expire_lock_add(lock, type);
 	} else {
 		if (debug_mask & DEBUG_WAKE_LOCK)
 			pr_info("wake_lock: %s, type %d\n", lock->name, type);
@@ -446,9 +951,16 @@ static void wake_lock_internal(
 		else if (!wake_lock_active(&main_wake_lock))
 			update_sleep_wait_stats_locked(0);
 #endif
-		if (has_timeout)
+		if (has_timeout) {
+#ifdef CONFIG_WAKELOCK_STAT
+			stat_pending_lock = lock;
+			stat_pending = &change;
+#endif
 			expire_in = has_wake_lock_locked(type);
-		else
+#ifdef CONFIG_WAKELOCK_STAT
+			stat_pending_lock = NULL;
+#endif
+		} else
 			expire_in = -1;
 		if (expire_in > 0) {
 			if (debug_mask & DEBUG_EXPIRE)
@@ -464,7 +976,11 @@ static void wake_lock_internal(
 				queue_work(suspend_work_queue, &suspend_work);
 		}
 	}
+#ifdef CONFIG_WAKELOCK_STAT
+	wake_lock_stat_unlock(lock, &change, irqflags);
+#else
 	spin_unlock_irqrestore(&list_lock, irqflags);
+#endif
 }
 
 void wake_lock(struct wake_lock *lock)
@@ -483,13 +999,17 @@ void wake_unlock(struct wake_lock *lock)
 {
 	int type;
 	unsigned long irqflags;
+#ifdef CONFIG_WAKELOCK_STAT
+	struct wake_lock_stat_change change = {};
+#endif
 	spin_lock_irqsave(&list_lock, irqflags);
 	type = lock->flags & WAKE_LOCK_TYPE_MASK;
 #ifdef CONFIG_WAKELOCK_STAT
-	wake_unlock_stat_locked(lock, 0);
+	wake_lock_stat_end(lock, &change, 0);
 #endif
 	if (debug_mask & DEBUG_WAKE_LOCK)
 		pr_info("wake_unlock: %s\n", lock->name);
+	expire_lock_del(lock, type);
 	lock->flags &= ~(WAKE_LOCK_ACTIVE | WAKE_LOCK_AUTO_EXPIRE);
 	list_del(&lock->link);
 	list_add(&lock->link, &inactive_locks);
@@ -511,12 +1031,17 @@ void wake_unlock(struct wake_lock *lock)
 		if (lock == &main_wake_lock) {
 			if (debug_mask & DEBUG_SUSPEND)
 				print_active_locks(WAKE_LOCK_SUSPEND);
+			suspend_sync_start();
 #ifdef CONFIG_WAKELOCK_STAT
 			update_sleep_wait_stats_locked(0);
 #endif
 		}
 	}
+#ifdef CONFIG_WAKELOCK_STAT
+	wake_lock_stat_unlock(lock, &change, irqflags);
+#else
 	spin_unlock_irqrestore(&list_lock, irqflags);
+#endif
 }
 EXPORT_SYMBOL(wake_unlock);
 
@@ -531,8 +1056,10 @@ static int __init wakelocks_init(void)
 	int ret;
 	int i;
 
-	for (i = 0; i < ARRAY_SIZE(active_wake_locks); i++)
+	for (i = 0; i < ARRAY_SIZE(active_wake_locks); i++) {
 		INIT_LIST_HEAD(&active_wake_locks[i]);
+		expire_locks[i] = RB_ROOT;
+	}
 
 #ifdef CONFIG_WAKELOCK_STAT
 	wake_lock_init(&deleted_wake_locks, WAKE_LOCK_SUSPEND,
@@ -559,13 +1086,22 @@ static int __init wakelocks_init(void)
 		goto err_suspend_work_queue;
 	}
 
+	suspend_sync_work_queue = create_singlethread_workqueue("suspend_sync");
+	if (suspend_sync_work_queue == NULL) {
+		ret = -ENOMEM;
+		goto err_suspend_sync_work_queue;
+	}
+
 #ifdef CONFIG_WAKELOCK_STAT
-	create_proc_read_entry("wakelocks", S_IRUGO, NULL,
-				wakelocks_read_proc, NULL);
+	proc_create("wakelocks", S_IRUGO, NULL, &wakelock_stat_fops);
+	proc_create("wakelocks_bin", S_IRUGO, NULL, &wakelock_stat_bin_fops);
+	proc_create("suspend_phases", S_IRUGO, NULL, &suspend_phase_fops);
 #endif
 
 	return 0;
 
+err_suspend_sync_work_queue:
+	destroy_workqueue(suspend_work_queue);
 err_suspend_work_queue:
 	platform_driver_unregister(&power_driver);
 err_platform_driver_register:
@@ -582,8 +1118,11 @@ err_platform_device_register:
 static void  __exit wakelocks_exit(void)
 {
 #ifdef CONFIG_WAKELOCK_STAT
+	remove_proc_entry("suspend_phases", NULL);
+	remove_proc_entry("wakelocks_bin", NULL);
 	remove_proc_entry("wakelocks", NULL);
 #endif
+	destroy_workqueue(suspend_sync_work_queue);
 	destroy_workqueue(suspend_work_queue);
 	platform_driver_unregister(&power_driver);
 	platform_device_unregister(&power_device);
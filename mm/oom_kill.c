@@ -460,6 +460,39 @@ int unregister_oom_notifier(struct notifier_block *nb)
 }
 EXPORT_SYMBOL_GPL(unregister_oom_notifier);
 
+static BLOCKING_NOTIFIER_HEAD(oom_adj_notify_list);
+
+int register_oom_adj_notifier(struct notifier_block *nb)
+{
+	return blocking_notifier_chain_register(&oom_adj_notify_list, nb);
+}
+EXPORT_SYMBOL_GPL(register_oom_adj_notifier);
+
+int unregister_oom_adj_notifier(struct notifier_block *nb)
+{
+	return blocking_notifier_chain_unregister(&oom_adj_notify_list, nb);
+}
+EXPORT_SYMBOL_GPL(unregister_oom_adj_notifier);
+
+/*
+ * Called after /proc/<pid>/oom_adj of task @p was written, with a reference
+ * on @p held, and for each new process before it first runs, since oom_adj
+ * is inherited across fork. The notifiers get the new value and the task.
+ */
+void oom_adj_changed(struct task_struct *p)
+{
+	blocking_notifier_call_chain(&oom_adj_notify_list, p->oomkilladj, p);
+}
+
+/*
+ * Called once the last thread of the process led by @p has started to exit.
+ * The notifiers get OOM_DISABLE, as the process is no longer a candidate.
+ */
+void oom_adj_exit(struct task_struct *p)
+{
+	blocking_notifier_call_chain(&oom_adj_notify_list, OOM_DISABLE, p);
+}
+
 /*
  * Try to acquire the OOM killer lock for the zones in zonelist.  Returns zero
  * if a parallel OOM killing is already taking place that includes a zone in